@@ -0,0 +1,107 @@
+/*
+ * A slab allocator for trie nodes
+ *
+ * Memory is carved out of large slabs, so building a big trie makes a
+ * handful of mmap calls instead of one malloc per node, and throwing
+ * the whole thing away only has to unmap the slabs.
+ */
+
+#ifndef INCLUDE_ARENA_H_
+#define INCLUDE_ARENA_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Size of a regular slab, and of one backed by a transparent huge page */
+#define ARENA_SLAB_SIZE (1 << 20)
+#define ARENA_HUGE_SLAB_SIZE (2 << 20)
+
+/* Allocations are rounded up to a multiple of this */
+#define ARENA_ALIGN 16
+
+/* Largest allocation served from a slab, bigger ones get their own mapping */
+#define ARENA_MAX_SMALL 4096
+
+typedef struct arena_slab arena_slab_t;
+struct arena_slab {
+    /* Slabs are kept in a doubly linked list so big ones can leave early */
+    arena_slab_t *next;
+    arena_slab_t *prev;
+
+    /* Size of the whole mapping, this header included */
+    size_t size;
+};
+
+typedef struct arena_t arena_t;
+struct arena_t {
+    /* Every mapping the arena owns */
+    arena_slab_t *slabs;
+
+    /* Bump pointer into the newest slab and the end of that slab */
+    char *cur;
+    char *end;
+
+    /* Size of regular slabs, ARENA_SLAB_SIZE or ARENA_HUGE_SLAB_SIZE */
+    size_t slab_size;
+
+    /* Whether slabs are aligned and advised for transparent huge pages */
+    bool hugepages;
+
+    /* One free list per size class, threaded through the freed chunks */
+    void *free_lists[ARENA_MAX_SMALL / ARENA_ALIGN];
+
+    /* Number of mappings and bytes currently handed out */
+    size_t num_slabs;
+    size_t bytes_used;
+};
+
+/*
+    Creates and allocates memory for a new, empty arena.
+
+    Parameters:
+     - hugepages: true to back slabs with transparent huge pages where
+       the system supports it
+
+    Returns:
+     - A pointer to the arena, or NULL if it cannot be allocated
+*/
+arena_t *arena_new(bool hugepages);
+
+/*
+    Frees an arena and everything allocated from it.
+
+    Parameters:
+     - a: An arena pointer
+
+    Returns:
+     - Always returns 0
+
+    Details:
+     - Takes time proportional to the number of slabs, not the number of
+       allocations
+*/
+int arena_free(arena_t *a);
+
+/*
+    Allocates zeroed memory from an arena.
+
+    Parameters:
+     - a: An arena pointer
+     - size: Number of bytes wanted
+
+    Returns:
+     - A pointer to the memory, or NULL if it cannot be allocated
+*/
+void *arena_alloc(arena_t *a, size_t size);
+
+/*
+    Hands memory back to an arena so later allocations can reuse it.
+
+    Parameters:
+     - a: The arena the memory came from
+     - ptr: The memory, may be NULL
+     - size: The size it was allocated with
+*/
+void arena_recycle(arena_t *a, void *ptr, size_t size);
+
+#endif
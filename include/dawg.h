@@ -0,0 +1,182 @@
+/*
+ * A minimal deterministic acyclic word graph (DAWG)
+ *
+ * Like a trie, but nodes with the same endings are shared, so a word
+ * list full of common suffixes ("-ing", "-ness") stores each of them
+ * once. The graph is built from words in sorted order, minimizing as it
+ * goes (Daciuk, Mihov, Watson and Watson, 2000): once a word has been
+ * added, the nodes only the previous word used can no longer change and
+ * are either merged with an equal node seen before or registered.
+ */
+
+#ifndef INCLUDE_DAWG_H_
+#define INCLUDE_DAWG_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "trie.h"
+
+/* Node id of the root, and the id returned when there is no node */
+#define DAWG_ROOT 0
+#define DAWG_NONE (-1)
+
+typedef struct {
+    /* 1 if a word ends on the node, otherwise 0 */
+    int is_word;
+
+    /* Number of words that can be read from here, set by dawg_finish() */
+    int word_count;
+
+    /* Outgoing edges, sorted by label */
+    int num_edges;
+    int edges_size;
+    unsigned char *labels;
+    int *targets;
+} dawg_node_t;
+
+typedef struct {
+    /* Nodes by id. Ids of merged nodes are left empty or reused. */
+    dawg_node_t *nodes;
+    int size;
+    int capacity;
+
+    /* Number of nodes in the graph */
+    int num_nodes;
+
+    /* Number of distinct words added */
+    int num_words;
+
+    /* Ids of nodes freed by merging, handed out again first */
+    int *free_ids;
+    int num_free;
+    int free_size;
+
+    /* Hash table of the registered nodes, as id + 1 (0 is empty) */
+    int *table;
+    int table_size;
+    int table_used;
+
+    /* Previous word, and path[i] is the node after its first i characters */
+    char *prev;
+    size_t prev_len;
+    size_t prev_size;
+    int *path;
+
+    /* Whether dawg_finish() has been called */
+    bool finished;
+} dawg_t;
+
+/*
+    Creates and allocates memory for a new, empty DAWG.
+
+    Returns:
+     - A pointer to the DAWG, or NULL if it cannot be allocated
+*/
+dawg_t *dawg_new(void);
+
+/*
+    Adds the next word to a DAWG being built.
+
+    Parameters:
+     - d: A DAWG pointer
+     - word: The word. Words must come in increasing strcmp() order,
+       repeating the previous word is allowed and ignored.
+
+    Returns:
+     - 0 on success, 1 if the word is out of order, the DAWG is finished
+       or an error occurs.
+*/
+int dawg_add(dawg_t *d, char *word);
+
+/*
+    Finishes building a DAWG. Nothing can be added afterwards.
+
+    Parameters:
+     - d: A DAWG pointer
+
+    Returns:
+     - 0 on success, 1 if error occurs.
+
+    Details:
+     - Minimizes the nodes of the last word, counts the words below every
+       node and frees the tables only needed while building
+*/
+int dawg_finish(dawg_t *d);
+
+/*
+    Builds a finished DAWG from a sorted array of words.
+
+    Parameters:
+     - words: The words in increasing strcmp() order
+     - n: Number of words
+
+    Returns:
+     - A pointer to the DAWG, or NULL if the words are out of order or
+       it cannot be allocated
+*/
+dawg_t *dawg_build(char **words, int n);
+
+/*
+    Frees a DAWG.
+
+    Parameters:
+     - d: A DAWG pointer
+
+    Returns:
+     - Always returns 0
+*/
+int dawg_free(dawg_t *d);
+
+/*
+    Follows the edge for one character out of a node.
+
+    Parameters:
+     - d: A DAWG pointer
+     - node: A node id
+     - c: The character
+
+    Returns:
+     - The id of the node the edge leads to, or DAWG_NONE
+*/
+int dawg_get_child(dawg_t *d, int node, char c);
+
+/*
+    Follows a word/prefix from the root, like trie_get_subtrie().
+
+    Parameters:
+     - d: A DAWG pointer
+     - word: The word/prefix
+
+    Returns:
+     - The id of the node the word/prefix ends on, or DAWG_NONE if it is
+       not in the DAWG
+*/
+int dawg_get_subtrie(dawg_t *d, char *word);
+
+/*
+    Searches for word in a DAWG, like trie_search().
+
+    Parameters:
+     - d: A DAWG pointer
+     - word: The word
+
+    Returns:
+     - IN_TRIE if word is found.
+     - NOT_IN_TRIE if word is not found at all.
+     - PARTIAL_IN_TRIE if word is only a prefix of other words.
+*/
+int dawg_search(dawg_t *d, char *word);
+
+/*
+    Counts the words with a given prefix, like trie_count_completion().
+
+    Parameters:
+     - d: A finished DAWG
+     - pre: The prefix
+
+    Returns:
+     - The number of words starting with pre, 0 if there are none
+*/
+int dawg_count_completion(dawg_t *d, char *pre);
+
+#endif
@@ -0,0 +1,92 @@
+/*
+ * Edit distance kernels shared by the engines that check candidate words
+ * one by one instead of walking the trie
+ */
+
+#ifndef INCLUDE_DISTANCE_H_
+#define INCLUDE_DISTANCE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Longest pattern distance_myers() takes, one bit per character */
+#define DISTANCE_MAX_PATTERN 64
+
+/*
+    A string set up for distance_myers(): peq[c] has bit i set where
+    character i of the string is c
+ */
+typedef struct {
+    uint64_t peq[256];
+    size_t len;
+} distance_pattern_t;
+
+/*
+    Counts the edits between two strings: deleting, inserting or replacing
+    a character, or swapping two adjacent ones. A swapped pair is not
+    edited again (optimal string alignment).
+
+    Parameters:
+     - a, alen: The first string and its length
+     - b, blen: The second string and its length
+     - max: Edits to give up after
+     - rows: Scratch space for 3 * (blen + 1) ints
+
+    Returns:
+     - The number of edits, or max + 1 if there are more than max
+
+    Details:
+     - Gives up as soon as the lengths or a whole row are over max, so
+       checking a far off word costs a few rows at most
+*/
+int distance_osa(char *a, size_t alen, char *b, size_t blen, int max, int *rows);
+
+/*
+    Sets up a string to be compared against many words.
+
+    Parameters:
+     - p: Where to put the pattern
+     - str, len: The string and its length, at most DISTANCE_MAX_PATTERN
+
+    Returns:
+     - 0 on success, 1 if the string is too long
+*/
+int distance_pattern(distance_pattern_t *p, char *str, size_t len);
+
+/*
+    Same as distance_osa() against a pattern, with one column of the table
+    kept as bits of a word (Myers' algorithm, with Hyyro's extension for
+    swaps).
+
+    Parameters:
+     - p: A pattern set up by distance_pattern()
+     - word, len: The word and its length, of any length
+     - max: Edits to give up after
+
+    Returns:
+     - The number of edits, or max + 1 if there are more than max
+
+    Details:
+     - Takes a handful of word operations per character of word, however
+       long the pattern
+*/
+int distance_myers(distance_pattern_t *p, char *word, size_t len, int max);
+
+/*
+    Runs distance_myers() on several words at once.
+
+    Parameters:
+     - p: A pattern set up by distance_pattern()
+     - words, lens: The words and their lengths
+     - count: Number of words
+     - max: Edits to give up after
+     - out: Where to put the distances, each max + 1 if over max
+
+    Details:
+     - Uses AVX2 (four words at a time) or SSE4.1 (two) when the CPU has
+       them, and distance_myers() on one word at a time otherwise
+*/
+void distance_many(distance_pattern_t *p, char **words, size_t *lens, int count,
+                   int max, int *out);
+
+#endif
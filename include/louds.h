@@ -0,0 +1,205 @@
+/*
+ * A frozen, read-only trie in LOUDS form
+ *
+ * The trie's shape is stored as a level-order unary degree sequence (one
+ * 1 bit per child and a 0 after each node, nodes in breadth-first order)
+ * next to one label byte and one is_word bit per node. Navigation only
+ * needs select on the shape bits and rank on the word bits, so a node
+ * costs a little over three bits plus its label instead of a trie_t.
+ *
+ * The in-memory form is the file format, so a saved trie can be mapped
+ * with louds_open() and queried in place without being loaded.
+ */
+
+#ifndef INCLUDE_LOUDS_H_
+#define INCLUDE_LOUDS_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "trie.h"
+
+/* First bytes of every louds file */
+#define LOUDS_MAGIC "LOUDSTR"
+#define LOUDS_VERSION 1
+
+/* Number of zero bits between select samples */
+#define LOUDS_SELECT_STEP 256
+
+/* Number of bits covered by each rank directory entry */
+#define LOUDS_RANK_STEP 512
+
+/* Node id of the root, and the id returned when there is no node */
+#define LOUDS_ROOT 0
+#define LOUDS_NONE (-1)
+
+/*
+    Start of a louds file. Every section is an array of 64-bit words
+    (the labels excepted) found at the given byte offset from the start
+    of the header, and offsets are multiples of 8. Numbers are in the
+    byte order of the machine that wrote the file.
+ */
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+
+    /* Size of the whole file */
+    uint64_t size;
+
+    /* Number of nodes (root included) and of words */
+    uint64_t num_nodes;
+    uint64_t num_words;
+
+    /* Shape bits, 2 * num_nodes + 1 of them */
+    uint64_t bits_off;
+
+    /* Position of zero number 1 + i * LOUDS_SELECT_STEP in the shape bits */
+    uint64_t select_off;
+    uint64_t num_select;
+
+    /* One is_word bit per node, and the rank directory over them */
+    uint64_t words_off;
+    uint64_t rank_off;
+
+    /* One byte per node, the character on the edge into it */
+    uint64_t labels_off;
+} louds_header_t;
+
+typedef struct {
+    /* The header, at the start of the buffer or mapping */
+    const louds_header_t *hdr;
+
+    /* Sections of the buffer, see louds_header_t */
+    const uint64_t *bits;
+    const uint64_t *select;
+    const uint64_t *words;
+    const uint64_t *rank;
+    const unsigned char *labels;
+
+    /* Whether hdr points into a file mapping or a malloc'ed buffer */
+    bool mapped;
+} louds_t;
+
+/*
+    Builds the frozen form of a trie.
+
+    Parameters:
+     - t: A trie pointer, plain or TRIE_COMPRESSED
+
+    Returns:
+     - A pointer to the frozen trie, or NULL if it cannot be allocated
+
+    Details:
+     - Labels of compressed nodes are spelled out, one node per character
+     - t is left as it is and can be freed straight away
+*/
+louds_t *louds_freeze(trie_t *t);
+
+/*
+    Writes a frozen trie to a file.
+
+    Parameters:
+     - l: A frozen trie
+     - path: The file to create or overwrite
+
+    Returns:
+     - 0 on success, 1 if error occurs.
+*/
+int louds_save(louds_t *l, const char *path);
+
+/*
+    Maps a file written by louds_save().
+
+    Parameters:
+     - path: The file
+
+    Returns:
+     - A pointer to the frozen trie, or NULL if the file cannot be mapped
+       or is not a louds file
+
+    Details:
+     - Nothing is copied, queries read the mapping directly
+*/
+louds_t *louds_open(const char *path);
+
+/*
+    Frees a frozen trie, unmapping it if it came from louds_open().
+
+    Parameters:
+     - l: A frozen trie
+
+    Returns:
+     - Always returns 0
+*/
+int louds_free(louds_t *l);
+
+/*
+    Looks up a single child of a node.
+
+    Parameters:
+     - l: A frozen trie
+     - node: A node id
+     - c: The character of the child wanted
+
+    Returns:
+     - The child's node id, or LOUDS_NONE if there is none
+*/
+int64_t louds_get_child(louds_t *l, int64_t node, char c);
+
+/*
+    Follows a word/prefix down from the root, like trie_get_subtrie().
+
+    Parameters:
+     - l: A frozen trie
+     - word: The word/prefix
+
+    Returns:
+     - The id of the node the word/prefix ends on, or LOUDS_NONE if it
+       is not in the trie
+*/
+int64_t louds_get_subtrie(louds_t *l, char *word);
+
+/*
+    Checks whether a word ends on a node.
+
+    Parameters:
+     - l: A frozen trie
+     - node: A node id
+
+    Returns:
+     - true if the node is the end of a word
+*/
+bool louds_is_word(louds_t *l, int64_t node);
+
+/*
+    Searches for word in a frozen trie, like trie_search().
+
+    Parameters:
+     - l: A frozen trie
+     - word: The word
+
+    Returns:
+     - IN_TRIE if word is found.
+     - NOT_IN_TRIE if word is not found at all.
+     - PARTIAL_IN_TRIE if word is only a prefix of other words.
+*/
+int louds_search(louds_t *l, char *word);
+
+/*
+    Counts the words with a given prefix, like trie_count_completion().
+
+    Parameters:
+     - l: A frozen trie
+     - pre: The prefix
+
+    Returns:
+     - The number of words starting with pre, 0 if there are none
+
+    Details:
+     - The descendants of a node sit in one run of ids on every level,
+       so this takes one rank per level below the prefix
+*/
+int louds_count_completion(louds_t *l, char *pre);
+
+#endif
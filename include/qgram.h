@@ -0,0 +1,184 @@
+/*
+ * A q-gram index of the words of a trie
+ *
+ * Every word is cut into its overlapping runs of q characters, padded at
+ * both ends, and each run (q-gram) has a posting list of the words it
+ * appears in. One edit only breaks the q-grams around it, so a word within
+ * k edits of a query still shares most of its q-grams with it. Counting
+ * the shared q-grams over the query's posting lists leaves a few
+ * candidates to check with distance_many(), even for edit budgets where
+ * the trie engines end up walking most of the trie.
+ */
+
+#ifndef INCLUDE_QGRAM_H_
+#define INCLUDE_QGRAM_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "trie.h"
+#include "distance.h"
+
+/* Length of the q-grams when none is given, and the longest allowed */
+#define QGRAM_Q 2
+#define QGRAM_MAX_Q 3
+
+/* The posting list of one q-gram */
+typedef struct {
+    /* The q-gram, its characters as digits in base 257, or -1 if empty */
+    int gram;
+
+    /*
+     * Ids of the words with the q-gram, in increasing order and once per
+     * time the q-gram appears in the word. Each is stored as a varint of
+     * its difference from the id before it.
+     */
+    unsigned char *data;
+    size_t len;
+    size_t size;
+
+    /* The last id in the list */
+    int last;
+} qgram_list_t;
+
+/* The ids of the words of one length */
+typedef struct {
+    int *ids;
+    int count;
+    int size;
+} qgram_bucket_t;
+
+typedef struct {
+    /* Length of the q-grams */
+    int q;
+
+    /* Words and their lengths by id, NULL for removed words */
+    char **words;
+    size_t *lengths;
+    int size;
+    int capacity;
+
+    /* Number of words in the index */
+    int num_words;
+
+    /* Open addressing table of word ids + 1, to find a word by string */
+    int *ids;
+    size_t ids_size;
+
+    /* Open addressing table of the posting lists */
+    qgram_list_t *lists;
+    size_t lists_size;
+    size_t lists_used;
+
+    /* Ids of the words by length */
+    qgram_bucket_t *by_length;
+    size_t num_lengths;
+
+    /* Removed words still in the posting lists, until they are rebuilt */
+    int num_stale;
+
+    /* Shared q-grams by id during a lookup, and the ids with any */
+    int *counts;
+    int *touched;
+
+    /* The query set up for distance_many(), and rows for longer ones */
+    distance_pattern_t pattern;
+    int *rows;
+    size_t rows_size;
+
+    /* Words the last lookup checked with the distance kernel */
+    int checked;
+} qgram_t;
+
+/*
+    Creates and allocates memory for a new, empty index.
+
+    Parameters:
+     - q: Length of the q-grams, from 1 to QGRAM_MAX_Q
+
+    Returns:
+     - A pointer to the index, or NULL if it cannot be allocated
+*/
+qgram_t *qgram_new(int q);
+
+/*
+    Builds an index of every word in a trie.
+
+    Parameters:
+     - t: A trie pointer
+     - q: Length of the q-grams, from 1 to QGRAM_MAX_Q
+
+    Returns:
+     - A pointer to the index, or NULL if it cannot be allocated
+*/
+qgram_t *qgram_build(trie_t *t, int q);
+
+/*
+    Adds a word to an index.
+
+    Parameters:
+     - qg: An index pointer
+     - word: The word
+
+    Returns:
+     - 0 on success (adding a word already in the index does nothing),
+       1 if an error occurs.
+*/
+int qgram_add(qgram_t *qg, char *word);
+
+/*
+    Takes a word out of an index.
+
+    Parameters:
+     - qg: An index pointer
+     - word: The word
+
+    Returns:
+     - 0 on success, 1 if the word is not in the index.
+
+    Details:
+     - The word stays in the posting lists, skipped by lookups, until
+       there are more removed words than words and the lists are built
+       again
+*/
+int qgram_remove(qgram_t *qg, char *word);
+
+/*
+    Frees an index.
+
+    Parameters:
+     - qg: An index pointer
+
+    Returns:
+     - Always returns 0
+*/
+int qgram_free(qgram_t *qg);
+
+/*
+    Finds the words of an index within max_edits of str.
+
+    Parameters:
+     - qg: An index pointer
+     - str: The (misspelled) word
+     - max_edits: Most edits a word can be away
+     - found: Called once for every word found with its distance, the
+       word only valid during the call. A nonzero return stops the lookup.
+     - arg: Passed on to found
+
+    Returns:
+     - 0 on success, 1 if an error occurs or found stopped the lookup.
+
+    Details:
+     - A word of length m within k edits of str shares at least
+       max(n, m) + q - 1 - k * w of its q-grams with str, where n is the
+       length of str and w is the most q-grams one edit can break: q, or
+       q + 1 since a swap touches two characters. Only words with that many
+       are checked, in batches with distance_many() (or distance_osa() for
+       a str over DISTANCE_MAX_PATTERN characters).
+     - Where that bound is not above zero every word of the length is
+       checked, so short words with a big budget cost a scan of the
+       words of those lengths
+*/
+int qgram_lookup(qgram_t *qg, char *str, int max_edits,
+                 int (*found)(void *arg, char *word, int distance), void *arg);
+
+#endif
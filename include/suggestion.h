@@ -6,17 +6,38 @@
 #define INCLUDE_SUGGESTION_H_
 
 #include "trie.h"
+#include "symspell.h"
+#include "qgram.h"
 
 // The maximum length of a string we're willing to process
 // Longest word in english dictionary is 45 letters lol
 #define MAXLEN 100
 
+/* Engines suggestion_list_engine() can use */
+#define SUGGEST_DEPTH_FIRST 0
+#define SUGGEST_DP 1
+#define SUGGEST_BEST_FIRST 2
+#define SUGGEST_SYMSPELL 3
+#define SUGGEST_QGRAM 4
+
+/* Edit budgets from which a q-gram index pays off over walking the trie, see suggestions_qgram() */
+#define SUGGEST_QGRAM_EDITS 4
+
 /* A simple way to store an approximate match and its score */
 typedef struct {
     char *str;
     int edits_left;
 } match_t;
 
+/* How much work a call to suggestions_stats() did */
+typedef struct {
+    // States (a place in the trie and in the word) expanded
+    long expanded;
+
+    // States reached again without more edits left than before, and skipped
+    long saved;
+} suggestion_stats_t;
+
 /*
  * Sees if there are any words in a trie that contain a given prefix
  * NOTE- awaiting the actual function from support tools
@@ -67,7 +88,8 @@ int attempt_add(match_t **set, trie_t *t, char *s, int edits_left, int n);
  * For more information on approx matching: https://www.wikiwand.com/en/Approximate_string_matching
  * 
  * Parameters:
- *  - set: An array of match_t*'s
+ *  - set: An array of match_t*'s. It is left as a heap with the worst match first, so
+ *    sort it with cmp_match() or suggestion_set_first_n()
  *  - t: A trie. Must point to a trie allocated with trie_new
  *  - prefix: A prefix of a word. Must be contained in a dictionary or ""
  *  - suffix: A suffix of a word. Can also be ""
@@ -76,9 +98,99 @@ int attempt_add(match_t **set, trie_t *t, char *s, int edits_left, int n);
  * 
  * Returns:
  *  - 0 for success, or a positive integer n for the number of errors encountered
+ * 
+ * Details:
+ *  - Keeps the set as a bounded heap with an index by string, so adding or improving a
+ *    match takes O(log n)
+ *  - Remembers the states (trie node, position in suffix) it has expanded and the edits it
+ *    had left there, and only expands a state again with more edits left
+ *  - Walks the prefix from the root once. After that every probe moves one child down
+ *    from the node the search is on, and all branches build their candidates in one buffer.
  */
 int suggestions(match_t **set, trie_t *t, char *prefix, char *suffix, int edits_left, int n);
 
+/*
+ * Same as suggestions(), and also reports how many expansions the visited states saved
+ * 
+ * Parameters:
+ *  - set, t, prefix, suffix, edits_left, n: See suggestions()
+ *  - stats: Where to put the counts, or NULL
+ * 
+ * Returns:
+ *  - 0 for success, or a positive integer n for the number of errors encountered
+ */
+int suggestions_stats(match_t **set, trie_t *t, char *prefix, char *suffix, int edits_left, int n,
+                      suggestion_stats_t *stats);
+
+/*
+ * Finds the same matches as suggestions() with an empty prefix, but expands states in order
+ * of edits used and stops once the set is full: the words with no edits come first, then
+ * the words one edit away, and so on.
+ * 
+ * Parameters:
+ *  - set: An array of match_t*'s, left as a heap like suggestions() leaves it
+ *  - t: A trie. Must point to a trie allocated with trie_new
+ *  - str: A string. This will be the (misspelled) word to match
+ *  - max_edits: the maximum levenshtein distance the words in the set can have
+ *  - n: The length of set (amount of matches in the set)
+ *  - stats: Where to put the counts, or NULL
+ * 
+ * Returns:
+ *  - 0 for success, or a positive integer n for the number of errors encountered
+ * 
+ * Details:
+ *  - Keeps one stack of states per number of edits used. Moving on to the next character
+ *    costs nothing, so it goes on the stack being emptied.
+ *  - Every word found while emptying the stack for d edits is exactly d edits away. Once
+ *    the set is full after a stack, the rest of the neighbourhood is never looked at, so
+ *    a word with n close matches takes a small part of the work of suggestions().
+ */
+int suggestions_best_first(match_t **set, trie_t *t, char *str, int max_edits, int n,
+                           suggestion_stats_t *stats);
+
+/*
+ * Finds the closest words to str with a symmetric delete index instead of the trie
+ * 
+ * Parameters:
+ *  - set: An array of match_t*'s, left as a heap like suggestions() leaves it
+ *  - ss: An index of the words, see symspell.h. Must go up to max_edits.
+ *  - str: A string. This will be the (misspelled) word to match
+ *  - max_edits: the maximum edit distance the words in the set can have
+ *  - n: The length of set (amount of matches in the set)
+ * 
+ * Returns:
+ *  - 0 for success, or a positive integer n for the number of errors encountered
+ * 
+ * Details:
+ *  - Distances come from symspell_distance(). A swap there does not need the rest of the
+ *    word to be in the trie, and is never followed by a delete in between, so the odd
+ *    word can score one edit apart from suggestions().
+ */
+int suggestions_symspell(match_t **set, symspell_t *ss, char *str, int max_edits, int n);
+
+/*
+ * Finds the closest words to str with a q-gram index instead of the trie
+ * 
+ * Parameters:
+ *  - set: An array of match_t*'s, left as a heap like suggestions() leaves it
+ *  - qg: An index of the words, see qgram.h
+ *  - str: A string. This will be the (misspelled) word to match
+ *  - max_edits: the maximum edit distance the words in the set can have
+ *  - n: The length of set (amount of matches in the set)
+ * 
+ * Returns:
+ *  - 0 for success, or a positive integer n for the number of errors encountered
+ * 
+ * Details:
+ *  - Distances come from distance_osa(), like suggestions_symspell(), but any budget works.
+ *    The bigger the budget, the more words are left to check, so it pays off from about
+ *    SUGGEST_QGRAM_EDITS on, where the trie engines look at most of the trie anyway.
+ *  - The trie engines only find a swap of two characters when the trie has a path for str
+ *    up to the first of them. suggestions_qgram() and suggestions_symspell() count every
+ *    swap, so they can find words the trie engines miss with the same budget.
+ */
+int suggestions_qgram(match_t **set, qgram_t *qg, char *str, int max_edits, int n);
+
 /*
  * Creates array of match_t*'s of spelling suggestions for a word using suggestions()
  * 
@@ -106,6 +218,9 @@ match_t** suggestion_set_new(trie_t *t, char *str, int max_edits, int n);
  *  - The first n strings with the smallest distance, where ties are broken by alphabetical order.
  *    If there aren't enough matching strings, each remaining spot is set to NULL.
  *  - NULL if there was an error
+ * 
+ * Details:
+ *  - Sorts with one heap sort, so the set can be in any order
  */
 char** suggestion_set_first_n(match_t **set, int n);
 
@@ -124,7 +239,111 @@ char** suggestion_set_first_n(match_t **set, int n);
  *  - The first n strings with the smallest distance, where ties are broken by alphabetical order.
  *    If there aren't enough matching strings, each remaining spot is set to NULL.
  *  - NULL if there was an error
+ * 
+ * Details:
+ *  - Always walks the trie depth first with suggestions(), whatever the budget. For big
+ *    budgets, keep a q-gram index and pass it to suggestion_list_engine() with
+ *    SUGGEST_QGRAM.
  */
 char** suggestion_list(trie_t *t, char *str, int max_edits, int n);
 
-#endif
\ No newline at end of file
+/*
+ * Returns the same words as suggestion_list(), using suggestions_best_first()
+ * 
+ * Parameters:
+ *  - t: A trie. Must point to a trie allocated with trie_new
+ *  - str: A string. This will be the (misspelled) word to match
+ *  - max_edits: the maximum levenshtein distance the words in the set can have
+ *  - n: the number of strings to return. 
+ * 
+ * Returns:
+ *  - The first n strings with the smallest distance, where ties are broken by alphabetical order.
+ *    If there aren't enough matching strings, each remaining spot is set to NULL.
+ *  - NULL if there was an error
+ */
+char** suggestion_list_best_first(trie_t *t, char *str, int max_edits, int n);
+
+/*
+ * Returns the closest words to str like suggestion_list(), with the engine picked
+ * 
+ * Parameters:
+ *  - t: A trie. Must point to a trie allocated with trie_new
+ *  - ss: An index of the words of t for SUGGEST_SYMSPELL, or NULL
+ *  - qg: An index of the words of t for SUGGEST_QGRAM, or NULL
+ *  - str: A string. This will be the (misspelled) word to match
+ *  - max_edits: the maximum levenshtein distance the words in the set can have
+ *  - n: the number of strings to return. 
+ *  - engine: SUGGEST_DEPTH_FIRST (suggestion_list()), SUGGEST_DP (suggestion_list_dp()),
+ *    SUGGEST_BEST_FIRST (suggestion_list_best_first()), SUGGEST_SYMSPELL
+ *    (suggestions_symspell()) or SUGGEST_QGRAM (suggestions_qgram())
+ * 
+ * Returns:
+ *  - The first n strings with the smallest distance, where ties are broken by alphabetical order.
+ *    If there aren't enough matching strings, each remaining spot is set to NULL.
+ *  - NULL if there was an error
+ * 
+ * Details:
+ *  - SUGGEST_SYMSPELL without an index, or with one that does not go up to max_edits,
+ *    and SUGGEST_QGRAM without an index use SUGGEST_DP instead
+ *  - SUGGEST_SYMSPELL and SUGGEST_QGRAM count every swap, see suggestions_qgram(), so
+ *    they can return words the trie engines do not
+ */
+char** suggestion_list_engine(trie_t *t, symspell_t *ss, qgram_t *qg, char *str, int max_edits,
+                              int n, int engine);
+
+/*
+ * Returns the same words as suggestion_list(), but walks the trie only once. Every node
+ * on the way carries a row of edit counts, one for each number of characters of str read,
+ * and the walk leaves a subtree as soon as every entry of the row is over max_edits.
+ * 
+ * Parameters:
+ *  - t: A trie. Must point to a trie allocated with trie_new
+ *  - str: A string. This will be the (misspelled) word to match
+ *  - max_edits: the maximum levenshtein distance the words in the set can have
+ *  - n: the number of strings to return. 
+ * 
+ * Returns:
+ *  - The first n strings with the smallest distance, where ties are broken by alphabetical order.
+ *    If there aren't enough matching strings, each remaining spot is set to NULL.
+ *  - NULL if there was an error
+ * 
+ * Details:
+ *  - The rows follow the edits suggestions() makes: a swap moves the next character of
+ *    str in front of the last character of the path, so a row also looks at the row of
+ *    its parent's sibling
+ *  - Takes O(len(str)) per node visited instead of a trie_search() per edit tried
+ */
+char** suggestion_list_dp(trie_t *t, char *str, int max_edits, int n);
+
+/*
+ * Completes a prefix that may have typos in it: finds every place in the trie within
+ * max_edits of the prefix, and ranks the words below them
+ * 
+ * Parameters:
+ *  - t: A trie. Must point to a trie allocated with trie_new
+ *  - prefix: A string. The (misspelled) prefix typed so far
+ *  - max_edits: the maximum levenshtein distance the prefix of a word can be from prefix
+ *  - n: the number of words wanted
+ *  - out: Array of at least n trie_t pointers for the nodes the words end on, see
+ *    trie_node_word()
+ *  - edits: Array of at least n ints for the edits the prefix of each word took
+ * 
+ * Returns:
+ *  - The number of words found, at most n
+ *  - -1 if there was an error
+ * 
+ * Details:
+ *  - Words are ranked by the fewest edits any prefix of theirs takes, then like
+ *    trie_topk(): highest score first, then alphabetically. A word below several places
+ *    that match comes out once.
+ *  - Counts edits like distance_osa(): a swap of two adjacent characters is one edit
+ *    wherever it is, even where the trie has no path for the prefix as typed
+ *  - Walks the trie like suggestion_list_dp(), which never goes deeper than the prefix
+ *    plus max_edits characters, and stops below a place that matches exactly. The words
+ *    come from the lists trie_topk() keeps on every node, so for n up to TRIE_TOPK the
+ *    cost does not depend on how many words there are below.
+ */
+int suggestion_complete(trie_t *t, char *prefix, int max_edits, int n, trie_t **out,
+                        int *edits);
+
+#endif
@@ -0,0 +1,163 @@
+/*
+ * A symmetric delete (SymSpell) index of the words of a trie
+ *
+ * Every word is stored under each string it turns into with up to
+ * max_distance characters deleted. Two words are within k edits only if
+ * deleting at most k characters from each gives the same string, so a
+ * query only has to look up its own deletes and check the few words
+ * found there. Lookups cost the same however big the dictionary is, for
+ * a lot more memory than the trie itself.
+ */
+
+#ifndef INCLUDE_SYMSPELL_H_
+#define INCLUDE_SYMSPELL_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "trie.h"
+
+/* Distance an index is built for when none is given */
+#define SYMSPELL_DISTANCE 2
+
+/* One delete string and the words it comes from */
+typedef struct {
+    /* The string, NULL if the table entry is empty */
+    char *variant;
+    unsigned int hash;
+
+    /* Ids of the words with this delete, each once */
+    int *ids;
+    int num_ids;
+    int ids_size;
+} symspell_entry_t;
+
+typedef struct {
+    /* Most characters deleted from a word, and so most edits a lookup can use */
+    int max_distance;
+
+    /* Words by id, NULL for ids freed by symspell_remove() */
+    char **words;
+    int size;
+    int capacity;
+
+    /* Number of words in the index */
+    int num_words;
+
+    /* Ids freed by symspell_remove(), handed out again first */
+    int *free_ids;
+    int num_free;
+    int free_size;
+
+    /* Open addressing table of the delete strings */
+    symspell_entry_t *table;
+    size_t table_size;
+    size_t table_used;
+
+    /* checked[id] == stamp once a lookup has checked word id */
+    unsigned int *checked;
+    unsigned int stamp;
+
+    /* Scratch rows for the distance kernel */
+    int *rows;
+    size_t rows_size;
+} symspell_t;
+
+/*
+    Creates and allocates memory for a new, empty index.
+
+    Parameters:
+     - max_distance: Most edits a lookup will be able to use
+
+    Returns:
+     - A pointer to the index, or NULL if it cannot be allocated
+*/
+symspell_t *symspell_new(int max_distance);
+
+/*
+    Builds an index of every word in a trie.
+
+    Parameters:
+     - t: A trie pointer
+     - max_distance: Most edits a lookup will be able to use
+
+    Returns:
+     - A pointer to the index, or NULL if it cannot be allocated
+*/
+symspell_t *symspell_build(trie_t *t, int max_distance);
+
+/*
+    Adds a word to an index.
+
+    Parameters:
+     - ss: An index pointer
+     - word: The word
+
+    Returns:
+     - 0 on success (adding a word already in the index does nothing),
+       1 if an error occurs.
+*/
+int symspell_add(symspell_t *ss, char *word);
+
+/*
+    Takes a word out of an index.
+
+    Parameters:
+     - ss: An index pointer
+     - word: The word
+
+    Returns:
+     - 0 on success, 1 if the word is not in the index.
+*/
+int symspell_remove(symspell_t *ss, char *word);
+
+/*
+    Frees an index.
+
+    Parameters:
+     - ss: An index pointer
+
+    Returns:
+     - Always returns 0
+*/
+int symspell_free(symspell_t *ss);
+
+/*
+    Finds the words of an index within max_edits of str.
+
+    Parameters:
+     - ss: An index pointer
+     - str: The (misspelled) word
+     - max_edits: Most edits a word can be away. No more than the index's
+       max_distance.
+     - found: Called once for every word found with its distance, the
+       word only valid during the call. A nonzero return stops the lookup.
+     - arg: Passed on to found
+
+    Returns:
+     - 0 on success, 1 if max_edits is over max_distance, an error occurs
+       or found stopped the lookup.
+
+    Details:
+     - Looks up every delete of str and checks each word stored under one
+       with distance_myers() (distance_osa() for a str over
+       DISTANCE_MAX_PATTERN characters), skipping words whose length alone
+       is too far off
+*/
+int symspell_lookup(symspell_t *ss, char *str, int max_edits,
+                    int (*found)(void *arg, char *word, int distance), void *arg);
+
+/*
+    Counts the edits between two strings: deleting, inserting or replacing
+    a character, or swapping two adjacent ones. A swapped pair is not
+    edited again (optimal string alignment).
+
+    Parameters:
+     - a, b: The strings
+     - max: Edits to give up after
+
+    Returns:
+     - The number of edits, or max + 1 if there are more than max
+*/
+int symspell_distance(char *a, char *b, int max);
+
+#endif
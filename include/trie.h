@@ -8,28 +8,147 @@
 #define PARTIAL_IN_TRIE (-1)
 
 #include <stdbool.h>
+#include <stdint.h>
+#include "arena.h"
+
+/* 
+    Child layouts a trie_t can use, smallest first. A node starts out with
+    no child storage at all and moves up (and back down) through these as
+    children are added and removed.
+ */
+#define TRIE_NODE4 0
+#define TRIE_NODE16 1
+#define TRIE_NODE48 2
+#define TRIE_NODE256 3
+
+/* Options for trie_new_flags(), inherited by every node of the trie */
+
+/* 
+    Path compression: runs of single-child nodes are collapsed into the
+    label of one node, split on insert and merged back on removal
+ */
+#define TRIE_COMPRESSED 0x01
+
+/*
+    Arena allocation: nodes, child storage and labels come from slabs
+    owned by the root, and trie_free() on the root releases the slabs
+    without visiting the nodes
+ */
+#define TRIE_ARENA 0x02
+
+/* TRIE_ARENA with slabs backed by transparent huge pages */
+#define TRIE_HUGEPAGES 0x04
+
+/* Number of best scoring words cached on every node, see trie_topk() */
+#define TRIE_TOPK 10
+
+/* Number of words trie_search_many() walks down the trie together */
+#define TRIE_SEARCH_BATCH 16
 
 typedef struct trie_t trie_t;
 struct trie_t {
     /* The first trie_t will be '/0' for any Trie. */
     char current; 
-    
-    /* ALPHABET_SIZE is 256 for all possible characters. */
-    trie_t **children;
+
+    /* The child layout in use, one of TRIE_NODE4 ... TRIE_NODE256 */
+    unsigned char type;
+
+    /* TRIE_* options the node was created with */
+    unsigned char flags;
+
+    /* Number of entries in topk */
+    unsigned char topk_len;
+
+    /* Number of entries topk has room for */
+    unsigned char topk_size;
+
+    /* Number of children currently stored in the node */
+    unsigned short num_children;
     
     /* 
         If is_word is 1, indicates that this is the end of a word. 
         Otherwise 0.
      */
     int is_word; 
+
+    /* Number of words ending at this node or anywhere below it */
+    int word_count;
+
+    /* Score of the word ending here, 0 unless set by trie_insert_scored() */
+    double score;
+
+    /* Number of characters in label */
+    unsigned int label_len;
     
     /* Parent trie_t for traversing backwards */
     trie_t *parent;
+
+    /*
+        Characters on the edge after current, only used in TRIE_COMPRESSED
+        tries. The node stands for its parent's string followed by current
+        and then label, and is_word refers to the end of the label.
+     */
+    char *label;
+
+    /* Arena the node was allocated from, NULL for plain calloc'ed nodes */
+    arena_t *arena;
     
-    /* Array of characters that are contained in the node and its children */
-    char *charlist;
+    /* Bitmap of characters that are contained in the node and its children */
+    uint64_t charlist[4];
+
+    /* Bitmap of the characters the node has a child for */
+    uint64_t childmap[4];
+
+    /*
+        Child storage, allocated on the first trie_add_node() so leaves
+        carry none of it. Use trie_get_child() and trie_next_child() rather
+        than reading these directly.
+         - TRIE_NODE4, TRIE_NODE16: keys holds the children's characters
+           in sorted order and children[i] is the child for keys[i]
+         - TRIE_NODE48: keys is a 256-entry index where keys[c] is one more
+           than the slot of c in children, or 0 if c has no child
+         - TRIE_NODE256: keys is NULL and children is indexed by character
+     */
+    unsigned char *keys;
+    trie_t **children;
+
+    /*
+        The (up to) TRIE_TOPK best words ending at this node or below it,
+        as the nodes they end on. Ordered by score, highest first, with
+        ties in lexicographic order. Allocated with the first word and
+        sized to what it holds, as most nodes only cover a word or two.
+     */
+    trie_t **topk;
 };
 
+/* One level of a trie_iter_t walk */
+typedef struct {
+    /* The node and how far trie_next_child() has got through it */
+    trie_t *node;
+    int pos;
+
+    /* Length of the key buffer with this node's characters appended */
+    size_t len;
+
+    /* Whether the node's own word has been returned (or skipped) */
+    bool done_self;
+} trie_iter_frame_t;
+
+/* 
+    Walks the words under a prefix in lexicographic order without
+    building a list of them. See trie_iter_new().
+ */
+typedef struct {
+    /* Path from the prefix node down to the node being visited */
+    trie_iter_frame_t *stack;
+    int depth;
+    int stack_size;
+
+    /* The current word, reused (and grown) for every word returned */
+    char *key;
+    size_t key_size;
+} trie_iter_t;
+
 /*
     Creates and allocates memory for new trie_t.
     
@@ -42,6 +161,19 @@ struct trie_t {
 */
 trie_t *trie_new(char current);
 
+/*
+    Creates and allocates memory for new trie_t with options.
+
+    Parameters:
+     - current: A char for the current character
+     - flags: TRIE_* options or'ed together, or 0 for a plain trie
+
+    Returns:
+     - A pointer to the trie, or NULL if a pointer 
+       cannot be allocated
+*/
+trie_t *trie_new_flags(char current, int flags);
+
 /*
     Free an entire trie.
 
@@ -50,6 +182,10 @@ trie_t *trie_new(char current);
     
     Returns:
      - Always returns 0
+
+    Details:
+     - For the root of a TRIE_ARENA trie this releases the whole arena in
+       time proportional to the number of slabs
 */
 int trie_free(trie_t *t);
 
@@ -65,11 +201,92 @@ int trie_free(trie_t *t);
      - 0 on success, 1 if an error occurs.
 
     Details: 
-     - Set t->children[current] to be current
+     - Adds a child for current if there is not one already, moving t
+       to the next larger child layout when the current one is full
      - is_word for new node set to 0.
 */
 int trie_add_node(trie_t *t, char current);
 
+/*
+    Removes a child, and everything below it, from a trie_t.
+
+    Parameters:
+     - t: A pointer to the trie where the node is to be removed
+     - current: A char indicating the character of the node being removed
+
+    Returns:
+     - 0 on success (including when there is no such child), 1 if an
+       error occurs.
+
+    Details:
+     - Frees the child with trie_free() and moves t back down to a smaller
+       child layout once it is sparse enough
+*/
+int trie_remove_node(trie_t *t, char current);
+
+/*
+    Looks up a single child of a trie_t.
+
+    Parameters:
+     - t: A pointer to the trie
+     - c: The character of the child wanted
+
+    Returns:
+     - A pointer to the child, or NULL if t has no child for c
+*/
+trie_t *trie_get_child(trie_t *t, char c);
+
+/*
+    Moves one character down a trie, following edge labels in
+    TRIE_COMPRESSED tries.
+
+    Parameters:
+     - t: A pointer to the node the walk is at
+     - pos: How many characters of t->label the walk has consumed. Start
+       a walk at node t with *pos = t->label_len.
+     - c: The next character
+
+    Returns:
+     - The node the walk is at after c, which is t itself while inside its
+       label, with *pos updated
+     - NULL if there is no path for c
+*/
+trie_t *trie_step(trie_t *t, unsigned int *pos, char c);
+
+/*
+    Finds the next character a trie_t has a child for.
+
+    Parameters:
+     - t: A pointer to the trie
+     - from: The character (0 to 255) to start looking at
+
+    Returns:
+     - The smallest character from or above that t has a child for, as
+       0 to 255, or -1 if there is none
+
+    Details:
+     - Reads only the child bitmap, skipping 64 missing characters at a
+       time, so stepping through a node costs its number of children
+       rather than the size of the alphabet
+*/
+int trie_next_char(trie_t *t, int from);
+
+/*
+    Walks the children of a trie_t in character order.
+
+    Parameters:
+     - t: A pointer to the trie
+     - pos: Iteration state. Set it to 0 before the first call and leave it
+       alone between calls.
+
+    Returns:
+     - The next child, or NULL once every child has been returned
+
+    Details:
+     - Adding or removing children of t invalidates pos
+*/
+trie_t *trie_next_child(trie_t *t, int *pos);
+
 /*
     Inserts word into trie.
 
@@ -90,6 +307,46 @@ int trie_add_node(trie_t *t, char current);
 */
 int trie_insert_string(trie_t *t, char *word);
 
+/*
+    Inserts a word with a score, or changes the score of a word that is
+    already in the trie.
+
+    Parameters:
+     - t: A pointer to the given trie
+     - word: A char array to be inserted into the given trie
+     - score: The word's score, higher ranks first in trie_topk()
+
+    Returns:
+     - 0 on success, 1 if error occurs.
+
+    Details:
+     - Updates the cached top words of the nodes on the word's path,
+       usually stopping at the first node the word does not rank on
+*/
+int trie_insert_scored(trie_t *t, char *word, double score);
+
+/*
+    Removes word from trie.
+
+    Parameters:
+     - t: A pointer to the given trie
+     - word: A char array to be removed from the given trie
+
+    Returns:
+     - IN_TRIE if word was in the trie and has been removed
+     - NOT_IN_TRIE if word is not in the trie at all
+     - PARTIAL_IN_TRIE if word is only a prefix of other words. Nothing
+       is removed.
+
+    Details:
+     - Sets the is_word of the last node to 0 and updates word counts
+     - Frees the nodes on the path that no longer lead to any word, right
+       away, and merges labels back together in TRIE_COMPRESSED tries
+     - charlist bits are left alone, so trie_char_exists() may still
+       report characters that only removed words used
+*/
+int trie_remove_string(trie_t *t, char *word);
+
 /*
     Checks if a char exists in a trie 
     Parameters:
@@ -110,6 +367,8 @@ bool trie_char_exists(trie_t *t, char c);
      - word: A char array in which the end pointer is desired
     Returns: 
      - pointer to the last letter in the word/prefix if word/prefix is found. 
+       In a TRIE_COMPRESSED trie this is the node whose label the
+       word/prefix ends in.
      - NULL if word/prefix is not found.
  */
 trie_t *trie_get_subtrie(trie_t *t, char* word);
@@ -128,6 +387,26 @@ trie_t *trie_get_subtrie(trie_t *t, char* word);
  */
 int trie_search(trie_t *t, char *word);
 
+/*
+    Searches for many words at once.
+
+    Parameters:
+     - t: A pointer to the given trie
+     - words: The words to search for
+     - n: Number of words
+     - results: Array of n ints, results[i] is set to what
+       trie_search() returns for words[i]
+
+    Returns:
+     - Always returns 0
+
+    Details:
+     - Walks TRIE_SEARCH_BATCH words down the trie in lockstep, one
+       character each per round, prefetching the next node of every walk
+       so their cache misses overlap instead of coming one after another
+*/
+int trie_search_many(trie_t *t, char **words, int n, int *results);
+
 /*
     Count the number of different possible endings of a given prefix in a trie
     
@@ -138,7 +417,104 @@ int trie_search(trie_t *t, char *word);
     Returns:
      - an integer of the number of endings if the prefix exists in the trie
      - 0 if the prefix does not exist in the trie
+
+    Details:
+     - Reads the word_count kept on every node, so this only costs a walk
+       down the prefix
 */
 int trie_count_completion(trie_t *t, char *pre);
 
+/*
+    Finds the best scoring words with a given prefix.
+
+    Parameters:
+     - t: A trie pointer
+     - pre: The prefix, "" for every word in the trie
+     - k: Number of words wanted
+     - out: Array of at least k trie_t pointers for the results
+
+    Returns:
+     - The number of words found, at most k. out[i] is the node the i-th
+       best word ends on, use trie_node_word() to get the word itself.
+
+    Details:
+     - Words are ranked by score, highest first, with ties in
+       lexicographic order
+     - For k up to TRIE_TOPK this copies the list cached on the prefix
+       node, so it only costs a walk down the prefix. Bigger k search
+       the subtree, skipping branches whose best word cannot make it.
+*/
+int trie_topk(trie_t *t, char *pre, int k, trie_t **out);
+
+/*
+    Compares the words ending on two nodes of the same trie the way
+    trie_topk() ranks them.
+
+    Parameters:
+     - a, b: Nodes that words end on
+
+    Returns:
+     - A negative number if the word on a ranks first, a positive one if
+       the word on b does, and 0 if a and b are the same node
+*/
+int trie_rank_cmp(trie_t *a, trie_t *b);
+
+/*
+    Rebuilds the word a node stands for by following its parents.
+
+    Parameters:
+     - t: A node of a trie
+     - buf: Where to write the word and a terminating NUL
+     - size: Size of buf
+
+    Returns:
+     - The length of the word. Nothing is written unless size is more
+       than that, so callers can grow buf and try again.
+*/
+size_t trie_node_word(trie_t *t, char *buf, size_t size);
+
+/*
+    Starts a walk over the words with a given prefix.
+
+    Parameters:
+     - t: A trie pointer
+     - pre: The prefix, "" for every word in the trie
+     - after: NULL to start at the first word, or a word to resume after.
+       The walk then starts with the first word greater than after, which
+       does not itself have to be in the trie.
+
+    Returns:
+     - A pointer to the iterator, or NULL if it cannot be allocated
+
+    Details:
+     - Words come out in lexicographic (unsigned byte) order
+     - The trie must not be changed while the iterator is in use
+*/
+trie_iter_t *trie_iter_new(trie_t *t, char *pre, char *after);
+
+/*
+    Moves a trie_iter_t on to its next word.
+
+    Parameters:
+     - it: An iterator from trie_iter_new()
+     - len: Set to the length of the word if not NULL
+
+    Returns:
+     - The word, in a buffer owned by the iterator that is overwritten by
+       the next call
+     - NULL once there are no more words
+*/
+char *trie_iter_next(trie_iter_t *it, size_t *len);
+
+/*
+    Frees a trie_iter_t.
+
+    Parameters:
+     - it: An iterator from trie_iter_new()
+
+    Returns:
+     - Always returns 0
+*/
+int trie_iter_free(trie_iter_t *it);
+
 #endif
\ No newline at end of file
@@ -12,30 +12,136 @@
 #include "redismodule.h"
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <assert.h>
 #include <math.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
 
 static RedisModuleType *trie;
 
+/* ===== Memory accounting ===== */
+
+/*
+    Bytes the module has allocated and trie nodes it has made, less what
+    it has freed again. Commands read these before and after changing a
+    key and add the difference to the key, which is how MEMORY USAGE and
+    UNLINK know how big a key is without walking it. Kept per thread, as
+    Redis may free a key on its lazy free thread, and the worker pool
+    build indexes, while the main thread goes on changing others.
+ */
+static __thread size_t trie_mem_used;
+static __thread size_t trie_mem_nodes;
+
+/* The allocator every structure below goes through */
+static void *trie_mem_alloc(size_t size)
+{
+    void *p = RedisModule_Alloc(size);
+
+    if (p != NULL)
+        trie_mem_used += RedisModule_MallocSize(p);
+    return p;
+}
+
+static void *trie_mem_calloc(size_t n, size_t size)
+{
+    void *p = RedisModule_Calloc(n, size);
+
+    if (p != NULL)
+        trie_mem_used += RedisModule_MallocSize(p);
+    return p;
+}
+
+static void *trie_mem_realloc(void *ptr, size_t size)
+{
+    size_t old = ptr != NULL ? RedisModule_MallocSize(ptr) : 0;
+    void *p = RedisModule_Realloc(ptr, size);
+
+    /* A failed realloc leaves ptr as it was */
+    if (p != NULL)
+        trie_mem_used += RedisModule_MallocSize(p) - old;
+    return p;
+}
+
+static void trie_mem_free(void *ptr)
+{
+    if (ptr != NULL) {
+        trie_mem_used -= RedisModule_MallocSize(ptr);
+        RedisModule_Free(ptr);
+    }
+}
+
 /* ===== Internal data structure (Bare bones functions)  ====== */
 
+/* 
+    Child layouts a trie can use, smallest first. A node starts out with
+    no child storage at all and moves up (and back down) through these as
+    children are added and removed.
+ */
+#define TRIE_NODE4 0
+#define TRIE_NODE16 1
+#define TRIE_NODE48 2
+#define TRIE_NODE256 3
+
+/* Number of best scoring words cached on every node, see trie_topk() */
+#define TRIE_TOPK 10
+
+/* Number of words trie_search_many() walks down the trie together */
+#define TRIE_SEARCH_BATCH 16
+
 /* A prefix trie, otherwise known as a trie */
 struct trie {
     // The first trie_t will be '/0' for any Trie.
     char current;
-    
-    // ALPHABET_SIZE is 256 for all possible characters.     
-    struct trie **children;
+
+    // the child layout in use, one of TRIE_NODE4 ... TRIE_NODE256
+    unsigned char type;
+
+    // number of entries in topk
+    unsigned char topk_len;
+
+    // number of children currently stored in the node
+    unsigned short num_children;
     
     // if is_word is 1, indicates that this is the end of a word. Otherwise 0.
     int is_word; 
 
+    // number of words ending at this node or anywhere below it
+    int word_count;
+
+    // score of the word ending here, 0 unless given with TRIE.INSERT
+    double score;
+
     // parent trie for traversing backwards
     struct trie *parent;
     
-    // list of characters that are contained in the node and its children
-    char *charlist;
+    // bitmap of characters that are contained in the node and its children
+    uint64_t charlist[4];
+
+    // bitmap of the characters the node has a child for
+    uint64_t childmap[4];
+
+    /*
+        Child storage, allocated on the first trie_add_node() so leaves
+        carry none of it.
+         - TRIE_NODE4, TRIE_NODE16: keys holds the children's characters
+           in sorted order and children[i] is the child for keys[i]
+         - TRIE_NODE48: keys is a 256-entry index where keys[c] is one more
+           than the slot of c in children, or 0 if c has no child
+         - TRIE_NODE256: keys is NULL and children is indexed by character
+     */
+    unsigned char *keys;
+    struct trie **children;
+
+    /*
+        The (up to) TRIE_TOPK best words ending at this node or below it,
+        as the nodes they end on. Ordered by score, highest first, with
+        ties in lexicographic order. Allocated with the first word and
+        always exactly topk_len entries long, as most nodes only cover a
+        word or two.
+     */
+    struct trie **topk;
 };
 
 /* A simple way to store an approximate match and its score */
@@ -47,6 +153,102 @@ typedef struct {
     int edits_left;
 } match_t;
 
+/* Number of children each layout can hold */
+static const int trie_capacity[] = { 4, 16, 48, 256 };
+
+/*
+    Thresholds for moving back down a layout. These sit below the
+    capacity of the smaller layout so that a node hovering around a
+    boundary does not reallocate on every add/remove.
+ */
+static const int trie_shrink_at[] = { 0, 3, 12, 40 };
+
+/* Size of the single block holding children and keys for a layout */
+static size_t trie_block_size(int type)
+{
+    switch (type) {
+    case TRIE_NODE4:
+        return 4 * sizeof(struct trie *) + 4;
+    case TRIE_NODE16:
+        return 16 * sizeof(struct trie *) + 16;
+    case TRIE_NODE48:
+        return 48 * sizeof(struct trie *) + 256;
+    default:
+        return 256 * sizeof(struct trie *);
+    }
+}
+
+/*
+    Allocates child storage for the given layout and points t->children
+    and t->keys into it. Does not touch the old block.
+ */
+static int trie_alloc_block(struct trie *t, int type)
+{
+    struct trie **block = trie_mem_calloc(1, trie_block_size(type));
+
+    if (block == NULL) {
+        fprintf(stderr, "Could not allocate memory for t->children\n");
+        return 1;
+    }
+
+    t->type = type;
+    t->children = block;
+    t->keys = (type == TRIE_NODE256) ? NULL
+        : (unsigned char *)(block + trie_capacity[type]);
+
+    return 0;
+}
+
+/*
+    Moves the children of t into a new block of the given layout, used
+    both for growing and for shrinking.
+ */
+static int trie_relayout(struct trie *t, int type)
+{
+    struct trie **old_children = t->children;
+    unsigned char *old_keys = t->keys;
+    int old_type = t->type;
+    int n = 0;
+
+    if (trie_alloc_block(t, type) != 0)
+        return 1;
+
+    /* 
+       Collect the old children in character order so the sorted
+       layouts stay sorted
+     */
+    for (int c = 0; c < 256; c++) {
+        struct trie *child = NULL;
+
+        if (old_type == TRIE_NODE256) {
+            child = old_children[c];
+        } else if (old_type == TRIE_NODE48) {
+            if (old_keys[c] != 0)
+                child = old_children[old_keys[c] - 1];
+        } else if (n < t->num_children && old_keys[n] == c) {
+            child = old_children[n];
+        }
+
+        if (child == NULL)
+            continue;
+
+        if (type == TRIE_NODE256) {
+            t->children[c] = child;
+        } else if (type == TRIE_NODE48) {
+            t->children[n] = child;
+            t->keys[c] = n + 1;
+        } else {
+            t->children[n] = child;
+            t->keys[n] = c;
+        }
+        n++;
+    }
+
+    trie_mem_free(old_children);
+
+    return 0;
+}
+
 /*
     Creates and allocates memory for new trie.
     
@@ -54,33 +256,144 @@ typedef struct {
      - current: A char for the current character
     
     Returns:
-     - A pointer to the trie, or REDISMODULE_ERR if a pointer 
+     - A pointer to the trie, or NULL if a pointer 
        cannot be allocated
 */
 struct trie *trie_new(char current)
 {
-    struct trie *t = RedisModule_Calloc(1, sizeof(struct trie));
+    struct trie *t = trie_mem_calloc(1, sizeof(struct trie));
 
     if (t == NULL) {
         fprintf(stderr, "Could not allocate memory for trie\n");
         return NULL;
     } 
+    trie_mem_nodes++;
 
     t->current = current;
-    t->children = RedisModule_Calloc(256, sizeof(struct trie *));
 
-    if (t->children == NULL) {
-        fprintf(stderr, "Could not allocate memory for t->children\n");
-        return NULL;
-    }
+    /* Child storage is only allocated once the node gets a child */
+    t->type = TRIE_NODE4;
+    t->num_children = 0;
+    t->children = NULL;
+    t->keys = NULL;
 
     t->is_word = 0;
+    t->word_count = 0;
     t->parent = NULL;
-    t->charlist = RedisModule_Calloc(256, sizeof(char));
+
+    t->score = 0;
+    t->topk = NULL;
+    t->topk_len = 0;
 
     return t;
 }
 
+/*
+    Looks up a single child of a trie.
+
+    Parameters:
+     - t: A pointer to the trie
+     - c: The character of the child wanted
+
+    Returns:
+     - A pointer to the child, or NULL if t has no child for c
+*/
+struct trie *trie_get_child(struct trie *t, char c)
+{
+    assert(t != NULL);
+
+    unsigned char uc = (unsigned char)c;
+
+    if (t->num_children == 0)
+        return NULL;
+
+    switch (t->type) {
+    case TRIE_NODE4:
+    case TRIE_NODE16:
+        for (int i = 0; i < t->num_children; i++) {
+            if (t->keys[i] == uc)
+                return t->children[i];
+        }
+        return NULL;
+    case TRIE_NODE48:
+        if (t->keys[uc] == 0)
+            return NULL;
+        return t->children[t->keys[uc] - 1];
+    default:
+        return t->children[uc];
+    }
+}
+
+/*
+    Finds the next character a trie has a child for, reading only the
+    child bitmap so a node costs its number of children to step through.
+
+    Parameters:
+     - t: A pointer to the trie
+     - from: The character (0 to 255) to start looking at
+
+    Returns:
+     - The smallest character from or above that t has a child for, as
+       0 to 255, or -1 if there is none
+*/
+int trie_next_char(struct trie *t, int from)
+{
+    assert(t != NULL);
+
+    for (int w = from / 64; w < 4; w++) {
+        uint64_t bits = t->childmap[w];
+
+        if (w == from / 64)
+            bits &= ~(uint64_t)0 << (from % 64);
+        if (bits != 0)
+            return w * 64 + __builtin_ctzll(bits);
+    }
+
+    return -1;
+}
+
+/*
+    Walks the children of a trie in character order.
+
+    Parameters:
+     - t: A pointer to the trie
+     - pos: Iteration state. Set it to 0 before the first call and leave it
+       alone between calls.
+
+    Returns:
+     - The next child, or NULL once every child has been returned
+*/
+struct trie *trie_next_child(struct trie *t, int *pos)
+{
+    assert(t != NULL);
+    assert(pos != NULL);
+
+    if (t->num_children == 0)
+        return NULL;
+
+    switch (t->type) {
+    case TRIE_NODE4:
+    case TRIE_NODE16:
+        if (*pos >= t->num_children)
+            return NULL;
+        return t->children[(*pos)++];
+    default: {
+        /* pos is the next character to look at, found from the bitmap */
+        int c = trie_next_char(t, *pos);
+
+        if (c < 0) {
+            *pos = 256;
+            return NULL;
+        }
+
+        *pos = c + 1;
+        if (t->type == TRIE_NODE48)
+            return t->children[t->keys[c] - 1];
+        return t->children[c];
+    }
+    }
+}
+
 /*
     Free an entire trie.
 
@@ -93,20 +406,24 @@ struct trie *trie_new(char current)
 int trie_free(struct trie *t)
 {
     if (t != NULL) {
-        for (int i = 0; i < 256; i++) {
-            if (t->children[i] != NULL)
-                /* Called recursively because the entire trie 
-                   and all of a trie's children are RedisModule_Calloc'ed 
-                 */
-                trie_free(t->children[i]); 
-        }
+        struct trie *child;
+        int pos = 0;
+
+        while ((child = trie_next_child(t, &pos)) != NULL)
+            /* Called recursively because the entire trie 
+               and all of a trie's children are RedisModule_Calloc'ed 
+             */
+            trie_free(child); 
+
+        trie_mem_free(t->children);
+        trie_mem_free(t->topk);
+        trie_mem_nodes--;
     }
 
-    RedisModule_Free(t->charlist);
     /* Used because the data structures are 
        originally RedisModule_Calloc'ed 
      */
-    RedisModule_Free(t); 
+    trie_mem_free(t); 
     return 0;
 }
 
@@ -120,7 +437,8 @@ int trie_free(struct trie *t)
     Returns:
      - 0 on success, 1 if an error occurs.
     Details: 
-     - Set t->children[current] to be current
+     - Adds a child for current if there is not one already, moving t
+       to the next larger child layout when the current one is full
      - is_word for new node set to 0.
 */
 int trie_add_node(struct trie *t, char current)
@@ -129,19 +447,339 @@ int trie_add_node(struct trie *t, char current)
 
     /* Current is casted because the compiler 
     will throw unnecessary warnings otherwise */
-    unsigned int c = (int)current; 
+    unsigned char c = (unsigned char)current; 
+
+    if (trie_get_child(t, current) != NULL)
+        return 0;
+
+    if (t->children == NULL) {
+        if (trie_alloc_block(t, TRIE_NODE4) != 0)
+            return 1;
+    } else if (t->type != TRIE_NODE256
+               && t->num_children == trie_capacity[t->type]) {
+        if (trie_relayout(t, t->type + 1) != 0)
+            return 1;
+    }
+
+    struct trie *child = trie_new(current);
+    if (child == NULL)
+        return 1;
+
+    child->parent = t;
+
+    switch (t->type) {
+    case TRIE_NODE4:
+    case TRIE_NODE16: {
+        /* Keep keys sorted so children come out in character order */
+        int i = 0;
+        while (i < t->num_children && t->keys[i] < c)
+            i++;
 
-    if (t->children[c] == NULL)
-        t->children[c] = trie_new(current);
+        memmove(t->keys + i + 1, t->keys + i, t->num_children - i);
+        memmove(t->children + i + 1, t->children + i,
+            (t->num_children - i) * sizeof(struct trie *));
+
+        t->keys[i] = c;
+        t->children[i] = child;
+        break;
+    }
+    case TRIE_NODE48:
+        /* The first free slot is always at num_children, see removal */
+        t->children[t->num_children] = child;
+        t->keys[c] = t->num_children + 1;
+        break;
+    default:
+        t->children[c] = child;
+        break;
+    }
+
+    t->num_children++;
+    t->childmap[c / 64] |= (uint64_t)1 << (c % 64);
 
     return 0;  
 }
 
+/*
+    Adds delta to the word_count of t and every node above it, called
+    whenever words start or stop ending somewhere at or below t.
+ */
+static void trie_count_words(struct trie *t, int delta)
+{
+    for (; t != NULL; t = t->parent)
+        t->word_count += delta;
+}
+
+/*
+    Compares the words ending on two nodes of the same trie. Distinct
+    children of a node differ in current, so the words are told apart
+    where their paths first split.
+ */
+static int trie_word_cmp(struct trie *a, struct trie *b)
+{
+    int da = 0, db = 0;
+    struct trie *n;
+
+    for (n = a; n->parent != NULL; n = n->parent)
+        da++;
+    for (n = b; n->parent != NULL; n = n->parent)
+        db++;
+
+    /* A word sorts after every word that is a prefix of it */
+    for (; da > db; da--) {
+        a = a->parent;
+        if (a == b)
+            return 1;
+    }
+    for (; db > da; db--) {
+        b = b->parent;
+        if (b == a)
+            return -1;
+    }
+
+    if (a == b)
+        return 0;
+
+    while (a->parent != b->parent) {
+        a = a->parent;
+        b = b->parent;
+    }
+
+    return (unsigned char)a->current - (unsigned char)b->current;
+}
+
+/* Negative if the word on a ranks before the word on b */
+static int trie_rank_cmp(struct trie *a, struct trie *b)
+{
+    if (a->score != b->score)
+        return a->score > b->score ? -1 : 1;
+
+    return trie_word_cmp(a, b);
+}
+
+/*
+    Inserts w into a ranked list of len entries holding at most cap,
+    dropping the last entry if the list is full.
+
+    Returns whether w made it into the list.
+ */
+static bool trie_rank_insert(struct trie **list, int *len, int cap, struct trie *w)
+{
+    int i = *len;
+
+    if (i == cap) {
+        if (trie_rank_cmp(w, list[cap - 1]) > 0)
+            return false;
+        i--;
+    } else {
+        (*len)++;
+    }
+
+    for (; i > 0 && trie_rank_cmp(w, list[i - 1]) < 0; i--)
+        list[i] = list[i - 1];
+    list[i] = w;
+
+    return true;
+}
+
+/*
+    Puts w, a word whose rank has just gone up, in the cached list of t.
+
+    Returns whether w is in the list afterwards.
+ */
+static bool trie_topk_offer(struct trie *t, struct trie *w)
+{
+    int len = t->topk_len;
+    bool held = false;
+
+    for (int i = 0; i < len && !held; i++)
+        held = t->topk[i] == w;
+
+    /* Below TRIE_TOPK entries a new word always gets in, so the list grows by one */
+    if (!held && len < TRIE_TOPK) {
+        struct trie **grown = trie_mem_realloc(t->topk, (len + 1) * sizeof(struct trie *));
+        if (grown == NULL) {
+            fprintf(stderr, "Could not allocate memory for top words\n");
+            return false;
+        }
+        t->topk = grown;
+    }
+
+    for (int i = 0; i < len; i++) {
+        if (t->topk[i] == w) {
+            memmove(t->topk + i, t->topk + i + 1,
+                (len - i - 1) * sizeof(struct trie *));
+            len--;
+            break;
+        }
+    }
+
+    bool kept = trie_rank_insert(t->topk, &len, TRIE_TOPK, w);
+    t->topk_len = len;
+
+    return kept;
+}
+
+/*
+    Updates the cached lists above w after its rank went up. A word that
+    misses the list of a node misses the lists of all its ancestors too,
+    so the climb usually stops early.
+ */
+static void trie_topk_raise(struct trie *w)
+{
+    for (struct trie *t = w; t != NULL; t = t->parent) {
+        if (!trie_topk_offer(t, w))
+            return;
+    }
+}
+
+/*
+    Recomputes the cached list of t from its own word and its children's
+    lists, which between them hold every word that can make it.
+ */
+static void trie_topk_rebuild(struct trie *t)
+{
+    struct trie *list[TRIE_TOPK];
+    struct trie *child;
+    int len = 0, pos = 0;
+
+    if (t->is_word == 1)
+        trie_rank_insert(list, &len, TRIE_TOPK, t);
+
+    while ((child = trie_next_child(t, &pos)) != NULL) {
+        for (int i = 0; i < child->topk_len; i++) {
+            if (!trie_rank_insert(list, &len, TRIE_TOPK, child->topk[i]))
+                break;
+        }
+    }
+
+    if (len == 0) {
+        trie_mem_free(t->topk);
+        t->topk = NULL;
+        t->topk_len = 0;
+        return;
+    }
+
+    if (len != t->topk_len) {
+        struct trie **sized = trie_mem_realloc(t->topk, len * sizeof(struct trie *));
+        if (sized == NULL) {
+            fprintf(stderr, "Could not allocate memory for top words\n");
+            return;
+        }
+        t->topk = sized;
+    }
+
+    memcpy(t->topk, list, len * sizeof(struct trie *));
+    t->topk_len = len;
+}
+
+/*
+    Updates the cached lists above w after its rank went down or it
+    stopped being a word. Only lists that held w can change.
+ */
+static void trie_topk_drop(struct trie *w)
+{
+    for (struct trie *t = w; t != NULL; t = t->parent) {
+        bool held = false;
+
+        for (int i = 0; i < t->topk_len && !held; i++)
+            held = t->topk[i] == w;
+
+        if (!held)
+            return;
+
+        trie_topk_rebuild(t);
+    }
+}
+
+/*
+    Removes a child, and everything below it, from a trie.
+
+    Parameters:
+     - t: A pointer to the trie where the node is to be removed
+     - current: A char indicating the character of the node being removed
+
+    Returns:
+     - 0 on success (including when there is no such child), 1 if an
+       error occurs.
+
+    Details:
+     - Frees the child with trie_free() and moves t back down to a smaller
+       child layout once it is sparse enough
+*/
+int trie_remove_node(struct trie *t, char current)
+{
+    assert(t != NULL);
+
+    unsigned char c = (unsigned char)current;
+    struct trie *child = trie_get_child(t, current);
+
+    if (child == NULL)
+        return 0;
+
+    switch (t->type) {
+    case TRIE_NODE4:
+    case TRIE_NODE16: {
+        int i = 0;
+        while (t->keys[i] != c)
+            i++;
+
+        memmove(t->keys + i, t->keys + i + 1, t->num_children - i - 1);
+        memmove(t->children + i, t->children + i + 1,
+            (t->num_children - i - 1) * sizeof(struct trie *));
+        break;
+    }
+    case TRIE_NODE48: {
+        /* Move the last slot into the hole to keep slots packed */
+        int slot = t->keys[c] - 1;
+        int last = t->num_children - 1;
+
+        t->keys[c] = 0;
+        if (slot != last) {
+            struct trie *moved = t->children[last];
+            t->children[slot] = moved;
+            t->keys[(unsigned char)moved->current] = slot + 1;
+        }
+        t->children[last] = NULL;
+        break;
+    }
+    default:
+        t->children[c] = NULL;
+        break;
+    }
+
+    t->num_children--;
+    t->childmap[c / 64] &= ~((uint64_t)1 << (c % 64));
+    trie_count_words(t, -child->word_count);
+
+    /* Words went with the child, so the lists above may have to refill */
+    if (child->word_count > 0) {
+        for (struct trie *up = t; up != NULL; up = up->parent)
+            trie_topk_rebuild(up);
+    }
+
+    trie_free(child);
+
+    if (t->num_children == 0) {
+        trie_mem_free(t->children);
+        t->children = NULL;
+        t->keys = NULL;
+        t->type = TRIE_NODE4;
+    } else if (t->type != TRIE_NODE4
+               && t->num_children <= trie_shrink_at[t->type]) {
+        /* A failed shrink leaves the node valid, just roomier than needed */
+        if (trie_relayout(t, t->type - 1) != 0)
+            return 1;
+    }
+
+    return 0;
+}
+
 /*
     Inserts word into trie.
     Parameters:
      - t: A pointer to the given trie
-     - word: A char array to be inserted into the given trie
+     - word, len: The word to be inserted and its length. It may hold
+       any bytes, NUL included.
     
     Returns:
      - 0 on success, 1 if error occurs.
@@ -154,23 +792,26 @@ int trie_add_node(struct trie *t, char current)
      - Then move on to the next character in string
      - Set the is_word of the last node to 1
 */
-int trie_insert_string(struct trie *t, char *word)
+int trie_insert_string(struct trie *t, const char *word, size_t len)
 {
     assert(t != NULL);
 
-    if (*word == '\0') {
-        t->is_word = 1;
+    if (len == 0) {
+        if (t->is_word == 0) {
+            t->is_word = 1;
+            t->score = 0;
+            trie_count_words(t, 1);
+            trie_topk_raise(t);
+        }
         return 0;
     } else {
-        int len = strlen(word);
-        int index;
-        for (int i = 0; i < len; i++) {
-            index = (int)word[i];
-            t->charlist[index] = word[i];
+        unsigned char index;
+        for (size_t i = 0; i < len; i++) {
+            index = (unsigned char)word[i];
+            t->charlist[index / 64] |= (uint64_t)1 << (index % 64);
         }
 
         char curr = word[0];
-	index = (int)curr;
 
         int rc = trie_add_node(t, curr);
         if (rc != 0) {
@@ -178,8 +819,7 @@ int trie_insert_string(struct trie *t, char *word)
             return 1;
         }
 
-        word++;
-        return trie_insert_string(t->children[index], word);
+        return trie_insert_string(trie_get_child(t, curr), word + 1, len - 1);
     }
 }
 
@@ -196,11 +836,13 @@ int trie_insert_string(struct trie *t, char *word)
 bool trie_char_exists(struct trie *t, char c) 
 {
     assert(t != NULL);
-    assert(t->charlist != NULL);
 
-    int index = (int)c;
+    unsigned char index = (unsigned char)c;
 
-    return (t->charlist[index] != '\0');
+    if (index == '\0')
+        return false;
+
+    return (t->charlist[index / 64] >> (index % 64)) & 1;
 }
 
 /* 
@@ -208,33 +850,27 @@ bool trie_char_exists(struct trie *t, char c)
  
     Parameters:
      - t: A pointer to the given trie
-     - word: A char array in which the end pointer is desired
+     - word, len: The word or prefix whose end node is desired, and its length
 
     Returns: 
      - pointer to the last letter in the word/prefix if word/prefix is found. 
      - NULL if word/prefix is not found.
  */
-struct trie *trie_get_subtrie(struct trie *t, char* word)
+struct trie *trie_get_subtrie(struct trie *t, const char *word, size_t len)
 {
-    int len;
     struct trie* curr;
-    struct trie** next;
 
-    len = strlen(word);
     curr = t;
-    next = t->children;
 
     /* 
        Iterates through each character of the word
-       and goes to child of current trie with index
-       of the current character casted as an int
+       and goes to the child of the current trie
+       for that character
      */
-    for (int i = 0; i < len; i++) {
-        int j = (int)word[i];
-        curr = next[j];
+    for (size_t i = 0; i < len; i++) {
+        curr = trie_get_child(curr, word[i]);
         if (curr == NULL)
             return NULL;
-        next = next[j]->children;
     }
 
     return curr;
@@ -245,16 +881,16 @@ struct trie *trie_get_subtrie(struct trie *t, char* word)
  
     Parameters:
      - t: A pointer to the given trie
-     - word: A char array that will be searched for in the trie 
+     - word, len: The word that will be searched for in the trie, and its length
 
     Returns: 
      - IN_TRIE if word is found. 
      - NOT_IN_TRIE  if word is not found at all.
      - PARTIAL_IN_TRIE if word is found but end node's is_word is 0.
  */
-int trie_search(struct trie *t, char* word)
+int trie_search(struct trie *t, const char *word, size_t len)
 {
-    struct trie *end = trie_get_subtrie(t, word);
+    struct trie *end = trie_get_subtrie(t, word, len);
 
     if (end == NULL)
         return NOT_IN_TRIE;
@@ -265,679 +901,5271 @@ int trie_search(struct trie *t, char* word)
     return PARTIAL_IN_TRIE;
 }
 
-/* Helper function for trie_count_completion */
-int trie_count_completion_recursive(struct trie *t)
+/*
+    Prefetches what trie_get_child() on t will read for c, so the loads
+    for a whole batch of lookups are in flight at once.
+ */
+static inline void trie_prefetch_child(struct trie *t, char c)
 {
-    int acc = 0;
-
-    if (t == NULL)
-        return acc;
-
-    if (t->is_word == 1)
-        acc++;
-
-    for (int i = 0; i < 256; i++)
-        acc += trie_count_completion_recursive(t->children[i]);
-
-    return acc;
+    unsigned char index = (unsigned char)c;
+
+    if (t->num_children == 0)
+        return;
+
+    switch (t->type) {
+    case TRIE_NODE4:
+    case TRIE_NODE16:
+        __builtin_prefetch(t->keys);
+        __builtin_prefetch(t->children);
+        break;
+    case TRIE_NODE48:
+        __builtin_prefetch(t->keys + index);
+        break;
+    default:
+        __builtin_prefetch(t->children + index);
+        break;
+    }
 }
 
 /*
-    Count the number of different possible endings of a given prefix in a trie
-    
+    Searches for many words at once.
+
     Parameters:
-     - pre: a string of the prefix converned
-     - t: a trie pointer
+     - t: A pointer to the given trie
+     - words, lens: The words to search for and their lengths
+     - n: Number of words
+     - results: Array of n ints, results[i] is set to what
+       trie_search() returns for words[i]
+
     Returns:
-     - an integer of the number of endings if the prefix exists in the trie
-     - 0 if the prefix does not exist in the trie
+     - Always returns 0
+
+    Details:
+     - Walks TRIE_SEARCH_BATCH words down the trie in lockstep, one
+       character each per round, prefetching the next node of every walk
+       so their cache misses overlap instead of coming one after another
 */
-int trie_count_completion(struct trie *t, char *pre)
+int trie_search_many(struct trie *t, const char **words, const size_t *lens, int n,
+                     int *results)
 {
-    struct trie *end = trie_get_subtrie(t, pre);
+    assert(t != NULL);
 
-    if (end == NULL)
-        return 0;
+    struct trie *node[TRIE_SEARCH_BATCH];
+    const char *at[TRIE_SEARCH_BATCH];
+    size_t left[TRIE_SEARCH_BATCH];
 
-    return trie_count_completion_recursive(end);
-}
+    for (int base = 0; base < n; base += TRIE_SEARCH_BATCH) {
+        int m = n - base < TRIE_SEARCH_BATCH ? n - base : TRIE_SEARCH_BATCH;
+        int active = 0;
 
-/* 
-    Since modules do not include header files typically, this is an early 
-    declaration of the suggestions() function since helper functions use it
- */
-int suggestions(match_t **set, struct trie *t, char *prefix, char *suffix, int edits_left, int n);
+        for (int i = 0; i < m; i++) {
+            node[i] = t;
+            at[i] = words[base + i];
+            left[i] = lens[base + i];
+            if (left[i] > 0)
+                active++;
+        }
 
-/*
-    Sees if there are any words in a trie that contain a given prefix
-  
-    Parameters: 
-     - t: A trie. Must point to a trie allocated with trie_new
-     - s: A string. The prefix to check
-  
-    Returns:
-     - true if there is a word in the dictionary with the prefix
-     - false otherwise
-*/
-bool trie_has_children(struct trie *t, char *s) 
-{    
-    return trie_search(t, s) != NOT_IN_TRIE;
+        /* Prefetch for the whole batch, then take one step each */
+        while (active > 0) {
+            for (int i = 0; i < m; i++) {
+                if (node[i] != NULL && left[i] > 0)
+                    trie_prefetch_child(node[i], *at[i]);
+            }
+
+            for (int i = 0; i < m; i++) {
+                if (node[i] == NULL || left[i] == 0)
+                    continue;
+
+                node[i] = trie_get_child(node[i], *at[i]);
+                at[i]++;
+                left[i]--;
+
+                if (node[i] == NULL || left[i] == 0)
+                    active--;
+                else
+                    __builtin_prefetch(node[i]);
+            }
+        }
+
+        for (int i = 0; i < m; i++) {
+            if (node[i] == NULL)
+                results[base + i] = NOT_IN_TRIE;
+            else if (node[i]->is_word == 1)
+                results[base + i] = IN_TRIE;
+            else
+                results[base + i] = PARTIAL_IN_TRIE;
+        }
+    }
+
+    return 0;
 }
 
 /*
-    Comparison function for qsort(). Returns which match_t has higher precedence.
-    - Note that qsort() requires a comparison function as input where the arguments 
-    has been cast as void* and the function should return a positive/negative integer
-    See here for more info: https://www.geeksforgeeks.org/comparator-function-of-qsort-in-c/
+    Inserts a word with a score, or changes the score of a word that is
+    already in the trie.
+
+    Parameters:
+     - t: A pointer to the given trie
+     - word, len: The word to be inserted and its length
+     - score: The word's score, higher ranks first in trie_topk()
 
-    Parameters: 
-     - a, b: match_t structs that have been cast as void*
-  
     Returns:
-     - a positive integer n if if a should go before b in the sorted list
-     - a negative integer n if if b should go before a in the sorted list
-     - 0 if a == b
+     - 0 on success, 1 if error occurs.
+
+    Details:
+     - Updates the cached top words of the nodes on the word's path,
+       usually stopping at the first node the word does not rank on
 */
-int cmp_match(const void* a, const void* b) 
+int trie_insert_scored(struct trie *t, const char *word, size_t len, double score)
 {
-    // Recast a and b as match_t's
-    match_t *aa = *(match_t **)a;
-    match_t *bb = *(match_t **)b;
+    assert(t != NULL);
 
-    // Put null entries at the end of the list
-    if (aa == NULL) {
+    if (trie_insert_string(t, word, len) != 0)
         return 1;
-    } else if (bb == NULL) {
-        return -1;
-    }
 
-    // Prioritize matches with the higher edits_left score
-    if (aa->edits_left != bb->edits_left) {
-        return bb->edits_left - aa->edits_left;
-    }
+    struct trie *end = trie_get_subtrie(t, word, len);
+    double old = end->score;
 
-    // Otherwise sort lexographically
-    return strncmp(aa->str, bb->str, MAXLEN);
+    end->score = score;
+    if (score > old)
+        trie_topk_raise(end);
+    else if (score < old)
+        trie_topk_drop(end);
+
+    return 0;
 }
 
-// Helper function for suggestions that just moves on to the next character
-int move_on(match_t **set, struct trie *t, char *prefix, char *suffix, int edits_left, int n)
+/*
+    Removes word from trie.
+
+    Parameters:
+     - t: A pointer to the given trie
+     - word, len: The word to be removed and its length
+
+    Returns:
+     - IN_TRIE if word was in the trie and has been removed
+     - NOT_IN_TRIE if word is not in the trie at all
+     - PARTIAL_IN_TRIE if word is only a prefix of other words. Nothing
+       is removed.
+
+    Details:
+     - Sets the is_word of the last node to 0 and updates word counts
+     - Frees the nodes on the path that no longer lead to any word right
+       away, so keys do not grow under churn
+*/
+int trie_remove_string(struct trie *t, const char *word, size_t len)
 {
-    int rc = EXIT_SUCCESS;
-    int len = strlen(prefix);
-    char* new_prefix;
+    assert(t != NULL);
 
-    new_prefix = RedisModule_Alloc(sizeof(char) * (MAXLEN + 1));
-    if (new_prefix == NULL) {
-        return EXIT_FAILURE;
-    }
+    struct trie *end = trie_get_subtrie(t, word, len);
+
+    if (end == NULL)
+        return NOT_IN_TRIE;
 
-    strncpy(new_prefix, prefix, MAXLEN);
+    if (end->is_word == 0)
+        return PARTIAL_IN_TRIE;
 
-    new_prefix[len] = suffix[0];
+    end->is_word = 0;
+    trie_count_words(end, -1);
+    trie_topk_drop(end);
+    end->score = 0;
 
-    if (trie_has_children(t, new_prefix) == true) {
+    /*
+        Climb to the highest node below t that no longer leads to a word
+        and cut the whole dead branch off there
+     */
+    struct trie *dead = end;
+    while (dead != t && dead->parent != t && dead->parent->word_count == 0)
+        dead = dead->parent;
 
-        // Move on to the next character, don't use up an edit
-        rc = suggestions(set, t, new_prefix, suffix + 1, edits_left, n);
+    if (dead != t && dead->word_count == 0) {
+        if (trie_remove_node(dead->parent, dead->current) != 0)
+            fprintf(stderr, "Fail to remove node\n");
     }
 
-    // Save some space now that we're done
-    RedisModule_Free(new_prefix);
+    return IN_TRIE;
+}
 
-    return rc;
+/*
+    Count the number of different possible endings of a given prefix in a trie
+    
+    Parameters:
+     - pre, len: the prefix concerned and its length
+     - t: a trie pointer
+    Returns:
+     - an integer of the number of endings if the prefix exists in the trie
+     - 0 if the prefix does not exist in the trie
+
+    Details:
+     - Reads the word_count kept on every node, so this only costs a walk
+       down the prefix
+*/
+int trie_count_completion(struct trie *t, const char *pre, size_t len)
+{
+    struct trie *end = trie_get_subtrie(t, pre, len);
+
+    if (end == NULL)
+        return 0;
+
+    return end->word_count;
 }
 
-// Helper function for suggestions that tries to remove the first character of the suffix
-int try_delete(match_t **set, struct trie *t, char *prefix, char *suffix, int edits_left, int n)
+/*
+    Adds the words below t to out, a ranked list of *n of the best k
+    found so far, skipping every branch whose best word is not good
+    enough to get in.
+ */
+static void trie_topk_collect(struct trie *t, int k, struct trie **out, int *n)
 {
-    int rc = EXIT_SUCCESS;
+    struct trie *child;
+    int pos = 0;
 
-    // Don't need to copy the string over as we aren't changing the prefix
+    if (t->topk_len == 0)
+        return;
 
-    if (trie_has_children(t, prefix) == true) {
+    if (*n == k && trie_rank_cmp(t->topk[0], out[k - 1]) > 0)
+        return;
 
-        // Adding 1 to the suffix pointer will essentially delete the first character
-        rc = suggestions(set, t, prefix, suffix + 1, edits_left - 1, n);
+    /* A list with room to spare already holds every word below t */
+    if (t->topk_len < TRIE_TOPK) {
+        for (int i = 0; i < t->topk_len; i++) {
+            if (!trie_rank_insert(out, n, k, t->topk[i]))
+                break;
+        }
+        return;
     }
 
-    return rc;
+    if (t->is_word == 1)
+        trie_rank_insert(out, n, k, t);
+
+    while ((child = trie_next_child(t, &pos)) != NULL)
+        trie_topk_collect(child, k, out, n);
 }
 
-// Helper function for suggestions that tries to replace the first character in the suffix and move it to the prefix
-int try_replace(match_t **set, struct trie *t, char *prefix, char *suffix, int edits_left, int n)
+/*
+    Finds the best scoring words with a given prefix.
+
+    Parameters:
+     - t: A trie pointer
+     - pre, len: The prefix and its length, "" and 0 for every word in the trie
+     - k: Number of words wanted
+     - out: Array of at least k trie pointers for the results
+
+    Returns:
+     - The number of words found, at most k. out[i] is the node the i-th
+       best word ends on, use trie_node_word() to get the word itself.
+
+    Details:
+     - For k up to TRIE_TOPK this copies the list cached on the prefix
+       node, so it only costs a walk down the prefix. Bigger k search
+       the subtree, skipping branches whose best word cannot make it.
+*/
+int trie_topk(struct trie *t, const char *pre, size_t len, int k, struct trie **out)
 {
-    int i;
-    int rc = EXIT_SUCCESS;
-    int len = strlen(prefix);
-    char *new_prefix;
+    int n = 0;
+    struct trie *end = trie_get_subtrie(t, pre, len);
 
-    // Ran out of space
-    if (len == MAXLEN - 1) {
-        return EXIT_FAILURE;
+    if (end == NULL || k <= 0)
+        return 0;
+
+    if (k <= end->topk_len || end->topk_len < TRIE_TOPK) {
+        n = k < end->topk_len ? k : end->topk_len;
+        memcpy(out, end->topk, n * sizeof(struct trie *));
+        return n;
     }
 
-    for (i = 1; i < 248; i++) {
+    trie_topk_collect(end, k, out, &n);
 
-        char c = (char)i;
+    return n;
+}
 
-        if (trie_char_exists(t, c) == true) {
+/*
+    Rebuilds the word a node stands for by following its parents.
 
-            new_prefix = RedisModule_Alloc(sizeof(char) * (MAXLEN + 1));
-            if (new_prefix == NULL) {
+    Parameters:
+     - t: A node of a trie
+     - buf: Where to write the word and a terminating NUL
+     - size: Size of buf
 
-                return EXIT_FAILURE;
+    Returns:
+     - The length of the word. Nothing is written unless size is more
+       than that, so callers can grow buf and try again.
+*/
+size_t trie_node_word(struct trie *t, char *buf, size_t size)
+{
+    size_t len = 0;
+    struct trie *n;
 
-            } else {
+    for (n = t; n->parent != NULL; n = n->parent)
+        len++;
 
-                strncpy(new_prefix, prefix, MAXLEN);
+    if (size <= len)
+        return len;
 
-                // Try replacing the beginning of the suffix with each ASCII character
-                // And move that to the end of the prefix
-                new_prefix[len] = c;
-                new_prefix[len + 1] = '\0';
+    /* Fill the word in back to front on the way up */
+    char *end = buf + len;
 
-                if (trie_has_children(t, new_prefix) == true) {
+    *end = '\0';
+    for (n = t; n->parent != NULL; n = n->parent)
+        *--end = n->current;
 
-                    // Adding 1 to the suffix pointer will essentially delete the first character
-                    // Shifting the "replaced" character to the prefix
-                    rc = suggestions(set, t, new_prefix, suffix + 1, edits_left - 1, n);
+    return len;
+}
 
-                    if (rc != EXIT_SUCCESS) {
+/* One level of a trie_iter walk */
+struct trie_iter_frame {
+    // the node and how far trie_next_child() has got through it
+    struct trie *node;
+    int pos;
 
-                        RedisModule_Free(new_prefix);
-                        return EXIT_FAILURE;
-                    }
-                }
+    // length of the key buffer with this node's character appended
+    size_t len;
 
-                // Save some space now that we're done
-                RedisModule_Free(new_prefix);
-            }
-        }
-    }
+    // whether the node's own word has been returned (or skipped)
+    bool done_self;
+};
 
-    // EXIT_FAILURE would've been caught above, so if we make it here we succeeded
-    return EXIT_SUCCESS;
-}
+/* Walks the words under a prefix in lexicographic order */
+struct trie_iter {
+    // path from the prefix node down to the node being visited
+    struct trie_iter_frame *stack;
+    int depth;
+    int stack_size;
 
-// Helper function that tries to swap the last character of the prefix and first character of the prefix
-// and append both to the prefix
-int try_swap(match_t **set, struct trie *t, char *prefix, char *suffix, int edits_left, int n)
-{
-    int rc = EXIT_SUCCESS;
-    int len = strlen(prefix);
-    char* new_prefix;
+    // the current word, reused (and grown) for every word returned
+    char *key;
+    size_t key_size;
+};
 
-    if (len == 0 || strlen(suffix) == 0) {
-        return EXIT_SUCCESS;
+/*
+   Sets *pos so that the next trie_next_child() call returns the first
+   child of t whose character is c or greater.
+ */
+static void trie_seek_child(struct trie *t, unsigned char c, int *pos)
+{
+    if (t->type == TRIE_NODE4 || t->type == TRIE_NODE16) {
+        int i = 0;
+        while (i < t->num_children && t->keys[i] < c)
+            i++;
+        *pos = i;
+    } else {
+        *pos = c;
     }
+}
 
-    new_prefix = RedisModule_Alloc(sizeof(char) * (MAXLEN + 1));
-    if (new_prefix == NULL) {
-        return EXIT_FAILURE;
+/* Copies n bytes of s to position at of the iterator's key, growing it */
+static int trie_iter_put(struct trie_iter *it, size_t at, const char *s, size_t n)
+{
+    if (at + n + 1 > it->key_size) {
+        size_t size = it->key_size * 2;
+        if (size < at + n + 1)
+            size = at + n + 1;
+
+        char *key = trie_mem_realloc(it->key, size);
+        if (key == NULL) {
+            fprintf(stderr, "Could not allocate memory for iterator key\n");
+            return 1;
+        }
+        it->key = key;
+        it->key_size = size;
     }
 
-    strncpy(new_prefix, prefix, MAXLEN);
+    memcpy(it->key + at, s, n);
 
-    // Swap suffix's first character into new_prefix and insert it in front of the last character
-    new_prefix[len] = new_prefix[len - 1];
-    new_prefix[len - 1] = suffix[0];
-    new_prefix[len + 1] = '\0';
+    return 0;
+}
 
-    if (trie_has_children(t, new_prefix) == true) {
-        // Adding 1 to the suffix pointer will essentially delete the first character
-        rc = suggestions(set, t, new_prefix, suffix + 1, edits_left - 1, n);
+/* Steps the walk down into node, whose word is the first len bytes of the key */
+static int trie_iter_push(struct trie_iter *it, struct trie *node, size_t len)
+{
+    if (it->depth == it->stack_size) {
+        int size = it->stack_size == 0 ? 16 : it->stack_size * 2;
+        struct trie_iter_frame *stack = trie_mem_realloc(it->stack,
+            size * sizeof(struct trie_iter_frame));
+        if (stack == NULL) {
+            fprintf(stderr, "Could not allocate memory for iterator stack\n");
+            return 1;
+        }
+        it->stack = stack;
+        it->stack_size = size;
     }
 
-    // Save some space now that we're done
-    RedisModule_Free(new_prefix);
+    struct trie_iter_frame *f = &it->stack[it->depth++];
+    f->node = node;
+    f->pos = 0;
+    f->len = len;
+    f->done_self = false;
 
-    return rc;
+    return 0;
 }
 
-// Helper function for suggestions that tries to insert a character to the end of a prefix
-int try_insert(match_t **set, struct trie *t, char *prefix, char *suffix, int edits_left, int n)
+/*
+   Moves a fresh iterator past every word less than or equal to after,
+   by following after down the trie instead of visiting those words.
+ */
+static int trie_iter_seek(struct trie_iter *it, const char *after, size_t alen)
 {
-    int i;
-    int rc = EXIT_SUCCESS;
-    int len = strlen(prefix);
-    char* new_prefix;
+    struct trie_iter_frame *f = &it->stack[0];
+    size_t n = f->len < alen ? f->len : alen;
+    int cmp = memcmp(it->key, after, n);
 
-    // Ran out of space
-    if (len == MAXLEN - 1) {
-        return EXIT_FAILURE;
+    /* Every word under the prefix sorts before after */
+    if (cmp < 0) {
+        it->depth = 0;
+        return 0;
     }
 
-    /* 
-        Loops through all the ASCII characters
-        Crashes if 248 <= i <= 255
-        No idea why, only when those specific characters are passed through
-        even if you attempt each one individually
-     */
-    for (i = 1; i < 248; i++) {
+    /* Or every word sorts after it */
+    if (cmp > 0 || f->len > alen)
+        return 0;
 
-        char c = (char)i;
+    while (true) {
+        f = &it->stack[it->depth - 1];
 
-        if (trie_char_exists(t, c) == true) {
-            
-            new_prefix = RedisModule_Alloc(sizeof(char) * (MAXLEN + 1));
-            if (new_prefix == NULL) {
+        /* Anything ending here is a prefix of after, or after itself */
+        f->done_self = true;
+        if (f->len == alen)
+            return 0;
 
-                return EXIT_FAILURE;
-            
-            } else {
+        unsigned char c = (unsigned char)after[f->len];
+        int pos;
 
-                strncpy(new_prefix, prefix, MAXLEN);
+        trie_seek_child(f->node, c, &f->pos);
+        pos = f->pos;
 
-                // Try adding on a new character
-                new_prefix[len] = c;
-                new_prefix[len + 1] = '\0';
+        struct trie *child = trie_next_child(f->node, &pos);
+        if (child == NULL || (unsigned char)child->current != c)
+            return 0;
 
-                if (trie_has_children(t, new_prefix) == true) {
+        f->pos = pos;
+        size_t at = f->len;
 
-                    // Basically just inserting the new ASCII character to the string
-                    rc = suggestions(set, t, new_prefix, suffix, edits_left - 1, n);
+        if (trie_iter_put(it, at, &child->current, 1) != 0
+            || trie_iter_push(it, child, at + 1) != 0)
+            return 1;
+    }
+}
 
-                    if (rc != EXIT_SUCCESS) {
+/*
+    Frees a trie_iter.
 
-                        RedisModule_Free(new_prefix);
-                        return EXIT_FAILURE;
-                    }
-                } 
-            
-                // Save some space now that we're done
-                RedisModule_Free(new_prefix);
-            }
-        }
-    }
+    Parameters:
+     - it: An iterator from trie_iter_new()
 
-    // EXIT_FAILURE would've been caught above, so if we make it here we succeeded
-    return EXIT_SUCCESS;
+    Returns:
+     - Always returns 0
+*/
+int trie_iter_free(struct trie_iter *it)
+{
+    assert(it != NULL);
+
+    trie_mem_free(it->stack);
+    trie_mem_free(it->key);
+    trie_mem_free(it);
+
+    return 0;
 }
 
-// Helper function for suggestions(). Attempts to add a match to a suggestion set
-int try_add(match_t **set, struct trie *t, char *s, int edits_left, int n)
-{
-    int i;
+/*
+    Starts a walk over the words with a given prefix.
 
-    // Check if the current string is in the trie
-    if (trie_search(t, s) == IN_TRIE) {
+    Parameters:
+     - t: A trie pointer
+     - pre, pre_len: The prefix and its length, "" and 0 for every word
+       in the trie
+     - after: NULL to start at the first word, or a word to resume after.
+       It does not have to be in the trie.
+     - after_len: Length of after
 
-        // Look for the string in the set to update it, or add it
-        for (i = 0; i < n; i++) {
+    Returns:
+     - A pointer to the iterator, or NULL if it cannot be allocated
+
+    Details:
+     - Words come out in lexicographic (unsigned byte) order
+     - The trie must not be changed while the iterator is in use
+*/
+struct trie_iter *trie_iter_new(struct trie *t, const char *pre, size_t pre_len,
+        const char *after, size_t after_len)
+{
+    assert(t != NULL);
+    assert(pre != NULL);
 
-            if (set[i] == NULL) {
+    struct trie_iter *it = trie_mem_calloc(1, sizeof(struct trie_iter));
 
-                // String does not exist in the set, so add it
+    if (it == NULL) {
+        fprintf(stderr, "Could not allocate memory for trie_iter\n");
+        return NULL;
+    }
 
-                set[i] = (match_t*)RedisModule_Alloc(sizeof(match_t));
-                if (set[i] == NULL) {
-                    return EXIT_FAILURE;
-                }
+    struct trie *end = trie_get_subtrie(t, pre, pre_len);
 
-                set[i]->str = RedisModule_Alloc(sizeof(char) * MAXLEN);
-                if (set[i]->str == NULL) {
-                    return EXIT_FAILURE;
-                }
-                strcpy(set[i]->str, s);
-                set[i]->edits_left = edits_left;
+    /* Nothing starts with the prefix, leave the iterator empty */
+    if (end == NULL)
+        return it;
 
-                if (set[i]->str == NULL) {
-                    // strcpy failed
-                    return EXIT_FAILURE;
-                }
+    if (trie_iter_put(it, 0, pre, pre_len) != 0
+        || trie_iter_push(it, end, pre_len) != 0
+        || (after != NULL && trie_iter_seek(it, after, after_len) != 0)) {
+        trie_iter_free(it);
+        return NULL;
+    }
 
-                return EXIT_SUCCESS;
+    return it;
+}
 
-            } else if (strcmp(set[i]->str, s) == 0) {
+/*
+    Moves a trie_iter on to its next word.
 
-                // String already exists in suggestion set
+    Parameters:
+     - it: An iterator from trie_iter_new()
+     - len: Set to the length of the word
 
-                // If we found the string in less edits, update its score
-                if (set[i]->edits_left < edits_left) {
-                    set[i]->edits_left = edits_left;
-                }
+    Returns:
+     - The word, in a buffer owned by the iterator that is overwritten by
+       the next call
+     - NULL once there are no more words
+*/
+char *trie_iter_next(struct trie_iter *it, size_t *len)
+{
+    assert(it != NULL);
 
-                // We don't want to trigger adding in place of the worst match
-                i = n + 1;
+    while (it->depth > 0) {
+        struct trie_iter_frame *f = &it->stack[it->depth - 1];
 
-                break;
+        if (!f->done_self) {
+            f->done_self = true;
+
+            if (f->node->is_word == 1) {
+                it->key[f->len] = '\0';
+                *len = f->len;
+                return it->key;
             }
         }
 
-        // If we hit the maximum amount of items, then see if we can add it in place of the worst match
-        if (i == n) {
+        struct trie *child = trie_next_child(f->node, &f->pos);
 
-            i--;
-
-            // Sort the set by edits_left and break ties alphabetically
-            qsort(set, n, sizeof(match_t*), cmp_match);
+        if (child == NULL) {
+            it->depth--;
+            continue;
+        }
 
-            // If we found it in less edits or match was alphabetically first
-            if (set[i]->edits_left < edits_left 
-                || (set[i]->edits_left == edits_left && (strncmp(set[i]->str, s, MAXLEN) > 0))) {
+        /* Nothing to find down a branch with no words left in it */
+        if (child->word_count == 0)
+            continue;
 
-                set[i]->str = RedisModule_Alloc(sizeof(char) * MAXLEN);
-                if (set[i]->str == NULL) {
-                    return EXIT_FAILURE;
-                }
-                strcpy(set[i]->str, s);
-                set[i]->edits_left = edits_left;
+        size_t at = f->len;
 
-                if (set[i]->str == NULL) {
-                    // strcpy failed
-                    return EXIT_FAILURE;
-                }
-            }
-        }
+        if (trie_iter_put(it, at, &child->current, 1) != 0
+            || trie_iter_push(it, child, at + 1) != 0)
+            return NULL;
     }
 
-    return EXIT_SUCCESS;
+    return NULL;
 }
 
 /*
-    Performs a mass approximate string match on all the words in a dictionary beginning with a prefix
-    For more information on approx matching: https://www.wikiwand.com/en/Approximate_string_matching
-  
-    Parameters:
-     - set: An array of match_t*'s
-     - t: A trie. Must point to a trie allocated with trie_new
+    The set is kept as a heap with the worst match on top, so a better match
+    replaces it in O(log n). The index finds a match by its string: slots is
+    an open addressing table of positions in the set plus one (0 is empty)
+    and where[i] is the slot of position i.
+ */
+struct set_index {
+    int *slots;
+    int size;
+    int *where;
+
+    /* Matches in the set, at positions 0..count-1 */
+    int count;
+};
+
+/*
+    A state of the search: where it is in the trie and in the word. The same
+    state is often reached by different edits (a delete then an insert, or a
+    replace), and everything below it only depends on the state and the
+    edits left.
+ */
+struct visited {
+    struct trie *node;
+    char *suffix;
+
+    /* The most edits left the state has been expanded with, or -1 if empty */
+    int edits_left;
+};
+
+/* What stays the same for one call to suggestions() */
+struct search {
+    match_t **set;
+    struct trie *t;
+    int n;
+    struct set_index index;
+
+    /* Open addressing table of the states expanded so far */
+    struct visited *visited;
+    size_t visited_size;
+    size_t visited_used;
+
+    /* The prefix built so far. Every branch writes its characters in place. */
+    char buf[2 * MAXLEN + 2];
+};
+
+/* 
+    Since modules do not include header files typically, this is an early 
+    declaration of the search() function since helper functions use it
+ */
+static int search(struct search *s, size_t len, struct trie *cur, struct trie *par,
+                  char *suffix, int edits_left);
+
+/*
+    Sees if there are any words in a trie that contain a given prefix
+  
+    Parameters: 
+     - t: A trie. Must point to a trie allocated with trie_new
+     - s: A string. The prefix to check
+  
+    Returns:
+     - true if there is a word in the dictionary with the prefix
+     - false otherwise
+*/
+bool trie_has_children(struct trie *t, char *s) 
+{    
+    return trie_search(t, s, strlen(s)) != NOT_IN_TRIE;
+}
+
+/*
+    Comparison function for qsort(). Returns which match_t has higher precedence.
+    - Note that qsort() requires a comparison function as input where the arguments 
+    has been cast as void* and the function should return a positive/negative integer
+    See here for more info: https://www.geeksforgeeks.org/comparator-function-of-qsort-in-c/
+
+    Parameters: 
+     - a, b: match_t structs that have been cast as void*
+  
+    Returns:
+     - a positive integer n if if a should go before b in the sorted list
+     - a negative integer n if if b should go before a in the sorted list
+     - 0 if a == b
+*/
+int cmp_match(const void* a, const void* b) 
+{
+    // Recast a and b as match_t's
+    match_t *aa = *(match_t **)a;
+    match_t *bb = *(match_t **)b;
+
+    // Put null entries at the end of the list
+    if (aa == NULL) {
+        return 1;
+    } else if (bb == NULL) {
+        return -1;
+    }
+
+    // Prioritize matches with the higher edits_left score
+    if (aa->edits_left != bb->edits_left) {
+        return bb->edits_left - aa->edits_left;
+    }
+
+    // Otherwise sort lexographically
+    return strncmp(aa->str, bb->str, MAXLEN);
+}
+
+// Helper function for suggestions that just moves on to the next character
+int move_on(struct search *s, size_t len, struct trie *cur, char *suffix, int edits_left)
+{
+    struct trie *next = cur == NULL ? NULL : trie_get_child(cur, suffix[0]);
+
+    // Words longer than the buffer can't be spelled out
+    if (len >= 2 * MAXLEN || next == NULL) {
+        return EXIT_SUCCESS;
+    }
+
+    // Move on to the next character, don't use up an edit
+    s->buf[len] = suffix[0];
+
+    return search(s, len + 1, next, cur, suffix + 1, edits_left);
+}
+
+// Helper function for suggestions that tries to remove the first character of the suffix
+int try_delete(struct search *s, size_t len, struct trie *cur, struct trie *par, char *suffix, int edits_left)
+{
+    // Don't need to change the prefix
+    if (cur == NULL) {
+        return EXIT_SUCCESS;
+    }
+
+    // Adding 1 to the suffix pointer will essentially delete the first character
+    return search(s, len, cur, par, suffix + 1, edits_left - 1);
+}
+
+// Helper function for suggestions that tries to replace the first character in the suffix and move it to the prefix
+int try_replace(struct search *s, size_t len, struct trie *cur, char *suffix, int edits_left)
+{
+    struct trie *next;
+    int pos = 0;
+
+    // Ran out of space
+    if (len >= MAXLEN - 1) {
+        return EXIT_FAILURE;
+    }
+
+    if (cur == NULL) {
+        return EXIT_SUCCESS;
+    }
+
+    // Only the characters that have a child can lead anywhere
+    while ((next = trie_next_child(cur, &pos)) != NULL) {
+        if (next->current == '\0') {
+            continue;
+        }
+        s->buf[len] = next->current;
+
+        if (search(s, len + 1, next, cur, suffix + 1, edits_left - 1) != EXIT_SUCCESS) {
+            return EXIT_FAILURE;
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
+
+// Helper function that tries to swap the last character of the prefix and first character of the suffix
+// and append both to the prefix
+int try_swap(struct search *s, size_t len, struct trie *par, char *suffix, int edits_left)
+{
+    struct trie *swapped, *next;
+    char last;
+    int rc;
+
+    if (len == 0 || len >= 2 * MAXLEN || par == NULL) {
+        return EXIT_SUCCESS;
+    }
+
+    last = s->buf[len - 1];
+
+    // Go back to before the last character, then take the two in swapped order
+    swapped = trie_get_child(par, suffix[0]);
+    next = swapped == NULL ? NULL : trie_get_child(swapped, last);
+    if (next == NULL) {
+        return EXIT_SUCCESS;
+    }
+
+    s->buf[len - 1] = suffix[0];
+    s->buf[len] = last;
+
+    rc = search(s, len + 1, next, swapped, suffix + 1, edits_left - 1);
+
+    // Put the prefix back for the other branches
+    s->buf[len - 1] = last;
+
+    return rc;
+}
+
+// Helper function for suggestions that tries to insert a character to the end of a prefix
+int try_insert(struct search *s, size_t len, struct trie *cur, char *suffix, int edits_left)
+{
+    struct trie *next;
+    int pos = 0;
+
+    // Ran out of space
+    if (len >= MAXLEN - 1) {
+        return EXIT_FAILURE;
+    }
+
+    if (cur == NULL) {
+        return EXIT_SUCCESS;
+    }
+
+    while ((next = trie_next_child(cur, &pos)) != NULL) {
+        if (next->current == '\0') {
+            continue;
+        }
+
+        // Basically just inserting the new character to the string
+        s->buf[len] = next->current;
+
+        if (search(s, len + 1, next, cur, suffix, edits_left - 1) != EXIT_SUCCESS) {
+            return EXIT_FAILURE;
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
+
+// Whether match a ranks after match b, see cmp_match()
+static bool worse(match_t *a, match_t *b)
+{
+    return cmp_match(&a, &b) > 0;
+}
+
+// FNV-1a, for the index of a set
+static unsigned int hash_str(char *str)
+{
+    unsigned int h = 2166136261u;
+
+    for (; *str != '\0'; str++) {
+        h = (h ^ (unsigned char)*str) * 16777619u;
+    }
+
+    return h;
+}
+
+// Swaps two matches of a set, keeping the index (if any) pointing at them
+static void heap_swap(match_t **set, struct set_index *index, int i, int j)
+{
+    match_t *m = set[i];
+    set[i] = set[j];
+    set[j] = m;
+
+    if (index != NULL) {
+        int slot = index->where[i];
+        index->where[i] = index->where[j];
+        index->where[j] = slot;
+        index->slots[index->where[i]] = i + 1;
+        index->slots[index->where[j]] = j + 1;
+    }
+}
+
+// Moves the match at i up while it is worse than its parent
+static void sift_up(match_t **set, struct set_index *index, int i)
+{
+    while (i > 0 && worse(set[i], set[(i - 1) / 2])) {
+        heap_swap(set, index, i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+}
+
+// Moves the match at i down while a child of it is worse, among the first count
+static void sift_down(match_t **set, struct set_index *index, int i, int count)
+{
+    while (2 * i + 1 < count) {
+        int child = 2 * i + 1;
+
+        if (child + 1 < count && worse(set[child + 1], set[child])) {
+            child++;
+        }
+
+        if (!worse(set[child], set[i])) {
+            break;
+        }
+
+        heap_swap(set, index, i, child);
+        i = child;
+    }
+}
+
+// Moves the matches in the first n slots to the front and makes a heap of them. Returns how many there are
+static int heapify(match_t **set, int n)
+{
+    int i, count = 0;
+
+    for (i = 0; i < n; i++) {
+        if (set[i] != NULL) {
+            set[count++] = set[i];
+        }
+    }
+
+    for (i = count; i < n; i++) {
+        set[i] = NULL;
+    }
+
+    for (i = count / 2 - 1; i >= 0; i--) {
+        sift_down(set, NULL, i, count);
+    }
+
+    return count;
+}
+
+// The position of the match for str in the set, or -1
+static int index_find(struct search *s, char *str)
+{
+    struct set_index *index = &s->index;
+    int mask = index->size - 1;
+    int slot = hash_str(str) & mask;
+
+    for (; index->slots[slot] != 0; slot = (slot + 1) & mask) {
+        if (strcmp(s->set[index->slots[slot] - 1]->str, str) == 0) {
+            return index->slots[slot] - 1;
+        }
+    }
+
+    return -1;
+}
+
+// Adds the match at position i of the set to the index
+static void index_put(struct search *s, int i)
+{
+    struct set_index *index = &s->index;
+    int mask = index->size - 1;
+    int slot = hash_str(s->set[i]->str) & mask;
+
+    while (index->slots[slot] != 0) {
+        slot = (slot + 1) & mask;
+    }
+
+    index->slots[slot] = i + 1;
+    index->where[i] = slot;
+}
+
+// Takes the match at position i of the set out of the index
+static void index_drop(struct search *s, int i)
+{
+    struct set_index *index = &s->index;
+    int mask = index->size - 1;
+    int hole = index->where[i];
+    int slot = hole;
+
+    index->slots[hole] = 0;
+
+    // Shift back every later entry of the run that would no longer be found
+    while (index->slots[slot = (slot + 1) & mask] != 0) {
+        int home = hash_str(s->set[index->slots[slot] - 1]->str) & mask;
+
+        if (((slot - home) & mask) >= ((slot - hole) & mask)) {
+            index->slots[hole] = index->slots[slot];
+            index->where[index->slots[hole] - 1] = hole;
+            index->slots[slot] = 0;
+            hole = slot;
+        }
+    }
+}
+
+// Makes a heap of the set given to suggestions() and indexes it
+static int index_new(struct search *s)
+{
+    struct set_index *index = &s->index;
+    int i;
+
+    index->count = heapify(s->set, s->n);
+    index->size = 4;
+    while (index->size < 2 * s->n) {
+        index->size *= 2;
+    }
+
+    index->slots = trie_mem_calloc(index->size, sizeof(int));
+    index->where = trie_mem_calloc(s->n > 0 ? s->n : 1, sizeof(int));
+    if (index->slots == NULL || index->where == NULL) {
+        trie_mem_free(index->slots);
+        trie_mem_free(index->where);
+        return EXIT_FAILURE;
+    }
+
+    for (i = 0; i < index->count; i++) {
+        index_put(s, i);
+    }
+
+    return EXIT_SUCCESS;
+}
+
+// Helper function for suggestions(). Adds a word of the trie to a suggestion set
+static int try_add(struct search *s, char *str, int edits_left)
+{
+    struct set_index *index = &s->index;
+    match_t **set = s->set;
+    match_t found = { str, edits_left };
+    char *copy;
+    int i = index_find(s, str);
+
+    if (i >= 0) {
+
+        // String already exists in suggestion set, if we found it in less edits update its score
+        if (set[i]->edits_left < edits_left) {
+            set[i]->edits_left = edits_left;
+            sift_down(set, index, i, index->count);
+        }
+
+        return EXIT_SUCCESS;
+    }
+
+    // A full set only takes matches better than its worst one, which is on top
+    if (index->count == s->n && (s->n == 0 || !worse(set[0], &found))) {
+        return EXIT_SUCCESS;
+    }
+
+    copy = trie_mem_alloc(strlen(str) + 1);
+    if (copy == NULL) {
+        return EXIT_FAILURE;
+    }
+    strcpy(copy, str);
+
+    if (index->count < s->n) {
+
+        // String does not exist in the set, so add it
+        set[index->count] = (match_t*)trie_mem_alloc(sizeof(match_t));
+        if (set[index->count] == NULL) {
+            trie_mem_free(copy);
+            return EXIT_FAILURE;
+        }
+
+        set[index->count]->str = copy;
+        set[index->count]->edits_left = edits_left;
+        index_put(s, index->count);
+        sift_up(set, index, index->count++);
+
+        return EXIT_SUCCESS;
+    }
+
+    // Put it in place of the worst match
+    index_drop(s, 0);
+    trie_mem_free(set[0]->str);
+    set[0]->str = copy;
+    set[0]->edits_left = edits_left;
+    index_put(s, 0);
+    sift_down(set, index, 0, index->count);
+
+    return EXIT_SUCCESS;
+}
+
+// Adds prefix+suffix if it is a word, following the suffix down from cur
+static int try_rest(struct search *s, size_t len, struct trie *cur, char *suffix, int edits_left)
+{
+    for (; *suffix != '\0'; suffix++, len++) {
+        if (len >= 2 * MAXLEN || (cur = trie_get_child(cur, *suffix)) == NULL) {
+            return EXIT_SUCCESS;
+        }
+        s->buf[len] = *suffix;
+    }
+
+    if (cur->is_word != 1) {
+        return EXIT_SUCCESS;
+    }
+
+    s->buf[len] = '\0';
+
+    return try_add(s, s->buf, edits_left);
+}
+
+// Hashes a state of the search, see struct visited
+static size_t hash_state(struct trie *cur, char *suffix)
+{
+    size_t h = ((size_t)cur ^ (size_t)suffix) * 0x9E3779B97F4A7C15ull;
+
+    return h ^ (h >> 29);
+}
+
+// Doubles the table of visited states, placing every entry again
+static int visited_grow(struct search *s)
+{
+    size_t size = s->visited_size * 2;
+    struct visited *table = trie_mem_alloc(size * sizeof(struct visited));
+
+    if (table == NULL) {
+        return EXIT_FAILURE;
+    }
+
+    for (size_t i = 0; i < size; i++) {
+        table[i].edits_left = -1;
+    }
+
+    for (size_t i = 0; i < s->visited_size; i++) {
+        struct visited *v = &s->visited[i];
+
+        if (v->edits_left >= 0) {
+            size_t slot = hash_state(v->node, v->suffix) & (size - 1);
+
+            while (table[slot].edits_left >= 0) {
+                slot = (slot + 1) & (size - 1);
+            }
+            table[slot] = *v;
+        }
+    }
+
+    trie_mem_free(s->visited);
+    s->visited = table;
+    s->visited_size = size;
+
+    return EXIT_SUCCESS;
+}
+
+/*
+    Records that a state is about to be expanded with edits_left. Sets *seen
+    if it already was with at least as many, since then it can only find the
+    same words with worse scores.
+ */
+static int visit(struct search *s, struct trie *cur, char *suffix, int edits_left, bool *seen)
+{
+    size_t mask, slot;
+
+    if (2 * (s->visited_used + 1) > s->visited_size && visited_grow(s) != EXIT_SUCCESS) {
+        return EXIT_FAILURE;
+    }
+
+    mask = s->visited_size - 1;
+    slot = hash_state(cur, suffix) & mask;
+
+    for (; s->visited[slot].edits_left >= 0; slot = (slot + 1) & mask) {
+        struct visited *v = &s->visited[slot];
+
+        if (v->node == cur && v->suffix == suffix) {
+            *seen = v->edits_left >= edits_left;
+            if (!*seen) {
+                v->edits_left = edits_left;
+            }
+            return EXIT_SUCCESS;
+        }
+    }
+
+    s->visited[slot].node = cur;
+    s->visited[slot].suffix = suffix;
+    s->visited[slot].edits_left = edits_left;
+    s->visited_used++;
+    *seen = false;
+
+    return EXIT_SUCCESS;
+}
+
+/*
+    The body of suggestions(). The prefix is s->buf[0..len), cur is its node
+    (NULL if it is not in the trie) and par is the node of the prefix without
+    its last character, for swaps.
+ */
+static int search(struct search *s, size_t len, struct trie *cur, struct trie *par,
+                  char *suffix, int edits_left)
+{
+    int rc = 0;
+    bool seen = false;
+
+    // Skip states already expanded with as many edits left. Without edits left there is
+    // nothing to expand, only the rest of the suffix to follow.
+    if (cur != NULL && edits_left > 0) {
+        if (visit(s, cur, suffix, edits_left, &seen) != EXIT_SUCCESS) {
+            return EXIT_FAILURE;
+        }
+
+        if (seen) {
+            return EXIT_SUCCESS;
+        }
+    }
+
+    // Words are only found through a node, so a prefix not in the trie adds nothing
+    if (cur != NULL
+        && (suffix[0] == '\0' || edits_left <= 0)
+        && try_rest(s, len, cur, suffix, edits_left) != EXIT_SUCCESS)  {
+        return EXIT_FAILURE;
+    }
+
+    if (edits_left <= 0) {
+        // Hooray for exit conditions!
+        return EXIT_SUCCESS;
+    }
+
+    // Make sure we aren't at the end of the suffix
+    if (suffix[0] != '\0') {
+
+        rc += move_on(s, len, cur, suffix, edits_left);
+
+        rc += try_delete(s, len, cur, par, suffix, edits_left);
+
+        rc += try_replace(s, len, cur, suffix, edits_left);
+
+        rc += try_swap(s, len, par, suffix, edits_left);
+    }
+
+    // This one doesn't need any fancy suffix checking
+    rc += try_insert(s, len, cur, suffix, edits_left);
+
+    if (rc != EXIT_SUCCESS) {
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+/*
+    Performs a mass approximate string match on all the words in a dictionary beginning with a prefix
+    For more information on approx matching: https://www.wikiwand.com/en/Approximate_string_matching
+  
+    Parameters:
+     - set: An array of match_t*'s
+     - t: A trie. Must point to a trie allocated with trie_new
      - prefix: A prefix of a word. Must be contained in a dictionary or ""
      - suffix: A suffix of a word. Can also be ""
      - edits_left: The maximum levenshtein distance a word can be from prefix+suffix
      - n: The length of set (number of matches in the set)
-  
+  
+    Returns:
+     - 0 for success, or a positive integer n for the number of errors encountered
+
+    Details:
+     - Remembers the states (trie node, position in suffix) it has expanded
+       and the edits it had left there, and only expands a state again with
+       more edits left
+     - Walks the prefix from the root once. After that every probe moves
+       one child down from the node the search is on, and all branches
+       build their candidates in one buffer.
+ */
+int suggestions(match_t **set, struct trie *t, char *prefix, char *suffix, int edits_left, int n)
+{
+    struct search s;
+    struct trie *cur = t, *par = NULL;
+    size_t len = strlen(prefix);
+
+    if (len > MAXLEN) {
+        return EXIT_FAILURE;
+    }
+
+    s.set = set;
+    s.t = t;
+    s.n = n;
+    memcpy(s.buf, prefix, len);
+
+    s.visited_used = 0;
+    s.visited_size = 64;
+    s.visited = trie_mem_alloc(s.visited_size * sizeof(struct visited));
+    if (s.visited == NULL) {
+        return EXIT_FAILURE;
+    }
+    for (size_t i = 0; i < s.visited_size; i++) {
+        s.visited[i].edits_left = -1;
+    }
+
+    if (index_new(&s) != EXIT_SUCCESS) {
+        trie_mem_free(s.visited);
+        return EXIT_FAILURE;
+    }
+
+    // The only walk from the root. Everything after moves one child at a time.
+    for (size_t i = 0; i < len && cur != NULL; i++) {
+        par = cur;
+        cur = trie_get_child(cur, prefix[i]);
+
+        // A prefix not in the trie can still swap, if all but its last character is
+        if (cur == NULL && i + 1 < len) {
+            par = NULL;
+        }
+    }
+
+    int rc = search(&s, len, cur, par, suffix, edits_left);
+
+    trie_mem_free(s.index.slots);
+    trie_mem_free(s.index.where);
+    trie_mem_free(s.visited);
+
+    return rc;
+}
+
+/*
+    Creates array of match_t*'s of spelling suggestions for a word using suggestions()
+  
+    Parameters:
+     - t: A trie. Must point to a trie allocated with trie_new
+     - str: A string. This will be the (misspelled) word to match
+     - max_edits: the maximum levenshtein distance the words in the set can have
+     - n: The length of set (number of matches in the set)
+  
+    Returns:
+     - A pointer to the array of match_t*'s containing the closest n words and their respective distance
+     - NULL if there was an error
+ */
+match_t **suggestion_set_new(struct trie *t, char *str, int max_edits, int n) 
+{
+    assert(t != NULL);
+    assert(str != NULL);
+
+    int i;
+
+    // We'll allocate space for as many matches as we need so we can make sure we get the closest matches
+    match_t **set = (match_t **)trie_mem_calloc(n, sizeof(match_t*));
+
+    if (set == NULL) {
+        return NULL;
+    }
+
+    if (suggestions(set, t, "", str, max_edits, n) != EXIT_SUCCESS) {
+        // suggestions() failed
+
+        for (i = 0; i < n; i++) {
+            if (set[i] != NULL) {
+                trie_mem_free(set[i]->str);
+                trie_mem_free(set[i]);
+            }
+        }
+
+        trie_mem_free(set);
+
+        return NULL;
+    }
+
+    return set;
+}
+
+/*
+    Takes an array of match_t*'s, sorts it, takes the highest n scoring strings out of it by
+    stripping off the match_t wrapper
+  
+    Parameters:
+     - set: An array of match_t*'s
+     - n: the number of strings to return
+  
+    Returns:
+     - The first n strings with the smallest distance, where ties are broken by alphabetical order.
+       If there aren't enough matching strings, each remaining spot is set to NULL.
+     - NULL if there was an error
+ */
+char** suggestion_set_first_n(match_t **set, int n)
+{
+    assert(set != NULL);
+
+    int i;
+
+    char **results = (char**)trie_mem_alloc(sizeof(char*) * n);
+    if (results == NULL) {
+        return NULL;
+    }
+
+    // Heap sort: take the worst match off the top and put it at the end until none are left
+    int count = heapify(set, n);
+
+    for (i = count - 1; i > 0; i--) {
+        heap_swap(set, NULL, 0, i);
+        sift_down(set, NULL, 0, i);
+    }
+
+    // Take the list of strings out of the match_t wrappers
+    for (i = 0; i < n; i++) {
+        if (set[i] == NULL) {
+            results[i] = NULL;
+        } else {
+            results[i] = set[i]->str;
+            trie_mem_free(set[i]);
+        }
+    }
+
+    trie_mem_free(set);
+
+    return results;
+}
+
+/*
+    Returns the n closest words to a given string in a trie. First creates a match_t* array with 
+    suggestion_set_new(), then passes it into suggestion_set_first_n() to sort it and strips the 
+    strings of their match_t wrappers.
+  
+    Parameters:
+     - t: A trie. Must point to a trie allocated with trie_new
+     - str: A string. This will be the (misspelled) word to match
+     - max_edits: the maximum levenshtein distance the words in the set can have
+     - n: the number of strings to return. 
+  
+    Returns:
+     - The first n strings with the smallest distance, where ties are broken by alphabetical order.
+       If there aren't enough matching strings, each remaining spot is set to NULL.
+     - NULL if there was an error
+ */
+char** suggestion_list(struct trie *t, char *str, int max_edits, int n) {
+
+    assert(t != NULL);
+    assert(str != NULL);
+
+    match_t **set = suggestion_set_new(t, str, max_edits, n);
+
+    if (set == NULL) {
+        return NULL;
+    }
+
+    char **results = suggestion_set_first_n(set, n);
+
+    return results;
+}    
+
+/*
+    The DP-row engine behind TRIE.APPROXMATCH. It finds the same words as
+    suggestion_list(), but walks the trie once: every node on the way carries
+    a row of edit counts, one for each number of characters of the word read,
+    and the walk leaves a subtree once every entry is over the budget.
+ */
+
+/* A node suggestion_complete() reached, and the fewest edits it took */
+struct dp_reached {
+    struct trie *node;
+    int edits;
+};
+
+/* State shared by the whole walk of suggestion_list_dp() */
+struct dp_ctx {
+    /* The word being matched and its length */
+    char *str;
+    int len;
+
+    /* Whether swaps count like distance_osa() rather than like suggestions() */
+    bool osa;
+
+    /* Edit budget, and the cost of anything over it */
+    int max_edits;
+    int inf;
+
+    /* Number of results wanted */
+    int n;
+
+    /* Stack of DP rows, len + 1 ints each, addressed by offset since it grows */
+    int *pool;
+    size_t pool_used;
+    size_t pool_size;
+
+    /* The characters on the path from the root to the current node */
+    char *key;
+    size_t key_size;
+
+    /* The best n matches so far, ranked like cmp_match() */
+    match_t *best;
+    int num_best;
+
+    /* For suggestion_complete(): the nodes within max_edits of str, NULL otherwise */
+    struct dp_reached *reached;
+    int num_reached;
+    int reached_size;
+
+    /* reach[len] is the fewest edits of any node on the path up to len characters */
+    int *reach;
+};
+
+/* The rows of the children of one node, found by character */
+struct dp_frame {
+    /* Offset of the first child's row, the rest follow in child order */
+    size_t base;
+
+    /* slot[c] is the index of the child for c, or -1 if it is over budget */
+    short slot[256];
+};
+
+/* Sets *off to the offset of count new rows on the row stack */
+static int dp_push_rows(struct dp_ctx *ctx, int count, size_t *off)
+{
+    size_t need = ctx->pool_used + (size_t)count * (ctx->len + 1);
+
+    if (need > ctx->pool_size) {
+        size_t size = ctx->pool_size * 2 > need ? ctx->pool_size * 2 : need;
+        int *pool = trie_mem_realloc(ctx->pool, size * sizeof(int));
+        if (pool == NULL)
+            return 1;
+        ctx->pool = pool;
+        ctx->pool_size = size;
+    }
+
+    *off = ctx->pool_used;
+    ctx->pool_used = need;
+
+    return 0;
+}
+
+/* Ranks a match like cmp_match(): more edits left first, then alphabetically */
+static int dp_cmp(int edits_a, char *str_a, int edits_b, char *str_b)
+{
+    if (edits_a != edits_b)
+        return edits_b - edits_a;
+
+    return strncmp(str_a, str_b, MAXLEN);
+}
+
+/* Offers the word on the current path, keeping the best n */
+static int dp_add(struct dp_ctx *ctx, size_t len, int edits_left)
+{
+    ctx->key[len] = '\0';
+
+    /* Full and no better than the worst match */
+    if (ctx->num_best == ctx->n
+        && dp_cmp(edits_left, ctx->key, ctx->best[ctx->n - 1].edits_left,
+                  ctx->best[ctx->n - 1].str) >= 0)
+        return 0;
+
+    char *str = trie_mem_alloc(len + 1);
+    if (str == NULL)
+        return 1;
+    memcpy(str, ctx->key, len + 1);
+
+    int i = ctx->num_best;
+    if (i == ctx->n)
+        trie_mem_free(ctx->best[--i].str);
+    else
+        ctx->num_best++;
+
+    for (; i > 0 && dp_cmp(edits_left, str, ctx->best[i - 1].edits_left,
+                           ctx->best[i - 1].str) < 0; i--)
+        ctx->best[i] = ctx->best[i - 1];
+
+    ctx->best[i].str = str;
+    ctx->best[i].edits_left = edits_left;
+
+    return 0;
+}
+
+/*
+    Notes that the walk reached node, len characters down, with cost edits
+    for all of str. The words below a node already reached with as few
+    edits higher up the path are not offered again.
+ */
+static int dp_reach(struct dp_ctx *ctx, struct trie *node, size_t len, int cost)
+{
+    int before = ctx->reach[len - 1];
+
+    ctx->reach[len] = cost < before ? cost : before;
+    if (cost > ctx->max_edits || cost >= before)
+        return 0;
+
+    if (ctx->num_reached == ctx->reached_size) {
+        struct dp_reached *reached = trie_mem_realloc(ctx->reached,
+            ctx->reached_size * 2 * sizeof(struct dp_reached));
+        if (reached == NULL)
+            return 1;
+        ctx->reached = reached;
+        ctx->reached_size *= 2;
+    }
+
+    ctx->reached[ctx->num_reached].node = node;
+    ctx->reached[ctx->num_reached].edits = cost;
+    ctx->num_reached++;
+
+    return 0;
+}
+
+/*
+    The fewest edits of any row below the node whose row is at row_off,
+    given the smallest entry low of the rows of the node and its siblings.
+    A row takes its entries from its parent's row, from itself plus one, or
+    from a row of its parent's siblings plus one (a swap), so none can be
+    smaller. With ctx->osa the swap comes from the row of the parent's
+    parent instead, and low is the smallest entry of the parent's row.
+ */
+static int dp_lowest(struct dp_ctx *ctx, size_t row_off, int low)
+{
+    int *row = ctx->pool + row_off;
+    int best = low + 1;
+
+    for (int i = 0; i <= ctx->len; i++) {
+        if (row[i] < best)
+            best = row[i];
+    }
+
+    return best;
+}
+
+/*
+    Fills the row of the child for c of a node whose own row is at
+    parent_off. Entry i is the fewest edits suggestions() needs to have read
+    i characters of the word and written the path to the child. up holds
+    the rows of the node and its siblings (NULL at the root) and pc is the
+    node's own character. grand is the row of the node's parent (NULL at
+    the root), where with ctx->osa a swap of pc and c takes one edit from.
+    Returns the smallest entry.
+ */
+static int dp_fill_row(struct dp_ctx *ctx, size_t parent_off, size_t row_off,
+                       char c, struct dp_frame *up, char pc, int *grand)
+{
+    int *parent = ctx->pool + parent_off;
+    int *row = ctx->pool + row_off;
+    unsigned char index = (unsigned char)c;
+    int best;
+
+    /*
+       try_swap() turns the path Q y into Q x y while reading x, so the
+       child (y after Q x) can also come from the sibling of the node for y
+     */
+    int *swap = NULL;
+    if (!ctx->osa && up != NULL && up->slot[index] >= 0)
+        swap = ctx->pool + up->base + (size_t)up->slot[index] * (ctx->len + 1);
+
+    /* A true swap only needs the path before the two characters */
+    if (!ctx->osa)
+        grand = NULL;
+
+    /* try_insert() */
+    row[0] = parent[0] + 1 < ctx->inf ? parent[0] + 1 : ctx->inf;
+    best = row[0];
+
+    for (int i = 1; i <= ctx->len; i++) {
+        int v = row[i - 1] + 1;                         /* try_delete() */
+
+        if (ctx->str[i - 1] == c) {
+            if (parent[i - 1] < v)                      /* move_on() */
+                v = parent[i - 1];
+        } else if (parent[i - 1] + 1 < v) {
+            v = parent[i - 1] + 1;                      /* try_replace() */
+        }
+
+        if (parent[i] + 1 < v)
+            v = parent[i] + 1;                          /* try_insert() */
+
+        if (swap != NULL && ctx->str[i - 1] == pc && swap[i - 1] + 1 < v)
+            v = swap[i - 1] + 1;                        /* try_swap() */
+
+        if (grand != NULL && i >= 2 && ctx->str[i - 1] == pc
+            && ctx->str[i - 2] == c && grand[i - 2] + 1 < v)
+            v = grand[i - 2] + 1;                       /* distance_osa()'s swap */
+
+        row[i] = v < ctx->inf ? v : ctx->inf;
+        if (row[i] < best)
+            best = row[i];
+    }
+
+    return best;
+}
+
+/*
+    Visits the children of node, whose row is at row_off and path len long.
+    The row of the node's parent is at grand_off, if len > 0.
+ */
+static int dp_visit(struct dp_ctx *ctx, struct trie *node, size_t row_off,
+                    size_t grand_off, size_t len, struct dp_frame *up, char pc)
+{
+    struct dp_frame frame;
+    struct trie *child;
+    int count = node->num_children;
+    int pos = 0;
+    int low = ctx->inf;
+
+    if (count == 0)
+        return 0;
+
+    if (dp_push_rows(ctx, count, &frame.base) != 0)
+        return 1;
+    memset(frame.slot, -1, sizeof(frame.slot));
+
+    /* Fill every child's row first, their children need them for swaps */
+    for (int i = 0; i < count; i++) {
+        child = trie_next_child(node, &pos);
+        size_t off = frame.base + (size_t)i * (ctx->len + 1);
+
+        int best = dp_fill_row(ctx, row_off, off, child->current, up, pc,
+                               len > 0 ? ctx->pool + grand_off : NULL);
+
+        /* Words are C strings here, so a NUL edge goes nowhere */
+        if (best <= ctx->max_edits && child->current != '\0')
+            frame.slot[(unsigned char)child->current] = i;
+        if (best < low)
+            low = best;
+    }
+
+    /* Below a child, a swap can also take its entries from the node's own row plus one */
+    if (ctx->osa) {
+        for (int i = 0; i <= ctx->len; i++) {
+            if (ctx->pool[row_off + i] < low)
+                low = ctx->pool[row_off + i];
+        }
+    }
+
+    if (len + 2 > ctx->key_size) {
+        char *key = trie_mem_realloc(ctx->key, ctx->key_size * 2);
+        if (key == NULL)
+            return 1;
+        ctx->key = key;
+
+        if (ctx->reach != NULL) {
+            int *reach = trie_mem_realloc(ctx->reach,
+                ctx->key_size * 2 * sizeof(int));
+            if (reach == NULL)
+                return 1;
+            ctx->reach = reach;
+        }
+        ctx->key_size *= 2;
+    }
+
+    pos = 0;
+    for (int i = 0; i < count; i++) {
+        child = trie_next_child(node, &pos);
+
+        /* Over budget everywhere, and so is everything below it */
+        if (frame.slot[(unsigned char)child->current] < 0)
+            continue;
+
+        size_t off = frame.base + (size_t)i * (ctx->len + 1);
+        int cost = ctx->pool[off + ctx->len];
+
+        ctx->key[len] = child->current;
+
+        if (ctx->reached != NULL) {
+            if (dp_reach(ctx, child, len + 1, cost) != 0)
+                return 1;
+
+            /* Nothing below can be reached with fewer edits */
+            if (dp_lowest(ctx, off, low) >= ctx->reach[len + 1])
+                continue;
+        } else if (child->is_word == 1 && cost <= ctx->max_edits
+                   && dp_add(ctx, len + 1, ctx->max_edits - cost) != 0) {
+            return 1;
+        }
+
+        if (dp_visit(ctx, child, off, row_off, len + 1, &frame, child->current) != 0)
+            return 1;
+    }
+
+    ctx->pool_used = frame.base;
+
+    return 0;
+}
+
+/*
+    Returns the same words as suggestion_list(), walking the trie only once.
+
+    Parameters:
+     - t: A trie. Must point to a trie allocated with trie_new
+     - str: A string. This will be the (misspelled) word to match
+     - max_edits: the maximum levenshtein distance the words in the set can have
+     - n: the number of strings to return. Must be at least 1
+
+    Returns:
+     - The first n strings with the smallest distance, where ties are broken by alphabetical order.
+       If there aren't enough matching strings, each remaining spot is set to NULL.
+     - NULL if there was an error
+ */
+char** suggestion_list_dp(struct trie *t, char *str, int max_edits, int n)
+{
+    assert(t != NULL);
+    assert(str != NULL);
+
+    struct dp_ctx ctx;
+    size_t root_off;
+    int i, rc = 1;
+    char **results;
+
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.str = str;
+    ctx.len = strlen(str);
+    ctx.max_edits = max_edits < 0 ? 0 : max_edits;
+    ctx.inf = ctx.max_edits + 1;
+    ctx.n = n;
+    ctx.key_size = MAXLEN + 1;
+    ctx.key = trie_mem_alloc(ctx.key_size);
+    ctx.best = trie_mem_calloc(n, sizeof(match_t));
+    results = trie_mem_calloc(n, sizeof(char*));
+
+    if (ctx.key == NULL || ctx.best == NULL || results == NULL
+        || dp_push_rows(&ctx, 1, &root_off) != 0)
+        goto done;
+
+    /* The empty path is reached by deleting everything read so far */
+    for (i = 0; i <= ctx.len; i++)
+        ctx.pool[root_off + i] = i < ctx.inf ? i : ctx.inf;
+
+    if (t->is_word == 1 && ctx.len <= ctx.max_edits
+        && dp_add(&ctx, 0, ctx.max_edits - ctx.len) != 0)
+        goto done;
+
+    rc = dp_visit(&ctx, t, root_off, 0, 0, NULL, '\0');
+
+done:
+    if (rc == 0) {
+        for (i = 0; i < ctx.num_best; i++)
+            results[i] = ctx.best[i].str;
+    } else {
+        for (i = 0; i < ctx.num_best; i++)
+            trie_mem_free(ctx.best[i].str);
+        trie_mem_free(results);
+        results = NULL;
+    }
+
+    trie_mem_free(ctx.best);
+    trie_mem_free(ctx.pool);
+    trie_mem_free(ctx.key);
+
+    return results;
+}
+
+/*
+    Offers the word on w, with e edits for the prefix, to the ranked list
+    of the best *num completions so far. Words come in with ever more
+    edits, so a word already on the list is there with no more. Returns
+    whether w is on the list after.
+ */
+static bool complete_offer(struct trie **out, int *edits, int *num, int n,
+                           struct trie *w, int e)
+{
+    for (int i = 0; i < *num; i++) {
+        if (out[i] == w)
+            return true;
+    }
+
+    int i = *num;
+    if (i == n) {
+        if (edits[n - 1] < e
+            || (edits[n - 1] == e && trie_rank_cmp(w, out[n - 1]) > 0))
+            return false;
+        i--;
+    } else {
+        (*num)++;
+    }
+
+    for (; i > 0 && edits[i - 1] == e && trie_rank_cmp(w, out[i - 1]) < 0; i--) {
+        out[i] = out[i - 1];
+        edits[i] = edits[i - 1];
+    }
+    out[i] = w;
+    edits[i] = e;
+
+    return true;
+}
+
+/*
+    Completes a prefix that may have typos in it: finds every node within
+    max_edits of the prefix with the walk of suggestion_list_dp(), and ranks
+    the words below them.
+
+    Parameters:
+     - t: A trie. Must point to a trie allocated with trie_new
+     - prefix: The (misspelled) prefix typed so far
+     - max_edits: the maximum levenshtein distance the prefix of a word can be from prefix
+     - n: the number of words wanted
+     - out: Array of at least n trie pointers for the nodes the words end on
+     - edits: Array of at least n ints for the edits the prefix of each word took
+
+    Returns:
+     - The number of words found, at most n, or -1 if there was an error
+
+    Details:
+     - Words are ranked by the fewest edits any prefix of theirs takes,
+       then like trie_topk(). A word below several nodes that match comes
+       out once.
+     - A swap of two adjacent characters is one edit wherever it is, even
+       where the trie has no path for the prefix as typed.
+     - The walk goes no deeper than the prefix plus max_edits characters,
+       and the words come from the lists trie_topk() keeps on every node
+ */
+int suggestion_complete(struct trie *t, char *prefix, int max_edits, int n,
+                        struct trie **out, int *edits)
+{
+    assert(t != NULL);
+    assert(prefix != NULL);
+
+    struct dp_ctx ctx;
+    size_t root_off;
+    int i, num = -1;
+    struct trie *list[TRIE_TOPK];
+    struct trie **found = list;
+
+    if (n <= 0)
+        return 0;
+
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.str = prefix;
+    ctx.len = strlen(prefix);
+    ctx.osa = true;
+    ctx.max_edits = max_edits < 0 ? 0 : max_edits;
+    ctx.inf = ctx.max_edits + 1;
+    ctx.key_size = MAXLEN + 1;
+    ctx.key = trie_mem_alloc(ctx.key_size);
+    ctx.reach = trie_mem_alloc(ctx.key_size * sizeof(int));
+    ctx.reached_size = 16;
+    ctx.reached = trie_mem_alloc(ctx.reached_size * sizeof(struct dp_reached));
+    if (n > TRIE_TOPK)
+        found = trie_mem_alloc(n * sizeof(struct trie *));
+
+    if (ctx.key == NULL || ctx.reach == NULL || ctx.reached == NULL
+        || found == NULL || dp_push_rows(&ctx, 1, &root_off) != 0)
+        goto done;
+
+    for (i = 0; i <= ctx.len; i++)
+        ctx.pool[root_off + i] = i < ctx.inf ? i : ctx.inf;
+
+    /* The whole trie completes a prefix that can be deleted outright */
+    ctx.reach[0] = ctx.inf;
+    if (ctx.len <= ctx.max_edits) {
+        ctx.reach[0] = ctx.len;
+        ctx.reached[0].node = t;
+        ctx.reached[0].edits = ctx.len;
+        ctx.num_reached = 1;
+    }
+
+    if (ctx.reach[0] > 0 && dp_visit(&ctx, t, root_off, 0, 0, NULL, '\0') != 0)
+        goto done;
+
+    /*
+       Fewest edits first, so a word met again below another node is
+       already on the list, and a node whose best word does not make it is
+       done with
+     */
+    num = 0;
+    for (int e = 0; e <= ctx.max_edits; e++) {
+        for (i = 0; i < ctx.num_reached; i++) {
+            if (ctx.reached[i].edits != e)
+                continue;
+
+            int got = trie_topk(ctx.reached[i].node, "", 0, n, found);
+            for (int j = 0; j < got; j++) {
+                if (!complete_offer(out, edits, &num, n, found[j], e))
+                    break;
+            }
+        }
+    }
+
+done:
+    if (found != list)
+        trie_mem_free(found);
+    trie_mem_free(ctx.reached);
+    trie_mem_free(ctx.reach);
+    trie_mem_free(ctx.pool);
+    trie_mem_free(ctx.key);
+
+    return num;
+}
+
+/*
+    The best-first engine: finds the same words as suggestion_list(), but
+    expands states in order of edits used, one bucket per edit count, and
+    stops once n words are known to be closer than anything left.
+ */
+
+/* A state waiting to be expanded, with the edits it took to get there */
+struct pending {
+    struct trie *cur;
+    struct trie *par;
+    char *suffix;
+
+    /* The prefix is len characters at offset prefix of the prefix pool */
+    size_t len;
+    size_t prefix;
+};
+
+/* One stack of pending states per number of edits used */
+struct bucket {
+    struct pending *states;
+    size_t used;
+    size_t size;
+};
+
+/* What stays the same for one call to suggestions_best_first() */
+struct best_first {
+    struct search *s;
+    int max_edits;
+    struct bucket *buckets;
+
+    /* The prefixes of the pending states, one after the other */
+    char *pool;
+    size_t pool_used;
+    size_t pool_size;
+};
+
+// The most edits left a state has been recorded with, or -1 if it has not been
+static int visited_edits(struct search *s, struct trie *cur, char *suffix)
+{
+    size_t mask = s->visited_size - 1;
+    size_t slot = hash_state(cur, suffix) & mask;
+
+    for (; s->visited[slot].edits_left >= 0; slot = (slot + 1) & mask) {
+        struct visited *v = &s->visited[slot];
+
+        if (v->node == cur && v->suffix == suffix) {
+            return v->edits_left;
+        }
+    }
+
+    return -1;
+}
+
+/*
+    Queues a state reached with edits edits used. The prefix is the first
+    len characters of the pool at offset prefix, followed by the count
+    characters of extra. States already queued with as few edits are left
+    out.
+ */
+static int bf_push(struct best_first *bf, int edits, struct trie *cur, struct trie *par,
+                   char *suffix, size_t len, size_t prefix, char *extra, size_t count)
+{
+    struct bucket *b = &bf->buckets[edits];
+    int edits_left = bf->max_edits - edits;
+    bool seen;
+
+    // Without edits left there is nothing to expand, only the rest of the suffix to
+    // follow, so those states are not worth remembering
+    if (edits_left > 0 && visit(bf->s, cur, suffix, edits_left, &seen) != EXIT_SUCCESS) {
+        return EXIT_FAILURE;
+    }
+
+    if (edits_left > 0 && seen) {
+        return EXIT_SUCCESS;
+    }
+
+    if (b->used == b->size) {
+        size_t size = b->size == 0 ? 64 : 2 * b->size;
+        struct pending *states = trie_mem_realloc(b->states, size * sizeof(struct pending));
+        if (states == NULL) {
+            return EXIT_FAILURE;
+        }
+        b->states = states;
+        b->size = size;
+    }
+
+    // A state that only reads past a character of the suffix keeps its prefix
+    if (count > 0) {
+        size_t need = bf->pool_used + len + count;
+
+        if (need > bf->pool_size) {
+            size_t size = 2 * bf->pool_size > need ? 2 * bf->pool_size : need;
+            char *pool = trie_mem_realloc(bf->pool, size);
+            if (pool == NULL) {
+                return EXIT_FAILURE;
+            }
+            bf->pool = pool;
+            bf->pool_size = size;
+        }
+
+        memcpy(bf->pool + bf->pool_used, bf->pool + prefix, len);
+        memcpy(bf->pool + bf->pool_used + len, extra, count);
+        prefix = bf->pool_used;
+        len += count;
+        bf->pool_used = need;
+    }
+
+    struct pending *p = &b->states[b->used++];
+    p->cur = cur;
+    p->par = par;
+    p->suffix = suffix;
+    p->len = len;
+    p->prefix = prefix;
+
+    return EXIT_SUCCESS;
+}
+
+/*
+    Expands a state taken off the bucket for edits edits used, queueing what
+    each edit leads to. Does the same as search() does for one state, without
+    going any deeper.
+ */
+static int bf_expand(struct best_first *bf, int edits, struct pending p)
+{
+    struct search *s = bf->s;
+    int edits_left = bf->max_edits - edits;
+    struct trie *next, *swapped;
+    char c[2];
+    int at = 0;
+
+    // A state queued again with fewer edits has been, or will be, expanded with those
+    if (edits_left > 0 && visited_edits(s, p.cur, p.suffix) > edits_left) {
+        return EXIT_SUCCESS;
+    }
+
+    if (p.suffix[0] == '\0' || edits_left <= 0) {
+        memcpy(s->buf, bf->pool + p.prefix, p.len);
+        if (try_rest(s, p.len, p.cur, p.suffix, edits_left) != EXIT_SUCCESS) {
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (edits_left <= 0) {
+        return EXIT_SUCCESS;
+    }
+
+    if (p.len >= MAXLEN - 1) {
+        // Ran out of space, like try_replace() and try_insert()
+        return EXIT_FAILURE;
+    }
+
+    if (p.suffix[0] != '\0') {
+
+        // Moving on costs nothing, so it goes on the bucket being emptied
+        next = trie_get_child(p.cur, p.suffix[0]);
+        if (next != NULL && bf_push(bf, edits, next, p.cur, p.suffix + 1, p.len, p.prefix,
+                                    p.suffix, 1) != EXIT_SUCCESS) {
+            return EXIT_FAILURE;
+        }
+
+        if (bf_push(bf, edits + 1, p.cur, p.par, p.suffix + 1, p.len, p.prefix,
+                    NULL, 0) != EXIT_SUCCESS) {
+            return EXIT_FAILURE;
+        }
+
+        while ((next = trie_next_child(p.cur, &at)) != NULL) {
+            if (next->current == '\0') {
+                continue;
+            }
+            c[0] = next->current;
+            if (bf_push(bf, edits + 1, next, p.cur, p.suffix + 1, p.len, p.prefix,
+                        c, 1) != EXIT_SUCCESS) {
+                return EXIT_FAILURE;
+            }
+        }
+
+        // Go back to before the last character, then take the two in swapped order
+        if (p.len > 0 && p.par != NULL
+            && (swapped = trie_get_child(p.par, p.suffix[0])) != NULL
+            && (next = trie_get_child(swapped, p.cur->current)) != NULL) {
+            c[0] = p.suffix[0];
+            c[1] = p.cur->current;
+            if (bf_push(bf, edits + 1, next, swapped, p.suffix + 1, p.len - 1, p.prefix,
+                        c, 2) != EXIT_SUCCESS) {
+                return EXIT_FAILURE;
+            }
+        }
+    }
+
+    at = 0;
+    while ((next = trie_next_child(p.cur, &at)) != NULL) {
+        if (next->current == '\0') {
+            continue;
+        }
+        c[0] = next->current;
+        if (bf_push(bf, edits + 1, next, p.cur, p.suffix, p.len, p.prefix,
+                    c, 1) != EXIT_SUCCESS) {
+            return EXIT_FAILURE;
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
+
+/*
+    Finds the same matches as suggestions() with an empty prefix, but expands
+    states in order of edits used and stops once the set is full: the words
+    with no edits come first, then the words one edit away, and so on.
+
+    Parameters:
+     - set: An array of match_t*'s, left as a heap like suggestions() leaves it
+     - t: A trie. Must point to a trie allocated with trie_new
+     - str: A string. This will be the (misspelled) word to match
+     - max_edits: the maximum levenshtein distance the words in the set can have
+     - n: The length of set (number of matches in the set)
+
+    Returns:
+     - 0 for success, or a positive integer n for the number of errors encountered
+ */
+int suggestions_best_first(match_t **set, struct trie *t, char *str, int max_edits, int n)
+{
+    assert(t != NULL);
+    assert(str != NULL);
+
+    struct search s;
+    struct best_first bf;
+    int rc = EXIT_SUCCESS;
+
+    if (max_edits < 0) {
+        max_edits = 0;
+    }
+
+    s.set = set;
+    s.t = t;
+    s.n = n;
+
+    s.visited_used = 0;
+    s.visited_size = 64;
+    s.visited = trie_mem_alloc(s.visited_size * sizeof(struct visited));
+    if (s.visited == NULL) {
+        return EXIT_FAILURE;
+    }
+    for (size_t i = 0; i < s.visited_size; i++) {
+        s.visited[i].edits_left = -1;
+    }
+
+    if (index_new(&s) != EXIT_SUCCESS) {
+        trie_mem_free(s.visited);
+        return EXIT_FAILURE;
+    }
+
+    bf.s = &s;
+    bf.max_edits = max_edits;
+    bf.buckets = trie_mem_calloc(max_edits + 1, sizeof(struct bucket));
+    bf.pool_used = 0;
+    bf.pool_size = 256;
+    bf.pool = trie_mem_alloc(bf.pool_size);
+
+    if (bf.buckets == NULL || bf.pool == NULL
+        || bf_push(&bf, 0, t, NULL, str, 0, 0, NULL, 0) != EXIT_SUCCESS) {
+        rc = EXIT_FAILURE;
+    }
+
+    /*
+        Every word found while emptying the bucket for edits used is that many
+        edits away and no closer, since the buckets before it are empty. Once
+        the set is full after a bucket, whatever is left can only rank below
+        all of it.
+     */
+    for (int edits = 0; rc == EXIT_SUCCESS && edits <= max_edits; edits++) {
+        struct bucket *b = &bf.buckets[edits];
+
+        while (rc == EXIT_SUCCESS && b->used > 0) {
+            rc = bf_expand(&bf, edits, b->states[--b->used]);
+        }
+
+        if (s.index.count == n) {
+            break;
+        }
+    }
+
+    if (bf.buckets != NULL) {
+        for (int i = 0; i <= max_edits; i++) {
+            trie_mem_free(bf.buckets[i].states);
+        }
+    }
+    trie_mem_free(bf.buckets);
+    trie_mem_free(bf.pool);
+    trie_mem_free(s.index.slots);
+    trie_mem_free(s.index.where);
+    trie_mem_free(s.visited);
+
+    return rc;
+}
+
+/*
+    Returns the same words as suggestion_list(), using suggestions_best_first()
+
+    Parameters:
+     - t: A trie. Must point to a trie allocated with trie_new
+     - str: A string. This will be the (misspelled) word to match
+     - max_edits: the maximum levenshtein distance the words in the set can have
+     - n: the number of strings to return. 
+
+    Returns:
+     - The first n strings with the smallest distance, where ties are broken by alphabetical order.
+       If there aren't enough matching strings, each remaining spot is set to NULL.
+     - NULL if there was an error
+ */
+char** suggestion_list_best_first(struct trie *t, char *str, int max_edits, int n)
+{
+    assert(t != NULL);
+    assert(str != NULL);
+
+    match_t **set = (match_t **)trie_mem_calloc(n, sizeof(match_t*));
+
+    if (set == NULL) {
+        return NULL;
+    }
+
+    if (suggestions_best_first(set, t, str, max_edits, n) != EXIT_SUCCESS) {
+
+        for (int i = 0; i < n; i++) {
+            if (set[i] != NULL) {
+                trie_mem_free(set[i]->str);
+                trie_mem_free(set[i]);
+            }
+        }
+
+        trie_mem_free(set);
+
+        return NULL;
+    }
+
+    return suggestion_set_first_n(set, n);
+}
+
+/*
+    A symmetric delete (SymSpell) index of the words of a trie, for
+    TRIE.APPROXMATCH ... ENGINE SYMSPELL. Every word is stored under each
+    string it turns into with up to max_distance characters deleted. Two
+    words are within k edits only if deleting at most k characters from
+    each gives the same string, so a query only looks up its own deletes
+    and checks the few words found there.
+ */
+
+/* Distance an index is built for when a query does not need more */
+#define SYMSPELL_DISTANCE 2
+
+/* One delete string and the words it comes from */
+struct symspell_entry {
+    /* The string, NULL if the table entry is empty */
+    char *variant;
+    unsigned int hash;
+
+    /* Ids of the words with this delete, each once */
+    int *ids;
+    int num_ids;
+    int ids_size;
+};
+
+struct symspell {
+    /* Most characters deleted from a word, and so most edits a lookup can use */
+    int max_distance;
+
+    /* Words by id, NULL for ids freed by symspell_remove() */
+    char **words;
+    int size;
+    int capacity;
+
+    /* Number of words in the index */
+    int num_words;
+
+    /* Ids freed by symspell_remove(), handed out again first */
+    int *free_ids;
+    int num_free;
+    int free_size;
+
+    /* Open addressing table of the delete strings */
+    struct symspell_entry *table;
+    size_t table_size;
+    size_t table_used;
+};
+
+/*
+    Scratch space of the lookups made on one thread. Keeping it out of the
+    index leaves lookups only reading the index, so searches on the worker
+    pool can share one without a lock.
+ */
+struct symspell_scratch {
+    /*
+       checked[id] == stamp once the running lookup has checked word id.
+       The stamp only grows, so marks left by a lookup in another index
+       never match.
+     */
+    unsigned int *checked;
+    size_t checked_size;
+    unsigned int stamp;
+
+    /* Rows for the distance kernel */
+    int *rows;
+    size_t rows_size;
+};
+
+static __thread struct symspell_scratch symspell_scratch;
+
+/* Early declaration, symspell_new() frees what it cannot finish */
+int symspell_free(struct symspell *ss);
+
+/* Size of the delete table at first, a power of two */
+#define SYMSPELL_TABLE_SIZE 1024
+
+/* What symspell_deletes() does with every delete of a word */
+typedef int (*symspell_visit_t)(struct symspell *ss, char *variant, size_t len,
+                                void *arg);
+
+/*
+    Creates and allocates memory for a new, empty index.
+
+    Parameters:
+     - max_distance: Most edits a lookup will be able to use
+
+    Returns:
+     - A pointer to the index, or NULL if it cannot be allocated
+ */
+struct symspell *symspell_new(int max_distance)
+{
+    struct symspell *ss = trie_mem_calloc(1, sizeof(struct symspell));
+
+    if (ss == NULL) {
+        return NULL;
+    }
+
+    ss->max_distance = max_distance < 0 ? 0 : max_distance;
+    ss->capacity = 16;
+    ss->words = trie_mem_calloc(ss->capacity, sizeof(char*));
+    ss->table_size = SYMSPELL_TABLE_SIZE;
+    ss->table = trie_mem_calloc(ss->table_size, sizeof(struct symspell_entry));
+
+    if (ss->words == NULL || ss->table == NULL) {
+        symspell_free(ss);
+        return NULL;
+    }
+
+    return ss;
+}
+
+/* FNV-1a over the len characters of str */
+static unsigned int symspell_hash(char *str, size_t len)
+{
+    unsigned int h = 2166136261u;
+
+    for (size_t i = 0; i < len; i++)
+        h = (h ^ (unsigned char)str[i]) * 16777619u;
+
+    return h;
+}
+
+/* Doubles the delete table, placing every entry again */
+static int symspell_grow_table(struct symspell *ss)
+{
+    size_t size = 2 * ss->table_size;
+    struct symspell_entry *table = trie_mem_calloc(size, sizeof(struct symspell_entry));
+
+    if (table == NULL) {
+        return EXIT_FAILURE;
+    }
+
+    for (size_t i = 0; i < ss->table_size; i++) {
+        if (ss->table[i].variant == NULL)
+            continue;
+
+        size_t h = ss->table[i].hash & (size - 1);
+        while (table[h].variant != NULL)
+            h = (h + 1) & (size - 1);
+        table[h] = ss->table[i];
+    }
+
+    trie_mem_free(ss->table);
+    ss->table = table;
+    ss->table_size = size;
+
+    return EXIT_SUCCESS;
+}
+
+/*
+    Finds the entry for the first len characters of variant. If there is
+    none, adds an empty one when create is set and returns NULL otherwise.
+ */
+static struct symspell_entry *symspell_entry(struct symspell *ss, char *variant,
+                                        size_t len, bool create)
+{
+    if (create && 2 * (ss->table_used + 1) > ss->table_size
+        && symspell_grow_table(ss) != EXIT_SUCCESS)
+        return NULL;
+
+    unsigned int hash = symspell_hash(variant, len);
+    size_t mask = ss->table_size - 1;
+    size_t h = hash & mask;
+
+    for (; ss->table[h].variant != NULL; h = (h + 1) & mask) {
+        struct symspell_entry *e = &ss->table[h];
+
+        if (e->hash == hash && strncmp(e->variant, variant, len) == 0
+            && e->variant[len] == '\0')
+            return e;
+    }
+
+    if (!create)
+        return NULL;
+
+    char *copy = trie_mem_alloc(len + 1);
+    if (copy == NULL) {
+        return NULL;
+    }
+    memcpy(copy, variant, len);
+    copy[len] = '\0';
+
+    ss->table[h].variant = copy;
+    ss->table[h].hash = hash;
+    ss->table_used++;
+
+    return &ss->table[h];
+}
+
+/*
+    Calls visit on word and on everything it turns into with up to left
+    more characters deleted, from position start on. Every set of
+    positions is deleted once, though different sets can give the same
+    string. scratch holds left strings of len characters.
+ */
+static int symspell_deletes(struct symspell *ss, char *word, size_t len,
+                            size_t start, int left, char *scratch,
+                            symspell_visit_t visit, void *arg)
+{
+    if (visit(ss, word, len, arg) != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+
+    if (left == 0 || len == 0)
+        return EXIT_SUCCESS;
+
+    for (size_t i = start; i < len; i++) {
+        memcpy(scratch, word, i);
+        memcpy(scratch + i, word + i + 1, len - i - 1);
+
+        if (symspell_deletes(ss, scratch, len - 1, i, left - 1, scratch + len,
+                             visit, arg) != EXIT_SUCCESS)
+            return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+/* Runs symspell_deletes() over word with up to left deletes */
+static int symspell_each_delete(struct symspell *ss, char *word, int left,
+                                symspell_visit_t visit, void *arg)
+{
+    size_t len = strlen(word);
+    char *scratch = trie_mem_alloc(left * len + 1);
+
+    if (scratch == NULL) {
+        return EXIT_FAILURE;
+    }
+
+    int rc = symspell_deletes(ss, word, len, 0, left, scratch, visit, arg);
+    trie_mem_free(scratch);
+
+    return rc;
+}
+
+/* Files word id under a delete, once */
+static int symspell_put_id(struct symspell *ss, char *variant, size_t len, void *arg)
+{
+    int id = *(int*)arg;
+    struct symspell_entry *e = symspell_entry(ss, variant, len, true);
+
+    if (e == NULL)
+        return EXIT_FAILURE;
+
+    /* The same delete made twice comes while the word is still last */
+    if (e->num_ids > 0 && e->ids[e->num_ids - 1] == id)
+        return EXIT_SUCCESS;
+
+    if (e->num_ids == e->ids_size) {
+        int size = e->ids_size == 0 ? 2 : 2 * e->ids_size;
+        int *ids = trie_mem_realloc(e->ids, size * sizeof(int));
+        if (ids == NULL) {
+            return EXIT_FAILURE;
+        }
+        e->ids = ids;
+        e->ids_size = size;
+    }
+
+    e->ids[e->num_ids++] = id;
+
+    return EXIT_SUCCESS;
+}
+
+/* Takes word id out from under a delete */
+static int symspell_drop_id(struct symspell *ss, char *variant, size_t len, void *arg)
+{
+    int id = *(int*)arg;
+    struct symspell_entry *e = symspell_entry(ss, variant, len, false);
+
+    if (e == NULL)
+        return EXIT_SUCCESS;
+
+    for (int i = 0; i < e->num_ids; i++) {
+        if (e->ids[i] == id) {
+            e->ids[i] = e->ids[--e->num_ids];
+            break;
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
+
+/* The id of word, or -1 if it is not in the index */
+static int symspell_find(struct symspell *ss, char *word)
+{
+    struct symspell_entry *e = symspell_entry(ss, word, strlen(word), false);
+
+    if (e == NULL)
+        return -1;
+
+    /* Longer words can have word as a delete too */
+    for (int i = 0; i < e->num_ids; i++) {
+        if (strcmp(ss->words[e->ids[i]], word) == 0)
+            return e->ids[i];
+    }
+
+    return -1;
+}
+
+/* Hands out an id for a new word, or -1 */
+static int symspell_new_id(struct symspell *ss)
+{
+    if (ss->num_free > 0)
+        return ss->free_ids[--ss->num_free];
+
+    if (ss->size == ss->capacity) {
+        int capacity = 2 * ss->capacity;
+        char **words = trie_mem_realloc(ss->words, capacity * sizeof(char*));
+        if (words == NULL) {
+            return -1;
+        }
+        ss->words = words;
+        ss->capacity = capacity;
+    }
+
+    return ss->size++;
+}
+
+/* Gives an id back, to be handed out again */
+static void symspell_free_id(struct symspell *ss, int id)
+{
+    trie_mem_free(ss->words[id]);
+    ss->words[id] = NULL;
+
+    if (ss->num_free == ss->free_size) {
+        int size = ss->free_size == 0 ? 16 : 2 * ss->free_size;
+        int *ids = trie_mem_realloc(ss->free_ids, size * sizeof(int));
+
+        /* Without room to remember it the id is simply never reused */
+        if (ids == NULL)
+            return;
+        ss->free_ids = ids;
+        ss->free_size = size;
+    }
+
+    ss->free_ids[ss->num_free++] = id;
+}
+
+/*
+    Adds a word to an index.
+
+    Parameters:
+     - ss: An index pointer
+     - word: The word
+
+    Returns:
+     - 0 on success (adding a word already in the index does nothing),
+       1 if an error occurs.
+ */
+int symspell_add(struct symspell *ss, char *word)
+{
+    assert(ss != NULL);
+    assert(word != NULL);
+
+    if (symspell_find(ss, word) >= 0)
+        return EXIT_SUCCESS;
+
+    int id = symspell_new_id(ss);
+    if (id < 0)
+        return EXIT_FAILURE;
+
+    ss->words[id] = trie_mem_alloc(strlen(word) + 1);
+    if (ss->words[id] == NULL) {
+        symspell_free_id(ss, id);
+        return EXIT_FAILURE;
+    }
+    strcpy(ss->words[id], word);
+
+    if (symspell_each_delete(ss, word, ss->max_distance, symspell_put_id,
+                             &id) != EXIT_SUCCESS) {
+        /* Take back the deletes it did get filed under */
+        symspell_each_delete(ss, word, ss->max_distance, symspell_drop_id, &id);
+        symspell_free_id(ss, id);
+        return EXIT_FAILURE;
+    }
+
+    ss->num_words++;
+
+    return EXIT_SUCCESS;
+}
+
+/*
+    Takes a word out of an index.
+
+    Parameters:
+     - ss: An index pointer
+     - word: The word
+
+    Returns:
+     - 0 on success, 1 if the word is not in the index.
+ */
+int symspell_remove(struct symspell *ss, char *word)
+{
+    assert(ss != NULL);
+    assert(word != NULL);
+
+    int id = symspell_find(ss, word);
+
+    if (id < 0)
+        return EXIT_FAILURE;
+
+    if (symspell_each_delete(ss, word, ss->max_distance, symspell_drop_id,
+                             &id) != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+
+    symspell_free_id(ss, id);
+    ss->num_words--;
+
+    return EXIT_SUCCESS;
+}
+
+/*
+    Builds an index of every word in a trie.
+
+    Parameters:
+     - t: A trie pointer
+     - max_distance: Most edits a lookup will be able to use
+
+    Returns:
+     - A pointer to the index, or NULL if it cannot be allocated
+ */
+struct symspell *symspell_build(struct trie *t, int max_distance)
+{
+    assert(t != NULL);
+
+    struct symspell *ss = symspell_new(max_distance);
+    struct trie_iter *it = trie_iter_new(t, "", 0, NULL, 0);
+    char *word;
+    size_t len;
+
+    if (ss == NULL || it == NULL) {
+        if (ss != NULL)
+            symspell_free(ss);
+        if (it != NULL)
+            trie_iter_free(it);
+        return NULL;
+    }
+
+    while ((word = trie_iter_next(it, &len)) != NULL) {
+        /* The index takes NUL terminated words, so it leaves these out */
+        if (memchr(word, '\0', len) != NULL)
+            continue;
+        if (symspell_add(ss, word) != EXIT_SUCCESS) {
+            trie_iter_free(it);
+            symspell_free(ss);
+            return NULL;
+        }
+    }
+
+    trie_iter_free(it);
+
+    return ss;
+}
+
+/*
+    Frees an index.
+
+    Parameters:
+     - ss: An index pointer
+
+    Returns:
+     - Always returns 0
+ */
+int symspell_free(struct symspell *ss)
+{
+    assert(ss != NULL);
+
+    if (ss->words != NULL) {
+        for (int i = 0; i < ss->size; i++)
+            trie_mem_free(ss->words[i]);
+    }
+
+    if (ss->table != NULL) {
+        for (size_t i = 0; i < ss->table_size; i++) {
+            trie_mem_free(ss->table[i].variant);
+            trie_mem_free(ss->table[i].ids);
+        }
+    }
+
+    trie_mem_free(ss->words);
+    trie_mem_free(ss->free_ids);
+    trie_mem_free(ss->table);
+    trie_mem_free(ss);
+
+    return EXIT_SUCCESS;
+}
+
+/*
+    The distance kernel behind symspell_distance(), and the one both indexes
+    check their candidates with. rows holds three rows of blen + 1 ints.
+ */
+static int distance_osa(char *a, size_t alen, char *b, size_t blen, int max,
+                        int *rows)
+{
+    if ((alen > blen ? alen - blen : blen - alen) > (size_t)max)
+        return max + 1;
+
+    int *before = rows, *prev = rows + blen + 1, *cur = rows + 2 * (blen + 1);
+
+    for (size_t j = 0; j <= blen; j++)
+        prev[j] = j;
+
+    for (size_t i = 1; i <= alen; i++) {
+        int best = cur[0] = i;
+
+        for (size_t j = 1; j <= blen; j++) {
+            int v = prev[j - 1] + (a[i - 1] != b[j - 1]);
+
+            v = v < prev[j] + 1 ? v : prev[j] + 1;
+            v = v < cur[j - 1] + 1 ? v : cur[j - 1] + 1;
+
+            if (i > 1 && j > 1 && a[i - 1] == b[j - 2] && a[i - 2] == b[j - 1])
+                v = v < before[j - 2] + 1 ? v : before[j - 2] + 1;
+
+            cur[j] = v;
+            best = best < v ? best : v;
+        }
+
+        /* Nothing in a later row can be smaller than the best of this one */
+        if (best > max)
+            return max + 1;
+
+        int *spare = before;
+        before = prev;
+        prev = cur;
+        cur = spare;
+    }
+
+    return prev[blen] < max + 1 ? prev[blen] : max + 1;
+}
+
+/* Longest pattern distance_myers() takes, one bit per character */
+#define DISTANCE_MAX_PATTERN 64
+
+/* Batches in SIMD registers where the compiler can target them per function */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define DISTANCE_SIMD
+#endif
+
+/*
+    A string set up for distance_myers(): peq[c] has bit i set where
+    character i of the string is c
+ */
+struct distance_pattern {
+    uint64_t peq[256];
+    size_t len;
+};
+
+/*
+    Sets up a string to be compared against many words.
+
+    Parameters:
+     - p: Where to put the pattern
+     - str, len: The string and its length, at most DISTANCE_MAX_PATTERN
+
+    Returns:
+     - 0 on success, 1 if the string is too long
+ */
+int distance_pattern(struct distance_pattern *p, char *str, size_t len)
+{
+    if (len > DISTANCE_MAX_PATTERN)
+        return EXIT_FAILURE;
+
+    memset(p->peq, 0, sizeof(p->peq));
+    for (size_t i = 0; i < len; i++)
+        p->peq[(unsigned char)str[i]] |= (uint64_t)1 << i;
+    p->len = len;
+
+    return EXIT_SUCCESS;
+}
+
+/*
+   How the bits work, for a pattern of m characters against a word: column
+   j of the distance table (one entry per character of the pattern) is kept
+   as the differences between neighbouring entries, vp where an entry is one
+   more than the one above it and vn where it is one less. d0 marks the
+   entries reached for free from the column before, by a match, or by a
+   swap (tr) where the pattern has ab and the word ba. hp and hn are the
+   same differences along the row, and bit m - 1 of them moves the bottom
+   entry, the distance so far, up or down by one.
+ */
+
+/* Longest pattern distance_myers() takes, one bit per character */
+int distance_myers(struct distance_pattern *p, char *word, size_t len, int max)
+{
+    size_t m = p->len;
+
+    if ((m > len ? m - len : len - m) > (size_t)max)
+        return max + 1;
+
+    if (m == 0)
+        return len;
+
+    uint64_t top = (uint64_t)1 << (m - 1);
+    uint64_t vp = ~(uint64_t)0, vn = 0, d0 = 0, pm_prev = 0;
+    int score = m;
+
+    for (size_t j = 0; j < len; j++) {
+        uint64_t pm = p->peq[(unsigned char)word[j]];
+        uint64_t tr = ((~d0 & pm) << 1) & pm_prev;
+
+        d0 = (((pm & vp) + vp) ^ vp) | pm | vn | tr;
+
+        uint64_t hp = vn | ~(d0 | vp);
+        uint64_t hn = d0 & vp;
+
+        score += (hp & top) != 0;
+        score -= (hn & top) != 0;
+
+        /* The distance can only come down one per character left */
+        if (score - (int)(len - j - 1) > max)
+            return max + 1;
+
+        /* The top row is j + 1, one more than the row before */
+        uint64_t x = (hp << 1) | 1;
+        vn = x & d0;
+        vp = (hn << 1) | ~(x | d0);
+        pm_prev = pm;
+    }
+
+    return score < max + 1 ? score : max + 1;
+}
+
+#ifdef DISTANCE_SIMD
+
+/* The bits of character j of each word, or none past the end of one */
+#define DISTANCE_PEQ(k) \
+    (j < lens[k] ? (long long)p->peq[(unsigned char)words[k][j]] : 0)
+
+/* All ones while j is within word k, so only those move the distance */
+#define DISTANCE_ACTIVE(k) (j < lens[k] ? -1LL : 0)
+
+/* distance_myers() on four words at once, one in each 64 bit lane */
+__attribute__((target("avx2")))
+static void distance_four(struct distance_pattern *p, char **words, size_t *lens,
+                          int max, int *out)
+{
+    size_t longest = 0;
+    for (int k = 0; k < 4; k++)
+        longest = lens[k] > longest ? lens[k] : longest;
+    __m256i ones = _mm256_set1_epi64x(-1), zero = _mm256_setzero_si256();
+    __m256i one = _mm256_set1_epi64x(1);
+    __m256i top = _mm256_set1_epi64x((long long)((uint64_t)1 << (p->len - 1)));
+    __m256i vp = ones, vn = zero, d0 = zero, pm_prev = zero;
+    __m256i score = _mm256_set1_epi64x(p->len);
+
+    for (size_t j = 0; j < longest; j++) {
+        __m256i pm = _mm256_set_epi64x(DISTANCE_PEQ(3), DISTANCE_PEQ(2),
+                                       DISTANCE_PEQ(1), DISTANCE_PEQ(0));
+        __m256i active = _mm256_set_epi64x(DISTANCE_ACTIVE(3), DISTANCE_ACTIVE(2),
+                                           DISTANCE_ACTIVE(1), DISTANCE_ACTIVE(0));
+        __m256i tr = _mm256_and_si256(_mm256_slli_epi64(_mm256_andnot_si256(d0, pm), 1),
+                                      pm_prev);
+
+        d0 = _mm256_xor_si256(_mm256_add_epi64(_mm256_and_si256(pm, vp), vp), vp);
+        d0 = _mm256_or_si256(_mm256_or_si256(d0, pm), _mm256_or_si256(vn, tr));
+
+        __m256i hp = _mm256_or_si256(vn, _mm256_xor_si256(_mm256_or_si256(d0, vp), ones));
+        __m256i hn = _mm256_and_si256(d0, vp);
+
+        /* All ones where the bottom bit is set, so subtracting adds one */
+        __m256i up = _mm256_andnot_si256(
+            _mm256_cmpeq_epi64(_mm256_and_si256(hp, top), zero), active);
+        __m256i down = _mm256_andnot_si256(
+            _mm256_cmpeq_epi64(_mm256_and_si256(hn, top), zero), active);
+        score = _mm256_add_epi64(_mm256_sub_epi64(score, up), down);
+
+        __m256i x = _mm256_or_si256(_mm256_slli_epi64(hp, 1), one);
+        vn = _mm256_and_si256(x, d0);
+        vp = _mm256_or_si256(_mm256_slli_epi64(hn, 1),
+                             _mm256_xor_si256(_mm256_or_si256(x, d0), ones));
+        pm_prev = pm;
+    }
+
+    long long scores[4];
+    _mm256_storeu_si256((__m256i*)scores, score);
+    for (int k = 0; k < 4; k++)
+        out[k] = scores[k] < max + 1 ? scores[k] : max + 1;
+}
+
+/* distance_myers() on two words at once, one in each 64 bit lane */
+__attribute__((target("sse4.1")))
+static void distance_two(struct distance_pattern *p, char **words, size_t *lens,
+                         int max, int *out)
+{
+    size_t longest = lens[0] > lens[1] ? lens[0] : lens[1];
+    __m128i ones = _mm_set1_epi64x(-1), zero = _mm_setzero_si128();
+    __m128i one = _mm_set1_epi64x(1);
+    __m128i top = _mm_set1_epi64x((long long)((uint64_t)1 << (p->len - 1)));
+    __m128i vp = ones, vn = zero, d0 = zero, pm_prev = zero;
+    __m128i score = _mm_set1_epi64x(p->len);
+
+    for (size_t j = 0; j < longest; j++) {
+        __m128i pm = _mm_set_epi64x(DISTANCE_PEQ(1), DISTANCE_PEQ(0));
+        __m128i active = _mm_set_epi64x(DISTANCE_ACTIVE(1), DISTANCE_ACTIVE(0));
+        __m128i tr = _mm_and_si128(_mm_slli_epi64(_mm_andnot_si128(d0, pm), 1), pm_prev);
+
+        d0 = _mm_xor_si128(_mm_add_epi64(_mm_and_si128(pm, vp), vp), vp);
+        d0 = _mm_or_si128(_mm_or_si128(d0, pm), _mm_or_si128(vn, tr));
+
+        __m128i hp = _mm_or_si128(vn, _mm_xor_si128(_mm_or_si128(d0, vp), ones));
+        __m128i hn = _mm_and_si128(d0, vp);
+
+        __m128i up = _mm_andnot_si128(_mm_cmpeq_epi64(_mm_and_si128(hp, top), zero),
+                                      active);
+        __m128i down = _mm_andnot_si128(_mm_cmpeq_epi64(_mm_and_si128(hn, top), zero),
+                                        active);
+        score = _mm_add_epi64(_mm_sub_epi64(score, up), down);
+
+        __m128i x = _mm_or_si128(_mm_slli_epi64(hp, 1), one);
+        vn = _mm_and_si128(x, d0);
+        vp = _mm_or_si128(_mm_slli_epi64(hn, 1), _mm_xor_si128(_mm_or_si128(x, d0), ones));
+        pm_prev = pm;
+    }
+
+    long long scores[2];
+    _mm_storeu_si128((__m128i*)scores, score);
+    for (int k = 0; k < 2; k++)
+        out[k] = scores[k] < max + 1 ? scores[k] : max + 1;
+}
+
+#endif
+
+/*
+    Runs distance_myers() on several words at once.
+
+    Parameters:
+     - p: A pattern set up by distance_pattern()
+     - words, lens: The words and their lengths
+     - count: Number of words
+     - max: Edits to give up after
+     - out: Where to put the distances, each max + 1 if over max
+
+    Details:
+     - Uses AVX2 (four words at a time) or SSE4.1 (two) when the CPU has
+       them, and distance_myers() on one word at a time otherwise
+ */
+void distance_many(struct distance_pattern *p, char **words, size_t *lens, int count,
+                   int max, int *out)
+{
+    int i = 0;
+
+#ifdef DISTANCE_SIMD
+    /* An empty pattern has no bottom bit, and needs no table anyway */
+    if (p->len > 0 && __builtin_cpu_supports("avx2")) {
+        for (; i + 4 <= count; i += 4)
+            distance_four(p, words + i, lens + i, max, out + i);
+    } else if (p->len > 0 && __builtin_cpu_supports("sse4.1")) {
+        for (; i + 2 <= count; i += 2)
+            distance_two(p, words + i, lens + i, max, out + i);
+    }
+#endif
+
+    for (; i < count; i++)
+        out[i] = distance_myers(p, words[i], lens[i], max);
+}
+
+/*
+    Counts the edits between two strings: deleting, inserting or replacing
+    a character, or swapping two adjacent ones. A swapped pair is not
+    edited again (optimal string alignment).
+
+    Parameters:
+     - a, b: The strings
+     - max: Edits to give up after
+
+    Returns:
+     - The number of edits, or max + 1 if there are more than max
+ */
+int symspell_distance(char *a, char *b, int max)
+{
+    size_t blen = strlen(b);
+    int *rows = trie_mem_alloc(3 * (blen + 1) * sizeof(int));
+
+    if (rows == NULL) {
+        return max + 1;
+    }
+
+    int d = distance_osa(a, strlen(a), b, blen, max, rows);
+    trie_mem_free(rows);
+
+    return d;
+}
+
+/* What stays the same for one call to symspell_lookup() */
+typedef struct {
+    char *str;
+    size_t len;
+    int max_edits;
+    int (*found)(void *arg, char *word, int distance);
+    void *arg;
+
+    /* str set up for distance_myers(), if it fits */
+    struct distance_pattern pattern;
+    bool bits;
+
+    struct symspell_scratch *scratch;
+} symspell_query_t;
+
+/* Checks the words filed under one delete of the query */
+static int symspell_check(struct symspell *ss, char *variant, size_t len, void *arg)
+{
+    symspell_query_t *q = arg;
+    struct symspell_scratch *sc = q->scratch;
+    struct symspell_entry *e = symspell_entry(ss, variant, len, false);
+
+    if (e == NULL)
+        return EXIT_SUCCESS;
+
+    for (int i = 0; i < e->num_ids; i++) {
+        int id = e->ids[i];
+
+        if (sc->checked[id] == sc->stamp)
+            continue;
+        sc->checked[id] = sc->stamp;
+
+        char *word = ss->words[id];
+        size_t wlen = strlen(word);
+        int d = q->bits ? distance_myers(&q->pattern, word, wlen, q->max_edits)
+                        : distance_osa(q->str, q->len, word, wlen, q->max_edits, sc->rows);
+
+        if (d <= q->max_edits && q->found(q->arg, word, d) != 0)
+            return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+/*
+    Finds the words of an index within max_edits of str.
+
+    Parameters:
+     - ss: An index pointer
+     - str: The (misspelled) word
+     - max_edits: Most edits a word can be away. No more than the index's
+       max_distance.
+     - found: Called once for every word found with its distance, the
+       word only valid during the call. A nonzero return stops the lookup.
+     - arg: Passed on to found
+
+    Returns:
+     - 0 on success, 1 if max_edits is over max_distance, an error occurs
+       or found stopped the lookup.
+ */
+int symspell_lookup(struct symspell *ss, char *str, int max_edits,
+                    int (*found)(void *arg, char *word, int distance), void *arg)
+{
+    assert(ss != NULL);
+    assert(str != NULL);
+
+    if (max_edits < 0)
+        max_edits = 0;
+
+    if (max_edits > ss->max_distance) {
+        return EXIT_FAILURE;
+    }
+
+    struct symspell_scratch *sc = &symspell_scratch;
+    symspell_query_t q = { .str = str, .len = strlen(str), .max_edits = max_edits,
+                           .found = found, .arg = arg, .scratch = sc };
+
+    q.bits = distance_pattern(&q.pattern, str, q.len) == EXIT_SUCCESS;
+
+    /* Rows for words up to max_edits longer than str */
+    size_t need = 3 * (q.len + max_edits + 1);
+    if (!q.bits && need > sc->rows_size) {
+        int *rows = trie_mem_realloc(sc->rows, need * sizeof(int));
+        if (rows == NULL) {
+            return EXIT_FAILURE;
+        }
+        sc->rows = rows;
+        sc->rows_size = need;
+    }
+
+    /* A mark for every id the index has handed out */
+    if ((size_t)ss->capacity > sc->checked_size) {
+        unsigned int *checked = trie_mem_realloc(sc->checked,
+            ss->capacity * sizeof(unsigned int));
+        if (checked == NULL) {
+            return EXIT_FAILURE;
+        }
+        memset(checked + sc->checked_size, 0,
+               (ss->capacity - sc->checked_size) * sizeof(unsigned int));
+        sc->checked = checked;
+        sc->checked_size = ss->capacity;
+    }
+
+    if (++sc->stamp == 0) {
+        memset(sc->checked, 0, sc->checked_size * sizeof(unsigned int));
+        sc->stamp = 1;
+    }
+
+    return symspell_each_delete(ss, str, max_edits, symspell_check, &q);
+}
+
+/*
+    A q-gram index of the words of a trie, for TRIE.APPROXMATCH with
+    SUGGEST_QGRAM_EDITS or more edits. Every word is cut into its
+    overlapping runs of q characters, padded at both ends, and each run
+    (q-gram) has a posting list of the words it appears in. One edit only
+    breaks the q-grams around it, so counting the q-grams a word shares
+    with the query leaves a few candidates to check with distance_many().
+ */
+
+/* Length of the q-grams when none is given, and the longest allowed */
+#define QGRAM_Q 2
+#define QGRAM_MAX_Q 3
+
+/* The posting list of one q-gram */
+struct qgram_list {
+    /* The q-gram, its characters as digits in base 257, or -1 if empty */
+    int gram;
+
+    /*
+     * Ids of the words with the q-gram, in increasing order and once per
+     * time the q-gram appears in the word. Each is stored as a varint of
+     * its difference from the id before it.
+     */
+    unsigned char *data;
+    size_t len;
+    size_t size;
+
+    /* The last id in the list */
+    int last;
+};
+
+/* The ids of the words of one length */
+struct qgram_bucket {
+    int *ids;
+    int count;
+    int size;
+};
+
+struct qgram {
+    /* Length of the q-grams */
+    int q;
+
+    /* Words and their lengths by id, NULL for removed words */
+    char **words;
+    size_t *lengths;
+    int size;
+    int capacity;
+
+    /* Number of words in the index */
+    int num_words;
+
+    /* Open addressing table of word ids + 1, to find a word by string */
+    int *ids;
+    size_t ids_size;
+
+    /* Open addressing table of the posting lists */
+    struct qgram_list *lists;
+    size_t lists_size;
+    size_t lists_used;
+
+    /* Ids of the words by length */
+    struct qgram_bucket *by_length;
+    size_t num_lengths;
+
+    /* Removed words still in the posting lists, until they are rebuilt */
+    int num_stale;
+};
+
+/* Scratch space of the lookups made on one thread, as for symspell_scratch */
+struct qgram_scratch {
+    /*
+       Shared q-grams by id during a lookup, and the ids with any. A lookup
+       puts every count it touched back to 0.
+     */
+    int *counts;
+    int *touched;
+    size_t size;
+
+    /* Rows for the distance kernel, for queries too long for distance_many() */
+    int *rows;
+    size_t rows_size;
+
+    /* Words the last lookup checked with the distance kernel */
+    int checked;
+};
+
+static __thread struct qgram_scratch qgram_scratch;
+
+/* Early declaration, qgram_new() frees what it cannot finish */
+int qgram_free(struct qgram *qg);
+
+/* Size of the tables at first, powers of two */
+#define QGRAM_TABLE_SIZE 1024
+
+/* The character standing for the padding before and after a word */
+#define QGRAM_PAD 256
+
+/* Candidates checked together by distance_many() */
+#define QGRAM_BATCH 64
+
+/* Removed words the posting lists can hold before they are rebuilt */
+#define QGRAM_MIN_STALE 64
+
+/*
+    Creates and allocates memory for a new, empty index.
+
+    Parameters:
+     - q: Length of the q-grams, from 1 to QGRAM_MAX_Q
+
+    Returns:
+     - A pointer to the index, or NULL if it cannot be allocated
+ */
+struct qgram *qgram_new(int q)
+{
+    struct qgram *qg = trie_mem_calloc(1, sizeof(struct qgram));
+
+    if (qg == NULL) {
+        return NULL;
+    }
+
+    qg->q = q < 1 ? 1 : (q < QGRAM_MAX_Q ? q : QGRAM_MAX_Q);
+    qg->capacity = 16;
+    qg->words = trie_mem_calloc(qg->capacity, sizeof(char*));
+    qg->lengths = trie_mem_calloc(qg->capacity, sizeof(size_t));
+    qg->ids_size = QGRAM_TABLE_SIZE;
+    qg->ids = trie_mem_calloc(qg->ids_size, sizeof(int));
+    qg->lists_size = QGRAM_TABLE_SIZE;
+    qg->lists = trie_mem_calloc(qg->lists_size, sizeof(struct qgram_list));
+
+    if (qg->words == NULL || qg->lengths == NULL || qg->ids == NULL
+        || qg->lists == NULL) {
+        qgram_free(qg);
+        return NULL;
+    }
+
+    for (size_t i = 0; i < qg->lists_size; i++)
+        qg->lists[i].gram = -1;
+
+    return qg;
+}
+
+/* FNV-1a over str */
+static unsigned int qgram_hash_str(char *str)
+{
+    unsigned int h = 2166136261u;
+
+    for (; *str != '\0'; str++)
+        h = (h ^ (unsigned char)*str) * 16777619u;
+
+    return h;
+}
+
+/* Spreads the bits of a q-gram code over the table */
+static unsigned int qgram_hash_gram(int gram)
+{
+    return (unsigned int)gram * 2654435761u;
+}
+
+/* Number of q-grams in a word of len characters */
+static size_t qgram_count(struct qgram *qg, size_t len)
+{
+    return len + qg->q - 1;
+}
+
+/*
+   Writes the codes of the q-grams of word into grams, in order. Each
+   character is a digit in base 257, with QGRAM_PAD for the q - 1
+   characters of padding at either end.
+ */
+static void qgram_codes(struct qgram *qg, char *word, size_t len, int *grams)
+{
+    size_t count = qgram_count(qg, len);
+
+    for (size_t i = 0; i < count; i++) {
+        int code = 0;
+
+        for (int j = 0; j < qg->q; j++) {
+            /* Position in the padded word, where the word starts at q - 1 */
+            size_t at = i + j;
+            int c = QGRAM_PAD;
+
+            if (at >= (size_t)(qg->q - 1) && at - (qg->q - 1) < len)
+                c = (unsigned char)word[at - (qg->q - 1)];
+
+            code = code * (QGRAM_PAD + 1) + c;
+        }
+
+        grams[i] = code;
+    }
+}
+
+/* Doubles the posting list table, placing every entry again */
+static int qgram_grow_lists(struct qgram *qg)
+{
+    size_t size = 2 * qg->lists_size;
+    struct qgram_list *lists = trie_mem_calloc(size, sizeof(struct qgram_list));
+
+    if (lists == NULL) {
+        return EXIT_FAILURE;
+    }
+
+    for (size_t i = 0; i < size; i++)
+        lists[i].gram = -1;
+
+    for (size_t i = 0; i < qg->lists_size; i++) {
+        if (qg->lists[i].gram < 0)
+            continue;
+
+        size_t h = qgram_hash_gram(qg->lists[i].gram) & (size - 1);
+        while (lists[h].gram >= 0)
+            h = (h + 1) & (size - 1);
+        lists[h] = qg->lists[i];
+    }
+
+    trie_mem_free(qg->lists);
+    qg->lists = lists;
+    qg->lists_size = size;
+
+    return EXIT_SUCCESS;
+}
+
+/*
+   Finds the posting list of a q-gram. If there is none, adds an empty
+   one when create is set and returns NULL otherwise.
+ */
+static struct qgram_list *qgram_list(struct qgram *qg, int gram, bool create)
+{
+    if (create && 2 * (qg->lists_used + 1) > qg->lists_size
+        && qgram_grow_lists(qg) != EXIT_SUCCESS)
+        return NULL;
+
+    size_t mask = qg->lists_size - 1;
+    size_t h = qgram_hash_gram(gram) & mask;
+
+    for (; qg->lists[h].gram >= 0; h = (h + 1) & mask) {
+        if (qg->lists[h].gram == gram)
+            return &qg->lists[h];
+    }
+
+    if (!create)
+        return NULL;
+
+    qg->lists[h].gram = gram;
+    qg->lists_used++;
+
+    return &qg->lists[h];
+}
+
+/* Adds id to the end of a posting list, as a varint of the gap */
+static int qgram_append(struct qgram_list *l, int id)
+{
+    unsigned int gap = id - l->last;
+
+    /* A varint of an int takes at most 5 bytes */
+    if (l->len + 5 > l->size) {
+        size_t size = l->size == 0 ? 8 : 2 * l->size;
+        unsigned char *data = trie_mem_realloc(l->data, size);
+        if (data == NULL) {
+            return EXIT_FAILURE;
+        }
+        l->data = data;
+        l->size = size;
+    }
+
+    while (gap >= 0x80) {
+        l->data[l->len++] = (gap & 0x7f) | 0x80;
+        gap >>= 7;
+    }
+    l->data[l->len++] = gap;
+    l->last = id;
+
+    return EXIT_SUCCESS;
+}
+
+/* Reads the varint at *pos and moves past it */
+static unsigned int qgram_varint(unsigned char *data, size_t *pos)
+{
+    unsigned int v = 0;
+    int shift = 0;
+
+    while (data[*pos] & 0x80) {
+        v |= (unsigned int)(data[(*pos)++] & 0x7f) << shift;
+        shift += 7;
+    }
+
+    return v | (unsigned int)data[(*pos)++] << shift;
+}
+
+/* The slot of word in the id table, or of the empty slot it would go in */
+static size_t qgram_slot(struct qgram *qg, char *word)
+{
+    size_t mask = qg->ids_size - 1;
+    size_t h = qgram_hash_str(word) & mask;
+
+    for (; qg->ids[h] != 0; h = (h + 1) & mask) {
+        if (strcmp(qg->words[qg->ids[h] - 1], word) == 0)
+            break;
+    }
+
+    return h;
+}
+
+/* Doubles the id table, placing every entry again */
+static int qgram_grow_ids(struct qgram *qg)
+{
+    int *old = qg->ids;
+    size_t old_size = qg->ids_size;
+
+    qg->ids = trie_mem_calloc(2 * old_size, sizeof(int));
+    if (qg->ids == NULL) {
+        qg->ids = old;
+        return EXIT_FAILURE;
+    }
+    qg->ids_size = 2 * old_size;
+
+    for (size_t i = 0; i < old_size; i++) {
+        if (old[i] != 0)
+            qg->ids[qgram_slot(qg, qg->words[old[i] - 1])] = old[i];
+    }
+
+    trie_mem_free(old);
+
+    return EXIT_SUCCESS;
+}
+
+/* Empties a slot of the id table, moving later entries of its run back */
+static void qgram_drop_slot(struct qgram *qg, size_t hole)
+{
+    size_t mask = qg->ids_size - 1;
+
+    qg->ids[hole] = 0;
+
+    for (size_t i = (hole + 1) & mask; qg->ids[i] != 0; i = (i + 1) & mask) {
+        size_t home = qgram_hash_str(qg->words[qg->ids[i] - 1]) & mask;
+
+        /* The entry can fill the hole if its home is not in (hole, i] */
+        if (((i - home) & mask) >= ((i - hole) & mask)) {
+            qg->ids[hole] = qg->ids[i];
+            qg->ids[i] = 0;
+            hole = i;
+        }
+    }
+}
+
+/* Makes room for one more id in the per id arrays */
+static int qgram_grow_words(struct qgram *qg)
+{
+    int capacity = 2 * qg->capacity;
+
+    char **words = trie_mem_realloc(qg->words, capacity * sizeof(char*));
+    if (words == NULL)
+        return EXIT_FAILURE;
+    qg->words = words;
+
+    size_t *lengths = trie_mem_realloc(qg->lengths, capacity * sizeof(size_t));
+    if (lengths == NULL)
+        return EXIT_FAILURE;
+    qg->lengths = lengths;
+    qg->capacity = capacity;
+
+    return EXIT_SUCCESS;
+}
+
+/* Adds id to the bucket of words of len characters */
+static int qgram_bucket_add(struct qgram *qg, size_t len, int id)
+{
+    if (len >= qg->num_lengths) {
+        size_t num = 2 * qg->num_lengths > len + 1 ? 2 * qg->num_lengths : len + 1;
+        struct qgram_bucket *by_length = trie_mem_realloc(qg->by_length,
+            num * sizeof(struct qgram_bucket));
+        if (by_length == NULL) {
+            return EXIT_FAILURE;
+        }
+        memset(by_length + qg->num_lengths, 0,
+               (num - qg->num_lengths) * sizeof(struct qgram_bucket));
+        qg->by_length = by_length;
+        qg->num_lengths = num;
+    }
+
+    struct qgram_bucket *b = &qg->by_length[len];
+
+    if (b->count == b->size) {
+        int size = b->size == 0 ? 16 : 2 * b->size;
+        int *ids = trie_mem_realloc(b->ids, size * sizeof(int));
+        if (ids == NULL) {
+            return EXIT_FAILURE;
+        }
+        b->ids = ids;
+        b->size = size;
+    }
+
+    b->ids[b->count++] = id;
+
+    return EXIT_SUCCESS;
+}
+
+/*
+    Adds a word to an index.
+
+    Parameters:
+     - qg: An index pointer
+     - word: The word
+
+    Returns:
+     - 0 on success (adding a word already in the index does nothing),
+       1 if an error occurs.
+ */
+int qgram_add(struct qgram *qg, char *word)
+{
+    assert(qg != NULL);
+    assert(word != NULL);
+
+    if (2 * (qg->num_words + 1) > (int)qg->ids_size
+        && qgram_grow_ids(qg) != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+
+    size_t slot = qgram_slot(qg, word);
+    if (qg->ids[slot] != 0)
+        return EXIT_SUCCESS;
+
+    if (qg->size == qg->capacity && qgram_grow_words(qg) != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+
+    size_t len = strlen(word);
+    size_t count = qgram_count(qg, len);
+    int *grams = trie_mem_alloc((count + 1) * sizeof(int));
+    char *copy = trie_mem_alloc(len + 1);
+
+    if (grams == NULL || copy == NULL) {
+        trie_mem_free(grams);
+        trie_mem_free(copy);
+        return EXIT_FAILURE;
+    }
+    memcpy(copy, word, len + 1);
+
+    /*
+     * Ids are never handed out again, so the new id is the largest yet and
+     * goes at the end of every list. A word added partway is left stale.
+     */
+    int id = qg->size++;
+    qg->words[id] = copy;
+    qg->lengths[id] = len;
+
+    qgram_codes(qg, word, len, grams);
+    for (size_t i = 0; i < count; i++) {
+        struct qgram_list *l = qgram_list(qg, grams[i], true);
+
+        if (l == NULL || qgram_append(l, id) != EXIT_SUCCESS) {
+            trie_mem_free(grams);
+            trie_mem_free(qg->words[id]);
+            qg->words[id] = NULL;
+            qg->num_stale++;
+            return EXIT_FAILURE;
+        }
+    }
+    trie_mem_free(grams);
+
+    if (qgram_bucket_add(qg, len, id) != EXIT_SUCCESS) {
+        trie_mem_free(qg->words[id]);
+        qg->words[id] = NULL;
+        qg->num_stale++;
+        return EXIT_FAILURE;
+    }
+
+    qg->ids[slot] = id + 1;
+    qg->num_words++;
+
+    return EXIT_SUCCESS;
+}
+
+/* Builds the posting lists again without the removed words */
+static int qgram_rebuild(struct qgram *qg)
+{
+    struct qgram *fresh = qgram_new(qg->q);
+
+    if (fresh == NULL)
+        return EXIT_FAILURE;
+
+    for (int id = 0; id < qg->size; id++) {
+        if (qg->words[id] != NULL
+            && qgram_add(fresh, qg->words[id]) != EXIT_SUCCESS) {
+            qgram_free(fresh);
+            return EXIT_FAILURE;
+        }
+    }
+
+    struct qgram old = *qg;
+    *qg = *fresh;
+    *fresh = old;
+    qgram_free(fresh);
+
+    return EXIT_SUCCESS;
+}
+
+/*
+    Takes a word out of an index.
+
+    Parameters:
+     - qg: An index pointer
+     - word: The word
+
+    Returns:
+     - 0 on success, 1 if the word is not in the index.
+
+    Details:
+     - The word stays in the posting lists, skipped by lookups, until
+       there are more removed words than words and the lists are built
+       again
+ */
+int qgram_remove(struct qgram *qg, char *word)
+{
+    assert(qg != NULL);
+    assert(word != NULL);
+
+    size_t slot = qgram_slot(qg, word);
+
+    if (qg->ids[slot] == 0)
+        return EXIT_FAILURE;
+
+    int id = qg->ids[slot] - 1;
+    struct qgram_bucket *b = &qg->by_length[qg->lengths[id]];
+
+    for (int i = 0; i < b->count; i++) {
+        if (b->ids[i] == id) {
+            b->ids[i] = b->ids[--b->count];
+            break;
+        }
+    }
+
+    qgram_drop_slot(qg, slot);
+    trie_mem_free(qg->words[id]);
+    qg->words[id] = NULL;
+    qg->num_words--;
+    qg->num_stale++;
+
+    /* Failing to rebuild only leaves the lists longer than they need be */
+    if (qg->num_stale > (qg->num_words > QGRAM_MIN_STALE ? qg->num_words : QGRAM_MIN_STALE))
+        qgram_rebuild(qg);
+
+    return EXIT_SUCCESS;
+}
+
+/*
+    Builds an index of every word in a trie.
+
+    Parameters:
+     - t: A trie pointer
+     - q: Length of the q-grams, from 1 to QGRAM_MAX_Q
+
+    Returns:
+     - A pointer to the index, or NULL if it cannot be allocated
+ */
+struct qgram *qgram_build(struct trie *t, int q)
+{
+    assert(t != NULL);
+
+    struct qgram *qg = qgram_new(q);
+    struct trie_iter *it = trie_iter_new(t, "", 0, NULL, 0);
+    char *word;
+    size_t len;
+
+    if (qg == NULL || it == NULL) {
+        if (qg != NULL)
+            qgram_free(qg);
+        if (it != NULL)
+            trie_iter_free(it);
+        return NULL;
+    }
+
+    while ((word = trie_iter_next(it, &len)) != NULL) {
+        /* The index takes NUL terminated words, so it leaves these out */
+        if (memchr(word, '\0', len) != NULL)
+            continue;
+        if (qgram_add(qg, word) != EXIT_SUCCESS) {
+            trie_iter_free(it);
+            qgram_free(qg);
+            return NULL;
+        }
+    }
+
+    trie_iter_free(it);
+
+    return qg;
+}
+
+/*
+    Frees an index.
+
+    Parameters:
+     - qg: An index pointer
+
+    Returns:
+     - Always returns 0
+ */
+int qgram_free(struct qgram *qg)
+{
+    assert(qg != NULL);
+
+    if (qg->words != NULL) {
+        for (int i = 0; i < qg->size; i++)
+            trie_mem_free(qg->words[i]);
+    }
+
+    if (qg->lists != NULL) {
+        for (size_t i = 0; i < qg->lists_size; i++)
+            trie_mem_free(qg->lists[i].data);
+    }
+
+    for (size_t i = 0; i < qg->num_lengths; i++)
+        trie_mem_free(qg->by_length[i].ids);
+
+    trie_mem_free(qg->words);
+    trie_mem_free(qg->lengths);
+    trie_mem_free(qg->ids);
+    trie_mem_free(qg->lists);
+    trie_mem_free(qg->by_length);
+    trie_mem_free(qg);
+
+    return EXIT_SUCCESS;
+}
+
+/* qsort() comparison for q-gram codes */
+static int qgram_cmp_code(const void *a, const void *b)
+{
+    int x = *(const int*)a, y = *(const int*)b;
+
+    return (x > y) - (x < y);
+}
+
+/* Adds a word's shared q-grams to its count, noting it the first time */
+static int qgram_credit(struct qgram_scratch *sc, int id, int shared, int touched)
+{
+    if (sc->counts[id] == 0)
+        sc->touched[touched++] = id;
+    sc->counts[id] += shared;
+
+    return touched;
+}
+
+/*
+   Adds to the count of every word on the posting list of a q-gram the
+   query has times times. Returns how many words are touched in all.
+ */
+static int qgram_tally(struct qgram_scratch *sc, struct qgram_list *l, int times,
+                       int touched)
+{
+    size_t pos = 0;
+    int id = 0, cur = -1, run = 0;
+
+    while (pos < l->len) {
+        id += qgram_varint(l->data, &pos);
+
+        /* A word's repeats of the q-gram are next to each other */
+        if (id == cur) {
+            run++;
+            continue;
+        }
+
+        if (cur >= 0)
+            touched = qgram_credit(sc, cur, (run < times ? run : times), touched);
+        cur = id;
+        run = 1;
+    }
+
+    if (cur >= 0)
+        touched = qgram_credit(sc, cur, (run < times ? run : times), touched);
+
+    return touched;
+}
+
+/*
+   Fewest q-grams a word of len characters can share with a query of
+   qlen characters and be within max_edits of it
+ */
+static long qgram_bound(struct qgram *qg, size_t qlen, size_t len, int max_edits)
+{
+    /* A swap breaks no q-gram of one character */
+    int per_edit = qg->q == 1 ? 1 : qg->q + 1;
+
+    return (long)qgram_count(qg, qlen > len ? qlen : len) - (long)max_edits * per_edit;
+}
+
+/* What stays the same for one call to qgram_lookup(), and the batch to check */
+struct qgram_query {
+    char *str;
+    size_t len;
+    int max_edits;
+    int (*found)(void *arg, char *word, int distance);
+    void *arg;
+
+    /* str set up for distance_many(), if it fits */
+    struct distance_pattern pattern;
+    bool bits;
+
+    struct qgram_scratch *scratch;
+
+    char *words[QGRAM_BATCH];
+    size_t lens[QGRAM_BATCH];
+    int count;
+};
+
+/* Checks the words waiting in the batch, and reports those close enough */
+static int qgram_flush(struct qgram_query *q)
+{
+    int d[QGRAM_BATCH];
+    int count = q->count;
+
+    if (q->bits) {
+        distance_many(&q->pattern, q->words, q->lens, count, q->max_edits, d);
+    } else {
+        for (int i = 0; i < count; i++)
+            d[i] = distance_osa(q->str, q->len, q->words[i], q->lens[i],
+                                q->max_edits, q->scratch->rows);
+    }
+
+    q->count = 0;
+    for (int i = 0; i < count; i++) {
+        if (d[i] <= q->max_edits && q->found(q->arg, q->words[i], d[i]) != 0)
+            return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+/* Queues a word to be checked, checking the batch once it is full */
+static int qgram_check(struct qgram_query *q, char *word, size_t len)
+{
+    q->scratch->checked++;
+    q->words[q->count] = word;
+    q->lens[q->count] = len;
+
+    if (++q->count == QGRAM_BATCH)
+        return qgram_flush(q);
+
+    return EXIT_SUCCESS;
+}
+
+/*
+    Finds the words of an index within max_edits of str.
+
+    Parameters:
+     - qg: An index pointer
+     - str: The (misspelled) word
+     - max_edits: Most edits a word can be away
+     - found: Called once for every word found with its distance, the
+       word only valid during the call. A nonzero return stops the lookup.
+     - arg: Passed on to found
+
+    Returns:
+     - 0 on success, 1 if an error occurs or found stopped the lookup.
+
+    Details:
+     - A word of length m within k edits of str shares at least
+       max(n, m) + q - 1 - k * w of its q-grams with str, where n is the
+       length of str and w is the most q-grams one edit can break: q, or
+       q + 1 since a swap touches two characters. Only words with that many
+       are checked, in batches with distance_many() (or distance_osa() for
+       a str over DISTANCE_MAX_PATTERN characters).
+     - Where that bound is not above zero every word of the length is
+       checked, so short words with a big budget cost a scan of the
+       words of those lengths
+ */
+int qgram_lookup(struct qgram *qg, char *str, int max_edits,
+                 int (*found)(void *arg, char *word, int distance), void *arg)
+{
+    assert(qg != NULL);
+    assert(str != NULL);
+
+    if (max_edits < 0)
+        max_edits = 0;
+
+    struct qgram_scratch *sc = &qgram_scratch;
+    struct qgram_query q = { .str = str, .len = strlen(str), .max_edits = max_edits,
+                        .found = found, .arg = arg, .scratch = sc, .count = 0 };
+    size_t len = q.len;
+    size_t count = qgram_count(qg, len);
+
+    q.bits = distance_pattern(&q.pattern, str, len) == EXIT_SUCCESS;
+
+    /* Rows for words up to max_edits longer than str */
+    size_t need = 3 * (len + max_edits + 1);
+    if (!q.bits && need > sc->rows_size) {
+        int *rows = trie_mem_realloc(sc->rows, need * sizeof(int));
+        if (rows == NULL) {
+            return EXIT_FAILURE;
+        }
+        sc->rows = rows;
+        sc->rows_size = need;
+    }
+
+    /* A count for every id the index has handed out */
+    if ((size_t)qg->capacity > sc->size) {
+        int *touched = trie_mem_realloc(sc->touched, qg->capacity * sizeof(int));
+        if (touched == NULL) {
+            return EXIT_FAILURE;
+        }
+        sc->touched = touched;
+
+        int *counts = trie_mem_realloc(sc->counts, qg->capacity * sizeof(int));
+        if (counts == NULL) {
+            return EXIT_FAILURE;
+        }
+        memset(counts + sc->size, 0, (qg->capacity - sc->size) * sizeof(int));
+        sc->counts = counts;
+        sc->size = qg->capacity;
+    }
+
+    int *grams = trie_mem_alloc((count + 1) * sizeof(int));
+    if (grams == NULL) {
+        return EXIT_FAILURE;
+    }
+
+    /* Each distinct q-gram of str once, with how many times it appears */
+    qgram_codes(qg, str, len, grams);
+    qsort(grams, count, sizeof(int), qgram_cmp_code);
+
+    int touched = 0;
+    for (size_t i = 0, j; i < count; i = j) {
+        for (j = i + 1; j < count && grams[j] == grams[i]; j++)
+            ;
+
+        struct qgram_list *l = qgram_list(qg, grams[i], false);
+        if (l != NULL)
+            touched = qgram_tally(sc, l, j - i, touched);
+    }
+    trie_mem_free(grams);
+
+    size_t lo = len > (size_t)max_edits ? len - max_edits : 0;
+    size_t hi = len + max_edits;
+    if (hi >= qg->num_lengths)
+        hi = qg->num_lengths == 0 ? 0 : qg->num_lengths - 1;
+    int rc = EXIT_SUCCESS;
+
+    sc->checked = 0;
+
+    /* Words with enough q-grams in common, for lengths where that means any */
+    for (int i = 0; i < touched && rc == EXIT_SUCCESS; i++) {
+        int id = sc->touched[i];
+        size_t wlen = qg->lengths[id];
+
+        if (qg->words[id] == NULL || wlen < lo || wlen > hi)
+            continue;
+
+        long bound = qgram_bound(qg, len, wlen, max_edits);
+        if (bound <= 0 || sc->counts[id] < bound)
+            continue;
+
+        rc = qgram_check(&q, qg->words[id], wlen);
+    }
+
+    /* Every word of the lengths where a word can share no q-gram at all */
+    for (size_t wlen = lo; wlen <= hi && hi < qg->num_lengths
+         && rc == EXIT_SUCCESS; wlen++) {
+        if (qgram_bound(qg, len, wlen, max_edits) > 0)
+            continue;
+
+        struct qgram_bucket *b = &qg->by_length[wlen];
+        for (int i = 0; i < b->count && rc == EXIT_SUCCESS; i++)
+            rc = qgram_check(&q, qg->words[b->ids[i]], wlen);
+    }
+
+    if (rc == EXIT_SUCCESS && q.count > 0)
+        rc = qgram_flush(&q);
+
+    for (int i = 0; i < touched; i++)
+        sc->counts[sc->touched[i]] = 0;
+
+    return rc;
+}
+
+/* Engines TRIE.APPROXMATCH can use, see suggestion_list_engine() */
+#define SUGGEST_DEPTH_FIRST 0
+#define SUGGEST_DP 1
+#define SUGGEST_BEST_FIRST 2
+#define SUGGEST_SYMSPELL 3
+#define SUGGEST_QGRAM 4
+
+/* Edit budgets from which TRIE.APPROXMATCH uses SUGGEST_QGRAM unless told otherwise */
+#define SUGGEST_QGRAM_EDITS 4
+
+/* What a symspell_lookup() or qgram_lookup() adds to */
+struct lookup_set {
+    struct search *s;
+    int max_edits;
+};
+
+// Offers a word an index lookup found to the set. Stops the lookup on an error
+static int lookup_found(void *arg, char *word, int distance)
+{
+    struct lookup_set *to = arg;
+
+    return try_add(to->s, word, to->max_edits - distance) != EXIT_SUCCESS;
+}
+
+/*
+    Finds the closest words to str with a symmetric delete index instead of
+    the trie. Distances come from symspell_distance(), so the odd word with
+    a swap next to other edits can score one edit apart from suggestions().
+
+    Parameters:
+     - set: An array of match_t*'s, left as a heap like suggestions() leaves it
+     - ss: An index of the words. Must go up to max_edits.
+     - str: A string. This will be the (misspelled) word to match
+     - max_edits: the maximum edit distance the words in the set can have
+     - n: The length of set (number of matches in the set)
+
+    Returns:
+     - 0 for success, or a positive integer n for the number of errors encountered
+ */
+int suggestions_symspell(match_t **set, struct symspell *ss, char *str, int max_edits, int n)
+{
+    assert(ss != NULL);
+    assert(str != NULL);
+
+    struct search s;
+    struct lookup_set to = { &s, max_edits };
+
+    s.set = set;
+    s.t = NULL;
+    s.n = n;
+
+    if (index_new(&s) != EXIT_SUCCESS) {
+        return EXIT_FAILURE;
+    }
+
+    int rc = symspell_lookup(ss, str, max_edits, lookup_found, &to);
+
+    trie_mem_free(s.index.slots);
+    trie_mem_free(s.index.where);
+
+    return rc;
+}
+
+/*
+    Finds the closest words to str with a q-gram index instead of the trie.
+    Distances come from distance_osa() like suggestions_symspell(), but any
+    budget works.
+
+    Parameters:
+     - set: An array of match_t*'s, left as a heap like suggestions() leaves it
+     - qg: An index of the words
+     - str: A string. This will be the (misspelled) word to match
+     - max_edits: the maximum edit distance the words in the set can have
+     - n: The length of set (number of matches in the set)
+
+    Returns:
+     - 0 for success, or a positive integer n for the number of errors encountered
+ */
+int suggestions_qgram(match_t **set, struct qgram *qg, char *str, int max_edits, int n)
+{
+    assert(qg != NULL);
+    assert(str != NULL);
+
+    struct search s;
+    struct lookup_set to = { &s, max_edits };
+
+    s.set = set;
+    s.t = NULL;
+    s.n = n;
+
+    if (index_new(&s) != EXIT_SUCCESS) {
+        return EXIT_FAILURE;
+    }
+
+    int rc = qgram_lookup(qg, str, max_edits, lookup_found, &to);
+
+    trie_mem_free(s.index.slots);
+    trie_mem_free(s.index.where);
+
+    return rc;
+}
+
+/* Returns the closest words to str from ss if it is not NULL, and from qg otherwise */
+static char** index_list(struct symspell *ss, struct qgram *qg, char *str, int max_edits,
+                         int n)
+{
+    match_t **set = (match_t **)trie_mem_calloc(n, sizeof(match_t*));
+
+    if (set == NULL) {
+        return NULL;
+    }
+
+    int rc;
+    if (ss != NULL) {
+        rc = suggestions_symspell(set, ss, str, max_edits, n);
+    } else {
+        rc = suggestions_qgram(set, qg, str, max_edits, n);
+    }
+
+    if (rc != EXIT_SUCCESS) {
+
+        for (int i = 0; i < n; i++) {
+            if (set[i] != NULL) {
+                trie_mem_free(set[i]->str);
+                trie_mem_free(set[i]);
+            }
+        }
+
+        trie_mem_free(set);
+
+        return NULL;
+    }
+
+    return suggestion_set_first_n(set, n);
+}
+
+/*
+    Returns the closest words to str like suggestion_list(), with the engine
+    picked. SUGGEST_SYMSPELL without an index, or with one that does not go
+    up to max_edits, and SUGGEST_QGRAM without an index use SUGGEST_DP
+    instead.
+
+    Parameters:
+     - t: A trie. Must point to a trie allocated with trie_new
+     - ss: An index of the words of t for SUGGEST_SYMSPELL, or NULL
+     - qg: An index of the words of t for SUGGEST_QGRAM, or NULL
+     - str: A string. This will be the (misspelled) word to match
+     - max_edits: the maximum levenshtein distance the words in the set can have
+     - n: the number of strings to return. 
+     - engine: One of SUGGEST_DEPTH_FIRST ... SUGGEST_QGRAM
+
     Returns:
-     - 0 for success, or a positive integer n for the number of errors encountered
+     - The first n strings with the smallest distance, where ties are broken by alphabetical order.
+       If there aren't enough matching strings, each remaining spot is set to NULL.
+     - NULL if there was an error
  */
-int suggestions(match_t **set, struct trie *t, char *prefix, char *suffix, int edits_left, int n)
+char** suggestion_list_engine(struct trie *t, struct symspell *ss, struct qgram *qg, char *str,
+                              int max_edits, int n, int engine)
 {
-    char* s;
-    int rc = 0;
+    assert(t != NULL);
+    assert(str != NULL);
+
+    switch (engine) {
+    case SUGGEST_DEPTH_FIRST:
+        return suggestion_list(t, str, max_edits, n);
+    case SUGGEST_BEST_FIRST:
+        return suggestion_list_best_first(t, str, max_edits, n);
+    case SUGGEST_SYMSPELL:
+        if (ss != NULL && max_edits <= ss->max_distance) {
+            return index_list(ss, NULL, str, max_edits, n);
+        }
+        return suggestion_list_dp(t, str, max_edits, n);
+    case SUGGEST_QGRAM:
+        if (qg != NULL) {
+            return index_list(NULL, qg, str, max_edits, n);
+        }
+        return suggestion_list_dp(t, str, max_edits, n);
+    default:
+        return suggestion_list_dp(t, str, max_edits, n);
+    }
+}
+
+/* ===== "trie" type commands (Redis wrapper functions) ===== */
+
+/*
+    What a TRIE key holds: the trie, the symmetric delete index of its words
+    once TRIE.APPROXMATCH ... ENGINE SYMSPELL has asked for one, and the
+    q-gram index once a query with SUGGEST_QGRAM has. TRIE.INSERT and
+    TRIE.DEL keep the indexes up to date from then on.
+ */
+struct trie_key {
+    struct trie *root;
+    struct symspell *index;
+    struct qgram *grams;
+
+    /* Bytes (the key itself included) and trie nodes it holds */
+    size_t bytes;
+    size_t nodes;
+
+    /*
+       Jobs of this key on the worker pool, from when they are queued until
+       TrieApproxMatch_Free() is done with them. Only the main thread
+       changes it, under trie_pool_lock since TrieFree() may look at it from
+       the lazy free thread. Nothing changes the trie or the indexes while
+       there are any.
+     */
+    int readers;
+
+    /* Commands waiting for the readers, oldest first, see trie_key_drain() */
+    struct trie_job *waiting;
+    struct trie_job *waiting_tail;
+
+    /* Whether a job on the pool is building the index, or the q-gram index */
+    bool building_index;
+    bool building_grams;
+
+    /* An index replaced while searches could still be using it */
+    struct symspell *retired;
+
+    /* Set by TrieFree() while there are readers, the last of which frees the key */
+    bool doomed;
+};
+
+/*
+    Whether a word can go in the indexes. They take NUL terminated
+    strings, like the engines of TRIE.APPROXMATCH and TRIE.FUZZYCOMPLETE,
+    so words holding a NUL are only found by the exact commands. The
+    strings Redis hands a command always end in a NUL, so the rest need
+    no copying.
+ */
+static bool trie_key_indexable(const char *word, size_t len)
+{
+    return memchr(word, '\0', len) == NULL;
+}
+
+/* Makes an empty TRIE key, or returns NULL if out of memory */
+static struct trie_key *trie_key_new(void)
+{
+    struct trie_key *k = trie_mem_calloc(1, sizeof(struct trie_key));
+
+    if (k == NULL)
+        return NULL;
+
+    k->root = trie_new('\0');
+    if (k->root == NULL) {
+        trie_mem_free(k);
+        return NULL;
+    }
+    return k;
+}
+
+/* Frees a TRIE key nothing reads any more, with its trie and indexes */
+static void trie_key_free(struct trie_key *k)
+{
+    trie_free(k->root);
+    if (k->index != NULL)
+        symspell_free(k->index);
+    if (k->retired != NULL)
+        symspell_free(k->retired);
+    if (k->grams != NULL)
+        qgram_free(k->grams);
+    trie_mem_free(k);
+}
+
+/*
+    The worker pool TRIE.APPROXMATCH runs on: a queue of jobs, and
+    threads taking them off it one at a time. A write to a key the pool
+    is reading waits its turn as a job too, see trie_key_drain().
+ */
+struct trie_job {
+    struct trie_job *next;
+    RedisModuleBlockedClient *bc;
+    struct trie_key *k;
+
+    /* The search, and the words it found */
+    struct symspell *index;
+    struct qgram *grams;
+    RedisModuleString *query;
+    char *str;
+    int max_edits;
+    int n;
+    int engine;
+    char **matches;
+
+    /*
+       An index the search builds first: with SUGGEST_SYMSPELL the distance
+       it covers, with SUGGEST_QGRAM the length of the q-grams, or 0 for
+       none. It is left in new_index or new_grams, along with the bytes it
+       took, until trie_job_publish() hands it to the key.
+     */
+    int build;
+    struct symspell *new_index;
+    struct qgram *new_grams;
+    size_t new_bytes;
+
+    /*
+       A write instead of a search, applied by trie_key_drain(): the
+       command's arguments and what it replies. A write replicated from a
+       master has no client to reply to.
+     */
+    long long (*write)(struct trie_key *k, RedisModuleString **argv, int argc);
+    RedisModuleString **argv;
+    int argc;
+    long long written;
+};
+
+static pthread_mutex_t trie_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Signalled when a job is queued */
+static pthread_cond_t trie_pool_work = PTHREAD_COND_INITIALIZER;
+
+static struct trie_job *trie_pool_head;
+static struct trie_job *trie_pool_tail;
+
+/* Threads in the pool, set with the WORKERS module argument */
+#define TRIE_WORKERS 4
+static long long trie_workers = TRIE_WORKERS;
+
+/*
+    Adds what the module allocated and freed since trie_mem_used and
+    trie_mem_nodes read used and nodes to the size of k
+ */
+static void trie_key_charge(struct trie_key *k, size_t used, size_t nodes)
+{
+    k->bytes += trie_mem_used - used;
+    k->nodes += trie_mem_nodes - nodes;
+}
+
+/* The trie of a TRIE key */
+static struct trie *trie_key_root(RedisModuleKey *key)
+{
+    struct trie_key *k = RedisModule_ModuleTypeGetValue(key);
+
+    return k->root;
+}
+
+/* Whether Redis has freed k while the pool was still reading it */
+static bool trie_key_doomed(struct trie_key *k)
+{
+    pthread_mutex_lock(&trie_pool_lock);
+    bool doomed = k->doomed;
+    pthread_mutex_unlock(&trie_pool_lock);
+
+    return doomed;
+}
+
+/*
+    Runs the search of a job, building the index it asked for first.
+    Searches and builds only read the trie and the indexes, so any number
+    of them can run at once.
+ */
+static void trie_job_run(struct trie_job *job)
+{
+    struct trie *t = job->k->root;
+
+    if (job->build > 0) {
+        size_t used = trie_mem_used;
+
+        if (job->engine == SUGGEST_SYMSPELL)
+            job->index = job->new_index = symspell_build(t, job->build);
+        else
+            job->grams = job->new_grams = qgram_build(t, job->build);
+        job->new_bytes = trie_mem_used - used;
+
+        if (job->new_index == NULL && job->new_grams == NULL)
+            return;
+    }
+
+    job->matches = suggestion_list_engine(t, job->index, job->grams, job->str,
+                                          job->max_edits, job->n, job->engine);
+}
+
+/* Replies with the words a job found */
+static int trie_job_reply(RedisModuleCtx *ctx, struct trie_job *job)
+{
+    if (job->matches == NULL)
+        return RedisModule_ReplyWithError(ctx, "ERR out of memory");
+
+    RedisModule_ReplyWithArray(ctx, job->n);
+    for (int i = 0; i < job->n; i++) {
+        if (job->matches[i] == NULL)
+            RedisModule_ReplyWithNull(ctx);
+        else
+            RedisModule_ReplyWithSimpleString(ctx, job->matches[i]);
+    }
+    return REDISMODULE_OK;
+}
+
+static void trie_job_free(struct trie_job *job)
+{
+    if (job->matches != NULL) {
+        for (int i = 0; i < job->n; i++)
+            trie_mem_free(job->matches[i]);
+        trie_mem_free(job->matches);
+    }
+    if (job->query != NULL)
+        RedisModule_FreeString(NULL, job->query);
+    if (job->new_index != NULL)
+        symspell_free(job->new_index);
+    if (job->new_grams != NULL)
+        qgram_free(job->new_grams);
+    if (job->argv != NULL) {
+        for (int i = 0; i < job->argc; i++)
+            RedisModule_FreeString(NULL, job->argv[i]);
+        trie_mem_free(job->argv);
+    }
+    trie_mem_free(job);
+}
+
+/* Takes jobs off the queue for as long as the server runs */
+static void *trie_pool_worker(void *arg)
+{
+    (void)arg;
+
+    for (;;) {
+        pthread_mutex_lock(&trie_pool_lock);
+        while (trie_pool_head == NULL)
+            pthread_cond_wait(&trie_pool_work, &trie_pool_lock);
+
+        struct trie_job *job = trie_pool_head;
+        trie_pool_head = job->next;
+        if (trie_pool_head == NULL)
+            trie_pool_tail = NULL;
+        pthread_mutex_unlock(&trie_pool_lock);
+
+        trie_job_run(job);
+
+        /* The job stays a reader of its key until TrieApproxMatch_Free() */
+        RedisModule_UnblockClient(job->bc, job);
+    }
+
+    return NULL;
+}
+
+/* Queues a job, counting it as a reader of its key until it is freed */
+static void trie_pool_push(struct trie_job *job)
+{
+    pthread_mutex_lock(&trie_pool_lock);
+    job->k->readers++;
+    job->next = NULL;
+    if (trie_pool_tail != NULL)
+        trie_pool_tail->next = job;
+    else
+        trie_pool_head = job;
+    trie_pool_tail = job;
+    pthread_cond_signal(&trie_pool_work);
+    pthread_mutex_unlock(&trie_pool_lock);
+}
+
+/*
+    Takes the jobs of k no worker has started off the queue, so that a
+    write only waits for the searches already running. Returns them in
+    order; they no longer count as readers.
+ */
+static struct trie_job *trie_pool_pull(struct trie_key *k)
+{
+    struct trie_job *pulled = NULL, **tail = &pulled, *last = NULL;
+
+    pthread_mutex_lock(&trie_pool_lock);
+    for (struct trie_job **p = &trie_pool_head; *p != NULL; ) {
+        struct trie_job *job = *p;
+
+        if (job->k != k) {
+            last = job;
+            p = &job->next;
+            continue;
+        }
+        *p = job->next;
+        job->next = NULL;
+        *tail = job;
+        tail = &job->next;
+        k->readers--;
+    }
+    trie_pool_tail = last;
+    pthread_mutex_unlock(&trie_pool_lock);
+
+    /* They build nothing until they are queued again */
+    for (struct trie_job *job = pulled; job != NULL; job = job->next) {
+        if (job->build > 0 && job->engine == SUGGEST_SYMSPELL)
+            k->building_index = false;
+        else if (job->build > 0)
+            k->building_grams = false;
+        job->build = 0;
+    }
+
+    return pulled;
+}
+
+/* Puts jobs (a list of them) at the end of the commands waiting on k */
+static void trie_key_queue(struct trie_key *k, struct trie_job *jobs)
+{
+    while (jobs != NULL) {
+        struct trie_job *job = jobs;
+
+        jobs = job->next;
+        job->next = NULL;
+        if (k->waiting_tail != NULL)
+            k->waiting_tail->next = job;
+        else
+            k->waiting = job;
+        k->waiting_tail = job;
+    }
+}
+
+/*
+    Points a search at the indexes its key has now, and has it build the
+    one its engine needs if the key lacks it. Only one job on the pool
+    builds an index at a time, and a search on the main thread (inside
+    MULTI or a script) only builds one when there is no pool to do it.
+    Searches that do not get to build fall back to SUGGEST_DP, as
+    suggestion_list_engine() does without an index.
+ */
+static void trie_job_prepare(struct trie_job *job, bool pooled)
+{
+    struct trie_key *k = job->k;
+    bool may_build = pooled || trie_workers == 0;
+
+    job->index = k->index;
+    job->grams = k->grams;
+    job->build = 0;
+
+    if (job->engine == SUGGEST_SYMSPELL && may_build && !k->building_index
+        && (k->index == NULL || k->index->max_distance < job->max_edits)) {
+        job->build = job->max_edits > SYMSPELL_DISTANCE ? job->max_edits
+                                                         : SYMSPELL_DISTANCE;
+        k->building_index = pooled;
+    }
+
+    if (job->engine == SUGGEST_QGRAM && may_build && !k->building_grams
+        && k->grams == NULL) {
+        job->build = QGRAM_Q;
+        k->building_grams = pooled;
+    }
+}
+
+/*
+    Hands the index a job built to its key, on the main thread. Searches
+    other than the job's own may still be using the index it replaces, so
+    that one is retired until they are done; if one already is, the new
+    index is dropped and built again by a later query.
+ */
+static void trie_job_publish(struct trie_job *job, int held)
+{
+    struct trie_key *k = job->k;
+    bool shared = k->readers > held;
+    size_t used = trie_mem_used, nodes = trie_mem_nodes;
+
+    if (job->build == 0)
+        return;
+
+    if (job->engine == SUGGEST_SYMSPELL) {
+        struct symspell *old = k->index;
+
+        k->building_index = false;
+        if (job->new_index != NULL && !(old != NULL && shared && k->retired != NULL)) {
+            k->index = job->new_index;
+            k->bytes += job->new_bytes;
+            job->new_index = NULL;
+
+            if (old != NULL && shared)
+                k->retired = old;
+            else if (old != NULL)
+                symspell_free(old);
+        }
+    } else {
+        k->building_grams = false;
+        if (job->new_grams != NULL && k->grams == NULL) {
+            k->grams = job->new_grams;
+            k->bytes += job->new_bytes;
+            job->new_grams = NULL;
+        }
+    }
+
+    trie_key_charge(k, used, nodes);
+}
+
+/* Queues a search on the pool */
+static void trie_job_dispatch(struct trie_job *job)
+{
+    trie_job_prepare(job, true);
+    trie_pool_push(job);
+}
+
+/*
+    Moves the commands waiting on k along, on the main thread. Searches go
+    to the pool. A write is applied once no job other than the held ones
+    of the caller reads the key, then passed on to replicas and the AOF
+    and its client unblocked; until then it holds up everything behind it,
+    so the commands on a key keep their order.
+ */
+static void trie_key_drain(struct trie_key *k, int held)
+{
+    struct trie_job *job;
+
+    while ((job = k->waiting) != NULL) {
+        if (job->write != NULL && k->readers > held)
+            return;
+
+        k->waiting = job->next;
+        if (k->waiting == NULL)
+            k->waiting_tail = NULL;
+        job->next = NULL;
+
+        if (job->write == NULL) {
+            trie_job_dispatch(job);
+            continue;
+        }
+
+        job->written = job->write(k, job->argv, job->argc);
+
+        /*
+           Redis passes a write from a master on by itself, and the DEL of
+           a doomed key already went out after this one came in
+         */
+        if (job->bc == NULL) {
+            trie_job_free(job);
+            continue;
+        }
+        if (!trie_key_doomed(k)) {
+            RedisModuleCtx *ctx = RedisModule_GetThreadSafeContext(job->bc);
+            const char *name = RedisModule_StringPtrLen(job->argv[0], NULL);
+
+            RedisModule_Replicate(ctx, name, "v", job->argv + 1,
+                                  (size_t)job->argc - 1);
+            RedisModule_FreeThreadSafeContext(ctx);
+        }
+        RedisModule_UnblockClient(job->bc, job);
+    }
+}
+
+/*
+    Lets go of a job reading k, once TrieApproxMatch_Free() is done with it.
+    The last reader frees the index retired while the pool read it, and
+    the key itself if Redis freed it meanwhile.
+ */
+static void trie_key_release(struct trie_key *k)
+{
+    trie_key_drain(k, 1);
+
+    if (k->readers == 1 && k->retired != NULL) {
+        size_t used = trie_mem_used, nodes = trie_mem_nodes;
+
+        symspell_free(k->retired);
+        k->retired = NULL;
+        trie_key_charge(k, used, nodes);
+    }
+
+    /* Once the count is down, the lazy free thread may free the key */
+    pthread_mutex_lock(&trie_pool_lock);
+    bool last = --k->readers == 0 && k->doomed;
+    pthread_mutex_unlock(&trie_pool_lock);
+
+    if (last)
+        trie_key_free(k);
+}
+
+/*
+    Whether a command can block its client until the pool is done. Scripts,
+    transactions and commands replayed from the AOF or a master can not.
+ */
+static bool trie_can_block(RedisModuleCtx *ctx)
+{
+    int flags = RedisModule_GetContextFlags(ctx);
+    int deny = REDISMODULE_CTX_FLAGS_LUA | REDISMODULE_CTX_FLAGS_MULTI
+        | REDISMODULE_CTX_FLAGS_LOADING | REDISMODULE_CTX_FLAGS_REPLICATED;
+
+#ifdef REDISMODULE_CTX_FLAGS_DENY_BLOCKING
+    deny |= REDISMODULE_CTX_FLAGS_DENY_BLOCKING;
+#endif
+
+    return trie_workers > 0 && (flags & deny) == 0;
+}
+
+/* Replies to a TRIE.INSERT or TRIE.DEL client once its write is applied */
+int TrieWrite_Reply(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
+{
+    struct trie_job *job = RedisModule_GetBlockedClientPrivateData(ctx);
+
+    (void)argv;
+    (void)argc;
+    return RedisModule_ReplyWithLongLong(ctx, job->written);
+}
+
+void TrieWrite_Free(RedisModuleCtx *ctx, void *privdata)
+{
+    (void)ctx;
+    trie_job_free(privdata);
+}
+
+/*
+    Applies a write to k and replies with what it returns, or when the pool
+    is reading k, queues it behind the searches running. The client then
+    waits for trie_key_drain() to apply it; a write from a master or the
+    AOF is applied then with no reply, while one inside MULTI or a script,
+    which can neither wait nor hold up the server, fails.
+ */
+static int trie_key_write(RedisModuleCtx *ctx, struct trie_key *k,
+                          long long (*write)(struct trie_key *k,
+                                             RedisModuleString **argv, int argc),
+                          RedisModuleString **argv, int argc)
+{
+    /* Searches no worker has started go after the write */
+    struct trie_job *pulled = trie_pool_pull(k);
+    trie_key_drain(k, 0);
+
+    if (k->readers == 0 && k->waiting == NULL) {
+        RedisModule_ReplyWithLongLong(ctx, write(k, argv, argc));
+        RedisModule_ReplicateVerbatim(ctx);
+        trie_key_queue(k, pulled);
+        trie_key_drain(k, 0);
+        return REDISMODULE_OK;
+    }
+
+    int flags = RedisModule_GetContextFlags(ctx);
+    bool master = (flags & (REDISMODULE_CTX_FLAGS_REPLICATED
+                            | REDISMODULE_CTX_FLAGS_LOADING)) != 0;
+
+    if (!master && !trie_can_block(ctx)) {
+        trie_key_queue(k, pulled);
+        trie_key_drain(k, 0);
+        return RedisModule_ReplyWithError(ctx, "ERR busy: the key is being searched");
+    }
+
+    struct trie_job *job = trie_mem_calloc(1, sizeof(struct trie_job));
+    if (job != NULL)
+        job->argv = trie_mem_alloc(argc * sizeof(RedisModuleString *));
+    if (job == NULL || job->argv == NULL) {
+        trie_mem_free(job);
+        trie_key_queue(k, pulled);
+        trie_key_drain(k, 0);
+        return RedisModule_ReplyWithError(ctx, "ERR out of memory");
+    }
+
+    /* The arguments are applied later, so they have to outlive the call */
+    for (int i = 0; i < argc; i++) {
+        job->argv[i] = argv[i];
+        RedisModule_RetainString(NULL, argv[i]);
+    }
+    job->argc = argc;
+    job->write = write;
+    if (!master)
+        job->bc = RedisModule_BlockClient(ctx, TrieWrite_Reply, NULL,
+                                          TrieWrite_Free, 0);
+    trie_key_queue(k, job);
+    trie_key_queue(k, pulled);
+    return REDISMODULE_OK;
+}
+
+/* Whether a TRIE.INSERT takes scores, see TrieInsert_RedisCommand() */
+static bool trie_insert_withscores(RedisModuleString **argv, int argc)
+{
+    size_t len;
+    const char *flag = RedisModule_StringPtrLen(argv[2], &len);
+
+    return argc > 3 && len == 10 && strncasecmp(flag, "withscores", 10) == 0;
+}
+
+/*
+    Inserts the words of a checked TRIE.INSERT into k and its indexes, and
+    returns how many were new
+ */
+static long long trie_key_insert(struct trie_key *k, RedisModuleString **argv,
+                                 int argc)
+{
+    bool scored = trie_insert_withscores(argv, argc);
+    /* Index of the first value, or of the first score with WITHSCORES */
+    int first = scored ? 3 : 2;
+    int nstrings = scored ? (argc - first) / 2 : argc - first;
+    struct trie *t = k->root;
+    size_t used = trie_mem_used, nodes = trie_mem_nodes;
+    double score = 0;
+
+    /* Total return value (from all trie_insert_string calls) */
+    long long total = 0;
+    /* Insert the new strings, straight from the arguments */
+    for (int i = 0; i < nstrings; i++) {
+        int arg = scored ? first + 2 * i + 1 : first + i;
+        size_t len;
+        const char *word = RedisModule_StringPtrLen(argv[arg], &len);
+
+        if (scored) {
+            RedisModule_StringToDouble(argv[arg - 1], &score);
+            total += trie_insert_scored(t, word, len, score);
+        } else {
+            total += trie_insert_string(t, word, len);
+        }
+        if (!trie_key_indexable(word, len))
+            continue;
+        if (k->index != NULL)
+            symspell_add(k->index, (char *)word);
+        if (k->grams != NULL)
+            qgram_add(k->grams, (char *)word);
+    }
+    trie_key_charge(k, used, nodes);
+
+    return total;
+}
+
+/* 
+   TRIE.INSERT key value1 value2... valueN
+   TRIE.INSERT key WITHSCORES score1 value1 score2 value2... scoreN valueN
+
+   A first value of WITHSCORES (in any case) is always taken as the flag
+   when more values follow. The word itself goes in through the second
+   form, with a score of 0.
+ */
+int TrieInsert_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv, 
+        int argc) {
+    RedisModule_AutoMemory(ctx); /* Use automatic memory management. */
+    
+    if (argc <= 2) 
+        return RedisModule_WrongArity(ctx);
+
+	RedisModuleKey *key = RedisModule_OpenKey(ctx, argv[1],
+        REDISMODULE_READ | REDISMODULE_WRITE);
+    int type = RedisModule_KeyType(key);
+	if (type != REDISMODULE_KEYTYPE_EMPTY &&
+        RedisModule_ModuleTypeGetType(key) != trie)
+    {
+        return RedisModule_ReplyWithError(ctx, REDISMODULE_ERRORMSG_WRONGTYPE);
+    }
+    size_t dummy;
+    bool scored = trie_insert_withscores(argv, argc);
+    /* Index of the first value, or of the first score with WITHSCORES */
+    int first = scored ? 3 : 2;
+    if (scored && (argc - first) % 2 != 0)
+        return RedisModule_WrongArity(ctx);
+
+    /* Number of strings to be inserted */
+    int nstrings = scored ? (argc - first) / 2 : argc - first;
+    double score = 0;
+
+    /* Check every argument first, so a bad one leaves the trie as it was */
+    for (int i = 0; i < nstrings; i++) {
+        int arg = scored ? first + 2 * i + 1 : first + i;
+        if (scored && RedisModule_StringToDouble(argv[arg - 1], &score)
+                == REDISMODULE_ERR) {
+            return RedisModule_ReplyWithError(ctx, "ERR score is not a valid float");
+        }
+        RedisModule_StringPtrLen(argv[arg], &dummy);
+        if (dummy == 0) {
+            return RedisModule_ReplyWithError(ctx, "ERR invalid value: must be a string");
+        } 
+    } 
     
-    // Since prefix and suffix can have max length MAXLEN
-    s = RedisModule_Alloc(sizeof(char) * (MAXLEN + 1) * 2);
-    if (s == NULL) {
-        return EXIT_FAILURE;
+    struct trie_key *k;
+    /* Create an empty value object if the key is currently empty. */
+    if (type == REDISMODULE_KEYTYPE_EMPTY) {
+    	k = trie_key_new();
+    	if (k == NULL)
+    	    return RedisModule_ReplyWithError(ctx, "ERR out of memory");
+    	RedisModule_ModuleTypeSetValue(key, trie, k);
+    } else {
+        k = RedisModule_ModuleTypeGetValue(key);
     }
 
-    // Now put prefix and suffix together
-    strncpy(s, prefix, MAXLEN);
-    strncat(s, suffix, MAXLEN);
+    return trie_key_write(ctx, k, trie_key_insert, argv, argc);
+}
 
-    if (try_add(set, t, s, edits_left, n) != EXIT_SUCCESS)  {
-        return EXIT_FAILURE;
-    }
+/* TRIE.CONTAINS key value */
+int TrieContains_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv, 
+        int argc) {
+    RedisModule_AutoMemory(ctx); /* Use automatic memory management. */
 
-    if (edits_left <= 0) {
-        // Hooray for exit conditions!
+    if (argc != 3) 
+        return RedisModule_WrongArity(ctx);
 
-        RedisModule_Free(s);
-        return EXIT_SUCCESS;
+    RedisModuleKey *key = RedisModule_OpenKey(ctx, argv[1],
+        REDISMODULE_READ | REDISMODULE_WRITE);
+    int type = RedisModule_KeyType(key);
+    if (type == REDISMODULE_KEYTYPE_EMPTY) {
+    	return RedisModule_ReplyWithError(ctx, "ERR invalid key: not an existing trie");
+    }
+    else if (RedisModule_ModuleTypeGetType(key) != trie)
+    {
+        return RedisModule_ReplyWithError(ctx,REDISMODULE_ERRORMSG_WRONGTYPE);
     }
+    size_t len;
+    const char *word = RedisModule_StringPtrLen(argv[2], &len);
 
-    // Make sure we aren't at the end of the suffix
-    if (suffix[0] != '\0') {
+    struct trie *t;
+    t = trie_key_root(key);
 
-        rc += move_on(set, t, prefix, suffix, edits_left, n);
+    /* Check for the string. */
+    int c = trie_search(t, word, len);
+    
+    RedisModule_ReplyWithLongLong(ctx, c);      
+    RedisModule_ReplicateVerbatim(ctx);
+    return REDISMODULE_OK;
+}
 
-        rc += try_delete(set, t, prefix, suffix, edits_left, n);
+/* TRIE.MCONTAINS key value1 value2... valueN */
+int TrieMContains_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv, 
+        int argc) {
+    RedisModule_AutoMemory(ctx); /* Use automatic memory management. */
 
-        rc += try_replace(set, t, prefix, suffix, edits_left, n);
+    if (argc <= 2) 
+        return RedisModule_WrongArity(ctx);
 
-        rc += try_swap(set, t, prefix, suffix, edits_left, n);
+    RedisModuleKey *key = RedisModule_OpenKey(ctx, argv[1], REDISMODULE_READ);
+    int type = RedisModule_KeyType(key);
+    if (type == REDISMODULE_KEYTYPE_EMPTY) {
+    	return RedisModule_ReplyWithError(ctx, "ERR invalid key: not an existing trie");
+    }
+    else if (RedisModule_ModuleTypeGetType(key) != trie)
+    {
+        return RedisModule_ReplyWithError(ctx,REDISMODULE_ERRORMSG_WRONGTYPE);
     }
 
-    // This one doesn't need any fancy suffix checking
-    rc += try_insert(set, t, prefix, suffix, edits_left, n);
+    struct trie *t;
+    t = trie_key_root(key);
 
-    RedisModule_Free(s);
+    /* The words are read where Redis holds them, without copies */
+    int nstrings = argc - 2;
+    const char **words = trie_mem_alloc(nstrings * sizeof(char*));
+    size_t *lens = trie_mem_alloc(nstrings * sizeof(size_t));
+    int *results = trie_mem_alloc(nstrings * sizeof(int));
+    for (int i = 0; i < nstrings; i++)
+        words[i] = RedisModule_StringPtrLen(argv[2 + i], &lens[i]);
 
-    if (rc != EXIT_SUCCESS) {
-        return EXIT_FAILURE;
-    }
+    trie_search_many(t, words, lens, nstrings, results);
 
-    return EXIT_SUCCESS;
-}
+    RedisModule_ReplyWithArray(ctx, nstrings);
+    for (int i = 0; i < nstrings; i++)
+        RedisModule_ReplyWithLongLong(ctx, results[i]);
 
-/*
-    Creates array of match_t*'s of spelling suggestions for a word using suggestions()
-  
-    Parameters:
-     - t: A trie. Must point to a trie allocated with trie_new
-     - str: A string. This will be the (misspelled) word to match
-     - max_edits: the maximum levenshtein distance the words in the set can have
-     - n: The length of set (number of matches in the set)
-  
-    Returns:
-     - A pointer to the array of match_t*'s containing the closest n words and their respective distance
-     - NULL if there was an error
- */
-match_t **suggestion_set_new(struct trie *t, char *str, int max_edits, int n) 
-{
-    assert(t != NULL);
-    assert(str != NULL);
+    trie_mem_free(words);
+    trie_mem_free(lens);
+    trie_mem_free(results);
+    return REDISMODULE_OK;
+}
 
-    int i;
+/* TRIE.COMPLETIONS key value */
+int TrieCompletions_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv, 
+        int argc) {
+    RedisModule_AutoMemory(ctx); /* Use automatic memory management. */
 
-    // We'll allocate space for as many matches as we need so we can make sure we get the closest matches
-    match_t **set = (match_t **)RedisModule_Calloc(n, sizeof(match_t*));
+    if (argc != 3) 
+        return RedisModule_WrongArity(ctx);
 
-    if (set == NULL) {
-        return NULL;
+    RedisModuleKey *key = RedisModule_OpenKey(ctx, argv[1],
+        REDISMODULE_READ | REDISMODULE_WRITE);
+    int type = RedisModule_KeyType(key);
+    if (type == REDISMODULE_KEYTYPE_EMPTY) {
+    	return RedisModule_ReplyWithError(ctx, "ERR invalid key: not an existing trie");
+    }
+    else if (RedisModule_ModuleTypeGetType(key) != trie)
+    {
+        return RedisModule_ReplyWithError(ctx,REDISMODULE_ERRORMSG_WRONGTYPE);
     }
 
-    if (suggestions(set, t, "", str, max_edits, n) != EXIT_SUCCESS) {
-        // suggestions() failed
-
-        for (i = 0; i < n; i++) {
-            if (set[i] != NULL) {
-                RedisModule_Free(set[i]->str);
-                RedisModule_Free(set[i]);
-            }
-        }
+    size_t len;
+    const char *pre = RedisModule_StringPtrLen(argv[2], &len);
 
-        RedisModule_Free(set);
+    struct trie *t;
+    t = trie_key_root(key);
 
-        return NULL;
-    }
+    /* Check for number of completions */
+    int c = trie_count_completion(t, pre, len);
 
-    return set;
+    RedisModule_ReplyWithLongLong(ctx, c); 
+    RedisModule_ReplicateVerbatim(ctx);
+    return REDISMODULE_OK;
 }
 
-/*
-    Takes an array of match_t*'s, sorts it, takes the highest n scoring strings out of it by
-    stripping off the match_t wrapper
-  
-    Parameters:
-     - set: An array of match_t*'s
-     - n: the number of strings to return
-  
-    Returns:
-     - The first n strings with the smallest distance, where ties are broken by alphabetical order.
-       If there aren't enough matching strings, each remaining spot is set to NULL.
-     - NULL if there was an error
- */
-char** suggestion_set_first_n(match_t **set, int n)
-{
-    assert(set != NULL);
+/* TRIE.COMPLETE key prefix [LIMIT n] [CURSOR c] */
+int TrieComplete_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv, 
+        int argc) {
+    RedisModule_AutoMemory(ctx); /* Use automatic memory management. */
 
-    int i;
+    if (argc < 3 || argc % 2 == 0) 
+        return RedisModule_WrongArity(ctx);
 
-    char **results = (char**)RedisModule_Alloc(sizeof(char*) * n);
-    if (results == NULL) {
-        return NULL;
-    }
+    /* No limit unless one is given */
+    long long limit = -1;
+    const char *cursor = NULL;
+    size_t cursor_len = 0;
 
-    qsort(set, n, sizeof(match_t*), cmp_match);
+    for (int i = 3; i < argc; i += 2) {
+        size_t len;
+        const char *opt = RedisModule_StringPtrLen(argv[i], &len);
 
-    // Take the list of strings out of the match_t wrappers
-    for (i = 0; i < n; i++) {
-        if (set[i] == NULL) {
-            results[i] = NULL;
-        } else {
-            results[i] = set[i]->str;
-            RedisModule_Free(set[i]);
+        if (strcasecmp(opt, "limit") == 0) {
+            if (RedisModule_StringToLongLong(argv[i + 1], &limit) 
+                    == REDISMODULE_ERR || limit <= 0)
+                return RedisModule_ReplyWithError(ctx, 
+                    "ERR LIMIT must be a positive integer");
         }
+        else if (strcasecmp(opt, "cursor") == 0) {
+            cursor = RedisModule_StringPtrLen(argv[i + 1], &cursor_len);
+        }
+        else {
+            return RedisModule_ReplyWithError(ctx, "ERR syntax error");
+        }
+    }
+
+    RedisModuleKey *key = RedisModule_OpenKey(ctx, argv[1], REDISMODULE_READ);
+    int type = RedisModule_KeyType(key);
+    if (type == REDISMODULE_KEYTYPE_EMPTY) {
+        return RedisModule_ReplyWithArray(ctx, 0);
+    }
+    else if (RedisModule_ModuleTypeGetType(key) != trie)
+    {
+        return RedisModule_ReplyWithError(ctx, REDISMODULE_ERRORMSG_WRONGTYPE);
     }
 
-    RedisModule_Free(set);
+    struct trie *t;
+    t = trie_key_root(key);
 
-    return results;
+    size_t pre_len;
+    const char *pre = RedisModule_StringPtrLen(argv[2], &pre_len);
+
+    struct trie_iter *it = trie_iter_new(t, pre, pre_len, cursor, cursor_len);
+    if (it == NULL)
+        return RedisModule_ReplyWithError(ctx, "ERR out of memory");
+
+    /* 
+       Words go out as they are found, so the length of the reply is 
+       only known at the end
+     */
+    RedisModule_ReplyWithArray(ctx, REDISMODULE_POSTPONED_ARRAY_LEN);
+
+    long count = 0;
+    char *word;
+    size_t len;
+    while ((limit < 0 || count < limit) 
+            && (word = trie_iter_next(it, &len)) != NULL) {
+        RedisModule_ReplyWithStringBuffer(ctx, word, len);
+        count++;
+    }
+
+    RedisModule_ReplySetArrayLength(ctx, count);
+    trie_iter_free(it);
+    return REDISMODULE_OK;
 }
 
-/*
-    Returns the n closest words to a given string in a trie. First creates a match_t* array with 
-    suggestion_set_new(), then passes it into suggestion_set_first_n() to sort it and strips the 
-    strings of their match_t wrappers.
-  
-    Parameters:
-     - t: A trie. Must point to a trie allocated with trie_new
-     - str: A string. This will be the (misspelled) word to match
-     - max_edits: the maximum levenshtein distance the words in the set can have
-     - n: the number of strings to return. 
-  
-    Returns:
-     - The first n strings with the smallest distance, where ties are broken by alphabetical order.
-       If there aren't enough matching strings, each remaining spot is set to NULL.
-     - NULL if there was an error
- */
-char** suggestion_list(struct trie *t, char *str, int max_edits, int n) {
+/* TRIE.TOPK key prefix k */
+int TrieTopK_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv, 
+        int argc) {
+    RedisModule_AutoMemory(ctx); /* Use automatic memory management. */
 
-    assert(t != NULL);
-    assert(str != NULL);
+    if (argc != 4) 
+        return RedisModule_WrongArity(ctx);
 
-    match_t **set = suggestion_set_new(t, str, max_edits, n);
+    long long k;
+    if (RedisModule_StringToLongLong(argv[3], &k) == REDISMODULE_ERR 
+            || k <= 0)
+        return RedisModule_ReplyWithError(ctx, 
+            "ERR k must be a positive integer");
 
-    if (set == NULL) {
-        return NULL;
+    RedisModuleKey *key = RedisModule_OpenKey(ctx, argv[1], REDISMODULE_READ);
+    int type = RedisModule_KeyType(key);
+    if (type == REDISMODULE_KEYTYPE_EMPTY) {
+        return RedisModule_ReplyWithArray(ctx, 0);
+    }
+    else if (RedisModule_ModuleTypeGetType(key) != trie)
+    {
+        return RedisModule_ReplyWithError(ctx, REDISMODULE_ERRORMSG_WRONGTYPE);
     }
 
-    char **results = suggestion_set_first_n(set, n);
+    struct trie *t;
+    t = trie_key_root(key);
 
-    return results;
-}    
+    size_t pre_len;
+    const char *pre = RedisModule_StringPtrLen(argv[2], &pre_len);
 
-/* ===== "trie" type commands (Redis wrapper functions) ===== */
+    /* There is no point making room for more words than the trie has */
+    if (k > t->word_count)
+        k = t->word_count;
 
-/* TRIE.INSERT key value1 value2... valueN */
-int TrieInsert_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv, 
+    struct trie *found[TRIE_TOPK];
+    struct trie **out = found;
+    if (k > TRIE_TOPK)
+        out = trie_mem_calloc(k, sizeof(struct trie *));
+
+    int n = trie_topk(t, pre, pre_len, k, out);
+
+    /* One buffer for every word, grown when a longer one comes along */
+    size_t size = MAXLEN;
+    char *buf = trie_mem_alloc(size);
+
+    RedisModule_ReplyWithArray(ctx, n);
+    for (int i = 0; i < n; i++) {
+        size_t len = trie_node_word(out[i], buf, size);
+        if (len >= size) {
+            size = len + 1;
+            buf = trie_mem_realloc(buf, size);
+            trie_node_word(out[i], buf, size);
+        }
+        RedisModule_ReplyWithStringBuffer(ctx, buf, len);
+    }
+
+    trie_mem_free(buf);
+    if (out != found)
+        trie_mem_free(out);
+    return REDISMODULE_OK;
+}
+
+/* TRIE.FUZZYCOMPLETE key prefix [EDITS k] [LIMIT n] */
+int TrieFuzzyComplete_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv, 
         int argc) {
     RedisModule_AutoMemory(ctx); /* Use automatic memory management. */
-    
-    if (argc <= 2) 
+
+    if (argc < 3 || argc % 2 == 0) 
         return RedisModule_WrongArity(ctx);
 
-	RedisModuleKey *key = RedisModule_OpenKey(ctx, argv[1],
-        REDISMODULE_READ | REDISMODULE_WRITE);
+    /* A typo or so in what has been typed, and a screenful of words */
+    long long medits = 1;
+    long long limit = TRIE_TOPK;
+
+    for (int i = 3; i < argc; i += 2) {
+        size_t len;
+        const char *opt = RedisModule_StringPtrLen(argv[i], &len);
+
+        if (strcasecmp(opt, "edits") == 0) {
+            if (RedisModule_StringToLongLong(argv[i + 1], &medits) 
+                    == REDISMODULE_ERR || medits < 0)
+                return RedisModule_ReplyWithError(ctx, 
+                    "ERR EDITS must be a non-negative integer");
+        }
+        else if (strcasecmp(opt, "limit") == 0) {
+            if (RedisModule_StringToLongLong(argv[i + 1], &limit) 
+                    == REDISMODULE_ERR || limit <= 0)
+                return RedisModule_ReplyWithError(ctx, 
+                    "ERR LIMIT must be a positive integer");
+        }
+        else {
+            return RedisModule_ReplyWithError(ctx, "ERR syntax error");
+        }
+    }
+
+    RedisModuleKey *key = RedisModule_OpenKey(ctx, argv[1], REDISMODULE_READ);
     int type = RedisModule_KeyType(key);
-	if (type != REDISMODULE_KEYTYPE_EMPTY &&
-        RedisModule_ModuleTypeGetType(key) != trie)
+    if (type == REDISMODULE_KEYTYPE_EMPTY) {
+        return RedisModule_ReplyWithArray(ctx, 0);
+    }
+    else if (RedisModule_ModuleTypeGetType(key) != trie)
     {
         return RedisModule_ReplyWithError(ctx, REDISMODULE_ERRORMSG_WRONGTYPE);
     }
-    size_t dummy;
-    /* Number of strings to be inserted */
-    int nstrings = argc - 2;
-    char *empty = "";
-    char **temp = RedisModule_Calloc(nstrings, sizeof(char*));
-    for (int i = 0; i < nstrings; i++) {
-        temp[i] = strdup(RedisModule_StringPtrLen(argv[2 + i], &dummy));
-        if (temp[i] == NULL || strcmp(temp[i], empty) == 0) {
-            return RedisModule_ReplyWithError(ctx, "ERR invalid value: must be a string");
-        } 
-    } 
-    
+
     struct trie *t;
-    /* Create an empty value object if the key is currently empty. */
-    if (type == REDISMODULE_KEYTYPE_EMPTY) {
-    	t = trie_new('\0');
-    	RedisModule_ModuleTypeSetValue(key, trie, t);
-    } else {
-        t = RedisModule_ModuleTypeGetValue(key);
+    t = trie_key_root(key);
+
+    /* There is no point making room for more words than the trie has */
+    if (limit > t->word_count)
+        limit = t->word_count;
+
+    size_t pre_len;
+    const char *pre = RedisModule_StringPtrLen(argv[2], &pre_len);
+    if (!trie_key_indexable(pre, pre_len))
+        return RedisModule_ReplyWithError(ctx, "ERR invalid prefix: must not hold NUL bytes");
+
+    struct trie **out = trie_mem_calloc(limit + 1, sizeof(struct trie *));
+    int *edits = trie_mem_calloc(limit + 1, sizeof(int));
+    int n = suggestion_complete(t, (char *)pre, medits, limit, out, edits);
+
+    if (n < 0) {
+        trie_mem_free(out);
+        trie_mem_free(edits);
+        return RedisModule_ReplyWithError(ctx, "ERR out of memory");
     }
 
-    /* Total return value (from all trie_insert_string calls) */
-    long long total = 0;
-    /* Insert the new string. */
-    for (int i = 0; i < nstrings; i++) {
-        total += trie_insert_string(t, temp[i]);
+    /* One buffer for every word, grown when a longer one comes along */
+    size_t size = MAXLEN;
+    char *buf = trie_mem_alloc(size);
+
+    RedisModule_ReplyWithArray(ctx, n);
+    for (int i = 0; i < n; i++) {
+        size_t len = trie_node_word(out[i], buf, size);
+        if (len >= size) {
+            size = len + 1;
+            buf = trie_mem_realloc(buf, size);
+            trie_node_word(out[i], buf, size);
+        }
+        RedisModule_ReplyWithStringBuffer(ctx, buf, len);
     }
-    RedisModule_Free(temp);
 
-	RedisModule_ReplyWithLongLong(ctx, total);    
-	RedisModule_ReplicateVerbatim(ctx);
+    trie_mem_free(buf);
+    trie_mem_free(out);
+    trie_mem_free(edits);
     return REDISMODULE_OK;
 }
 
-/* TRIE.CONTAINS key value */
-int TrieContains_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv, 
+/*
+    Removes the words of a TRIE.DEL from k and its indexes, and returns how
+    many were in it
+ */
+static long long trie_key_remove(struct trie_key *k, RedisModuleString **argv,
+                                 int argc)
+{
+    struct trie *t = k->root;
+
+    /* Number of words that were actually in the trie */
+    long long removed = 0;
+    size_t dummy;
+    size_t used = trie_mem_used, nodes = trie_mem_nodes;
+    for (int i = 2; i < argc; i++) {
+        const char *word = RedisModule_StringPtrLen(argv[i], &dummy);
+        if (trie_remove_string(t, word, dummy) == IN_TRIE) {
+            removed++;
+            if (!trie_key_indexable(word, dummy))
+                continue;
+            if (k->index != NULL)
+                symspell_remove(k->index, (char *)word);
+            if (k->grams != NULL)
+                qgram_remove(k->grams, (char *)word);
+        }
+    }
+    trie_key_charge(k, used, nodes);
+
+    return removed;
+}
+
+/* TRIE.DEL key value1 value2... valueN */
+int TrieDel_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv, 
         int argc) {
     RedisModule_AutoMemory(ctx); /* Use automatic memory management. */
 
-    if (argc != 3) 
+    if (argc <= 2) 
         return RedisModule_WrongArity(ctx);
 
     RedisModuleKey *key = RedisModule_OpenKey(ctx, argv[1],
         REDISMODULE_READ | REDISMODULE_WRITE);
     int type = RedisModule_KeyType(key);
     if (type == REDISMODULE_KEYTYPE_EMPTY) {
-    	return RedisModule_ReplyWithError(ctx, "ERR invalid key: not an existing trie");
+        return RedisModule_ReplyWithLongLong(ctx, 0);
     }
     else if (RedisModule_ModuleTypeGetType(key) != trie)
     {
-        return RedisModule_ReplyWithError(ctx,REDISMODULE_ERRORMSG_WRONGTYPE);
+        return RedisModule_ReplyWithError(ctx, REDISMODULE_ERRORMSG_WRONGTYPE);
     }
-    size_t dummy;
-    char *temp = strdup(RedisModule_StringPtrLen(argv[2], &dummy));
 
-    struct trie *t;
-    t = RedisModule_ModuleTypeGetValue(key);
+    struct trie_key *k = RedisModule_ModuleTypeGetValue(key);
 
-    /* Check for the string. */
-    int c = trie_search(t, temp);
-    
-    RedisModule_ReplyWithLongLong(ctx, c);      
-    RedisModule_ReplicateVerbatim(ctx);
-    return REDISMODULE_OK;
+    return trie_key_write(ctx, k, trie_key_remove, argv, argc);
 }
 
-/* TRIE.COMPLETIONS key value */
-int TrieCompletions_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv, 
-        int argc) {
-    RedisModule_AutoMemory(ctx); /* Use automatic memory management. */
-
-    if (argc != 3) 
-        return RedisModule_WrongArity(ctx);
-
-    RedisModuleKey *key = RedisModule_OpenKey(ctx, argv[1],
-        REDISMODULE_READ | REDISMODULE_WRITE);
-
-    size_t dummy;
-    char *temp = strdup(RedisModule_StringPtrLen(argv[2], &dummy));
+/* Replies to a TRIE.APPROXMATCH client once the pool has unblocked it */
+int TrieApproxMatch_Reply(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
+{
+    (void)argv;
+    (void)argc;
 
-    struct trie *t;
-    t = RedisModule_ModuleTypeGetValue(key);
+    return trie_job_reply(ctx, RedisModule_GetBlockedClientPrivateData(ctx));
+}
 
-    /* Check for number of completions */
-    int c = trie_count_completion(t, temp);
+/* Hands the key what the job built, and lets go of it, on the main thread */
+void TrieApproxMatch_Free(RedisModuleCtx *ctx, void *privdata)
+{
+    struct trie_job *job = privdata;
 
-    RedisModule_ReplyWithLongLong(ctx, c); 
-    RedisModule_ReplicateVerbatim(ctx);
-    return REDISMODULE_OK;
+    (void)ctx;
+    trie_job_publish(job, 1);
+    trie_key_release(job->k);
+    trie_job_free(job);
 }
 
-/* TRIE.APPROXMATCH key prefix (optional)max_edit_distance (optional)num_matches */
+/* 
+   TRIE.APPROXMATCH key prefix [max_edit_distance [num_matches]] 
+       [ENGINE DP|BESTFIRST|DEPTHFIRST|SYMSPELL|QGRAM]
+ */
 int TrieApproxMatch_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv, 
         int argc) {
     RedisModule_AutoMemory(ctx); /* Use automatic memory management. */
 
-    if (argc <= 2 || argc >= 6) {
+    if (argc <= 2 || argc >= 8) {
         return RedisModule_WrongArity(ctx);
     }
 
-    RedisModuleKey *key = RedisModule_OpenKey(ctx, argv[1],
-        REDISMODULE_READ | REDISMODULE_WRITE);
+    RedisModuleKey *key = RedisModule_OpenKey(ctx, argv[1], REDISMODULE_READ);
 
     int type = RedisModule_KeyType(key);
     if (type == REDISMODULE_KEYTYPE_EMPTY) {
@@ -949,16 +6177,45 @@ int TrieApproxMatch_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv,
     }
 
     size_t dummy;
-    char *temp = strdup(RedisModule_StringPtrLen(argv[2], &dummy));
+    const char *str = RedisModule_StringPtrLen(argv[2], &dummy);
+    if (!trie_key_indexable(str, dummy)) {
+        return RedisModule_ReplyWithError(ctx, "ERR invalid prefix: must not hold NUL bytes");
+    }
     /* Default max number of edits */
     long long medits = 2;
     /* Default amount of matches (strings) to return */
     long long amount = 10;
+    /* Picked from the number of edits unless one is asked for */
+    int engine = -1;
+
+    /* The numbers come first, then the engine */
+    int nargs = argc;
+    if (argc >= 5 && strcasecmp(RedisModule_StringPtrLen(argv[argc - 2], &dummy),
+            "engine") == 0) {
+        const char *name = RedisModule_StringPtrLen(argv[argc - 1], &dummy);
+
+        if (strcasecmp(name, "dp") == 0)
+            engine = SUGGEST_DP;
+        else if (strcasecmp(name, "bestfirst") == 0)
+            engine = SUGGEST_BEST_FIRST;
+        else if (strcasecmp(name, "depthfirst") == 0)
+            engine = SUGGEST_DEPTH_FIRST;
+        else if (strcasecmp(name, "symspell") == 0)
+            engine = SUGGEST_SYMSPELL;
+        else if (strcasecmp(name, "qgram") == 0)
+            engine = SUGGEST_QGRAM;
+        else
+            return RedisModule_ReplyWithError(ctx, "ERR unknown engine");
+        nargs -= 2;
+    }
+    if (nargs >= 6) {
+        return RedisModule_WrongArity(ctx);
+    }
 
     /* Check for optional arguments */
-    if (argc == 4) {
+    if (nargs == 4) {
         RedisModule_StringToLongLong(argv[3], &medits);
-    } else if (argc == 5) {
+    } else if (nargs == 5) {
         RedisModule_StringToLongLong(argv[3], &medits);
         RedisModule_StringToLongLong(argv[4], &amount);
     }
@@ -970,50 +6227,627 @@ int TrieApproxMatch_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv,
         return RedisModule_ReplyWithError(ctx, "ERR invalid max number of edits: cannot be less than 0");
     }
 
-    /* Get the trie */
-    struct trie *t;
-    t = RedisModule_ModuleTypeGetValue(key);
-    /* Find the approximate matches */
-    char** matches = suggestion_list(t, temp, medits, amount);
+    /* Past a few edits the trie engines reach most of the trie */
+    if (engine < 0) {
+        engine = medits >= SUGGEST_QGRAM_EDITS ? SUGGEST_QGRAM : SUGGEST_DP;
+    }
 
-    RedisModule_ReplyWithArray(ctx, amount);
-    for (int i = 0; i < amount; i++) {
-    	if (matches[i] == NULL) {
-    		RedisModule_ReplyWithNull(ctx);
-    	}
-    	else {
-        	RedisModule_ReplyWithSimpleString(ctx, matches[i]);
-        }
+    struct trie_key *k = RedisModule_ModuleTypeGetValue(key);
+    struct trie_job *job = trie_mem_calloc(1, sizeof(struct trie_job));
+    if (job == NULL) {
+        return RedisModule_ReplyWithError(ctx, "ERR out of memory");
     }
-    RedisModule_ReplicateVerbatim(ctx);
+    job->k = k;
+    job->str = (char *)str;
+    job->max_edits = medits;
+    job->n = amount;
+    job->engine = engine;
+
+    /*
+       Find the approximate matches on the worker pool if the client can
+       wait, behind any write waiting for the searches of the key. The
+       indexes are built by the first query that needs one, and again for
+       more edits than the symmetric delete one was built for. That one
+       costs memory for every delete of every word, so only keys that ask
+       for it get one. The indexes are only a cache of the trie, so the
+       query is not replicated: replicas build their own.
+     */
+    if (trie_can_block(ctx)) {
+        /* The worker reads the argument itself, so it has to outlive the call */
+        job->query = argv[2];
+        RedisModule_RetainString(NULL, job->query);
+        job->bc = RedisModule_BlockClient(ctx, TrieApproxMatch_Reply, NULL,
+                                          TrieApproxMatch_Free, 0);
+        if (k->waiting != NULL)
+            trie_key_queue(k, job);
+        else
+            trie_job_dispatch(job);
+        return REDISMODULE_OK;
+    }
+
+    trie_job_prepare(job, false);
+    trie_job_run(job);
+    trie_job_publish(job, 0);
+    trie_job_reply(ctx, job);
+    trie_job_free(job);
     return REDISMODULE_OK;  
 }
 
 /* ===== "trie" type methods (Redis data saving and entry functions) ===== */
 
+/*
+    RDB format of a TRIE key: the number of words, then the words in
+    lexicographic order packed into string chunks of about TRIE_RDB_CHUNK
+    bytes. Each word is stored front coded against the one before it:
+     - a varint of (shared << 1 | scored), where shared is the number of
+       leading characters the word has in common with the word before
+     - a varint of the number of characters after those, then the
+       characters themselves
+     - if scored, the score's 64 bits, lowest byte first
+    The symmetric delete and q-gram indexes are not saved; queries build
+    them again when they are first asked for.
+ */
+#define TRIE_ENCODING_VERSION 0
+#define TRIE_RDB_CHUNK (64 * 1024)
+
+/* A varint takes at most 10 bytes, and a score 8 */
+#define TRIE_RDB_OVERHEAD (2 * 10 + 8)
+
+/* A walk over the words of a trie in order, see trie_walk_words() */
+struct trie_walk {
+    /* The path from the root to the node being visited, reused throughout */
+    char *key;
+    size_t key_size;
+
+    /* How much of the path the next word has in common with the last one */
+    size_t shared;
+
+    /*
+       Called for every word: the node it ends on, the word (the first len
+       characters of key) and how many of those the word before had too.
+       Stops the walk by returning non-zero.
+     */
+    int (*word)(void *arg, struct trie *t, char *key, size_t len, size_t shared);
+    void *arg;
+};
+
+/* Walks the words below t, whose path is len characters long, in order */
+static int trie_walk_words(struct trie_walk *w, struct trie *t, size_t len)
+{
+    struct trie *child;
+    int pos = 0;
+
+    if (t->is_word == 1) {
+        if (w->word(w->arg, t, w->key, len, w->shared) != 0)
+            return 1;
+        w->shared = len;
+    }
+
+    if (t->num_children > 0 && len + 1 > w->key_size) {
+        char *key = trie_mem_realloc(w->key, 2 * w->key_size);
+        if (key == NULL)
+            return 1;
+        w->key = key;
+        w->key_size *= 2;
+    }
+
+    while ((child = trie_next_child(t, &pos)) != NULL) {
+        w->key[len] = child->current;
+        if (trie_walk_words(w, child, len + 1) != 0)
+            return 1;
+
+        /* Whatever comes next parts from this child's words at len at most */
+        if (w->shared > len)
+            w->shared = len;
+    }
+
+    return 0;
+}
+
+/* State of TrieRdbSave() while it walks the trie */
+struct trie_rdb_writer {
+    RedisModuleIO *rdb;
+
+    /* The chunk being filled */
+    unsigned char *buf;
+    size_t used;
+    size_t size;
+};
+
+/* Appends v to the chunk as a varint, the room for it already made */
+static void trie_rdb_put_varint(struct trie_rdb_writer *w, uint64_t v)
+{
+    while (v >= 0x80) {
+        w->buf[w->used++] = (v & 0x7f) | 0x80;
+        v >>= 7;
+    }
+    w->buf[w->used++] = v;
+}
+
+/* Reads the varint at *pos of a chunk of len bytes, 1 if it runs off the end */
+static int trie_rdb_get_varint(unsigned char *data, size_t len, size_t *pos,
+                               uint64_t *v)
+{
+    int shift = 0;
+
+    *v = 0;
+    while (*pos < len && shift < 64) {
+        unsigned char b = data[(*pos)++];
+
+        *v |= (uint64_t)(b & 0x7f) << shift;
+        if ((b & 0x80) == 0)
+            return 0;
+        shift += 7;
+    }
+
+    return 1;
+}
+
+/* Sends the chunk filled so far to the RDB */
+static void trie_rdb_flush(struct trie_rdb_writer *w)
+{
+    if (w->used > 0)
+        RedisModule_SaveStringBuffer(w->rdb, (char *)w->buf, w->used);
+    w->used = 0;
+}
+
+/* Writes the word ending on t to the chunk, front coded, see trie_walk */
+static int trie_rdb_put_word(void *arg, struct trie *t, char *key, size_t len,
+                             size_t shared)
+{
+    struct trie_rdb_writer *w = arg;
+    size_t suffix = len - shared;
+    size_t need = w->used + suffix + TRIE_RDB_OVERHEAD;
+
+    /* A word longer than a chunk gets a chunk of its own */
+    if (need > w->size) {
+        unsigned char *buf = trie_mem_realloc(w->buf, need);
+        if (buf == NULL)
+            return 1;
+        w->buf = buf;
+        w->size = need;
+    }
+
+    trie_rdb_put_varint(w, (uint64_t)shared << 1 | (t->score != 0));
+    trie_rdb_put_varint(w, suffix);
+    memcpy(w->buf + w->used, key + shared, suffix);
+    w->used += suffix;
+
+    if (t->score != 0) {
+        uint64_t bits;
+
+        memcpy(&bits, &t->score, sizeof(bits));
+        for (int i = 0; i < 8; i++)
+            w->buf[w->used++] = bits >> (8 * i);
+    }
+
+    if (w->used >= TRIE_RDB_CHUNK)
+        trie_rdb_flush(w);
+
+    return 0;
+}
+
+void TrieRdbSave(RedisModuleIO *rdb, void *value)
+{
+    struct trie_key *k = value;
+    struct trie_rdb_writer w = {
+        .rdb = rdb,
+        .size = TRIE_RDB_CHUNK + TRIE_RDB_OVERHEAD
+    };
+    struct trie_walk walk = {
+        .key_size = MAXLEN,
+        .shared = 0,
+        .word = trie_rdb_put_word,
+        .arg = &w
+    };
+
+    w.buf = trie_mem_alloc(w.size);
+    walk.key = trie_mem_alloc(walk.key_size);
+
+    RedisModule_SaveUnsigned(rdb, k->root->word_count);
+    if (trie_walk_words(&walk, k->root, 0) != 0)
+        RedisModule_LogIOError(rdb, "warning", "Out of memory saving a trie");
+    trie_rdb_flush(&w);
+
+    trie_mem_free(w.buf);
+    trie_mem_free(walk.key);
+}
+
+/*
+    Adds w to a list of the best words like trie_rank_insert(), for words
+    offered in lexicographic order: a word ranks below every word of the
+    same score already on the list, so only scores are compared.
+
+    Returns whether w made it into the list.
+ */
+static bool trie_rdb_rank(struct trie **list, int *len, struct trie *w)
+{
+    int i = *len;
+
+    if (i == TRIE_TOPK) {
+        if (w->score <= list[TRIE_TOPK - 1]->score)
+            return false;
+        i--;
+    } else {
+        (*len)++;
+    }
+
+    for (; i > 0 && w->score > list[i - 1]->score; i--)
+        list[i] = list[i - 1];
+    list[i] = w;
+
+    return true;
+}
+
+/*
+    Fills in what trie_insert_string() would have kept up to date on t,
+    once every node below it is done: its word count, the characters
+    below it and its cached top words. Those come from its own word and
+    its children's lists like trie_topk_rebuild(), which are already in
+    lexicographic order.
+ */
+static int trie_rdb_finish(struct trie *t)
+{
+    struct trie *list[TRIE_TOPK];
+    struct trie *child;
+    int len = 0, pos = 0;
+
+    t->word_count = t->is_word;
+    if (t->is_word == 1)
+        trie_rdb_rank(list, &len, t);
+
+    while ((child = trie_next_child(t, &pos)) != NULL) {
+        unsigned char c = (unsigned char)child->current;
+
+        t->word_count += child->word_count;
+        for (int i = 0; i < 4; i++)
+            t->charlist[i] |= child->charlist[i];
+        t->charlist[c / 64] |= (uint64_t)1 << (c % 64);
+
+        for (int i = 0; i < child->topk_len; i++) {
+            if (!trie_rdb_rank(list, &len, child->topk[i]))
+                break;
+        }
+    }
+
+    if (len == 0)
+        return 0;
+
+    t->topk = trie_mem_alloc(len * sizeof(struct trie *));
+    if (t->topk == NULL)
+        return 1;
+
+    memcpy(t->topk, list, len * sizeof(struct trie *));
+    t->topk_len = len;
+
+    return 0;
+}
+
+/*
+    Builds the trie back from the words TrieRdbSave() wrote, bottom up.
+    The nodes on the path of the last word stay on a stack, so each word
+    only adds the nodes for its own suffix, and a node is finished once the
+    words have moved past it and its subtree is complete.
+ */
+void *TrieRdbLoad(RedisModuleIO *rdb, int encver)
+{
+    if (encver != TRIE_ENCODING_VERSION) {
+        RedisModule_LogIOError(rdb, "warning", "Can't load trie encoding version %d",
+            encver);
+        return NULL;
+    }
+
+    uint64_t count = RedisModule_LoadUnsigned(rdb);
+    uint64_t loaded = 0;
+    size_t used = trie_mem_used, nodes = trie_mem_nodes;
+    struct trie *root = trie_new('\0');
+    size_t depth = 0, path_size = MAXLEN + 1;
+    struct trie **path = trie_mem_alloc(path_size * sizeof(struct trie *));
+    unsigned char *chunk = NULL;
+    const char *problem = NULL;
+
+    if (root == NULL || path == NULL) {
+        RedisModule_LogIOError(rdb, "warning", "Out of memory loading a trie");
+        trie_mem_free(path);
+        if (root != NULL)
+            trie_free(root);
+        return NULL;
+    }
+    path[0] = root;
+
+    while (loaded < count && problem == NULL) {
+        size_t len, pos = 0;
+
+        /* TrieRdbSave() never writes an empty chunk */
+        chunk = (unsigned char *)RedisModule_LoadStringBuffer(rdb, &len);
+        if (chunk == NULL || len == 0) {
+            problem = "Truncated trie";
+            break;
+        }
+
+        while (pos < len && problem == NULL) {
+            uint64_t head, suffix;
+
+            if (trie_rdb_get_varint(chunk, len, &pos, &head) != 0
+                || trie_rdb_get_varint(chunk, len, &pos, &suffix) != 0
+                || suffix > len - pos
+                || ((head & 1) && len - pos - suffix < 8)) {
+                problem = "Truncated word in trie";
+                break;
+            }
+
+            uint64_t shared = head >> 1;
+            if (shared > depth || (suffix == 0 && loaded > 0)) {
+                problem = "Trie words out of order";
+                break;
+            }
+
+            while (depth > shared && problem == NULL) {
+                if (trie_rdb_finish(path[depth--]) != 0)
+                    problem = "Out of memory loading a trie";
+            }
+            if (problem != NULL)
+                break;
+
+            if (depth + suffix + 1 > path_size) {
+                struct trie **grown = trie_mem_realloc(path,
+                    2 * (depth + suffix + 1) * sizeof(struct trie *));
+                if (grown == NULL) {
+                    problem = "Out of memory loading a trie";
+                    break;
+                }
+                path = grown;
+                path_size = 2 * (depth + suffix + 1);
+            }
+
+            /* Words come in order, so a suffix always starts a new child */
+            if (suffix > 0 && trie_get_child(path[depth], chunk[pos]) != NULL) {
+                problem = "Trie words out of order";
+                break;
+            }
+
+            for (uint64_t i = 0; i < suffix; i++) {
+                char c = chunk[pos++];
+
+                if (trie_add_node(path[depth], c) != 0) {
+                    problem = "Out of memory loading a trie";
+                    break;
+                }
+                path[depth + 1] = trie_get_child(path[depth], c);
+                depth++;
+            }
+            if (problem != NULL)
+                break;
+
+            struct trie *end = path[depth];
+            end->is_word = 1;
+            if (head & 1) {
+                uint64_t bits = 0;
+
+                for (int i = 0; i < 8; i++)
+                    bits |= (uint64_t)chunk[pos++] << (8 * i);
+                memcpy(&end->score, &bits, sizeof(bits));
+            }
+            loaded++;
+        }
+
+        /* Redis allocated the chunk, so it was never counted */
+        RedisModule_Free(chunk);
+        chunk = NULL;
+    }
+
+    if (problem == NULL && loaded != count)
+        problem = "Trie holds more words than it says";
+
+    /* The words are done with the path of the last one as well */
+    while (problem == NULL && depth > 0) {
+        if (trie_rdb_finish(path[depth--]) != 0)
+            problem = "Out of memory loading a trie";
+    }
+    if (problem == NULL && trie_rdb_finish(root) != 0)
+        problem = "Out of memory loading a trie";
+
+    if (problem != NULL) {
+        RedisModule_LogIOError(rdb, "warning", "%s", problem);
+        if (chunk != NULL)
+            RedisModule_Free(chunk);
+        trie_mem_free(path);
+        trie_free(root);
+        return NULL;
+    }
+
+    trie_mem_free(path);
+
+    struct trie_key *k = trie_mem_calloc(1, sizeof(struct trie_key));
+    if (k == NULL) {
+        RedisModule_LogIOError(rdb, "warning", "Out of memory loading a trie");
+        trie_free(root);
+        return NULL;
+    }
+    k->root = root;
+    trie_key_charge(k, used, nodes);
+    return k;
+}
+
+/*
+    Words per TRIE.INSERT in a rewritten AOF, set with the AOF_BATCH
+    module argument. Bigger batches make the file smaller and replay
+    faster, at the cost of larger commands.
+ */
+#define TRIE_AOF_BATCH 1000
+static long long trie_aof_batch = TRIE_AOF_BATCH;
+
+/* State of TrieAofRewrite() while it walks the trie */
+struct trie_aof_writer {
+    RedisModuleIO *aof;
+    RedisModuleString *name;
+
+    /* Words without a score, for a plain TRIE.INSERT */
+    RedisModuleString **words;
+    size_t num_words;
+
+    /* Scores and words in turn, for TRIE.INSERT ... WITHSCORES */
+    RedisModuleString **scored;
+    size_t num_scored;
+};
+
+/* Emits one TRIE.INSERT for the strings in args, and frees them */
+static void trie_aof_flush(struct trie_aof_writer *w, RedisModuleString **args,
+                           size_t *n, bool scored)
+{
+    if (*n == 0)
+        return;
+
+    if (scored)
+        RedisModule_EmitAOF(w->aof, "TRIE.INSERT", "scv", w->name, "WITHSCORES", args, *n);
+    else
+        RedisModule_EmitAOF(w->aof, "TRIE.INSERT", "sv", w->name, args, *n);
+
+    for (size_t i = 0; i < *n; i++)
+        RedisModule_FreeString(NULL, args[i]);
+    *n = 0;
+}
+
+/* Adds the word ending on t to its batch, see trie_walk */
+static int trie_aof_put_word(void *arg, struct trie *t, char *key, size_t len,
+                             size_t shared)
+{
+    struct trie_aof_writer *w = arg;
+
+    REDISMODULE_NOT_USED(shared);
+
+    /* TRIE.INSERT takes no empty words, so none can be in the trie */
+    if (len == 0)
+        return 0;
+
+    /* A plain TRIE.INSERT would take this word for its flag */
+    bool flag = len == 10 && strncasecmp(key, "withscores", 10) == 0;
+
+    if (t->score == 0 && !flag) {
+        w->words[w->num_words++] = RedisModule_CreateString(NULL, key, len);
+        if (w->num_words == (size_t)trie_aof_batch)
+            trie_aof_flush(w, w->words, &w->num_words, false);
+    } else {
+        /* Printed with enough digits to read back the same double */
+        w->scored[w->num_scored++] = RedisModule_CreateStringPrintf(NULL, "%.17g",
+            t->score);
+        w->scored[w->num_scored++] = RedisModule_CreateString(NULL, key, len);
+        if (w->num_scored == 2 * (size_t)trie_aof_batch)
+            trie_aof_flush(w, w->scored, &w->num_scored, true);
+    }
+
+    return 0;
+}
+
+/*
+    Writes a TRIE key to a rewritten AOF as TRIE.INSERT commands of up to
+    trie_aof_batch words each, walking the trie once with one key buffer
+ */
+void TrieAofRewrite(RedisModuleIO *aof, RedisModuleString *key, void *value)
+{
+    struct trie_key *k = value;
+    struct trie_aof_writer w = {
+        .aof = aof,
+        .name = key
+    };
+    struct trie_walk walk = {
+        .key_size = MAXLEN,
+        .shared = 0,
+        .word = trie_aof_put_word,
+        .arg = &w
+    };
+
+    w.words = trie_mem_alloc(trie_aof_batch * sizeof(RedisModuleString *));
+    w.scored = trie_mem_alloc(2 * trie_aof_batch * sizeof(RedisModuleString *));
+    walk.key = trie_mem_alloc(walk.key_size);
+
+    if (trie_walk_words(&walk, k->root, 0) != 0)
+        RedisModule_LogIOError(aof, "warning", "Out of memory rewriting a trie");
+    trie_aof_flush(&w, w.words, &w.num_words, false);
+    trie_aof_flush(&w, w.scored, &w.num_scored, true);
+
+    trie_mem_free(w.words);
+    trie_mem_free(w.scored);
+    trie_mem_free(walk.key);
+}
+
+/* Frees a TRIE key, its trie and whichever indexes it has */
+void TrieFree(void *value)
+{
+    struct trie_key *k = value;
+
+    /* A key the pool still reads is freed by the last of its jobs */
+    pthread_mutex_lock(&trie_pool_lock);
+    bool busy = k->readers > 0;
+    k->doomed = busy;
+    pthread_mutex_unlock(&trie_pool_lock);
+
+    if (!busy)
+        trie_key_free(k);
+}
+
+/*
+    How much work freeing a TRIE key is, one unit per trie node. Past
+    LAZYFREE_THRESHOLD (64) UNLINK, and DEL under lazyfree-lazy-user-del,
+    hand the key to Redis' lazy free thread so TrieFree() runs there.
+ */
+size_t TrieFreeEffort(RedisModuleString *key, const void *value)
+{
+    const struct trie_key *k = value;
+
+    (void)key;
+    return k->nodes;
+}
+
+/* MEMORY USAGE of a TRIE key, kept up to date by the commands */
+size_t TrieMemUsage(const void *value)
+{
+    const struct trie_key *k = value;
+
+    return k->bytes;
+}
+
 /* This function must be present on each Redis module. It is used in order to
  * register the commands into the Redis server. 
  */
 
 int RedisModule_OnLoad(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
-    REDISMODULE_NOT_USED(argv);
-    REDISMODULE_NOT_USED(argc);
-
     if (RedisModule_Init(ctx, "trie123az", 1, REDISMODULE_APIVER_1)
         == REDISMODULE_ERR) 
         return REDISMODULE_ERR;
 
+    /* MODULE LOAD path/to/trie.so [AOF_BATCH n] [WORKERS n] */
+    for (int i = 0; i < argc; i += 2) {
+        size_t len;
+        const char *opt = RedisModule_StringPtrLen(argv[i], &len);
+
+        if (i + 1 < argc && strcasecmp(opt, "aof_batch") == 0) {
+            if (RedisModule_StringToLongLong(argv[i + 1], &trie_aof_batch)
+                    == REDISMODULE_ERR || trie_aof_batch <= 0)
+                return REDISMODULE_ERR;
+        }
+        else if (i + 1 < argc && strcasecmp(opt, "workers") == 0) {
+            if (RedisModule_StringToLongLong(argv[i + 1], &trie_workers)
+                    == REDISMODULE_ERR || trie_workers < 0)
+                return REDISMODULE_ERR;
+        }
+        else {
+            return REDISMODULE_ERR;
+        }
+    }
+
     RedisModuleTypeMethods tm = {
         .version = REDISMODULE_TYPE_METHOD_VERSION,
-        .rdb_load = NULL,
-        .rdb_save = NULL,
-        .aof_rewrite = NULL,
-        .mem_usage = NULL,
-        .free = NULL,
-        .digest = NULL
+        .rdb_load = TrieRdbLoad,
+        .rdb_save = TrieRdbSave,
+        .aof_rewrite = TrieAofRewrite,
+        .mem_usage = TrieMemUsage,
+        .free = TrieFree,
+        .digest = NULL,
+        .free_effort = TrieFreeEffort
     };
 
-    trie = RedisModule_CreateDataType(ctx, "trie123az", 0, &tm);
+    trie = RedisModule_CreateDataType(ctx, "trie123az", TRIE_ENCODING_VERSION, &tm);
     if (trie == NULL) 
         return REDISMODULE_ERR;
 
@@ -1025,13 +6859,51 @@ int RedisModule_OnLoad(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
         TrieContains_RedisCommand, "readonly", 1, 1, 1) == REDISMODULE_ERR)
         return REDISMODULE_ERR;
 
+    if (RedisModule_CreateCommand(ctx, "trie.mcontains",
+        TrieMContains_RedisCommand, "readonly", 1, 1, 1) == REDISMODULE_ERR)
+        return REDISMODULE_ERR;
+
     if (RedisModule_CreateCommand(ctx, "trie.completions",
         TrieCompletions_RedisCommand, "readonly", 1, 1, 1) == REDISMODULE_ERR)
         return REDISMODULE_ERR;    
 
+    if (RedisModule_CreateCommand(ctx, "trie.complete",
+        TrieComplete_RedisCommand, "readonly", 1, 1, 1) == REDISMODULE_ERR)
+        return REDISMODULE_ERR;
+
+    if (RedisModule_CreateCommand(ctx, "trie.topk",
+        TrieTopK_RedisCommand, "readonly", 1, 1, 1) == REDISMODULE_ERR)
+        return REDISMODULE_ERR;
+
+    if (RedisModule_CreateCommand(ctx, "trie.fuzzycomplete",
+        TrieFuzzyComplete_RedisCommand, "readonly", 1, 1, 1) == REDISMODULE_ERR)
+        return REDISMODULE_ERR;
+
+    if (RedisModule_CreateCommand(ctx, "trie.del",
+        TrieDel_RedisCommand, "write", 1, 1, 1) == REDISMODULE_ERR)
+        return REDISMODULE_ERR;
+
     if (RedisModule_CreateCommand(ctx, "trie.approxmatch",
-        TrieApproxMatch_RedisCommand, "write deny-oom", 1, 1, 1) == REDISMODULE_ERR)
+        TrieApproxMatch_RedisCommand, "readonly", 1, 1, 1) == REDISMODULE_ERR)
         return REDISMODULE_ERR;
 
+    /*
+       The pool starts last, so a module that fails to load leaves no
+       threads behind. With WORKERS 0, or if no thread can be started,
+       TRIE.APPROXMATCH runs on the main thread; otherwise it makes do
+       with the threads it got.
+     */
+    for (long long i = 0; i < trie_workers; i++) {
+        pthread_t thread;
+
+        if (pthread_create(&thread, NULL, trie_pool_worker, NULL) != 0) {
+            RedisModule_Log(ctx, "warning", "Started %lld of %lld trie workers",
+                i, trie_workers);
+            trie_workers = i;
+            break;
+        }
+        pthread_detach(thread);
+    }
+
     return REDISMODULE_OK;
 }
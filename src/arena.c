@@ -0,0 +1,176 @@
+/*
+	 A slab allocator for trie nodes
+*/
+
+#define _DEFAULT_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+#include <sys/mman.h>
+#include "arena.h"
+#include "utils.h"
+
+/* Room kept at the start of every mapping for its arena_slab_t */
+#define ARENA_HEADER \
+    ((sizeof(arena_slab_t) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+
+/* Rounds size up to its size class */
+static size_t arena_round(size_t size)
+{
+    if (size == 0)
+        size = 1;
+
+    return (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+}
+
+/*
+   Maps size bytes and links them into the slab list. Huge page slabs
+   are aligned to their own size, which is what the kernel needs to back
+   them with a single huge page.
+ */
+static arena_slab_t *arena_map(arena_t *a, size_t size, bool huge)
+{
+    size_t len = huge ? size * 2 : size;
+    char *p = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (p == MAP_FAILED) {
+        error("Could not map %zu bytes for arena slab", len);
+        return NULL;
+    }
+
+    if (huge) {
+        char *aligned = (char*)(((uintptr_t)p + size - 1) & ~(uintptr_t)(size - 1));
+
+        if (aligned > p)
+            munmap(p, aligned - p);
+        if (aligned + size < p + len)
+            munmap(aligned + size, (p + len) - (aligned + size));
+        p = aligned;
+
+#ifdef MADV_HUGEPAGE
+        madvise(p, size, MADV_HUGEPAGE);
+#endif
+    }
+
+    arena_slab_t *slab = (arena_slab_t*)p;
+    slab->size = size;
+    slab->prev = NULL;
+    slab->next = a->slabs;
+    if (a->slabs != NULL)
+        a->slabs->prev = slab;
+    a->slabs = slab;
+    a->num_slabs++;
+
+    return slab;
+}
+
+/* See arena.h */
+arena_t *arena_new(bool hugepages)
+{
+    arena_t *a = calloc(1, sizeof(arena_t));
+
+    if (a == NULL) {
+        error("Could not allocate memory for arena_t");
+        return NULL;
+    }
+
+    a->hugepages = hugepages;
+    a->slab_size = hugepages ? ARENA_HUGE_SLAB_SIZE : ARENA_SLAB_SIZE;
+
+    return a;
+}
+
+int arena_free(arena_t *a)
+{
+    assert(a != NULL);
+
+    arena_slab_t *slab = a->slabs;
+
+    while (slab != NULL) {
+        arena_slab_t *next = slab->next;
+        munmap(slab, slab->size);
+        slab = next;
+    }
+
+    free(a);
+
+    return EXIT_SUCCESS;
+}
+
+void *arena_alloc(arena_t *a, size_t size)
+{
+    assert(a != NULL);
+
+    size = arena_round(size);
+
+    /* Big allocations get a mapping of their own */
+    if (size > ARENA_MAX_SMALL) {
+        arena_slab_t *slab = arena_map(a, ARENA_HEADER + size, false);
+        if (slab == NULL)
+            return NULL;
+
+        a->bytes_used += size;
+        return (char*)slab + ARENA_HEADER;
+    }
+
+    void **list = &a->free_lists[size / ARENA_ALIGN - 1];
+
+    if (*list != NULL) {
+        void *p = *list;
+        *list = *(void**)p;
+        memset(p, 0, size);
+
+        a->bytes_used += size;
+        return p;
+    }
+
+    if (a->cur == NULL || (size_t)(a->end - a->cur) < size) {
+        /* Whatever is left of the old slab is too small to bother with */
+        arena_slab_t *slab = arena_map(a, a->slab_size, a->hugepages);
+        if (slab == NULL)
+            return NULL;
+
+        a->cur = (char*)slab + ARENA_HEADER;
+        a->end = (char*)slab + a->slab_size;
+    }
+
+    /* Fresh mappings are already zeroed */
+    void *p = a->cur;
+    a->cur += size;
+
+    a->bytes_used += size;
+    return p;
+}
+
+void arena_recycle(arena_t *a, void *ptr, size_t size)
+{
+    assert(a != NULL);
+
+    if (ptr == NULL)
+        return;
+
+    size = arena_round(size);
+    a->bytes_used -= size;
+
+    if (size > ARENA_MAX_SMALL) {
+        arena_slab_t *slab = (arena_slab_t*)((char*)ptr - ARENA_HEADER);
+
+        if (slab->prev != NULL)
+            slab->prev->next = slab->next;
+        else
+            a->slabs = slab->next;
+        if (slab->next != NULL)
+            slab->next->prev = slab->prev;
+
+        a->num_slabs--;
+        munmap(slab, slab->size);
+        return;
+    }
+
+    void **list = &a->free_lists[size / ARENA_ALIGN - 1];
+    *(void**)ptr = *list;
+    *list = ptr;
+}
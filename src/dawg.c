@@ -0,0 +1,453 @@
+/*
+	 A minimal deterministic acyclic word graph
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "dawg.h"
+#include "utils.h"
+
+/* Size of the register hash table at first, a power of two */
+#define DAWG_TABLE_SIZE 1024
+
+dawg_t *dawg_new(void)
+{
+    dawg_t *d = calloc(1, sizeof(dawg_t));
+
+    if (d == NULL) {
+        error("Could not allocate memory for dawg_t");
+        return NULL;
+    }
+
+    d->capacity = 16;
+    d->nodes = calloc(d->capacity, sizeof(dawg_node_t));
+    d->table_size = DAWG_TABLE_SIZE;
+    d->table = calloc(d->table_size, sizeof(int));
+    d->prev_size = 16;
+    d->prev = malloc(d->prev_size);
+    d->path = malloc(d->prev_size * sizeof(int));
+
+    if (d->nodes == NULL || d->table == NULL || d->prev == NULL
+        || d->path == NULL) {
+        error("Could not allocate memory for dawg_t");
+        dawg_free(d);
+        return NULL;
+    }
+
+    /* The root */
+    d->size = 1;
+    d->num_nodes = 1;
+    d->path[0] = DAWG_ROOT;
+
+    return d;
+}
+
+/* Hands out the id of a new, empty node, or DAWG_NONE */
+static int dawg_new_node(dawg_t *d)
+{
+    int id;
+
+    if (d->num_free > 0) {
+        id = d->free_ids[--d->num_free];
+    } else {
+        if (d->size == d->capacity) {
+            dawg_node_t *nodes = realloc(d->nodes,
+                2 * d->capacity * sizeof(dawg_node_t));
+            if (nodes == NULL) {
+                error("Could not allocate memory for dawg nodes");
+                return DAWG_NONE;
+            }
+            d->nodes = nodes;
+            d->capacity *= 2;
+        }
+        id = d->size++;
+    }
+
+    memset(&d->nodes[id], 0, sizeof(dawg_node_t));
+    d->num_nodes++;
+
+    return id;
+}
+
+/* Frees a node that has been merged with an equal one */
+static void dawg_free_node(dawg_t *d, int id)
+{
+    dawg_node_t *n = &d->nodes[id];
+
+    free(n->labels);
+    free(n->targets);
+    memset(n, 0, sizeof(dawg_node_t));
+    d->num_nodes--;
+
+    if (d->num_free == d->free_size) {
+        int size = d->free_size == 0 ? 16 : 2 * d->free_size;
+        int *ids = realloc(d->free_ids, size * sizeof(int));
+
+        /* Without room to remember it the id is simply never reused */
+        if (ids == NULL)
+            return;
+        d->free_ids = ids;
+        d->free_size = size;
+    }
+
+    d->free_ids[d->num_free++] = id;
+}
+
+/* Adds an edge after every existing one of node */
+static int dawg_add_edge(dawg_t *d, int node, unsigned char c, int target)
+{
+    dawg_node_t *n = &d->nodes[node];
+
+    if (n->num_edges == n->edges_size) {
+        int size = n->edges_size == 0 ? 2 : 2 * n->edges_size;
+        unsigned char *labels = realloc(n->labels, size);
+        if (labels == NULL) {
+            error("Could not allocate memory for dawg edges");
+            return EXIT_FAILURE;
+        }
+        n->labels = labels;
+
+        int *targets = realloc(n->targets, size * sizeof(int));
+        if (targets == NULL) {
+            error("Could not allocate memory for dawg edges");
+            return EXIT_FAILURE;
+        }
+        n->targets = targets;
+        n->edges_size = size;
+    }
+
+    n->labels[n->num_edges] = c;
+    n->targets[n->num_edges] = target;
+    n->num_edges++;
+
+    return EXIT_SUCCESS;
+}
+
+/* Hashes what makes two nodes equal: is_word and the edges */
+static unsigned int dawg_hash(dawg_node_t *n)
+{
+    unsigned int h = 2166136261u ^ n->is_word;
+
+    for (int i = 0; i < n->num_edges; i++) {
+        h = (h ^ n->labels[i]) * 16777619u;
+        h = (h ^ (unsigned int)n->targets[i]) * 16777619u;
+    }
+
+    return h;
+}
+
+/*
+   Whether two nodes accept the same endings, given minimal children.
+   Leaves have no edge arrays at all, and memcmp() must not see NULL.
+ */
+static bool dawg_equal(dawg_node_t *a, dawg_node_t *b)
+{
+    if (a->is_word != b->is_word || a->num_edges != b->num_edges)
+        return false;
+    if (a->num_edges == 0)
+        return true;
+
+    return memcmp(a->labels, b->labels, a->num_edges) == 0
+        && memcmp(a->targets, b->targets, a->num_edges * sizeof(int)) == 0;
+}
+
+/* Doubles the register table, placing every entry again */
+static int dawg_grow_table(dawg_t *d)
+{
+    int size = 2 * d->table_size;
+    int *table = calloc(size, sizeof(int));
+
+    if (table == NULL) {
+        error("Could not allocate memory for dawg register");
+        return EXIT_FAILURE;
+    }
+
+    for (int i = 0; i < d->table_size; i++) {
+        if (d->table[i] == 0)
+            continue;
+
+        unsigned int h = dawg_hash(&d->nodes[d->table[i] - 1]) & (size - 1);
+        while (table[h] != 0)
+            h = (h + 1) & (size - 1);
+        table[h] = d->table[i];
+    }
+
+    free(d->table);
+    d->table = table;
+    d->table_size = size;
+
+    return EXIT_SUCCESS;
+}
+
+/*
+   Looks for a registered node equal to id. Returns it if there is one,
+   otherwise registers id and returns it, or DAWG_NONE on error.
+ */
+static int dawg_register(dawg_t *d, int id)
+{
+    if (2 * (d->table_used + 1) > d->table_size
+        && dawg_grow_table(d) != EXIT_SUCCESS)
+        return DAWG_NONE;
+
+    dawg_node_t *n = &d->nodes[id];
+    unsigned int mask = d->table_size - 1;
+    unsigned int h = dawg_hash(n) & mask;
+
+    for (; d->table[h] != 0; h = (h + 1) & mask) {
+        if (dawg_equal(&d->nodes[d->table[h] - 1], n))
+            return d->table[h] - 1;
+    }
+
+    d->table[h] = id + 1;
+    d->table_used++;
+
+    return id;
+}
+
+/*
+   Replaces or registers the nodes of the previous word deeper than
+   depth, deepest first. They can no longer gain edges, since every word
+   still to come sorts after the previous one.
+ */
+static int dawg_minimize(dawg_t *d, size_t depth)
+{
+    for (size_t i = d->prev_len; i > depth; i--) {
+        int child = d->path[i];
+        int found = dawg_register(d, child);
+
+        if (found == DAWG_NONE)
+            return EXIT_FAILURE;
+
+        if (found != child) {
+            dawg_node_t *parent = &d->nodes[d->path[i - 1]];
+            parent->targets[parent->num_edges - 1] = found;
+            dawg_free_node(d, child);
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
+
+int dawg_add(dawg_t *d, char *word)
+{
+    assert(d != NULL);
+
+    if (d->finished) {
+        error("Cannot add to a finished dawg");
+        return EXIT_FAILURE;
+    }
+
+    size_t len = strlen(word);
+    size_t common = 0;
+
+    while (common < len && common < d->prev_len
+           && word[common] == d->prev[common])
+        common++;
+
+    if (d->num_words > 0) {
+        if (common == len && len == d->prev_len)
+            return EXIT_SUCCESS;
+
+        if (common == len || (common < d->prev_len
+            && (unsigned char)word[common] < (unsigned char)d->prev[common])) {
+            error("Words must be added in sorted order");
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (len + 1 > d->prev_size) {
+        size_t size = max(2 * d->prev_size, len + 1);
+        char *prev = realloc(d->prev, size);
+        if (prev == NULL) {
+            error("Could not allocate memory for dawg path");
+            return EXIT_FAILURE;
+        }
+        d->prev = prev;
+
+        int *path = realloc(d->path, size * sizeof(int));
+        if (path == NULL) {
+            error("Could not allocate memory for dawg path");
+            return EXIT_FAILURE;
+        }
+        d->path = path;
+        d->prev_size = size;
+    }
+
+    if (dawg_minimize(d, common) != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+
+    /* The rest of the word hangs off the shared prefix as a fresh chain */
+    for (size_t i = common; i < len; i++) {
+        int node = dawg_new_node(d);
+
+        if (node == DAWG_NONE
+            || dawg_add_edge(d, d->path[i], word[i], node) != EXIT_SUCCESS) {
+            d->prev_len = i;
+            return EXIT_FAILURE;
+        }
+
+        d->path[i + 1] = node;
+        d->prev[i] = word[i];
+    }
+
+    d->nodes[d->path[len]].is_word = 1;
+    d->prev_len = len;
+    d->num_words++;
+
+    return EXIT_SUCCESS;
+}
+
+/* Sets the word_count of node and everything below it, once per node */
+static int dawg_count_words(dawg_t *d, int node, bool *done)
+{
+    dawg_node_t *n = &d->nodes[node];
+
+    if (done[node])
+        return n->word_count;
+
+    n->word_count = n->is_word;
+    for (int i = 0; i < n->num_edges; i++)
+        n->word_count += dawg_count_words(d, n->targets[i], done);
+
+    done[node] = true;
+
+    return n->word_count;
+}
+
+int dawg_finish(dawg_t *d)
+{
+    assert(d != NULL);
+
+    if (d->finished)
+        return EXIT_SUCCESS;
+
+    if (dawg_minimize(d, 0) != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+
+    bool *done = calloc(d->size, sizeof(bool));
+    if (done == NULL) {
+        error("Could not allocate memory for dawg counts");
+        return EXIT_FAILURE;
+    }
+
+    dawg_count_words(d, DAWG_ROOT, done);
+    free(done);
+
+    free(d->table);
+    free(d->free_ids);
+    free(d->prev);
+    free(d->path);
+    d->table = NULL;
+    d->free_ids = NULL;
+    d->prev = NULL;
+    d->path = NULL;
+    d->num_free = 0;
+    d->finished = true;
+
+    return EXIT_SUCCESS;
+}
+
+dawg_t *dawg_build(char **words, int n)
+{
+    dawg_t *d = dawg_new();
+
+    if (d == NULL)
+        return NULL;
+
+    for (int i = 0; i < n; i++) {
+        if (dawg_add(d, words[i]) != EXIT_SUCCESS) {
+            dawg_free(d);
+            return NULL;
+        }
+    }
+
+    if (dawg_finish(d) != EXIT_SUCCESS) {
+        dawg_free(d);
+        return NULL;
+    }
+
+    return d;
+}
+
+int dawg_free(dawg_t *d)
+{
+    assert(d != NULL);
+
+    if (d->nodes != NULL) {
+        for (int i = 0; i < d->size; i++) {
+            free(d->nodes[i].labels);
+            free(d->nodes[i].targets);
+        }
+    }
+
+    free(d->nodes);
+    free(d->table);
+    free(d->free_ids);
+    free(d->prev);
+    free(d->path);
+    free(d);
+
+    return EXIT_SUCCESS;
+}
+
+int dawg_get_child(dawg_t *d, int node, char c)
+{
+    assert(d != NULL);
+
+    dawg_node_t *n = &d->nodes[node];
+    unsigned char key = (unsigned char)c;
+    int lo = 0, hi = n->num_edges;
+
+    /* Edges are added in sorted order */
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+
+        if (n->labels[mid] < key)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    if (lo < n->num_edges && n->labels[lo] == key)
+        return n->targets[lo];
+
+    return DAWG_NONE;
+}
+
+int dawg_get_subtrie(dawg_t *d, char *word)
+{
+    assert(d != NULL);
+
+    int node = DAWG_ROOT;
+
+    for (; *word != '\0' && node != DAWG_NONE; word++)
+        node = dawg_get_child(d, node, *word);
+
+    return node;
+}
+
+int dawg_search(dawg_t *d, char *word)
+{
+    int end = dawg_get_subtrie(d, word);
+
+    if (end == DAWG_NONE)
+        return NOT_IN_TRIE;
+
+    if (d->nodes[end].is_word == 1)
+        return IN_TRIE;
+
+    return PARTIAL_IN_TRIE;
+}
+
+int dawg_count_completion(dawg_t *d, char *pre)
+{
+    assert(d->finished);
+
+    int end = dawg_get_subtrie(d, pre);
+
+    if (end == DAWG_NONE)
+        return 0;
+
+    return d->nodes[end].word_count;
+}
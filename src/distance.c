@@ -0,0 +1,234 @@
+/*
+	 Edit distance kernels
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include "distance.h"
+#include "utils.h"
+
+/* Batches in SIMD registers where the compiler can target them per function */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define DISTANCE_SIMD
+#endif
+
+int distance_osa(char *a, size_t alen, char *b, size_t blen, int max, int *rows)
+{
+    if ((alen > blen ? alen - blen : blen - alen) > (size_t)max)
+        return max + 1;
+
+    int *before = rows, *prev = rows + blen + 1, *cur = rows + 2 * (blen + 1);
+
+    for (size_t j = 0; j <= blen; j++)
+        prev[j] = j;
+
+    for (size_t i = 1; i <= alen; i++) {
+        int best = cur[0] = i;
+
+        for (size_t j = 1; j <= blen; j++) {
+            int v = prev[j - 1] + (a[i - 1] != b[j - 1]);
+
+            v = min(v, prev[j] + 1);
+            v = min(v, cur[j - 1] + 1);
+
+            if (i > 1 && j > 1 && a[i - 1] == b[j - 2] && a[i - 2] == b[j - 1])
+                v = min(v, before[j - 2] + 1);
+
+            cur[j] = v;
+            best = min(best, v);
+        }
+
+        /* Nothing in a later row can be smaller than the best of this one */
+        if (best > max)
+            return max + 1;
+
+        int *spare = before;
+        before = prev;
+        prev = cur;
+        cur = spare;
+    }
+
+    return min(prev[blen], max + 1);
+}
+
+int distance_pattern(distance_pattern_t *p, char *str, size_t len)
+{
+    if (len > DISTANCE_MAX_PATTERN)
+        return EXIT_FAILURE;
+
+    memset(p->peq, 0, sizeof(p->peq));
+    for (size_t i = 0; i < len; i++)
+        p->peq[(unsigned char)str[i]] |= (uint64_t)1 << i;
+    p->len = len;
+
+    return EXIT_SUCCESS;
+}
+
+/*
+   How the bits work, for a pattern of m characters against a word: column
+   j of the distance table (one entry per character of the pattern) is kept
+   as the differences between neighbouring entries, vp where an entry is one
+   more than the one above it and vn where it is one less. d0 marks the
+   entries reached for free from the column before, by a match, or by a
+   swap (tr) where the pattern has ab and the word ba. hp and hn are the
+   same differences along the row, and bit m - 1 of them moves the bottom
+   entry, the distance so far, up or down by one.
+ */
+int distance_myers(distance_pattern_t *p, char *word, size_t len, int max)
+{
+    size_t m = p->len;
+
+    if ((m > len ? m - len : len - m) > (size_t)max)
+        return max + 1;
+
+    if (m == 0)
+        return len;
+
+    uint64_t top = (uint64_t)1 << (m - 1);
+    uint64_t vp = ~(uint64_t)0, vn = 0, d0 = 0, pm_prev = 0;
+    int score = m;
+
+    for (size_t j = 0; j < len; j++) {
+        uint64_t pm = p->peq[(unsigned char)word[j]];
+        uint64_t tr = ((~d0 & pm) << 1) & pm_prev;
+
+        d0 = (((pm & vp) + vp) ^ vp) | pm | vn | tr;
+
+        uint64_t hp = vn | ~(d0 | vp);
+        uint64_t hn = d0 & vp;
+
+        score += (hp & top) != 0;
+        score -= (hn & top) != 0;
+
+        /* The distance can only come down one per character left */
+        if (score - (int)(len - j - 1) > max)
+            return max + 1;
+
+        /* The top row is j + 1, one more than the row before */
+        uint64_t x = (hp << 1) | 1;
+        vn = x & d0;
+        vp = (hn << 1) | ~(x | d0);
+        pm_prev = pm;
+    }
+
+    return min(score, max + 1);
+}
+
+#ifdef DISTANCE_SIMD
+
+/* The bits of character j of each word, or none past the end of one */
+#define DISTANCE_PEQ(k) \
+    (j < lens[k] ? (long long)p->peq[(unsigned char)words[k][j]] : 0)
+
+/* All ones while j is within word k, so only those move the distance */
+#define DISTANCE_ACTIVE(k) (j < lens[k] ? -1LL : 0)
+
+/* distance_myers() on four words at once, one in each 64 bit lane */
+__attribute__((target("avx2")))
+static void distance_four(distance_pattern_t *p, char **words, size_t *lens,
+                          int max, int *out)
+{
+    size_t longest = max(max(lens[0], lens[1]), max(lens[2], lens[3]));
+    __m256i ones = _mm256_set1_epi64x(-1), zero = _mm256_setzero_si256();
+    __m256i one = _mm256_set1_epi64x(1);
+    __m256i top = _mm256_set1_epi64x((long long)((uint64_t)1 << (p->len - 1)));
+    __m256i vp = ones, vn = zero, d0 = zero, pm_prev = zero;
+    __m256i score = _mm256_set1_epi64x(p->len);
+
+    for (size_t j = 0; j < longest; j++) {
+        __m256i pm = _mm256_set_epi64x(DISTANCE_PEQ(3), DISTANCE_PEQ(2),
+                                       DISTANCE_PEQ(1), DISTANCE_PEQ(0));
+        __m256i active = _mm256_set_epi64x(DISTANCE_ACTIVE(3), DISTANCE_ACTIVE(2),
+                                           DISTANCE_ACTIVE(1), DISTANCE_ACTIVE(0));
+        __m256i tr = _mm256_and_si256(_mm256_slli_epi64(_mm256_andnot_si256(d0, pm), 1),
+                                      pm_prev);
+
+        d0 = _mm256_xor_si256(_mm256_add_epi64(_mm256_and_si256(pm, vp), vp), vp);
+        d0 = _mm256_or_si256(_mm256_or_si256(d0, pm), _mm256_or_si256(vn, tr));
+
+        __m256i hp = _mm256_or_si256(vn, _mm256_xor_si256(_mm256_or_si256(d0, vp), ones));
+        __m256i hn = _mm256_and_si256(d0, vp);
+
+        /* All ones where the bottom bit is set, so subtracting adds one */
+        __m256i up = _mm256_andnot_si256(
+            _mm256_cmpeq_epi64(_mm256_and_si256(hp, top), zero), active);
+        __m256i down = _mm256_andnot_si256(
+            _mm256_cmpeq_epi64(_mm256_and_si256(hn, top), zero), active);
+        score = _mm256_add_epi64(_mm256_sub_epi64(score, up), down);
+
+        __m256i x = _mm256_or_si256(_mm256_slli_epi64(hp, 1), one);
+        vn = _mm256_and_si256(x, d0);
+        vp = _mm256_or_si256(_mm256_slli_epi64(hn, 1),
+                             _mm256_xor_si256(_mm256_or_si256(x, d0), ones));
+        pm_prev = pm;
+    }
+
+    long long scores[4];
+    _mm256_storeu_si256((__m256i*)scores, score);
+    for (int k = 0; k < 4; k++)
+        out[k] = min(scores[k], max + 1);
+}
+
+/* distance_myers() on two words at once, one in each 64 bit lane */
+__attribute__((target("sse4.1")))
+static void distance_two(distance_pattern_t *p, char **words, size_t *lens,
+                         int max, int *out)
+{
+    size_t longest = max(lens[0], lens[1]);
+    __m128i ones = _mm_set1_epi64x(-1), zero = _mm_setzero_si128();
+    __m128i one = _mm_set1_epi64x(1);
+    __m128i top = _mm_set1_epi64x((long long)((uint64_t)1 << (p->len - 1)));
+    __m128i vp = ones, vn = zero, d0 = zero, pm_prev = zero;
+    __m128i score = _mm_set1_epi64x(p->len);
+
+    for (size_t j = 0; j < longest; j++) {
+        __m128i pm = _mm_set_epi64x(DISTANCE_PEQ(1), DISTANCE_PEQ(0));
+        __m128i active = _mm_set_epi64x(DISTANCE_ACTIVE(1), DISTANCE_ACTIVE(0));
+        __m128i tr = _mm_and_si128(_mm_slli_epi64(_mm_andnot_si128(d0, pm), 1), pm_prev);
+
+        d0 = _mm_xor_si128(_mm_add_epi64(_mm_and_si128(pm, vp), vp), vp);
+        d0 = _mm_or_si128(_mm_or_si128(d0, pm), _mm_or_si128(vn, tr));
+
+        __m128i hp = _mm_or_si128(vn, _mm_xor_si128(_mm_or_si128(d0, vp), ones));
+        __m128i hn = _mm_and_si128(d0, vp);
+
+        __m128i up = _mm_andnot_si128(_mm_cmpeq_epi64(_mm_and_si128(hp, top), zero),
+                                      active);
+        __m128i down = _mm_andnot_si128(_mm_cmpeq_epi64(_mm_and_si128(hn, top), zero),
+                                        active);
+        score = _mm_add_epi64(_mm_sub_epi64(score, up), down);
+
+        __m128i x = _mm_or_si128(_mm_slli_epi64(hp, 1), one);
+        vn = _mm_and_si128(x, d0);
+        vp = _mm_or_si128(_mm_slli_epi64(hn, 1), _mm_xor_si128(_mm_or_si128(x, d0), ones));
+        pm_prev = pm;
+    }
+
+    long long scores[2];
+    _mm_storeu_si128((__m128i*)scores, score);
+    for (int k = 0; k < 2; k++)
+        out[k] = min(scores[k], max + 1);
+}
+
+#endif
+
+void distance_many(distance_pattern_t *p, char **words, size_t *lens, int count,
+                   int max, int *out)
+{
+    int i = 0;
+
+#ifdef DISTANCE_SIMD
+    /* An empty pattern has no bottom bit, and needs no table anyway */
+    if (p->len > 0 && __builtin_cpu_supports("avx2")) {
+        for (; i + 4 <= count; i += 4)
+            distance_four(p, words + i, lens + i, max, out + i);
+    } else if (p->len > 0 && __builtin_cpu_supports("sse4.1")) {
+        for (; i + 2 <= count; i += 2)
+            distance_two(p, words + i, lens + i, max, out + i);
+    }
+#endif
+
+    for (; i < count; i++)
+        out[i] = distance_myers(p, words[i], lens[i], max);
+}
@@ -0,0 +1,408 @@
+/*
+	 A frozen, read-only trie in LOUDS form
+*/
+
+#define _DEFAULT_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "louds.h"
+#include "utils.h"
+
+/* Number of 64-bit words needed for n bits */
+#define LOUDS_WORDS(n) (((n) + 63) / 64)
+
+/* Rounds a byte count up to a multiple of 8 */
+#define LOUDS_ALIGN(n) (((n) + 7) & ~(uint64_t)7)
+
+/*
+   Fills in the size and section offsets of a file holding num_nodes
+   nodes. Used to lay out new files and to check mapped ones.
+ */
+static void louds_layout(louds_header_t *h, uint64_t num_nodes)
+{
+    uint64_t num_bits = 2 * num_nodes + 1;
+    uint64_t off = LOUDS_ALIGN(sizeof(louds_header_t));
+
+    h->num_nodes = num_nodes;
+    h->num_select = (num_nodes + 1 + LOUDS_SELECT_STEP - 1) / LOUDS_SELECT_STEP;
+
+    h->bits_off = off;
+    off += LOUDS_WORDS(num_bits) * sizeof(uint64_t);
+
+    h->select_off = off;
+    off += h->num_select * sizeof(uint64_t);
+
+    h->words_off = off;
+    off += LOUDS_WORDS(num_nodes) * sizeof(uint64_t);
+
+    h->rank_off = off;
+    off += (num_nodes / LOUDS_RANK_STEP + 1) * sizeof(uint64_t);
+
+    h->labels_off = off;
+    off += LOUDS_ALIGN(num_nodes);
+
+    h->size = off;
+}
+
+/* Points the sections of l into the buffer starting at hdr */
+static void louds_attach(louds_t *l, const louds_header_t *hdr)
+{
+    const char *base = (const char*)hdr;
+
+    l->hdr = hdr;
+    l->bits = (const uint64_t*)(base + hdr->bits_off);
+    l->select = (const uint64_t*)(base + hdr->select_off);
+    l->words = (const uint64_t*)(base + hdr->words_off);
+    l->rank = (const uint64_t*)(base + hdr->rank_off);
+    l->labels = (const unsigned char*)(base + hdr->labels_off);
+}
+
+/* Position of the r-th (from 1) set bit of w */
+static int louds_select_word(uint64_t w, uint64_t r)
+{
+    for (; r > 1; r--)
+        w &= w - 1;
+
+    return __builtin_ctzll(w);
+}
+
+/* Position of the j-th (from 1) zero in the shape bits */
+static uint64_t louds_select0(const louds_t *l, uint64_t j)
+{
+    uint64_t s = (j - 1) / LOUDS_SELECT_STEP;
+    uint64_t pos = l->select[s];
+    uint64_t r = j - 1 - s * LOUDS_SELECT_STEP;
+
+    if (r == 0)
+        return pos;
+
+    /* Count on from the sampled zero, leaving it and everything before out */
+    uint64_t i = pos / 64;
+    uint64_t zeros = ~l->bits[i] & ~((2ULL << (pos % 64)) - 1);
+
+    while (true) {
+        uint64_t c = __builtin_popcountll(zeros);
+
+        if (c >= r)
+            return i * 64 + louds_select_word(zeros, r);
+
+        r -= c;
+        zeros = ~l->bits[++i];
+    }
+}
+
+/* Number of words on nodes with an id below node */
+static uint64_t louds_rank_words(const louds_t *l, uint64_t node)
+{
+    uint64_t block = node / LOUDS_RANK_STEP;
+    uint64_t count = l->rank[block];
+    uint64_t i = block * (LOUDS_RANK_STEP / 64);
+
+    for (; i < node / 64; i++)
+        count += __builtin_popcountll(l->words[i]);
+
+    if (node % 64 != 0)
+        count += __builtin_popcountll(l->words[i] & ((1ULL << (node % 64)) - 1));
+
+    return count;
+}
+
+/*
+   Id of the first child node would have. Children of consecutive nodes
+   are consecutive, so this is also one past the last child of node - 1.
+ */
+static uint64_t louds_first_child(const louds_t *l, uint64_t node)
+{
+    /* Every bit before the zero ending node - 1's children is a child */
+    return louds_select0(l, node + 1) - node;
+}
+
+/* Counts the nodes of the logical (one character per node) trie below t */
+static uint64_t louds_count_nodes(trie_t *t)
+{
+    uint64_t n = 1 + t->label_len;
+    trie_t *child;
+    int pos = 0;
+
+    while ((child = trie_next_child(t, &pos)) != NULL)
+        n += louds_count_nodes(child);
+
+    return n;
+}
+
+/* A node of the logical trie: t with pos characters of its label read */
+typedef struct {
+    trie_t *node;
+    unsigned int pos;
+} louds_queue_t;
+
+louds_t *louds_freeze(trie_t *t)
+{
+    assert(t != NULL);
+
+    uint64_t n = louds_count_nodes(t);
+    louds_header_t layout;
+
+    memset(&layout, 0, sizeof(layout));
+    louds_layout(&layout, n);
+
+    louds_t *l = calloc(1, sizeof(louds_t));
+    char *buf = calloc(1, layout.size);
+    louds_queue_t *queue = malloc(n * sizeof(louds_queue_t));
+
+    if (l == NULL || buf == NULL || queue == NULL) {
+        error("Could not allocate memory for louds_t");
+        free(l);
+        free(buf);
+        free(queue);
+        return NULL;
+    }
+
+    louds_header_t *hdr = (louds_header_t*)buf;
+    memcpy(hdr, &layout, sizeof(layout));
+    memcpy(hdr->magic, LOUDS_MAGIC, sizeof(hdr->magic));
+    hdr->version = LOUDS_VERSION;
+
+    uint64_t *bits = (uint64_t*)(buf + hdr->bits_off);
+    uint64_t *words = (uint64_t*)(buf + hdr->words_off);
+    unsigned char *labels = (unsigned char*)(buf + hdr->labels_off);
+
+    /* The super-root: one edge into the root, then the end of its children */
+    uint64_t p = 2, tail = 1;
+    bits[0] = 1;
+
+    queue[0].node = t;
+    queue[0].pos = 0;
+
+    for (uint64_t i = 0; i < n; i++) {
+        trie_t *node = queue[i].node;
+        unsigned int pos = queue[i].pos;
+
+        if (pos < node->label_len) {
+            /* Inside a compressed label the only child is the next character */
+            queue[tail].node = node;
+            queue[tail].pos = pos + 1;
+            labels[tail++] = (unsigned char)node->label[pos];
+            bits[p / 64] |= 1ULL << (p % 64);
+            p++;
+        } else {
+            trie_t *child;
+            int at = 0;
+
+            if (node->is_word == 1) {
+                words[i / 64] |= 1ULL << (i % 64);
+                hdr->num_words++;
+            }
+
+            /* trie_next_child() goes in character order */
+            while ((child = trie_next_child(node, &at)) != NULL) {
+                queue[tail].node = child;
+                queue[tail].pos = 0;
+                labels[tail++] = (unsigned char)child->current;
+                bits[p / 64] |= 1ULL << (p % 64);
+                p++;
+            }
+        }
+
+        /* The zero ending the node's children */
+        p++;
+    }
+
+    free(queue);
+
+    /* Select samples over the zeros and rank directory over the words */
+    uint64_t *select = (uint64_t*)(buf + hdr->select_off);
+    uint64_t *rank = (uint64_t*)(buf + hdr->rank_off);
+    uint64_t zeros = 0, ones = 0;
+
+    for (uint64_t i = 0; i < p; i++) {
+        if ((bits[i / 64] >> (i % 64) & 1) == 0) {
+            if (zeros % LOUDS_SELECT_STEP == 0)
+                select[zeros / LOUDS_SELECT_STEP] = i;
+            zeros++;
+        }
+    }
+
+    for (uint64_t i = 0; i <= n / LOUDS_RANK_STEP; i++) {
+        rank[i] = ones;
+        for (uint64_t w = 0; w < LOUDS_RANK_STEP / 64
+             && i * (LOUDS_RANK_STEP / 64) + w < LOUDS_WORDS(n); w++)
+            ones += __builtin_popcountll(words[i * (LOUDS_RANK_STEP / 64) + w]);
+    }
+
+    louds_attach(l, hdr);
+    l->mapped = false;
+
+    return l;
+}
+
+int louds_save(louds_t *l, const char *path)
+{
+    assert(l != NULL);
+
+    FILE *f = fopen(path, "wb");
+
+    if (f == NULL) {
+        error("Could not open %s", path);
+        return EXIT_FAILURE;
+    }
+
+    size_t written = fwrite(l->hdr, 1, l->hdr->size, f);
+
+    if (fclose(f) != 0 || written != l->hdr->size) {
+        error("Could not write %s", path);
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+louds_t *louds_open(const char *path)
+{
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+
+    if (fd < 0) {
+        error("Could not open %s", path);
+        return NULL;
+    }
+
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(louds_header_t)) {
+        error("%s is not a louds file", path);
+        close(fd);
+        return NULL;
+    }
+
+    void *p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (p == MAP_FAILED) {
+        error("Could not map %s", path);
+        return NULL;
+    }
+
+    /* The sections must be exactly where a file of this many nodes has them */
+    const louds_header_t *hdr = p;
+    louds_header_t layout = *hdr;
+    louds_layout(&layout, hdr->num_nodes);
+
+    if (memcmp(hdr->magic, LOUDS_MAGIC, sizeof(hdr->magic)) != 0
+        || hdr->version != LOUDS_VERSION || hdr->num_nodes == 0
+        || memcmp(&layout, hdr, sizeof(layout)) != 0
+        || hdr->size != (uint64_t)st.st_size) {
+        error("%s is not a louds file", path);
+        munmap(p, st.st_size);
+        return NULL;
+    }
+
+    louds_t *l = calloc(1, sizeof(louds_t));
+
+    if (l == NULL) {
+        error("Could not allocate memory for louds_t");
+        munmap(p, st.st_size);
+        return NULL;
+    }
+
+    louds_attach(l, hdr);
+    l->mapped = true;
+
+    return l;
+}
+
+int louds_free(louds_t *l)
+{
+    assert(l != NULL);
+
+    if (l->mapped)
+        munmap((void*)l->hdr, l->hdr->size);
+    else
+        free((void*)l->hdr);
+
+    free(l);
+
+    return EXIT_SUCCESS;
+}
+
+int64_t louds_get_child(louds_t *l, int64_t node, char c)
+{
+    assert(l != NULL);
+
+    uint64_t start = louds_select0(l, node + 1);
+    uint64_t end = louds_select0(l, node + 2);
+
+    /* Children are in character order, so binary search their labels */
+    uint64_t lo = start - node, hi = lo + (end - start - 1);
+    unsigned char key = (unsigned char)c;
+
+    while (lo < hi) {
+        uint64_t mid = lo + (hi - lo) / 2;
+
+        if (l->labels[mid] < key)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    if (lo < end - node - 1 && l->labels[lo] == key)
+        return lo;
+
+    return LOUDS_NONE;
+}
+
+int64_t louds_get_subtrie(louds_t *l, char *word)
+{
+    assert(l != NULL);
+
+    int64_t node = LOUDS_ROOT;
+
+    for (; *word != '\0' && node != LOUDS_NONE; word++)
+        node = louds_get_child(l, node, *word);
+
+    return node;
+}
+
+bool louds_is_word(louds_t *l, int64_t node)
+{
+    assert(l != NULL);
+
+    return (l->words[node / 64] >> (node % 64) & 1) != 0;
+}
+
+int louds_search(louds_t *l, char *word)
+{
+    int64_t end = louds_get_subtrie(l, word);
+
+    if (end == LOUDS_NONE)
+        return NOT_IN_TRIE;
+
+    if (louds_is_word(l, end))
+        return IN_TRIE;
+
+    return PARTIAL_IN_TRIE;
+}
+
+int louds_count_completion(louds_t *l, char *pre)
+{
+    int64_t node = louds_get_subtrie(l, pre);
+
+    if (node == LOUDS_NONE)
+        return 0;
+
+    /* Walk down the run of ids the subtree takes up on each level */
+    uint64_t lo = node, hi = node + 1;
+    uint64_t count = 0;
+
+    while (lo < hi) {
+        count += louds_rank_words(l, hi) - louds_rank_words(l, lo);
+        lo = louds_first_child(l, lo);
+        hi = louds_first_child(l, hi);
+    }
+
+    return count;
+}
@@ -0,0 +1,714 @@
+/*
+	 A q-gram index for approximate matching
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "qgram.h"
+#include "distance.h"
+#include "utils.h"
+
+/* Size of the tables at first, powers of two */
+#define QGRAM_TABLE_SIZE 1024
+
+/* The character standing for the padding before and after a word */
+#define QGRAM_PAD 256
+
+/* Candidates checked together by distance_many() */
+#define QGRAM_BATCH 64
+
+/* Removed words the posting lists can hold before they are rebuilt */
+#define QGRAM_MIN_STALE 64
+
+qgram_t *qgram_new(int q)
+{
+    qgram_t *qg = calloc(1, sizeof(qgram_t));
+
+    if (qg == NULL) {
+        error("Could not allocate memory for qgram_t");
+        return NULL;
+    }
+
+    qg->q = q < 1 ? 1 : min(q, QGRAM_MAX_Q);
+    qg->capacity = 16;
+    qg->words = calloc(qg->capacity, sizeof(char*));
+    qg->lengths = calloc(qg->capacity, sizeof(size_t));
+    qg->counts = calloc(qg->capacity, sizeof(int));
+    qg->touched = calloc(qg->capacity, sizeof(int));
+    qg->ids_size = QGRAM_TABLE_SIZE;
+    qg->ids = calloc(qg->ids_size, sizeof(int));
+    qg->lists_size = QGRAM_TABLE_SIZE;
+    qg->lists = calloc(qg->lists_size, sizeof(qgram_list_t));
+
+    if (qg->words == NULL || qg->lengths == NULL || qg->counts == NULL
+        || qg->touched == NULL || qg->ids == NULL || qg->lists == NULL) {
+        error("Could not allocate memory for qgram_t");
+        qgram_free(qg);
+        return NULL;
+    }
+
+    for (size_t i = 0; i < qg->lists_size; i++)
+        qg->lists[i].gram = -1;
+
+    return qg;
+}
+
+/* FNV-1a over str */
+static unsigned int qgram_hash_str(char *str)
+{
+    unsigned int h = 2166136261u;
+
+    for (; *str != '\0'; str++)
+        h = (h ^ (unsigned char)*str) * 16777619u;
+
+    return h;
+}
+
+/* Spreads the bits of a q-gram code over the table */
+static unsigned int qgram_hash_gram(int gram)
+{
+    return (unsigned int)gram * 2654435761u;
+}
+
+/* Number of q-grams in a word of len characters */
+static size_t qgram_count(qgram_t *qg, size_t len)
+{
+    return len + qg->q - 1;
+}
+
+/*
+   Writes the codes of the q-grams of word into grams, in order. Each
+   character is a digit in base 257, with QGRAM_PAD for the q - 1
+   characters of padding at either end.
+ */
+static void qgram_codes(qgram_t *qg, char *word, size_t len, int *grams)
+{
+    size_t count = qgram_count(qg, len);
+
+    for (size_t i = 0; i < count; i++) {
+        int code = 0;
+
+        for (int j = 0; j < qg->q; j++) {
+            /* Position in the padded word, where the word starts at q - 1 */
+            size_t at = i + j;
+            int c = QGRAM_PAD;
+
+            if (at >= (size_t)(qg->q - 1) && at - (qg->q - 1) < len)
+                c = (unsigned char)word[at - (qg->q - 1)];
+
+            code = code * (QGRAM_PAD + 1) + c;
+        }
+
+        grams[i] = code;
+    }
+}
+
+/* Doubles the posting list table, placing every entry again */
+static int qgram_grow_lists(qgram_t *qg)
+{
+    size_t size = 2 * qg->lists_size;
+    qgram_list_t *lists = calloc(size, sizeof(qgram_list_t));
+
+    if (lists == NULL) {
+        error("Could not allocate memory for qgram lists");
+        return EXIT_FAILURE;
+    }
+
+    for (size_t i = 0; i < size; i++)
+        lists[i].gram = -1;
+
+    for (size_t i = 0; i < qg->lists_size; i++) {
+        if (qg->lists[i].gram < 0)
+            continue;
+
+        size_t h = qgram_hash_gram(qg->lists[i].gram) & (size - 1);
+        while (lists[h].gram >= 0)
+            h = (h + 1) & (size - 1);
+        lists[h] = qg->lists[i];
+    }
+
+    free(qg->lists);
+    qg->lists = lists;
+    qg->lists_size = size;
+
+    return EXIT_SUCCESS;
+}
+
+/*
+   Finds the posting list of a q-gram. If there is none, adds an empty
+   one when create is set and returns NULL otherwise.
+ */
+static qgram_list_t *qgram_list(qgram_t *qg, int gram, bool create)
+{
+    if (create && 2 * (qg->lists_used + 1) > qg->lists_size
+        && qgram_grow_lists(qg) != EXIT_SUCCESS)
+        return NULL;
+
+    size_t mask = qg->lists_size - 1;
+    size_t h = qgram_hash_gram(gram) & mask;
+
+    for (; qg->lists[h].gram >= 0; h = (h + 1) & mask) {
+        if (qg->lists[h].gram == gram)
+            return &qg->lists[h];
+    }
+
+    if (!create)
+        return NULL;
+
+    qg->lists[h].gram = gram;
+    qg->lists_used++;
+
+    return &qg->lists[h];
+}
+
+/* Adds id to the end of a posting list, as a varint of the gap */
+static int qgram_append(qgram_list_t *l, int id)
+{
+    unsigned int gap = id - l->last;
+
+    /* A varint of an int takes at most 5 bytes */
+    if (l->len + 5 > l->size) {
+        size_t size = l->size == 0 ? 8 : 2 * l->size;
+        unsigned char *data = realloc(l->data, size);
+        if (data == NULL) {
+            error("Could not allocate memory for qgram postings");
+            return EXIT_FAILURE;
+        }
+        l->data = data;
+        l->size = size;
+    }
+
+    while (gap >= 0x80) {
+        l->data[l->len++] = (gap & 0x7f) | 0x80;
+        gap >>= 7;
+    }
+    l->data[l->len++] = gap;
+    l->last = id;
+
+    return EXIT_SUCCESS;
+}
+
+/* Reads the varint at *pos and moves past it */
+static unsigned int qgram_varint(unsigned char *data, size_t *pos)
+{
+    unsigned int v = 0;
+    int shift = 0;
+
+    while (data[*pos] & 0x80) {
+        v |= (unsigned int)(data[(*pos)++] & 0x7f) << shift;
+        shift += 7;
+    }
+
+    return v | (unsigned int)data[(*pos)++] << shift;
+}
+
+/* The slot of word in the id table, or of the empty slot it would go in */
+static size_t qgram_slot(qgram_t *qg, char *word)
+{
+    size_t mask = qg->ids_size - 1;
+    size_t h = qgram_hash_str(word) & mask;
+
+    for (; qg->ids[h] != 0; h = (h + 1) & mask) {
+        if (strcmp(qg->words[qg->ids[h] - 1], word) == 0)
+            break;
+    }
+
+    return h;
+}
+
+/* Doubles the id table, placing every entry again */
+static int qgram_grow_ids(qgram_t *qg)
+{
+    int *old = qg->ids;
+    size_t old_size = qg->ids_size;
+
+    qg->ids = calloc(2 * old_size, sizeof(int));
+    if (qg->ids == NULL) {
+        error("Could not allocate memory for qgram ids");
+        qg->ids = old;
+        return EXIT_FAILURE;
+    }
+    qg->ids_size = 2 * old_size;
+
+    for (size_t i = 0; i < old_size; i++) {
+        if (old[i] != 0)
+            qg->ids[qgram_slot(qg, qg->words[old[i] - 1])] = old[i];
+    }
+
+    free(old);
+
+    return EXIT_SUCCESS;
+}
+
+/* Empties a slot of the id table, moving later entries of its run back */
+static void qgram_drop_slot(qgram_t *qg, size_t hole)
+{
+    size_t mask = qg->ids_size - 1;
+
+    qg->ids[hole] = 0;
+
+    for (size_t i = (hole + 1) & mask; qg->ids[i] != 0; i = (i + 1) & mask) {
+        size_t home = qgram_hash_str(qg->words[qg->ids[i] - 1]) & mask;
+
+        /* The entry can fill the hole if its home is not in (hole, i] */
+        if (((i - home) & mask) >= ((i - hole) & mask)) {
+            qg->ids[hole] = qg->ids[i];
+            qg->ids[i] = 0;
+            hole = i;
+        }
+    }
+}
+
+/* Makes room for one more id in the per id arrays */
+static int qgram_grow_words(qgram_t *qg)
+{
+    int capacity = 2 * qg->capacity;
+
+    char **words = realloc(qg->words, capacity * sizeof(char*));
+    if (words == NULL)
+        goto fail;
+    qg->words = words;
+
+    size_t *lengths = realloc(qg->lengths, capacity * sizeof(size_t));
+    if (lengths == NULL)
+        goto fail;
+    qg->lengths = lengths;
+
+    int *touched = realloc(qg->touched, capacity * sizeof(int));
+    if (touched == NULL)
+        goto fail;
+    qg->touched = touched;
+
+    int *counts = realloc(qg->counts, capacity * sizeof(int));
+    if (counts == NULL)
+        goto fail;
+    memset(counts + qg->capacity, 0, (capacity - qg->capacity) * sizeof(int));
+    qg->counts = counts;
+
+    qg->capacity = capacity;
+
+    return EXIT_SUCCESS;
+
+fail:
+    error("Could not allocate memory for qgram words");
+    return EXIT_FAILURE;
+}
+
+/* Adds id to the bucket of words of len characters */
+static int qgram_bucket_add(qgram_t *qg, size_t len, int id)
+{
+    if (len >= qg->num_lengths) {
+        size_t num = max(2 * qg->num_lengths, len + 1);
+        qgram_bucket_t *by_length = realloc(qg->by_length,
+            num * sizeof(qgram_bucket_t));
+        if (by_length == NULL) {
+            error("Could not allocate memory for qgram lengths");
+            return EXIT_FAILURE;
+        }
+        memset(by_length + qg->num_lengths, 0,
+               (num - qg->num_lengths) * sizeof(qgram_bucket_t));
+        qg->by_length = by_length;
+        qg->num_lengths = num;
+    }
+
+    qgram_bucket_t *b = &qg->by_length[len];
+
+    if (b->count == b->size) {
+        int size = b->size == 0 ? 16 : 2 * b->size;
+        int *ids = realloc(b->ids, size * sizeof(int));
+        if (ids == NULL) {
+            error("Could not allocate memory for qgram lengths");
+            return EXIT_FAILURE;
+        }
+        b->ids = ids;
+        b->size = size;
+    }
+
+    b->ids[b->count++] = id;
+
+    return EXIT_SUCCESS;
+}
+
+int qgram_add(qgram_t *qg, char *word)
+{
+    assert(qg != NULL);
+    assert(word != NULL);
+
+    if (2 * (qg->num_words + 1) > (int)qg->ids_size
+        && qgram_grow_ids(qg) != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+
+    size_t slot = qgram_slot(qg, word);
+    if (qg->ids[slot] != 0)
+        return EXIT_SUCCESS;
+
+    if (qg->size == qg->capacity && qgram_grow_words(qg) != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+
+    size_t len = strlen(word);
+    size_t count = qgram_count(qg, len);
+    int *grams = malloc((count + 1) * sizeof(int));
+    char *copy = malloc(len + 1);
+
+    if (grams == NULL || copy == NULL) {
+        error("Could not allocate memory for qgram words");
+        free(grams);
+        free(copy);
+        return EXIT_FAILURE;
+    }
+    memcpy(copy, word, len + 1);
+
+    /*
+     * Ids are never handed out again, so the new id is the largest yet and
+     * goes at the end of every list. A word added partway is left stale.
+     */
+    int id = qg->size++;
+    qg->words[id] = copy;
+    qg->lengths[id] = len;
+
+    qgram_codes(qg, word, len, grams);
+    for (size_t i = 0; i < count; i++) {
+        qgram_list_t *l = qgram_list(qg, grams[i], true);
+
+        if (l == NULL || qgram_append(l, id) != EXIT_SUCCESS) {
+            free(grams);
+            free(qg->words[id]);
+            qg->words[id] = NULL;
+            qg->num_stale++;
+            return EXIT_FAILURE;
+        }
+    }
+    free(grams);
+
+    if (qgram_bucket_add(qg, len, id) != EXIT_SUCCESS) {
+        free(qg->words[id]);
+        qg->words[id] = NULL;
+        qg->num_stale++;
+        return EXIT_FAILURE;
+    }
+
+    qg->ids[slot] = id + 1;
+    qg->num_words++;
+
+    return EXIT_SUCCESS;
+}
+
+/* Builds the posting lists again without the removed words */
+static int qgram_rebuild(qgram_t *qg)
+{
+    qgram_t *fresh = qgram_new(qg->q);
+
+    if (fresh == NULL)
+        return EXIT_FAILURE;
+
+    for (int id = 0; id < qg->size; id++) {
+        if (qg->words[id] != NULL
+            && qgram_add(fresh, qg->words[id]) != EXIT_SUCCESS) {
+            qgram_free(fresh);
+            return EXIT_FAILURE;
+        }
+    }
+
+    qgram_t old = *qg;
+    *qg = *fresh;
+    *fresh = old;
+    qgram_free(fresh);
+
+    return EXIT_SUCCESS;
+}
+
+int qgram_remove(qgram_t *qg, char *word)
+{
+    assert(qg != NULL);
+    assert(word != NULL);
+
+    size_t slot = qgram_slot(qg, word);
+
+    if (qg->ids[slot] == 0)
+        return EXIT_FAILURE;
+
+    int id = qg->ids[slot] - 1;
+    qgram_bucket_t *b = &qg->by_length[qg->lengths[id]];
+
+    for (int i = 0; i < b->count; i++) {
+        if (b->ids[i] == id) {
+            b->ids[i] = b->ids[--b->count];
+            break;
+        }
+    }
+
+    qgram_drop_slot(qg, slot);
+    free(qg->words[id]);
+    qg->words[id] = NULL;
+    qg->num_words--;
+    qg->num_stale++;
+
+    /* Failing to rebuild only leaves the lists longer than they need be */
+    if (qg->num_stale > max(qg->num_words, QGRAM_MIN_STALE))
+        qgram_rebuild(qg);
+
+    return EXIT_SUCCESS;
+}
+
+qgram_t *qgram_build(trie_t *t, int q)
+{
+    assert(t != NULL);
+
+    qgram_t *qg = qgram_new(q);
+    trie_iter_t *it = trie_iter_new(t, "", NULL);
+    char *word;
+
+    if (qg == NULL || it == NULL) {
+        if (qg != NULL)
+            qgram_free(qg);
+        if (it != NULL)
+            trie_iter_free(it);
+        return NULL;
+    }
+
+    while ((word = trie_iter_next(it, NULL)) != NULL) {
+        if (qgram_add(qg, word) != EXIT_SUCCESS) {
+            trie_iter_free(it);
+            qgram_free(qg);
+            return NULL;
+        }
+    }
+
+    trie_iter_free(it);
+
+    return qg;
+}
+
+int qgram_free(qgram_t *qg)
+{
+    assert(qg != NULL);
+
+    if (qg->words != NULL) {
+        for (int i = 0; i < qg->size; i++)
+            free(qg->words[i]);
+    }
+
+    if (qg->lists != NULL) {
+        for (size_t i = 0; i < qg->lists_size; i++)
+            free(qg->lists[i].data);
+    }
+
+    for (size_t i = 0; i < qg->num_lengths; i++)
+        free(qg->by_length[i].ids);
+
+    free(qg->words);
+    free(qg->lengths);
+    free(qg->ids);
+    free(qg->lists);
+    free(qg->by_length);
+    free(qg->counts);
+    free(qg->touched);
+    free(qg->rows);
+    free(qg);
+
+    return EXIT_SUCCESS;
+}
+
+/* qsort() comparison for q-gram codes */
+static int qgram_cmp_code(const void *a, const void *b)
+{
+    int x = *(const int*)a, y = *(const int*)b;
+
+    return (x > y) - (x < y);
+}
+
+/* Adds a word's shared q-grams to its count, noting it the first time */
+static int qgram_credit(qgram_t *qg, int id, int shared, int touched)
+{
+    if (qg->counts[id] == 0)
+        qg->touched[touched++] = id;
+    qg->counts[id] += shared;
+
+    return touched;
+}
+
+/*
+   Adds to the count of every word on the posting list of a q-gram the
+   query has times times. Returns how many words are touched in all.
+ */
+static int qgram_tally(qgram_t *qg, qgram_list_t *l, int times, int touched)
+{
+    size_t pos = 0;
+    int id = 0, cur = -1, run = 0;
+
+    while (pos < l->len) {
+        id += qgram_varint(l->data, &pos);
+
+        /* A word's repeats of the q-gram are next to each other */
+        if (id == cur) {
+            run++;
+            continue;
+        }
+
+        if (cur >= 0)
+            touched = qgram_credit(qg, cur, min(run, times), touched);
+        cur = id;
+        run = 1;
+    }
+
+    if (cur >= 0)
+        touched = qgram_credit(qg, cur, min(run, times), touched);
+
+    return touched;
+}
+
+/*
+   Fewest q-grams a word of len characters can share with a query of
+   qlen characters and be within max_edits of it
+ */
+static long qgram_bound(qgram_t *qg, size_t qlen, size_t len, int max_edits)
+{
+    /* A swap breaks no q-gram of one character */
+    int per_edit = qg->q == 1 ? 1 : qg->q + 1;
+
+    return (long)qgram_count(qg, max(qlen, len)) - (long)max_edits * per_edit;
+}
+
+/* What stays the same for one call to qgram_lookup(), and the batch to check */
+typedef struct {
+    char *str;
+    size_t len;
+    int max_edits;
+    int (*found)(void *arg, char *word, int distance);
+    void *arg;
+
+    /* Whether str fits in qg->pattern, or needs distance_osa() */
+    bool bits;
+
+    char *words[QGRAM_BATCH];
+    size_t lens[QGRAM_BATCH];
+    int count;
+} qgram_query_t;
+
+/* Checks the words waiting in the batch, and reports those close enough */
+static int qgram_flush(qgram_t *qg, qgram_query_t *q)
+{
+    int d[QGRAM_BATCH];
+    int count = q->count;
+
+    if (q->bits) {
+        distance_many(&qg->pattern, q->words, q->lens, count, q->max_edits, d);
+    } else {
+        for (int i = 0; i < count; i++)
+            d[i] = distance_osa(q->str, q->len, q->words[i], q->lens[i],
+                                q->max_edits, qg->rows);
+    }
+
+    q->count = 0;
+    for (int i = 0; i < count; i++) {
+        if (d[i] <= q->max_edits && q->found(q->arg, q->words[i], d[i]) != 0)
+            return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+/* Queues a word to be checked, checking the batch once it is full */
+static int qgram_check(qgram_t *qg, qgram_query_t *q, char *word, size_t len)
+{
+    qg->checked++;
+    q->words[q->count] = word;
+    q->lens[q->count] = len;
+
+    if (++q->count == QGRAM_BATCH)
+        return qgram_flush(qg, q);
+
+    return EXIT_SUCCESS;
+}
+
+int qgram_lookup(qgram_t *qg, char *str, int max_edits,
+                 int (*found)(void *arg, char *word, int distance), void *arg)
+{
+    assert(qg != NULL);
+    assert(str != NULL);
+
+    if (max_edits < 0)
+        max_edits = 0;
+
+    qgram_query_t q = { .str = str, .len = strlen(str), .max_edits = max_edits,
+                        .found = found, .arg = arg, .count = 0 };
+    size_t len = q.len;
+    size_t count = qgram_count(qg, len);
+    int *grams = malloc((count + 1) * sizeof(int));
+
+    q.bits = distance_pattern(&qg->pattern, str, len) == EXIT_SUCCESS;
+
+    /* Rows for words up to max_edits longer than str */
+    size_t need = 3 * (len + max_edits + 1);
+    if (!q.bits && need > qg->rows_size) {
+        int *rows = realloc(qg->rows, need * sizeof(int));
+        if (rows == NULL) {
+            free(grams);
+            grams = NULL;
+        } else {
+            qg->rows = rows;
+            qg->rows_size = need;
+        }
+    }
+
+    if (grams == NULL) {
+        error("Could not allocate memory for qgram lookup");
+        return EXIT_FAILURE;
+    }
+
+    /* Each distinct q-gram of str once, with how many times it appears */
+    qgram_codes(qg, str, len, grams);
+    qsort(grams, count, sizeof(int), qgram_cmp_code);
+
+    int touched = 0;
+    for (size_t i = 0, j; i < count; i = j) {
+        for (j = i + 1; j < count && grams[j] == grams[i]; j++)
+            ;
+
+        qgram_list_t *l = qgram_list(qg, grams[i], false);
+        if (l != NULL)
+            touched = qgram_tally(qg, l, j - i, touched);
+    }
+    free(grams);
+
+    size_t lo = len > (size_t)max_edits ? len - max_edits : 0;
+    size_t hi = min(len + max_edits, qg->num_lengths == 0 ? 0 : qg->num_lengths - 1);
+    int rc = EXIT_SUCCESS;
+
+    qg->checked = 0;
+
+    /* Words with enough q-grams in common, for lengths where that means any */
+    for (int i = 0; i < touched && rc == EXIT_SUCCESS; i++) {
+        int id = qg->touched[i];
+        size_t wlen = qg->lengths[id];
+
+        if (qg->words[id] == NULL || wlen < lo || wlen > hi)
+            continue;
+
+        long bound = qgram_bound(qg, len, wlen, max_edits);
+        if (bound <= 0 || qg->counts[id] < bound)
+            continue;
+
+        rc = qgram_check(qg, &q, qg->words[id], wlen);
+    }
+
+    /* Every word of the lengths where a word can share no q-gram at all */
+    for (size_t wlen = lo; wlen <= hi && hi < qg->num_lengths
+         && rc == EXIT_SUCCESS; wlen++) {
+        if (qgram_bound(qg, len, wlen, max_edits) > 0)
+            continue;
+
+        qgram_bucket_t *b = &qg->by_length[wlen];
+        for (int i = 0; i < b->count && rc == EXIT_SUCCESS; i++)
+            rc = qgram_check(qg, &q, qg->words[b->ids[i]], wlen);
+    }
+
+    if (rc == EXIT_SUCCESS && q.count > 0)
+        rc = qgram_flush(qg, &q);
+
+    for (int i = 0; i < touched; i++)
+        qg->counts[qg->touched[i]] = 0;
+
+    return rc;
+}
@@ -12,6 +12,7 @@
 #include <string.h>
 #include "suggestion.h"
 #include "trie.h"
+#include "utils.h"
 
 bool has_children(trie_t *t, char *s) {
     
@@ -41,315 +42,685 @@ int cmp_match(const void* a, const void* b) {
     return strncmp(aa->str, bb->str, MAXLEN);
 }
 
-// Helper function for suggestions that just moves on to the next character
-int move_on(match_t **set, trie_t *t, char *prefix, char *suffix, int edits_left, int n) {
+/*
+ * Where a search is in the trie: node, with pos characters of its label read. Every
+ * probe moves a cursor down one character instead of searching again from the root.
+ */
+typedef struct {
+    trie_t *node;
+    unsigned int pos;
+} cursor_t;
 
-    int rc = EXIT_SUCCESS;
-    int len = strlen(prefix);
-    char* new_prefix;
+/*
+ * The set is kept as a heap with the worst match on top, so a better match replaces it in
+ * O(log n). The index finds a match by its string: slots[] is an open addressing table of
+ * positions in the set plus one (0 is empty) and where[i] is the slot of position i.
+ */
+typedef struct {
+    int *slots;
+    int size;
+    int *where;
 
-    new_prefix = malloc(sizeof(char) * (MAXLEN + 1));
-    if (new_prefix == NULL) {
-        return EXIT_FAILURE;
+    // Matches in the set, at positions 0..count-1
+    int count;
+} set_index_t;
+
+/*
+ * A state of the search: where it is in the trie and in the word. The same state is often
+ * reached by different edits (a delete then an insert, or a replace), and everything
+ * below it only depends on the state and the edits left.
+ */
+typedef struct {
+    trie_t *node;
+    unsigned int pos;
+    char *suffix;
+
+    // The most edits left the state has been expanded with, or -1 if the entry is empty
+    int edits_left;
+} visited_t;
+
+/* What stays the same for one call to suggestions() */
+typedef struct {
+    match_t **set;
+    trie_t *t;
+    int n;
+    set_index_t index;
+
+    // Open addressing table of the states expanded so far
+    visited_t *visited;
+    size_t visited_size;
+    size_t visited_used;
+
+    suggestion_stats_t stats;
+
+    // The prefix built so far. Every branch writes its characters in place.
+    char buf[2 * MAXLEN + 2];
+} search_t;
+
+static int search(search_t *s, size_t len, cursor_t *cur, cursor_t *par, char *suffix, int edits_left);
+static char** index_list(symspell_t *ss, qgram_t *qg, char *str, int max_edits, int n);
+
+// Moves a cursor down one character. Returns false if there is no path for c
+static bool cursor_step(cursor_t *from, char c, cursor_t *to) {
+
+    if (from == NULL || from->node == NULL) {
+        return false;
     }
 
-    strncpy(new_prefix, prefix, MAXLEN);
+    to->pos = from->pos;
+    to->node = trie_step(from->node, &to->pos, c);
 
-    new_prefix[len] = suffix[0];
+    return to->node != NULL;
+}
 
-    if (has_children(t, new_prefix) == true) {
+// Moves a cursor to its next child, starting with *at = 0. Returns false after the last one
+static bool cursor_next(cursor_t *from, int *at, cursor_t *to) {
 
-        // Move on to the next character, don't use up an edit
-        rc = suggestions(set, t, new_prefix, suffix + 1, edits_left, n);
+    // Inside a compressed label the only child is the next character
+    if (from->pos < from->node->label_len) {
+        if ((*at)++ > 0) {
+            return false;
+        }
+        to->node = from->node;
+        to->pos = from->pos + 1;
+        return true;
     }
 
-    // Save some space now that we're done
-    free(new_prefix);
+    to->node = trie_next_child(from->node, at);
+    to->pos = 0;
 
-    return rc;
+    return to->node != NULL;
 }
 
-// Helper function for suggestions that tries to remove the first character of the suffix
-int try_delete(match_t **set, trie_t *t, char *prefix, char *suffix, int edits_left, int n) {
+// The character a cursor moved past to get to to from from
+static char cursor_char(cursor_t *from, cursor_t *to) {
 
-    int rc = EXIT_SUCCESS;
+    return from->node == to->node ? from->node->label[from->pos] : to->node->current;
+}
 
-    // Don't need to copy the string over as we aren't changing the prefix
+// Helper function for suggestions that just moves on to the next character
+int move_on(search_t *s, size_t len, cursor_t *cur, char *suffix, int edits_left) {
 
-    if (has_children(t, prefix) == true) {
+    cursor_t next;
 
-        // Adding 1 to the suffix pointer will essentially delete the first character
-        rc = suggestions(set, t, prefix, suffix + 1, edits_left - 1, n);
+    // Words longer than the buffer can't be spelled out
+    if (len >= 2 * MAXLEN || cursor_step(cur, suffix[0], &next) == false) {
+        return EXIT_SUCCESS;
     }
 
-    return rc;
+    // Move on to the next character, don't use up an edit
+    s->buf[len] = suffix[0];
+
+    return search(s, len + 1, &next, cur, suffix + 1, edits_left);
+}
+
+// Helper function for suggestions that tries to remove the first character of the suffix
+int try_delete(search_t *s, size_t len, cursor_t *cur, cursor_t *par, char *suffix, int edits_left) {
+
+    // Don't need to change the prefix
+    if (cur->node == NULL) {
+        return EXIT_SUCCESS;
+    }
+
+    // Adding 1 to the suffix pointer will essentially delete the first character
+    return search(s, len, cur, par, suffix + 1, edits_left - 1);
 }
 
 // Helper function for suggestions that tries to replace the first character in the suffix and move it to the prefix
-int try_replace(match_t **set, trie_t *t, char *prefix, char *suffix, int edits_left, int n) {
+int try_replace(search_t *s, size_t len, cursor_t *cur, char *suffix, int edits_left) {
 
-    int i;
-    int rc = EXIT_SUCCESS;
-    int len = strlen(prefix);
-    char *new_prefix;
+    cursor_t next;
+    int at = 0;
 
     // Ran out of space
-    if (len == MAXLEN - 1) {
+    if (len >= MAXLEN - 1) {
         return EXIT_FAILURE;
     }
 
-    for (i = 1; i < 248; i++) {
+    if (cur->node == NULL) {
+        return EXIT_SUCCESS;
+    }
 
-        char c = (char)i;
+    // Only the characters that have a child can lead anywhere
+    while (cursor_next(cur, &at, &next) == true) {
 
-        if (trie_char_exists(t, c) == true) {
+        s->buf[len] = cursor_char(cur, &next);
 
-            new_prefix = malloc(sizeof(char) * (MAXLEN + 1));
-            if (new_prefix == NULL) {
-                return EXIT_FAILURE;
-            } else {
+        if (search(s, len + 1, &next, cur, suffix + 1, edits_left - 1) != EXIT_SUCCESS) {
+            return EXIT_FAILURE;
+        }
+    }
 
-                strncpy(new_prefix, prefix, MAXLEN);
+    return EXIT_SUCCESS;
+}
 
-                // Try replacing the beginning of the suffix with each ASCII character
-                // And move that to the end of the prefix
-                new_prefix[len] = c;
-                new_prefix[len + 1] = '\0';
+// Helper function that tries to swap the last character of the prefix and first character of the suffix
+// and append both to the prefix
+int try_swap(search_t *s, size_t len, cursor_t *par, char *suffix, int edits_left) {
 
-                if (has_children(t, new_prefix) == true) {
+    cursor_t swapped, next;
+    char last;
+    int rc;
 
-                    // Adding 1 to the suffix pointer will essentially delete the first character
-                    // Shifting the "replaced" character to the prefix
-                    rc = suggestions(set, t, new_prefix, suffix + 1, edits_left - 1, n);
+    if (len == 0 || len >= 2 * MAXLEN) {
+        return EXIT_SUCCESS;
+    }
 
-                    if (rc != EXIT_SUCCESS) {
+    last = s->buf[len - 1];
 
-                        free(new_prefix);
-                        return EXIT_FAILURE;
-                    }
-                }
+    // Go back to before the last character, then take the two in swapped order
+    if (cursor_step(par, suffix[0], &swapped) == false
+        || cursor_step(&swapped, last, &next) == false) {
+        return EXIT_SUCCESS;
+    }
 
-                // Save some space now that we're done
-                free(new_prefix);
-            }
+    s->buf[len - 1] = suffix[0];
+    s->buf[len] = last;
+
+    rc = search(s, len + 1, &next, &swapped, suffix + 1, edits_left - 1);
+
+    // Put the prefix back for the other branches
+    s->buf[len - 1] = last;
+
+    return rc;
+}
+
+// Helper function for suggestions that tries to insert a character to the end of a prefix
+int try_insert(search_t *s, size_t len, cursor_t *cur, char *suffix, int edits_left) {
+
+    cursor_t next;
+    int at = 0;
+
+    // Ran out of space
+    if (len >= MAXLEN - 1) {
+        return EXIT_FAILURE;
+    }
+
+    if (cur->node == NULL) {
+        return EXIT_SUCCESS;
+    }
+
+    while (cursor_next(cur, &at, &next) == true) {
+
+        // Basically just inserting the new character to the string
+        s->buf[len] = cursor_char(cur, &next);
+
+        if (search(s, len + 1, &next, cur, suffix, edits_left - 1) != EXIT_SUCCESS) {
+            return EXIT_FAILURE;
         }
     }
 
-    // EXIT_FAILURE would've been caught above, so if we make it here we succeeded
     return EXIT_SUCCESS;
 }
 
-// Helper function that tries to swap the last character of the prefix and first character of the prefix
-// and append both to the prefix
-int try_swap(match_t **set, trie_t * t, char *prefix, char *suffix, int edits_left, int n) {
+// Whether match a ranks after match b, see cmp_match()
+static bool worse(match_t *a, match_t *b) {
 
-    int rc = EXIT_SUCCESS;
-    int len = strlen(prefix);
-    char* new_prefix;
+    return cmp_match(&a, &b) > 0;
+}
 
-    if (len == 0 || strlen(suffix) == 0) {
-        return EXIT_SUCCESS;
+// FNV-1a, for the index of a set
+static unsigned int hash_str(char *str) {
+
+    unsigned int h = 2166136261u;
+
+    for (; *str != '\0'; str++) {
+        h = (h ^ (unsigned char)*str) * 16777619u;
     }
 
-    new_prefix = malloc(sizeof(char) * (MAXLEN + 1));
-    if (new_prefix == NULL) {
-        return EXIT_FAILURE;
+    return h;
+}
+
+// Swaps two matches of a set, keeping the index (if any) pointing at them
+static void heap_swap(match_t **set, set_index_t *index, int i, int j) {
+
+    match_t *m = set[i];
+    set[i] = set[j];
+    set[j] = m;
+
+    if (index != NULL) {
+        int slot = index->where[i];
+        index->where[i] = index->where[j];
+        index->where[j] = slot;
+        index->slots[index->where[i]] = i + 1;
+        index->slots[index->where[j]] = j + 1;
     }
+}
+
+// Moves the match at i up while it is worse than its parent
+static void sift_up(match_t **set, set_index_t *index, int i) {
+
+    while (i > 0 && worse(set[i], set[(i - 1) / 2])) {
+        heap_swap(set, index, i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+}
+
+// Moves the match at i down while a child of it is worse, among the first count
+static void sift_down(match_t **set, set_index_t *index, int i, int count) {
 
-    strncpy(new_prefix, prefix, MAXLEN);
+    while (2 * i + 1 < count) {
+        int child = 2 * i + 1;
+
+        if (child + 1 < count && worse(set[child + 1], set[child])) {
+            child++;
+        }
 
-    // Swap suffix's first character into new_prefix and insert it in front of the last character
-    new_prefix[len] = new_prefix[len - 1];
-    new_prefix[len - 1] = suffix[0];
-    new_prefix[len + 1] = '\0';
+        if (!worse(set[child], set[i])) {
+            break;
+        }
 
-    if (has_children(t, new_prefix) == true) {
-        // Adding 1 to the suffix pointer will essentially delete the first character
-        rc = suggestions(set, t, new_prefix, suffix + 1, edits_left - 1, n);
+        heap_swap(set, index, i, child);
+        i = child;
     }
+}
 
-    // Save some space now that we're done
-    free(new_prefix);
+// Moves the matches in the first n slots to the front and makes a heap of them. Returns how many there are
+static int heapify(match_t **set, int n) {
 
-    return rc;
+    int i, count = 0;
+
+    for (i = 0; i < n; i++) {
+        if (set[i] != NULL) {
+            set[count++] = set[i];
+        }
+    }
+
+    for (i = count; i < n; i++) {
+        set[i] = NULL;
+    }
+
+    for (i = count / 2 - 1; i >= 0; i--) {
+        sift_down(set, NULL, i, count);
+    }
+
+    return count;
 }
 
-// Helper function for suggestions that tries to insert a character to the end of a prefix
-int try_insert(match_t **set, trie_t *t, char *prefix, char *suffix, int edits_left, int n) {
+// The position of the match for str in the set, or -1
+static int index_find(search_t *s, char *str) {
+
+    set_index_t *index = &s->index;
+    int mask = index->size - 1;
+    int slot = hash_str(str) & mask;
+
+    for (; index->slots[slot] != 0; slot = (slot + 1) & mask) {
+        if (strcmp(s->set[index->slots[slot] - 1]->str, str) == 0) {
+            return index->slots[slot] - 1;
+        }
+    }
+
+    return -1;
+}
+
+// Adds the match at position i of the set to the index
+static void index_put(search_t *s, int i) {
+
+    set_index_t *index = &s->index;
+    int mask = index->size - 1;
+    int slot = hash_str(s->set[i]->str) & mask;
+
+    while (index->slots[slot] != 0) {
+        slot = (slot + 1) & mask;
+    }
+
+    index->slots[slot] = i + 1;
+    index->where[i] = slot;
+}
+
+// Takes the match at position i of the set out of the index
+static void index_drop(search_t *s, int i) {
+
+    set_index_t *index = &s->index;
+    int mask = index->size - 1;
+    int hole = index->where[i];
+    int slot = hole;
+
+    index->slots[hole] = 0;
+
+    // Shift back every later entry of the run that would no longer be found
+    while (index->slots[slot = (slot + 1) & mask] != 0) {
+        int home = hash_str(s->set[index->slots[slot] - 1]->str) & mask;
+
+        if (((slot - home) & mask) >= ((slot - hole) & mask)) {
+            index->slots[hole] = index->slots[slot];
+            index->where[index->slots[hole] - 1] = hole;
+            index->slots[slot] = 0;
+            hole = slot;
+        }
+    }
+}
+
+// Makes a heap of the set given to suggestions() and indexes it
+static int index_new(search_t *s) {
 
+    set_index_t *index = &s->index;
     int i;
-    int rc = EXIT_SUCCESS;
-    int len = strlen(prefix);
-    char* new_prefix;
 
-    // Ran out of space
-    if (len == MAXLEN - 1) {
+    index->count = heapify(s->set, s->n);
+    index->size = 4;
+    while (index->size < 2 * s->n) {
+        index->size *= 2;
+    }
+
+    index->slots = calloc(index->size, sizeof(int));
+    index->where = calloc(s->n > 0 ? s->n : 1, sizeof(int));
+    if (index->slots == NULL || index->where == NULL) {
+        free(index->slots);
+        free(index->where);
         return EXIT_FAILURE;
     }
 
-    for (i = 1; i < 248; i++) {
+    for (i = 0; i < index->count; i++) {
+        index_put(s, i);
+    }
+
+    return EXIT_SUCCESS;
+}
 
-        char c = (char)i;
+// Helper function for suggestions(). Adds a word of the trie to a suggestion set
+static int try_add(search_t *s, char *str, int edits_left) {
 
-        if (trie_char_exists(t, c) == true) {
-            
-            new_prefix = malloc(sizeof(char) * (MAXLEN + 1));
-            if (new_prefix == NULL) {
-                return EXIT_FAILURE;
-            } else {
+    set_index_t *index = &s->index;
+    match_t **set = s->set;
+    match_t found = { str, edits_left };
+    char *copy;
+    int i = index_find(s, str);
+
+    if (i >= 0) {
 
-                strncpy(new_prefix, prefix, MAXLEN);
+        // String already exists in suggestion set, if we found it in less edits update its score
+        if (set[i]->edits_left < edits_left) {
+            set[i]->edits_left = edits_left;
+            sift_down(set, index, i, index->count);
+        }
 
-                // Try adding on a new character
-                new_prefix[len] = c;
-                new_prefix[len + 1] = '\0';
+        return EXIT_SUCCESS;
+    }
 
-                if (has_children(t, new_prefix) == true) {
+    // A full set only takes matches better than its worst one, which is on top
+    if (index->count == s->n && (s->n == 0 || !worse(set[0], &found))) {
+        return EXIT_SUCCESS;
+    }
 
-                    // Basically just inserting the new ASCII character to the string
-                    rc = suggestions(set, t, new_prefix, suffix, edits_left - 1, n);
+    copy = malloc(strlen(str) + 1);
+    if (copy == NULL) {
+        return EXIT_FAILURE;
+    }
+    strcpy(copy, str);
 
-                    if (rc != EXIT_SUCCESS) {
+    if (index->count < s->n) {
 
-                        free(new_prefix);
-                        return EXIT_FAILURE;
-                    }
-                } 
-            
-                // Save some space now that we're done
-                free(new_prefix);
-            }
+        // String does not exist in the set, so add it
+        set[index->count] = (match_t*)malloc(sizeof(match_t));
+        if (set[index->count] == NULL) {
+            free(copy);
+            return EXIT_FAILURE;
         }
+
+        set[index->count]->str = copy;
+        set[index->count]->edits_left = edits_left;
+        index_put(s, index->count);
+        sift_up(set, index, index->count++);
+
+        return EXIT_SUCCESS;
     }
 
-    // EXIT_FAILURE would've been caught above, so if we make it here we succeeded
+    // Put it in place of the worst match
+    index_drop(s, 0);
+    free(set[0]->str);
+    set[0]->str = copy;
+    set[0]->edits_left = edits_left;
+    index_put(s, 0);
+    sift_down(set, index, 0, index->count);
+
     return EXIT_SUCCESS;
 }
 
-// Helper function for suggestions(). Attempts to add a match to a suggestion set
-int try_add(match_t **set, trie_t *t, char *s, int edits_left, int n) {
-    int i;
+// Adds prefix+suffix if it is a word, following the suffix from the cursor
+static int try_rest(search_t *s, size_t len, cursor_t *cur, char *suffix, int edits_left) {
 
-    // Check if the current string is in the trie
-    if (trie_search(t, s) == IN_TRIE) {
+    cursor_t at = *cur;
 
-        // Look for the string in the set to update it, or add it
-        for (i = 0; i < n; i++) {
-            if (set[i] == NULL) {
+    for (; *suffix != '\0'; suffix++, len++) {
+        if (len >= 2 * MAXLEN || cursor_step(&at, *suffix, &at) == false) {
+            return EXIT_SUCCESS;
+        }
+        s->buf[len] = *suffix;
+    }
 
-                // String does not exist in the set, so add it
+    if (at.pos < at.node->label_len || at.node->is_word != 1) {
+        return EXIT_SUCCESS;
+    }
 
-                set[i] = (match_t*)malloc(sizeof(match_t));
-                if (set[i] == NULL) {
-                    return EXIT_FAILURE;
-                }
+    s->buf[len] = '\0';
 
-                set[i]->str = malloc(sizeof(char) * MAXLEN);
-                if (set[i]->str == NULL) {
-                    return EXIT_FAILURE;
-                }
-                strcpy(set[i]->str, s);
-                set[i]->edits_left = edits_left;
+    return try_add(s, s->buf, edits_left);
+}
 
-                if (set[i]->str == NULL) {
-                    // strcpy failed
-                    return EXIT_FAILURE;
-                }
+// Hashes a state of the search, see visited_t
+static size_t hash_state(cursor_t *cur, char *suffix) {
 
-                return EXIT_SUCCESS;
-            } else if (strcmp(set[i]->str, s) == 0) {
+    size_t h = (size_t)cur->node * 31 + cur->pos;
 
-                // String already exists in suggestion set
+    h = (h ^ (size_t)suffix) * 0x9E3779B97F4A7C15ull;
 
-                // If we found the string in less edits, update its score
-                if (set[i]->edits_left < edits_left) {
-                    set[i]->edits_left = edits_left;
-                }
+    return h ^ (h >> 29);
+}
+
+// Doubles the table of visited states, placing every entry again
+static int visited_grow(search_t *s) {
+
+    size_t size = s->visited_size * 2;
+    visited_t *table = malloc(size * sizeof(visited_t));
+
+    if (table == NULL) {
+        return EXIT_FAILURE;
+    }
+
+    for (size_t i = 0; i < size; i++) {
+        table[i].edits_left = -1;
+    }
+
+    for (size_t i = 0; i < s->visited_size; i++) {
+        visited_t *v = &s->visited[i];
 
-                // We don't want to trigger adding in place of the worst match
-                i = n + 1;
-                break;
+        if (v->edits_left >= 0) {
+            cursor_t cur = { v->node, v->pos };
+            size_t slot = hash_state(&cur, v->suffix) & (size - 1);
+
+            while (table[slot].edits_left >= 0) {
+                slot = (slot + 1) & (size - 1);
             }
+            table[slot] = *v;
         }
+    }
+
+    free(s->visited);
+    s->visited = table;
+    s->visited_size = size;
+
+    return EXIT_SUCCESS;
+}
 
-        // If we hit the maximum amount of items, then see if we can add it in place of the worst match
-        if (i == n) {
-            i--;
+// The most edits left a state has been recorded with, or -1 if it has not been
+static int visited_edits(search_t *s, cursor_t *cur, char *suffix) {
 
-            // Sort the set by edits_left and break ties alphabetically
-            qsort(set, n, sizeof(match_t*), cmp_match);
+    size_t mask = s->visited_size - 1;
+    size_t slot = hash_state(cur, suffix) & mask;
 
-            // If we found it in less edits or match was alphabetically first
-            if (set[i]->edits_left < edits_left 
-                || (set[i]->edits_left == edits_left && (strncmp(set[i]->str, s, MAXLEN) > 0))) {
+    for (; s->visited[slot].edits_left >= 0; slot = (slot + 1) & mask) {
+        visited_t *v = &s->visited[slot];
 
-                set[i]->str = malloc(sizeof(char) * MAXLEN);
-                if (set[i]->str == NULL) {
-                    return EXIT_FAILURE;
-                }
-                strcpy(set[i]->str, s);
-                set[i]->edits_left = edits_left;
+        if (v->node == cur->node && v->pos == cur->pos && v->suffix == suffix) {
+            return v->edits_left;
+        }
+    }
 
-                if (set[i]->str == NULL) {
-                    // strcpy failed
-                    return EXIT_FAILURE;
-                }
+    return -1;
+}
+
+/*
+ * Records that a state is about to be expanded with edits_left. Sets *seen if it already
+ * was with at least as many, since then it can only find the same words with worse scores.
+ */
+static int visit(search_t *s, cursor_t *cur, char *suffix, int edits_left, bool *seen) {
+
+    size_t mask, slot;
+
+    if (2 * (s->visited_used + 1) > s->visited_size && visited_grow(s) != EXIT_SUCCESS) {
+        return EXIT_FAILURE;
+    }
+
+    mask = s->visited_size - 1;
+    slot = hash_state(cur, suffix) & mask;
+
+    for (; s->visited[slot].edits_left >= 0; slot = (slot + 1) & mask) {
+        visited_t *v = &s->visited[slot];
+
+        if (v->node == cur->node && v->pos == cur->pos && v->suffix == suffix) {
+            *seen = v->edits_left >= edits_left;
+            if (!*seen) {
+                v->edits_left = edits_left;
             }
+            return EXIT_SUCCESS;
         }
     }
 
+    s->visited[slot].node = cur->node;
+    s->visited[slot].pos = cur->pos;
+    s->visited[slot].suffix = suffix;
+    s->visited[slot].edits_left = edits_left;
+    s->visited_used++;
+    *seen = false;
+
     return EXIT_SUCCESS;
 }
 
-// Look at suggestion.h for documentation
-int suggestions(match_t **set, trie_t *t, char *prefix, char *suffix, int edits_left, int n) {
+/*
+ * The body of suggestions(). The prefix is s->buf[0..len), cur is where it ends in the
+ * trie (node NULL if it is not in the trie) and par is where it ends without its last
+ * character, for swaps.
+ */
+static int search(search_t *s, size_t len, cursor_t *cur, cursor_t *par, char *suffix, int edits_left) {
 
-    char* s;
     int rc = 0;
-    
-    // Since prefix and suffix can have max length MAXLEN
-    s = malloc(sizeof(char) * (MAXLEN + 1) * 2);
-    if (s == NULL) {
-        return EXIT_FAILURE;
+    bool seen = false;
+
+    // Skip states already expanded with as many edits left. Without edits left there is
+    // nothing to expand, only the rest of the suffix to follow.
+    if (cur->node != NULL && edits_left > 0) {
+        if (visit(s, cur, suffix, edits_left, &seen) != EXIT_SUCCESS) {
+            return EXIT_FAILURE;
+        }
+
+        if (seen) {
+            s->stats.saved++;
+            return EXIT_SUCCESS;
+        }
     }
 
-    // Now put prefix and suffix together
-    strncpy(s, prefix, MAXLEN);
-    strncat(s, suffix, MAXLEN);
+    s->stats.expanded++;
 
-    if (try_add(set, t, s, edits_left, n) != EXIT_SUCCESS)  {
+    // Words are only found through a cursor, so a prefix not in the trie adds nothing
+    if (cur->node != NULL
+        && (suffix[0] == '\0' || edits_left <= 0)
+        && try_rest(s, len, cur, suffix, edits_left) != EXIT_SUCCESS)  {
         return EXIT_FAILURE;
     }
 
     if (edits_left <= 0) {
         // Hooray for exit conditions!
-
-        free(s);
         return EXIT_SUCCESS;
     }
 
     // Make sure we aren't at the end of the suffix
     if (suffix[0] != '\0') {
 
-        rc += move_on(set, t, prefix, suffix, edits_left, n);
+        rc += move_on(s, len, cur, suffix, edits_left);
 
-        rc += try_delete(set, t, prefix, suffix, edits_left, n);
+        rc += try_delete(s, len, cur, par, suffix, edits_left);
 
-        rc += try_replace(set, t, prefix, suffix, edits_left, n);
+        rc += try_replace(s, len, cur, suffix, edits_left);
 
-        rc += try_swap(set, t, prefix, suffix, edits_left, n);
+        rc += try_swap(s, len, par, suffix, edits_left);
     }
 
     // This one doesn't need any fancy suffix checking
-    rc += try_insert(set, t, prefix, suffix, edits_left, n);
-
-    free(s);
+    rc += try_insert(s, len, cur, suffix, edits_left);
 
     if (rc != EXIT_SUCCESS) {
         return EXIT_FAILURE;
     }
 
     return EXIT_SUCCESS;
+}
+
+// Look at suggestion.h for documentation
+int suggestions(match_t **set, trie_t *t, char *prefix, char *suffix, int edits_left, int n) {
+
+    return suggestions_stats(set, t, prefix, suffix, edits_left, n, NULL);
+}
+
+// Look at suggestion.h for documentation
+int suggestions_stats(match_t **set, trie_t *t, char *prefix, char *suffix, int edits_left, int n,
+                      suggestion_stats_t *stats) {
+
+    search_t s;
+    cursor_t cur = { t, t->label_len };
+    cursor_t par = { NULL, 0 };
+    size_t len = strlen(prefix);
+
+    if (len > MAXLEN) {
+        return EXIT_FAILURE;
+    }
+
+    s.set = set;
+    s.t = t;
+    s.n = n;
+    memcpy(s.buf, prefix, len);
+
+    memset(&s.stats, 0, sizeof(s.stats));
+    s.visited_used = 0;
+    s.visited_size = 64;
+    s.visited = malloc(s.visited_size * sizeof(visited_t));
+    if (s.visited == NULL) {
+        return EXIT_FAILURE;
+    }
+    for (size_t i = 0; i < s.visited_size; i++) {
+        s.visited[i].edits_left = -1;
+    }
+
+    if (index_new(&s) != EXIT_SUCCESS) {
+        free(s.visited);
+        return EXIT_FAILURE;
+    }
+
+    // The only walk from the root. Everything after moves one character at a time.
+    for (size_t i = 0; i < len; i++) {
+        par = cur;
+        if (cursor_step(&par, prefix[i], &cur) == false) {
+
+            // A prefix not in the trie can still swap, if all but its last character is
+            cur.node = NULL;
+            if (i + 1 < len) {
+                par.node = NULL;
+            }
+            break;
+        }
+    }
+
+    int rc = search(&s, len, &cur, &par, suffix, edits_left);
+
+    free(s.index.slots);
+    free(s.index.where);
+    free(s.visited);
+
+    if (stats != NULL) {
+        *stats = s.stats;
+    }
+
+    return rc;
 }    
 
 match_t **suggestion_set_new(trie_t *t, char *str, int max_edits, int n) {
@@ -394,7 +765,13 @@ char** suggestion_set_first_n(match_t **set, int n) {
         return NULL;
     }
 
-    qsort(set, n, sizeof(match_t*), cmp_match);
+    // Heap sort: take the worst match off the top and put it at the end until none are left
+    int count = heapify(set, n);
+
+    for (i = count - 1; i > 0; i--) {
+        heap_swap(set, NULL, 0, i);
+        sift_down(set, NULL, 0, i);
+    }
 
     // Take the list of strings out of the match_t wrappers
     for (i = 0; i < n; i++) {
@@ -425,4 +802,973 @@ char** suggestion_list(trie_t *t, char *str, int max_edits, int amount) {
     char **results = suggestion_set_first_n(set, amount);
 
     return results;
-}
\ No newline at end of file
+}
+
+/*************   Best-first engine, see suggestions_best_first()   *************/
+
+/* A state waiting to be expanded, with the edits it took to get there */
+typedef struct {
+    cursor_t cur;
+    cursor_t par;
+    char *suffix;
+
+    // The prefix is len characters at offset prefix of the prefix pool
+    size_t len;
+    size_t prefix;
+} pending_t;
+
+/* One stack of pending states per number of edits used */
+typedef struct {
+    pending_t *states;
+    size_t used;
+    size_t size;
+} bucket_t;
+
+/* What stays the same for one call to suggestions_best_first() */
+typedef struct {
+    search_t *s;
+    int max_edits;
+    bucket_t *buckets;
+
+    // The prefixes of the pending states, one after the other
+    char *pool;
+    size_t pool_used;
+    size_t pool_size;
+} best_first_t;
+
+/*
+ * Queues a state reached with edits edits used. The prefix is the first len characters
+ * of the pool at offset prefix, followed by the count characters of extra. States already
+ * queued with as few edits are left out.
+ */
+static int bf_push(best_first_t *bf, int edits, cursor_t *cur, cursor_t *par, char *suffix,
+                   size_t len, size_t prefix, char *extra, size_t count) {
+
+    search_t *s = bf->s;
+    bucket_t *b = &bf->buckets[edits];
+    int edits_left = bf->max_edits - edits;
+    bool seen;
+
+    // Without edits left there is nothing to expand, only the rest of the suffix to
+    // follow, so those states are not worth remembering
+    if (edits_left > 0 && visit(s, cur, suffix, edits_left, &seen) != EXIT_SUCCESS) {
+        return EXIT_FAILURE;
+    }
+
+    if (edits_left > 0 && seen) {
+        s->stats.saved++;
+        return EXIT_SUCCESS;
+    }
+
+    if (b->used == b->size) {
+        size_t size = b->size == 0 ? 64 : 2 * b->size;
+        pending_t *states = realloc(b->states, size * sizeof(pending_t));
+        if (states == NULL) {
+            return EXIT_FAILURE;
+        }
+        b->states = states;
+        b->size = size;
+    }
+
+    // A state that only reads past a character of the suffix keeps its prefix
+    if (count > 0) {
+        size_t need = bf->pool_used + len + count;
+
+        if (need > bf->pool_size) {
+            size_t size = 2 * bf->pool_size > need ? 2 * bf->pool_size : need;
+            char *pool = realloc(bf->pool, size);
+            if (pool == NULL) {
+                return EXIT_FAILURE;
+            }
+            bf->pool = pool;
+            bf->pool_size = size;
+        }
+
+        memcpy(bf->pool + bf->pool_used, bf->pool + prefix, len);
+        memcpy(bf->pool + bf->pool_used + len, extra, count);
+        prefix = bf->pool_used;
+        len += count;
+        bf->pool_used = need;
+    }
+
+    pending_t *p = &b->states[b->used++];
+    p->cur = *cur;
+    p->par = *par;
+    p->suffix = suffix;
+    p->len = len;
+    p->prefix = prefix;
+
+    return EXIT_SUCCESS;
+}
+
+/*
+ * Expands a state taken off the bucket for edits edits used, queueing what each edit leads
+ * to. Does the same as search() does for one state, without going any deeper.
+ */
+static int bf_expand(best_first_t *bf, int edits, pending_t p) {
+
+    search_t *s = bf->s;
+    int edits_left = bf->max_edits - edits;
+    cursor_t next, swapped;
+    char c[2];
+    int at = 0;
+
+    // A state queued again with fewer edits has been, or will be, expanded with those
+    if (edits_left > 0 && visited_edits(s, &p.cur, p.suffix) > edits_left) {
+        s->stats.saved++;
+        return EXIT_SUCCESS;
+    }
+
+    s->stats.expanded++;
+
+    if (p.suffix[0] == '\0' || edits_left <= 0) {
+        memcpy(s->buf, bf->pool + p.prefix, p.len);
+        if (try_rest(s, p.len, &p.cur, p.suffix, edits_left) != EXIT_SUCCESS) {
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (edits_left <= 0) {
+        return EXIT_SUCCESS;
+    }
+
+    if (p.len >= MAXLEN - 1) {
+        // Ran out of space, like try_replace() and try_insert()
+        return EXIT_FAILURE;
+    }
+
+    if (p.suffix[0] != '\0') {
+
+        // Moving on costs nothing, so it goes on the bucket being emptied
+        if (cursor_step(&p.cur, p.suffix[0], &next) == true
+            && bf_push(bf, edits, &next, &p.cur, p.suffix + 1, p.len, p.prefix,
+                       p.suffix, 1) != EXIT_SUCCESS) {
+            return EXIT_FAILURE;
+        }
+
+        if (bf_push(bf, edits + 1, &p.cur, &p.par, p.suffix + 1, p.len, p.prefix,
+                    NULL, 0) != EXIT_SUCCESS) {
+            return EXIT_FAILURE;
+        }
+
+        while (cursor_next(&p.cur, &at, &next) == true) {
+            c[0] = cursor_char(&p.cur, &next);
+            if (bf_push(bf, edits + 1, &next, &p.cur, p.suffix + 1, p.len, p.prefix,
+                        c, 1) != EXIT_SUCCESS) {
+                return EXIT_FAILURE;
+            }
+        }
+
+        // Go back to before the last character, then take the two in swapped order
+        if (p.len > 0 && cursor_step(&p.par, p.suffix[0], &swapped) == true
+            && cursor_step(&swapped, bf->pool[p.prefix + p.len - 1], &next) == true) {
+            c[0] = p.suffix[0];
+            c[1] = bf->pool[p.prefix + p.len - 1];
+            if (bf_push(bf, edits + 1, &next, &swapped, p.suffix + 1, p.len - 1, p.prefix,
+                        c, 2) != EXIT_SUCCESS) {
+                return EXIT_FAILURE;
+            }
+        }
+    }
+
+    at = 0;
+    while (cursor_next(&p.cur, &at, &next) == true) {
+        c[0] = cursor_char(&p.cur, &next);
+        if (bf_push(bf, edits + 1, &next, &p.cur, p.suffix, p.len, p.prefix,
+                    c, 1) != EXIT_SUCCESS) {
+            return EXIT_FAILURE;
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
+
+// Look at suggestion.h for documentation
+int suggestions_best_first(match_t **set, trie_t *t, char *str, int max_edits, int n,
+                           suggestion_stats_t *stats) {
+
+    assert(t != NULL);
+    assert(str != NULL);
+
+    search_t s;
+    best_first_t bf;
+    cursor_t root = { t, t->label_len };
+    cursor_t none = { NULL, 0 };
+    int rc = EXIT_SUCCESS;
+
+    if (max_edits < 0) {
+        max_edits = 0;
+    }
+
+    s.set = set;
+    s.t = t;
+    s.n = n;
+
+    memset(&s.stats, 0, sizeof(s.stats));
+    s.visited_used = 0;
+    s.visited_size = 64;
+    s.visited = malloc(s.visited_size * sizeof(visited_t));
+    if (s.visited == NULL) {
+        return EXIT_FAILURE;
+    }
+    for (size_t i = 0; i < s.visited_size; i++) {
+        s.visited[i].edits_left = -1;
+    }
+
+    if (index_new(&s) != EXIT_SUCCESS) {
+        free(s.visited);
+        return EXIT_FAILURE;
+    }
+
+    bf.s = &s;
+    bf.max_edits = max_edits;
+    bf.buckets = calloc(max_edits + 1, sizeof(bucket_t));
+    bf.pool_used = 0;
+    bf.pool_size = 256;
+    bf.pool = malloc(bf.pool_size);
+
+    if (bf.buckets == NULL || bf.pool == NULL
+        || bf_push(&bf, 0, &root, &none, str, 0, 0, NULL, 0) != EXIT_SUCCESS) {
+        rc = EXIT_FAILURE;
+    }
+
+    /*
+     * Every word found while emptying the bucket for edits used is that many edits away and
+     * no closer, since the buckets before it are empty. Once the set is full after a bucket,
+     * whatever is left can only rank below all of it.
+     */
+    for (int edits = 0; rc == EXIT_SUCCESS && edits <= max_edits; edits++) {
+        bucket_t *b = &bf.buckets[edits];
+
+        while (rc == EXIT_SUCCESS && b->used > 0) {
+            rc = bf_expand(&bf, edits, b->states[--b->used]);
+        }
+
+        if (s.index.count == n) {
+            break;
+        }
+    }
+
+    if (bf.buckets != NULL) {
+        for (int i = 0; i <= max_edits; i++) {
+            free(bf.buckets[i].states);
+        }
+    }
+    free(bf.buckets);
+    free(bf.pool);
+    free(s.index.slots);
+    free(s.index.where);
+    free(s.visited);
+
+    if (stats != NULL) {
+        *stats = s.stats;
+    }
+
+    return rc;
+}
+
+char** suggestion_list_best_first(trie_t *t, char *str, int max_edits, int n) {
+
+    assert(t != NULL);
+    assert(str != NULL);
+
+    match_t **set = (match_t **)calloc(n, sizeof(match_t*));
+
+    if (set == NULL) {
+        return NULL;
+    }
+
+    if (suggestions_best_first(set, t, str, max_edits, n, NULL) != EXIT_SUCCESS) {
+
+        for (int i = 0; i < n; i++) {
+            if (set[i] != NULL) {
+                free(set[i]->str);
+                free(set[i]);
+            }
+        }
+
+        free(set);
+
+        return NULL;
+    }
+
+    return suggestion_set_first_n(set, n);
+}
+
+/*************   Index engines, see suggestions_symspell() and suggestions_qgram()   *************/
+
+/* What a symspell_lookup() or qgram_lookup() adds to */
+typedef struct {
+    search_t *s;
+    int max_edits;
+} lookup_set_t;
+
+// Offers a word an index lookup found to the set. Stops the lookup on an error
+static int lookup_found(void *arg, char *word, int distance) {
+
+    lookup_set_t *to = arg;
+
+    return try_add(to->s, word, to->max_edits - distance) != EXIT_SUCCESS;
+}
+
+// Look at suggestion.h for documentation
+int suggestions_symspell(match_t **set, symspell_t *ss, char *str, int max_edits, int n) {
+
+    assert(ss != NULL);
+    assert(str != NULL);
+
+    search_t s;
+    lookup_set_t to = { &s, max_edits };
+
+    s.set = set;
+    s.t = NULL;
+    s.n = n;
+
+    if (index_new(&s) != EXIT_SUCCESS) {
+        return EXIT_FAILURE;
+    }
+
+    int rc = symspell_lookup(ss, str, max_edits, lookup_found, &to);
+
+    free(s.index.slots);
+    free(s.index.where);
+
+    return rc;
+}
+
+// Look at suggestion.h for documentation
+int suggestions_qgram(match_t **set, qgram_t *qg, char *str, int max_edits, int n) {
+
+    assert(qg != NULL);
+    assert(str != NULL);
+
+    search_t s;
+    lookup_set_t to = { &s, max_edits };
+
+    s.set = set;
+    s.t = NULL;
+    s.n = n;
+
+    if (index_new(&s) != EXIT_SUCCESS) {
+        return EXIT_FAILURE;
+    }
+
+    int rc = qgram_lookup(qg, str, max_edits, lookup_found, &to);
+
+    free(s.index.slots);
+    free(s.index.where);
+
+    return rc;
+}
+
+// Returns the closest words to str from an index, ss if it is not NULL and qg otherwise
+static char** index_list(symspell_t *ss, qgram_t *qg, char *str, int max_edits, int n) {
+
+    match_t **set = (match_t **)calloc(n, sizeof(match_t*));
+    int rc = EXIT_FAILURE;
+
+    if (set != NULL) {
+        if (ss != NULL) {
+            rc = suggestions_symspell(set, ss, str, max_edits, n);
+        } else {
+            rc = suggestions_qgram(set, qg, str, max_edits, n);
+        }
+    }
+
+    if (set == NULL) {
+        return NULL;
+    }
+
+    if (rc != EXIT_SUCCESS) {
+
+        for (int i = 0; i < n; i++) {
+            if (set[i] != NULL) {
+                free(set[i]->str);
+                free(set[i]);
+            }
+        }
+
+        free(set);
+
+        return NULL;
+    }
+
+    return suggestion_set_first_n(set, n);
+}
+
+char** suggestion_list_engine(trie_t *t, symspell_t *ss, qgram_t *qg, char *str, int max_edits,
+                              int n, int engine) {
+
+    assert(t != NULL);
+    assert(str != NULL);
+
+    switch (engine) {
+    case SUGGEST_DEPTH_FIRST: {
+        match_t **set = suggestion_set_new(t, str, max_edits, n);
+
+        return set == NULL ? NULL : suggestion_set_first_n(set, n);
+    }
+    case SUGGEST_BEST_FIRST:
+        return suggestion_list_best_first(t, str, max_edits, n);
+    case SUGGEST_SYMSPELL:
+        if (ss != NULL && max_edits <= ss->max_distance) {
+            return index_list(ss, NULL, str, max_edits, n);
+        }
+        return suggestion_list_dp(t, str, max_edits, n);
+    case SUGGEST_QGRAM:
+        if (qg != NULL) {
+            return index_list(NULL, qg, str, max_edits, n);
+        }
+        return suggestion_list_dp(t, str, max_edits, n);
+    default:
+        return suggestion_list_dp(t, str, max_edits, n);
+    }
+}
+
+/*************   DP-row engine, see suggestion_list_dp()   *************/
+
+/*
+ * Cost of a state with more than max_edits edits. Costs are capped here so
+ * adding 1 can never overflow.
+ */
+#define DP_INF(ctx) ((ctx)->max_edits + 1)
+
+/* A node suggestion_complete() reached, and the fewest edits it took */
+typedef struct {
+    trie_t *node;
+    int edits;
+} dp_reached_t;
+
+/* State shared by the whole walk of suggestion_list_dp() */
+typedef struct {
+    // The word being matched and its length
+    char *str;
+    int len;
+
+    // Whether swaps count like distance_osa() rather than like suggestions()
+    bool osa;
+
+    // Edit budget and number of results wanted
+    int max_edits;
+    int n;
+
+    // Stack of DP rows, len + 1 ints each, addressed by offset since it grows
+    int *pool;
+    size_t pool_used;
+    size_t pool_size;
+
+    // The characters on the path from the root to the current node
+    char *key;
+    size_t key_size;
+
+    // The best n matches so far, ranked like cmp_match()
+    match_t *best;
+    int num_best;
+
+    // For suggestion_complete(): the nodes within max_edits of str, NULL otherwise
+    dp_reached_t *reached;
+    int num_reached;
+    int reached_size;
+
+    // reach[len] is the fewest edits of any place on the path up to len characters
+    int *reach;
+} dp_ctx_t;
+
+/* The rows of the children of one node, found by character */
+typedef struct dp_frame {
+    // Offset of the first child's row, the rest follow in child order
+    size_t base;
+
+    // slot[c] is the index of the child for c, or -1 if it is over budget
+    short slot[256];
+} dp_frame_t;
+
+/* Returns the offset of count new rows on the row stack */
+static int dp_push_rows(dp_ctx_t *ctx, int count, size_t *off) {
+    size_t need = ctx->pool_used + (size_t)count * (ctx->len + 1);
+
+    if (need > ctx->pool_size) {
+        size_t size = ctx->pool_size * 2 > need ? ctx->pool_size * 2 : need;
+        int *pool = realloc(ctx->pool, size * sizeof(int));
+        if (pool == NULL) {
+            return EXIT_FAILURE;
+        }
+        ctx->pool = pool;
+        ctx->pool_size = size;
+    }
+
+    *off = ctx->pool_used;
+    ctx->pool_used = need;
+
+    return EXIT_SUCCESS;
+}
+
+/* Ranks a match like cmp_match(): more edits left first, then alphabetically */
+static int dp_cmp(int edits_a, char *str_a, int edits_b, char *str_b) {
+
+    if (edits_a != edits_b) {
+        return edits_b - edits_a;
+    }
+
+    return strncmp(str_a, str_b, MAXLEN);
+}
+
+/* Offers the word on the current path, keeping the best n */
+static int dp_add(dp_ctx_t *ctx, size_t len, int edits_left) {
+
+    ctx->key[len] = '\0';
+
+    if (ctx->n <= 0) {
+        return EXIT_SUCCESS;
+    }
+
+    // Full and no better than the worst match
+    if (ctx->num_best == ctx->n
+        && dp_cmp(edits_left, ctx->key, ctx->best[ctx->n - 1].edits_left,
+                  ctx->best[ctx->n - 1].str) >= 0) {
+        return EXIT_SUCCESS;
+    }
+
+    char *str = malloc(len + 1);
+    if (str == NULL) {
+        return EXIT_FAILURE;
+    }
+    memcpy(str, ctx->key, len + 1);
+
+    int i = ctx->num_best;
+    if (i == ctx->n) {
+        free(ctx->best[--i].str);
+    } else {
+        ctx->num_best++;
+    }
+
+    for (; i > 0 && dp_cmp(edits_left, str, ctx->best[i - 1].edits_left,
+                           ctx->best[i - 1].str) < 0; i--) {
+        ctx->best[i] = ctx->best[i - 1];
+    }
+    ctx->best[i].str = str;
+    ctx->best[i].edits_left = edits_left;
+
+    return EXIT_SUCCESS;
+}
+
+/*
+ * Notes that the walk reached node after len characters of path, with cost
+ * edits for all of str. The words below a node already reached with as few
+ * edits higher up the path are not offered again.
+ */
+static int dp_reach(dp_ctx_t *ctx, trie_t *node, size_t len, int cost) {
+
+    int before = ctx->reach[len - 1];
+
+    ctx->reach[len] = min(before, cost);
+    if (cost > ctx->max_edits || cost >= before) {
+        return EXIT_SUCCESS;
+    }
+
+    // Further along the label of the node last reached, with fewer edits
+    if (ctx->num_reached > 0 && ctx->reached[ctx->num_reached - 1].node == node) {
+        ctx->reached[ctx->num_reached - 1].edits = cost;
+        return EXIT_SUCCESS;
+    }
+
+    if (ctx->num_reached == ctx->reached_size) {
+        dp_reached_t *reached = realloc(ctx->reached,
+                                        ctx->reached_size * 2 * sizeof(dp_reached_t));
+        if (reached == NULL) {
+            return EXIT_FAILURE;
+        }
+        ctx->reached = reached;
+        ctx->reached_size *= 2;
+    }
+
+    ctx->reached[ctx->num_reached].node = node;
+    ctx->reached[ctx->num_reached].edits = cost;
+    ctx->num_reached++;
+
+    return EXIT_SUCCESS;
+}
+
+/*
+ * The fewest edits of any row below the node whose row is at row_off, given
+ * the smallest entry low of the rows of the node and its siblings. A row
+ * takes its entries from its parent's row, from itself plus one, or from a
+ * row of its parent's siblings plus one (a swap), so none can be smaller.
+ * With ctx->osa the swap comes from the row of the parent's parent instead,
+ * and low is the smallest entry of the parent's row.
+ */
+static int dp_lowest(dp_ctx_t *ctx, size_t row_off, int low) {
+
+    int *row = ctx->pool + row_off;
+    int best = low + 1;
+
+    for (int i = 0; i <= ctx->len; i++) {
+        best = min(best, row[i]);
+    }
+
+    return best;
+}
+
+/*
+ * Fills the row of the child with character c of a node whose own row is
+ * at parent_off. Entry i is the fewest edits suggestions() needs to have
+ * read i characters of the word and written the path to the child.
+ *  - up: the frame holding the rows of the node and its siblings, NULL
+ *    at the root
+ *  - pc: the node's own character
+ *  - grand: the row of the node's parent, NULL at the root. Only used
+ *    with ctx->osa, where a swap of pc and c takes one edit from there.
+ * Returns the smallest entry.
+ */
+static int dp_fill_row(dp_ctx_t *ctx, size_t parent_off, size_t row_off,
+                       char c, dp_frame_t *up, char pc, int *grand) {
+
+    int *parent = ctx->pool + parent_off;
+    int *row = ctx->pool + row_off;
+    int inf = DP_INF(ctx);
+    int best;
+
+    /*
+     * try_swap() turns the path Q y into Q x y while reading x, so the
+     * child (y after Q x) can also come from the sibling of the node for y
+     */
+    int *swap = NULL;
+    if (!ctx->osa && up != NULL && up->slot[(unsigned char)c] >= 0) {
+        swap = ctx->pool + up->base
+            + (size_t)up->slot[(unsigned char)c] * (ctx->len + 1);
+    }
+
+    // A true swap only needs the path before the two characters
+    if (!ctx->osa) {
+        grand = NULL;
+    }
+
+    // try_insert()
+    row[0] = min(parent[0] + 1, inf);
+    best = row[0];
+
+    for (int i = 1; i <= ctx->len; i++) {
+        int v = row[i - 1] + 1;                     // try_delete()
+
+        if (ctx->str[i - 1] == c) {
+            v = min(v, parent[i - 1]);              // move_on()
+        } else {
+            v = min(v, parent[i - 1] + 1);          // try_replace()
+        }
+
+        v = min(v, parent[i] + 1);                  // try_insert()
+
+        if (swap != NULL && ctx->str[i - 1] == pc) {
+            v = min(v, swap[i - 1] + 1);            // try_swap()
+        }
+
+        if (grand != NULL && i >= 2 && ctx->str[i - 1] == pc && ctx->str[i - 2] == c) {
+            v = min(v, grand[i - 2] + 1);           // distance_osa()'s swap
+        }
+
+        row[i] = min(v, inf);
+        best = min(best, row[i]);
+    }
+
+    return best;
+}
+
+/* The character of the node the walk reaches by going to child */
+static char dp_child_char(trie_t *node, unsigned int pos, trie_t *child) {
+
+    return pos < node->label_len ? node->label[pos] : child->current;
+}
+
+/*
+ * Visits the children of a node (node with pos characters of its label
+ * read), whose row is at row_off and whose path is len characters long.
+ * The row of the node's parent is at grand_off, if len > 0.
+ */
+static int dp_visit(dp_ctx_t *ctx, trie_t *node, unsigned int pos,
+                    size_t row_off, size_t grand_off, size_t len, dp_frame_t *up, char pc) {
+
+    dp_frame_t frame;
+    trie_t *child;
+    int count = pos < node->label_len ? 1 : node->num_children;
+    int at = 0;
+    int low = DP_INF(ctx);
+    int parent_low = DP_INF(ctx);
+
+    if (count == 0) {
+        return EXIT_SUCCESS;
+    }
+
+    if (dp_push_rows(ctx, count, &frame.base) != EXIT_SUCCESS) {
+        return EXIT_FAILURE;
+    }
+    memset(frame.slot, -1, sizeof(frame.slot));
+
+    // Fill every child's row first, their children need them for swaps
+    for (int i = 0; i < count; i++) {
+        child = pos < node->label_len ? node : trie_next_child(node, &at);
+        char c = dp_child_char(node, pos, child);
+        size_t off = frame.base + (size_t)i * (ctx->len + 1);
+
+        int best = dp_fill_row(ctx, row_off, off, c, up, pc,
+                               len > 0 ? ctx->pool + grand_off : NULL);
+
+        if (best <= ctx->max_edits) {
+            frame.slot[(unsigned char)c] = i;
+        }
+        low = min(low, best);
+    }
+
+    // Below a child, a swap can also take its entries from the node's own row plus one
+    if (ctx->osa) {
+        for (int i = 0; i <= ctx->len; i++) {
+            parent_low = min(parent_low, ctx->pool[row_off + i]);
+        }
+        low = min(low, parent_low);
+    }
+
+    if (len + 2 > ctx->key_size) {
+        char *key = realloc(ctx->key, ctx->key_size * 2);
+        if (key == NULL) {
+            return EXIT_FAILURE;
+        }
+        ctx->key = key;
+
+        if (ctx->reach != NULL) {
+            int *reach = realloc(ctx->reach, ctx->key_size * 2 * sizeof(int));
+            if (reach == NULL) {
+                return EXIT_FAILURE;
+            }
+            ctx->reach = reach;
+        }
+        ctx->key_size *= 2;
+    }
+
+    at = 0;
+    for (int i = 0; i < count; i++) {
+        unsigned int child_pos = pos + 1;
+
+        child = pos < node->label_len ? node : trie_next_child(node, &at);
+        char c = dp_child_char(node, pos, child);
+        if (child != node) {
+            child_pos = 0;
+        }
+
+        // Over budget everywhere, and so is everything below it
+        if (frame.slot[(unsigned char)c] < 0) {
+            continue;
+        }
+
+        size_t off = frame.base + (size_t)i * (ctx->len + 1);
+        int cost = ctx->pool[off + ctx->len];
+
+        ctx->key[len] = c;
+
+        if (ctx->reached != NULL) {
+            if (dp_reach(ctx, child, len + 1, cost) != EXIT_SUCCESS) {
+                return EXIT_FAILURE;
+            }
+
+            // Nothing below can be reached with fewer edits
+            if (dp_lowest(ctx, off, low) >= ctx->reach[len + 1]) {
+                continue;
+            }
+        } else if (child->is_word == 1 && child_pos == child->label_len
+                   && cost <= ctx->max_edits
+                   && dp_add(ctx, len + 1, ctx->max_edits - cost) != EXIT_SUCCESS) {
+            return EXIT_FAILURE;
+        }
+
+        if (dp_visit(ctx, child, child_pos, off, row_off, len + 1, &frame, c)
+            != EXIT_SUCCESS) {
+            return EXIT_FAILURE;
+        }
+    }
+
+    ctx->pool_used = frame.base;
+
+    return EXIT_SUCCESS;
+}
+
+char** suggestion_list_dp(trie_t *t, char *str, int max_edits, int n) {
+
+    assert(t != NULL);
+    assert(str != NULL);
+
+    dp_ctx_t ctx;
+    size_t root_off;
+    int i, rc = EXIT_FAILURE;
+    char **results = NULL;
+
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.str = str;
+    ctx.len = strlen(str);
+    ctx.max_edits = max_edits < 0 ? 0 : max_edits;
+    ctx.n = n;
+    ctx.key_size = MAXLEN + 1;
+    ctx.key = malloc(ctx.key_size);
+    ctx.best = calloc(n, sizeof(match_t));
+    results = calloc(n, sizeof(char*));
+
+    if (ctx.key == NULL || ctx.best == NULL || results == NULL) {
+        goto done;
+    }
+
+    if (dp_push_rows(&ctx, 1, &root_off) != EXIT_SUCCESS) {
+        goto done;
+    }
+
+    // The empty path is reached by deleting everything read so far
+    for (i = 0; i <= ctx.len; i++) {
+        ctx.pool[root_off + i] = min(i, DP_INF(&ctx));
+    }
+
+    if (t->is_word == 1 && t->label_len == 0 && ctx.len <= ctx.max_edits
+        && dp_add(&ctx, 0, ctx.max_edits - ctx.len) != EXIT_SUCCESS) {
+        goto done;
+    }
+
+    rc = dp_visit(&ctx, t, t->label_len, root_off, 0, 0, NULL, '\0');
+
+done:
+    if (rc == EXIT_SUCCESS) {
+        for (i = 0; i < ctx.num_best; i++) {
+            results[i] = ctx.best[i].str;
+        }
+    } else {
+        for (i = 0; i < ctx.num_best; i++) {
+            free(ctx.best[i].str);
+        }
+        free(results);
+        results = NULL;
+    }
+
+    free(ctx.best);
+    free(ctx.pool);
+    free(ctx.key);
+
+    return results;
+}
+
+/*
+ * Offers the word on w, with edits for the prefix, to the ranked list of the
+ * best *num completions so far. Words come in with ever more edits, so a
+ * word already on the list is there with no more. Returns whether w is on
+ * the list after.
+ */
+static bool complete_offer(trie_t **out, int *edits, int *num, int n, trie_t *w, int e) {
+
+    for (int i = 0; i < *num; i++) {
+        if (out[i] == w) {
+            return true;
+        }
+    }
+
+    int i = *num;
+    if (i == n) {
+        if (edits[n - 1] < e || (edits[n - 1] == e && trie_rank_cmp(w, out[n - 1]) > 0)) {
+            return false;
+        }
+        i--;
+    } else {
+        (*num)++;
+    }
+
+    for (; i > 0 && edits[i - 1] == e && trie_rank_cmp(w, out[i - 1]) < 0; i--) {
+        out[i] = out[i - 1];
+        edits[i] = edits[i - 1];
+    }
+    out[i] = w;
+    edits[i] = e;
+
+    return true;
+}
+
+int suggestion_complete(trie_t *t, char *prefix, int max_edits, int n, trie_t **out,
+                        int *edits) {
+
+    assert(t != NULL);
+    assert(prefix != NULL);
+    assert(out != NULL);
+    assert(edits != NULL);
+
+    dp_ctx_t ctx;
+    size_t root_off;
+    int i, num = -1;
+    trie_t *list[TRIE_TOPK];
+    trie_t **found = list;
+
+    if (n <= 0) {
+        return 0;
+    }
+
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.str = prefix;
+    ctx.len = strlen(prefix);
+    ctx.osa = true;
+    ctx.max_edits = max_edits < 0 ? 0 : max_edits;
+    ctx.key_size = MAXLEN + 1;
+    ctx.key = malloc(ctx.key_size);
+    ctx.reach = malloc(ctx.key_size * sizeof(int));
+    ctx.reached_size = 16;
+    ctx.reached = malloc(ctx.reached_size * sizeof(dp_reached_t));
+    if (n > TRIE_TOPK) {
+        found = malloc(n * sizeof(trie_t*));
+    }
+
+    if (ctx.key == NULL || ctx.reach == NULL || ctx.reached == NULL || found == NULL) {
+        goto done;
+    }
+
+    if (dp_push_rows(&ctx, 1, &root_off) != EXIT_SUCCESS) {
+        goto done;
+    }
+
+    for (i = 0; i <= ctx.len; i++) {
+        ctx.pool[root_off + i] = min(i, DP_INF(&ctx));
+    }
+
+    // The whole trie completes a prefix that can be deleted outright
+    ctx.reach[0] = DP_INF(&ctx);
+    if (ctx.len <= ctx.max_edits) {
+        ctx.reach[0] = ctx.len;
+        ctx.reached[0].node = t;
+        ctx.reached[0].edits = ctx.len;
+        ctx.num_reached = 1;
+    }
+
+    if (ctx.reach[0] > 0
+        && dp_visit(&ctx, t, t->label_len, root_off, 0, 0, NULL, '\0') != EXIT_SUCCESS) {
+        goto done;
+    }
+
+    /*
+     * Fewest edits first, so a word met again below another node is already
+     * on the list, and a node whose best word does not make it is done with
+     */
+    num = 0;
+    for (int e = 0; e <= ctx.max_edits; e++) {
+        for (i = 0; i < ctx.num_reached; i++) {
+            if (ctx.reached[i].edits != e) {
+                continue;
+            }
+
+            int got = trie_topk(ctx.reached[i].node, "", n, found);
+            for (int j = 0; j < got; j++) {
+                if (!complete_offer(out, edits, &num, n, found[j], e)) {
+                    break;
+                }
+            }
+        }
+    }
+
+done:
+    if (found != list) {
+        free(found);
+    }
+    free(ctx.reached);
+    free(ctx.reach);
+    free(ctx.pool);
+    free(ctx.key);
+
+    return num;
+}
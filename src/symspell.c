@@ -0,0 +1,487 @@
+/*
+	 A symmetric delete index for approximate matching
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "symspell.h"
+#include "distance.h"
+#include "utils.h"
+
+/* Size of the delete table at first, a power of two */
+#define SYMSPELL_TABLE_SIZE 1024
+
+/* What symspell_deletes() does with every delete of a word */
+typedef int (*symspell_visit_t)(symspell_t *ss, char *variant, size_t len,
+                                void *arg);
+
+symspell_t *symspell_new(int max_distance)
+{
+    symspell_t *ss = calloc(1, sizeof(symspell_t));
+
+    if (ss == NULL) {
+        error("Could not allocate memory for symspell_t");
+        return NULL;
+    }
+
+    ss->max_distance = max_distance < 0 ? 0 : max_distance;
+    ss->capacity = 16;
+    ss->words = calloc(ss->capacity, sizeof(char*));
+    ss->checked = calloc(ss->capacity, sizeof(unsigned int));
+    ss->table_size = SYMSPELL_TABLE_SIZE;
+    ss->table = calloc(ss->table_size, sizeof(symspell_entry_t));
+
+    if (ss->words == NULL || ss->checked == NULL || ss->table == NULL) {
+        error("Could not allocate memory for symspell_t");
+        symspell_free(ss);
+        return NULL;
+    }
+
+    return ss;
+}
+
+/* FNV-1a over the len characters of str */
+static unsigned int symspell_hash(char *str, size_t len)
+{
+    unsigned int h = 2166136261u;
+
+    for (size_t i = 0; i < len; i++)
+        h = (h ^ (unsigned char)str[i]) * 16777619u;
+
+    return h;
+}
+
+/* Doubles the delete table, placing every entry again */
+static int symspell_grow_table(symspell_t *ss)
+{
+    size_t size = 2 * ss->table_size;
+    symspell_entry_t *table = calloc(size, sizeof(symspell_entry_t));
+
+    if (table == NULL) {
+        error("Could not allocate memory for symspell table");
+        return EXIT_FAILURE;
+    }
+
+    for (size_t i = 0; i < ss->table_size; i++) {
+        if (ss->table[i].variant == NULL)
+            continue;
+
+        size_t h = ss->table[i].hash & (size - 1);
+        while (table[h].variant != NULL)
+            h = (h + 1) & (size - 1);
+        table[h] = ss->table[i];
+    }
+
+    free(ss->table);
+    ss->table = table;
+    ss->table_size = size;
+
+    return EXIT_SUCCESS;
+}
+
+/*
+   Finds the entry for the first len characters of variant. If there is
+   none, adds an empty one when create is set and returns NULL otherwise.
+ */
+static symspell_entry_t *symspell_entry(symspell_t *ss, char *variant,
+                                        size_t len, bool create)
+{
+    if (create && 2 * (ss->table_used + 1) > ss->table_size
+        && symspell_grow_table(ss) != EXIT_SUCCESS)
+        return NULL;
+
+    unsigned int hash = symspell_hash(variant, len);
+    size_t mask = ss->table_size - 1;
+    size_t h = hash & mask;
+
+    for (; ss->table[h].variant != NULL; h = (h + 1) & mask) {
+        symspell_entry_t *e = &ss->table[h];
+
+        if (e->hash == hash && strncmp(e->variant, variant, len) == 0
+            && e->variant[len] == '\0')
+            return e;
+    }
+
+    if (!create)
+        return NULL;
+
+    char *copy = malloc(len + 1);
+    if (copy == NULL) {
+        error("Could not allocate memory for symspell table");
+        return NULL;
+    }
+    memcpy(copy, variant, len);
+    copy[len] = '\0';
+
+    ss->table[h].variant = copy;
+    ss->table[h].hash = hash;
+    ss->table_used++;
+
+    return &ss->table[h];
+}
+
+/*
+   Calls visit on word and on everything it turns into with up to left
+   more characters deleted, from position start on. Every set of
+   positions is deleted once, though different sets can give the same
+   string. scratch holds left strings of len characters.
+ */
+static int symspell_deletes(symspell_t *ss, char *word, size_t len,
+                            size_t start, int left, char *scratch,
+                            symspell_visit_t visit, void *arg)
+{
+    if (visit(ss, word, len, arg) != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+
+    if (left == 0 || len == 0)
+        return EXIT_SUCCESS;
+
+    for (size_t i = start; i < len; i++) {
+        memcpy(scratch, word, i);
+        memcpy(scratch + i, word + i + 1, len - i - 1);
+
+        if (symspell_deletes(ss, scratch, len - 1, i, left - 1, scratch + len,
+                             visit, arg) != EXIT_SUCCESS)
+            return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+/* Runs symspell_deletes() over word with up to left deletes */
+static int symspell_each_delete(symspell_t *ss, char *word, int left,
+                                symspell_visit_t visit, void *arg)
+{
+    size_t len = strlen(word);
+    char *scratch = malloc(left * len + 1);
+
+    if (scratch == NULL) {
+        error("Could not allocate memory for symspell deletes");
+        return EXIT_FAILURE;
+    }
+
+    int rc = symspell_deletes(ss, word, len, 0, left, scratch, visit, arg);
+    free(scratch);
+
+    return rc;
+}
+
+/* Files word id under a delete, once */
+static int symspell_put_id(symspell_t *ss, char *variant, size_t len, void *arg)
+{
+    int id = *(int*)arg;
+    symspell_entry_t *e = symspell_entry(ss, variant, len, true);
+
+    if (e == NULL)
+        return EXIT_FAILURE;
+
+    /* The same delete made twice comes while the word is still last */
+    if (e->num_ids > 0 && e->ids[e->num_ids - 1] == id)
+        return EXIT_SUCCESS;
+
+    if (e->num_ids == e->ids_size) {
+        int size = e->ids_size == 0 ? 2 : 2 * e->ids_size;
+        int *ids = realloc(e->ids, size * sizeof(int));
+        if (ids == NULL) {
+            error("Could not allocate memory for symspell ids");
+            return EXIT_FAILURE;
+        }
+        e->ids = ids;
+        e->ids_size = size;
+    }
+
+    e->ids[e->num_ids++] = id;
+
+    return EXIT_SUCCESS;
+}
+
+/* Takes word id out from under a delete */
+static int symspell_drop_id(symspell_t *ss, char *variant, size_t len, void *arg)
+{
+    int id = *(int*)arg;
+    symspell_entry_t *e = symspell_entry(ss, variant, len, false);
+
+    if (e == NULL)
+        return EXIT_SUCCESS;
+
+    for (int i = 0; i < e->num_ids; i++) {
+        if (e->ids[i] == id) {
+            e->ids[i] = e->ids[--e->num_ids];
+            break;
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
+
+/* The id of word, or -1 if it is not in the index */
+static int symspell_find(symspell_t *ss, char *word)
+{
+    symspell_entry_t *e = symspell_entry(ss, word, strlen(word), false);
+
+    if (e == NULL)
+        return -1;
+
+    /* Longer words can have word as a delete too */
+    for (int i = 0; i < e->num_ids; i++) {
+        if (strcmp(ss->words[e->ids[i]], word) == 0)
+            return e->ids[i];
+    }
+
+    return -1;
+}
+
+/* Hands out an id for a new word, or -1 */
+static int symspell_new_id(symspell_t *ss)
+{
+    if (ss->num_free > 0)
+        return ss->free_ids[--ss->num_free];
+
+    if (ss->size == ss->capacity) {
+        int capacity = 2 * ss->capacity;
+        char **words = realloc(ss->words, capacity * sizeof(char*));
+        if (words == NULL) {
+            error("Could not allocate memory for symspell words");
+            return -1;
+        }
+        ss->words = words;
+
+        unsigned int *checked = realloc(ss->checked,
+            capacity * sizeof(unsigned int));
+        if (checked == NULL) {
+            error("Could not allocate memory for symspell words");
+            return -1;
+        }
+        memset(checked + ss->capacity, 0,
+               (capacity - ss->capacity) * sizeof(unsigned int));
+        ss->checked = checked;
+        ss->capacity = capacity;
+    }
+
+    return ss->size++;
+}
+
+/* Gives an id back, to be handed out again */
+static void symspell_free_id(symspell_t *ss, int id)
+{
+    free(ss->words[id]);
+    ss->words[id] = NULL;
+
+    if (ss->num_free == ss->free_size) {
+        int size = ss->free_size == 0 ? 16 : 2 * ss->free_size;
+        int *ids = realloc(ss->free_ids, size * sizeof(int));
+
+        /* Without room to remember it the id is simply never reused */
+        if (ids == NULL)
+            return;
+        ss->free_ids = ids;
+        ss->free_size = size;
+    }
+
+    ss->free_ids[ss->num_free++] = id;
+}
+
+int symspell_add(symspell_t *ss, char *word)
+{
+    assert(ss != NULL);
+    assert(word != NULL);
+
+    if (symspell_find(ss, word) >= 0)
+        return EXIT_SUCCESS;
+
+    int id = symspell_new_id(ss);
+    if (id < 0)
+        return EXIT_FAILURE;
+
+    ss->words[id] = malloc(strlen(word) + 1);
+    if (ss->words[id] == NULL) {
+        error("Could not allocate memory for symspell words");
+        symspell_free_id(ss, id);
+        return EXIT_FAILURE;
+    }
+    strcpy(ss->words[id], word);
+
+    if (symspell_each_delete(ss, word, ss->max_distance, symspell_put_id,
+                             &id) != EXIT_SUCCESS) {
+        /* Take back the deletes it did get filed under */
+        symspell_each_delete(ss, word, ss->max_distance, symspell_drop_id, &id);
+        symspell_free_id(ss, id);
+        return EXIT_FAILURE;
+    }
+
+    ss->num_words++;
+
+    return EXIT_SUCCESS;
+}
+
+int symspell_remove(symspell_t *ss, char *word)
+{
+    assert(ss != NULL);
+    assert(word != NULL);
+
+    int id = symspell_find(ss, word);
+
+    if (id < 0)
+        return EXIT_FAILURE;
+
+    if (symspell_each_delete(ss, word, ss->max_distance, symspell_drop_id,
+                             &id) != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+
+    symspell_free_id(ss, id);
+    ss->num_words--;
+
+    return EXIT_SUCCESS;
+}
+
+symspell_t *symspell_build(trie_t *t, int max_distance)
+{
+    assert(t != NULL);
+
+    symspell_t *ss = symspell_new(max_distance);
+    trie_iter_t *it = trie_iter_new(t, "", NULL);
+    char *word;
+
+    if (ss == NULL || it == NULL) {
+        if (ss != NULL)
+            symspell_free(ss);
+        if (it != NULL)
+            trie_iter_free(it);
+        return NULL;
+    }
+
+    while ((word = trie_iter_next(it, NULL)) != NULL) {
+        if (symspell_add(ss, word) != EXIT_SUCCESS) {
+            trie_iter_free(it);
+            symspell_free(ss);
+            return NULL;
+        }
+    }
+
+    trie_iter_free(it);
+
+    return ss;
+}
+
+int symspell_free(symspell_t *ss)
+{
+    assert(ss != NULL);
+
+    if (ss->words != NULL) {
+        for (int i = 0; i < ss->size; i++)
+            free(ss->words[i]);
+    }
+
+    if (ss->table != NULL) {
+        for (size_t i = 0; i < ss->table_size; i++) {
+            free(ss->table[i].variant);
+            free(ss->table[i].ids);
+        }
+    }
+
+    free(ss->words);
+    free(ss->free_ids);
+    free(ss->table);
+    free(ss->checked);
+    free(ss->rows);
+    free(ss);
+
+    return EXIT_SUCCESS;
+}
+
+int symspell_distance(char *a, char *b, int max)
+{
+    size_t blen = strlen(b);
+    int *rows = malloc(3 * (blen + 1) * sizeof(int));
+
+    if (rows == NULL) {
+        error("Could not allocate memory for distance rows");
+        return max + 1;
+    }
+
+    int d = distance_osa(a, strlen(a), b, blen, max, rows);
+    free(rows);
+
+    return d;
+}
+
+/* What stays the same for one call to symspell_lookup() */
+typedef struct {
+    char *str;
+    size_t len;
+    int max_edits;
+    int (*found)(void *arg, char *word, int distance);
+    void *arg;
+
+    /* str set up for distance_myers(), if it fits */
+    distance_pattern_t pattern;
+    bool bits;
+} symspell_query_t;
+
+/* Checks the words filed under one delete of the query */
+static int symspell_check(symspell_t *ss, char *variant, size_t len, void *arg)
+{
+    symspell_query_t *q = arg;
+    symspell_entry_t *e = symspell_entry(ss, variant, len, false);
+
+    if (e == NULL)
+        return EXIT_SUCCESS;
+
+    for (int i = 0; i < e->num_ids; i++) {
+        int id = e->ids[i];
+
+        if (ss->checked[id] == ss->stamp)
+            continue;
+        ss->checked[id] = ss->stamp;
+
+        char *word = ss->words[id];
+        size_t wlen = strlen(word);
+        int d = q->bits ? distance_myers(&q->pattern, word, wlen, q->max_edits)
+                        : distance_osa(q->str, q->len, word, wlen, q->max_edits, ss->rows);
+
+        if (d <= q->max_edits && q->found(q->arg, word, d) != 0)
+            return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+int symspell_lookup(symspell_t *ss, char *str, int max_edits,
+                    int (*found)(void *arg, char *word, int distance), void *arg)
+{
+    assert(ss != NULL);
+    assert(str != NULL);
+
+    if (max_edits < 0)
+        max_edits = 0;
+
+    if (max_edits > ss->max_distance) {
+        error("Index only goes up to %d edits", ss->max_distance);
+        return EXIT_FAILURE;
+    }
+
+    symspell_query_t q = { .str = str, .len = strlen(str), .max_edits = max_edits,
+                           .found = found, .arg = arg };
+
+    q.bits = distance_pattern(&q.pattern, str, q.len) == EXIT_SUCCESS;
+
+    /* Rows for words up to max_edits longer than str */
+    size_t need = 3 * (q.len + max_edits + 1);
+    if (!q.bits && need > ss->rows_size) {
+        int *rows = realloc(ss->rows, need * sizeof(int));
+        if (rows == NULL) {
+            error("Could not allocate memory for distance rows");
+            return EXIT_FAILURE;
+        }
+        ss->rows = rows;
+        ss->rows_size = need;
+    }
+
+    if (++ss->stamp == 0) {
+        memset(ss->checked, 0, ss->capacity * sizeof(unsigned int));
+        ss->stamp = 1;
+    }
+
+    return symspell_each_delete(ss, str, max_edits, symspell_check, &q);
+}
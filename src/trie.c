@@ -10,156 +10,1148 @@
 #include "utils.h"
 #include <stdbool.h>
 
+/* Number of children each layout can hold */
+static const int trie_capacity[] = { 4, 16, 48, 256 };
+
+/*
+   Thresholds for moving back down a layout. These sit below the
+   capacity of the smaller layout so that a node hovering around a
+   boundary does not reallocate on every add/remove.
+ */
+static const int trie_shrink_at[] = { 0, 3, 12, 40 };
+
+/* Allocates zeroed memory, from arena if there is one */
+static void *trie_mem_alloc(arena_t *arena, size_t size)
+{
+    if (arena != NULL)
+        return arena_alloc(arena, size);
+
+    return calloc(1, size);
+}
+
+/* Frees memory from trie_mem_alloc(), size must match the allocation */
+static void trie_mem_free(arena_t *arena, void *ptr, size_t size)
+{
+    if (arena != NULL)
+        arena_recycle(arena, ptr, size);
+    else
+        free(ptr);
+}
+
+/*
+   Replaces the label of t with a copy of len bytes of src, which may
+   point into the old label.
+ */
+static int trie_set_label(trie_t *t, const char *src, unsigned int len)
+{
+    char *label = NULL;
+
+    if (len > 0) {
+        label = trie_mem_alloc(t->arena, len);
+        if (label == NULL) {
+            error("Could not allocate memory for label");
+            return EXIT_FAILURE;
+        }
+        memcpy(label, src, len);
+    }
+
+    trie_mem_free(t->arena, t->label, t->label_len);
+    t->label = label;
+    t->label_len = len;
+
+    return EXIT_SUCCESS;
+}
+
+/* Size of the single block holding children and keys for a layout */
+static size_t trie_block_size(int type)
+{
+    switch (type) {
+    case TRIE_NODE4:
+        return 4 * sizeof(trie_t*) + 4;
+    case TRIE_NODE16:
+        return 16 * sizeof(trie_t*) + 16;
+    case TRIE_NODE48:
+        return 48 * sizeof(trie_t*) + 256;
+    default:
+        return 256 * sizeof(trie_t*);
+    }
+}
+
+/*
+   Allocates child storage for the given layout and points t->children
+   and t->keys into it. Does not touch the old block.
+ */
+static int trie_alloc_block(trie_t *t, int type)
+{
+    trie_t **block = trie_mem_alloc(t->arena, trie_block_size(type));
+    if (block == NULL) {
+        error("Could not allocate memory for t->children");
+        return EXIT_FAILURE;
+    }
+
+    t->type = type;
+    t->children = block;
+    t->keys = (type == TRIE_NODE256) ? NULL
+        : (unsigned char*)(block + trie_capacity[type]);
+
+    return EXIT_SUCCESS;
+}
+
+/*
+   Moves the children of t into a new block of the given layout, used
+   both for growing and for shrinking.
+ */
+static int trie_relayout(trie_t *t, int type)
+{
+    trie_t **old_children = t->children;
+    unsigned char *old_keys = t->keys;
+    int old_type = t->type;
+    int n = 0;
+
+    if (trie_alloc_block(t, type) != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+
+    /*
+       Collect the old children in character order so the sorted
+       layouts stay sorted
+     */
+    for (int c = 0; c < 256; c++) {
+        trie_t *child = NULL;
+
+        if (old_type == TRIE_NODE256) {
+            child = old_children[c];
+        } else if (old_type == TRIE_NODE48) {
+            if (old_keys[c] != 0)
+                child = old_children[old_keys[c] - 1];
+        } else if (n < t->num_children && old_keys[n] == c) {
+            child = old_children[n];
+        }
+
+        if (child == NULL)
+            continue;
+
+        if (type == TRIE_NODE256) {
+            t->children[c] = child;
+        } else if (type == TRIE_NODE48) {
+            t->children[n] = child;
+            t->keys[c] = n + 1;
+        } else {
+            t->children[n] = child;
+            t->keys[n] = c;
+        }
+        n++;
+    }
+
+    trie_mem_free(t->arena, old_children, trie_block_size(old_type));
+
+    return EXIT_SUCCESS;
+}
+
 /* See trie.h */
 trie_t *trie_new(char current)
 {
-    trie_t *t = calloc(1, sizeof(trie_t));
-    
+    return trie_new_flags(current, 0);
+}
+
+/*
+   Allocates a single node from arena (or with calloc if arena is NULL)
+   and sets it up with no children.
+ */
+static trie_t *trie_new_node(arena_t *arena, char current, int flags)
+{
+    trie_t *t = trie_mem_alloc(arena, sizeof(trie_t));
+
     if (t == NULL) {
         error("Could not allocate memory for trie_t");
         return NULL;
-    } 
+    }
+
+    t->current = current;
+    t->flags = flags;
+    t->arena = arena;
+
+    /* Child storage is only allocated once the node gets a child */
+    t->type = TRIE_NODE4;
+    t->num_children = 0;
+    t->children = NULL;
+    t->keys = NULL;
+
+    t->is_word = 0;
+    t->word_count = 0;
+    t->parent = NULL;
+
+    t->label = NULL;
+    t->label_len = 0;
+
+    t->score = 0;
+    t->topk = NULL;
+    t->topk_len = 0;
+    t->topk_size = 0;
+
+    return t;
+}
+
+trie_t *trie_new_flags(char current, int flags)
+{
+    arena_t *arena = NULL;
+
+    if (flags & (TRIE_ARENA | TRIE_HUGEPAGES)) {
+        flags |= TRIE_ARENA;
+
+        arena = arena_new((flags & TRIE_HUGEPAGES) != 0);
+        if (arena == NULL)
+            return NULL;
+    }
+
+    trie_t *t = trie_new_node(arena, current, flags);
+
+    if (t == NULL && arena != NULL)
+        arena_free(arena);
+
+    return t;
+}
+
+int trie_free(trie_t *t)
+{
+    assert(t != NULL);
+
+    trie_t *child;
+    int pos = 0;
+
+    /* The root owns the arena and every node lives in its slabs */
+    if (t->arena != NULL && t->parent == NULL)
+        return arena_free(t->arena);
+
+    while ((child = trie_next_child(t, &pos)) != NULL)
+        trie_free(child);
+
+    trie_mem_free(t->arena, t->children, trie_block_size(t->type));
+    trie_mem_free(t->arena, t->label, t->label_len);
+    trie_mem_free(t->arena, t->topk, t->topk_size * sizeof(trie_t*));
+    trie_mem_free(t->arena, t, sizeof(trie_t));
+
+    return EXIT_SUCCESS;
+}
+
+trie_t *trie_get_child(trie_t *t, char c)
+{
+    assert(t != NULL);
+
+    unsigned char uc = (unsigned char)c;
+
+    if (t->num_children == 0)
+        return NULL;
+
+    switch (t->type) {
+    case TRIE_NODE4:
+    case TRIE_NODE16:
+        for (int i = 0; i < t->num_children; i++) {
+            if (t->keys[i] == uc)
+                return t->children[i];
+        }
+        return NULL;
+    case TRIE_NODE48:
+        if (t->keys[uc] == 0)
+            return NULL;
+        return t->children[t->keys[uc] - 1];
+    default:
+        return t->children[uc];
+    }
+}
+
+int trie_next_char(trie_t *t, int from)
+{
+    assert(t != NULL);
+
+    for (int w = from / 64; w < 4; w++) {
+        uint64_t bits = t->childmap[w];
+
+        if (w == from / 64)
+            bits &= ~(uint64_t)0 << (from % 64);
+        if (bits != 0)
+            return w * 64 + __builtin_ctzll(bits);
+    }
+
+    return -1;
+}
+
+trie_t *trie_next_child(trie_t *t, int *pos)
+{
+    assert(t != NULL);
+    assert(pos != NULL);
+
+    if (t->num_children == 0)
+        return NULL;
+
+    switch (t->type) {
+    case TRIE_NODE4:
+    case TRIE_NODE16:
+        if (*pos >= t->num_children)
+            return NULL;
+        return t->children[(*pos)++];
+    default: {
+        /* pos is the next character to look at, found from the bitmap */
+        int c = trie_next_char(t, *pos);
+
+        if (c < 0) {
+            *pos = 256;
+            return NULL;
+        }
+
+        *pos = c + 1;
+        if (t->type == TRIE_NODE48)
+            return t->children[t->keys[c] - 1];
+        return t->children[c];
+    }
+    }
+}
+
+/*
+   Links an existing node in as a child of t, growing t's layout if
+   needed. The caller makes sure t has no child for child->current yet.
+ */
+static int trie_attach_child(trie_t *t, trie_t *child)
+{
+    unsigned char c = (unsigned char)child->current;
+
+    if (t->children == NULL) {
+        if (trie_alloc_block(t, TRIE_NODE4) != EXIT_SUCCESS)
+            return EXIT_FAILURE;
+    } else if (t->type != TRIE_NODE256
+               && t->num_children == trie_capacity[t->type]) {
+        if (trie_relayout(t, t->type + 1) != EXIT_SUCCESS)
+            return EXIT_FAILURE;
+    }
+
+    child->parent = t;
+
+    switch (t->type) {
+    case TRIE_NODE4:
+    case TRIE_NODE16: {
+        /* Keep keys sorted so children come out in character order */
+        int i = 0;
+        while (i < t->num_children && t->keys[i] < c)
+            i++;
+
+        memmove(t->keys + i + 1, t->keys + i, t->num_children - i);
+        memmove(t->children + i + 1, t->children + i,
+            (t->num_children - i) * sizeof(trie_t*));
+
+        t->keys[i] = c;
+        t->children[i] = child;
+        break;
+    }
+    case TRIE_NODE48:
+        /* The first free slot is always at num_children, see removal */
+        t->children[t->num_children] = child;
+        t->keys[c] = t->num_children + 1;
+        break;
+    default:
+        t->children[c] = child;
+        break;
+    }
+
+    t->num_children++;
+    t->childmap[c / 64] |= (uint64_t)1 << (c % 64);
+
+    return EXIT_SUCCESS;
+}
+
+int trie_add_node(trie_t *t, char current)
+{
+    assert(t != NULL);
+
+    if (trie_get_child(t, current) != NULL)
+        return EXIT_SUCCESS;
+
+    trie_t *child = trie_new_node(t->arena, current, t->flags);
+    if (child == NULL)
+        return EXIT_FAILURE;
+
+    if (trie_attach_child(t, child) != EXIT_SUCCESS) {
+        trie_mem_free(t->arena, child, sizeof(trie_t));
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+/*
+   Hands the whole child storage of src over to dst, which must have
+   none, and points the moved children at their new parent.
+ */
+static void trie_move_children(trie_t *dst, trie_t *src)
+{
+    trie_t *child;
+    int pos = 0;
+
+    dst->type = src->type;
+    dst->num_children = src->num_children;
+    dst->keys = src->keys;
+    dst->children = src->children;
+    memcpy(dst->childmap, src->childmap, sizeof(src->childmap));
+
+    src->type = TRIE_NODE4;
+    src->num_children = 0;
+    src->keys = NULL;
+    src->children = NULL;
+    memset(src->childmap, 0, sizeof(src->childmap));
+
+    while ((child = trie_next_child(dst, &pos)) != NULL)
+        child->parent = dst;
+}
+
+/*
+   Compares the words ending on two nodes of the same trie. Distinct
+   children of a node differ in current, so the words are told apart
+   where their paths first split.
+ */
+static int trie_word_cmp(trie_t *a, trie_t *b)
+{
+    int da = 0, db = 0;
+    trie_t *n;
+
+    for (n = a; n->parent != NULL; n = n->parent)
+        da++;
+    for (n = b; n->parent != NULL; n = n->parent)
+        db++;
+
+    /* A word sorts after every word that is a prefix of it */
+    for (; da > db; da--) {
+        a = a->parent;
+        if (a == b)
+            return 1;
+    }
+    for (; db > da; db--) {
+        b = b->parent;
+        if (b == a)
+            return -1;
+    }
+
+    if (a == b)
+        return 0;
+
+    while (a->parent != b->parent) {
+        a = a->parent;
+        b = b->parent;
+    }
+
+    return (unsigned char)a->current - (unsigned char)b->current;
+}
+
+int trie_rank_cmp(trie_t *a, trie_t *b)
+{
+    if (a->score != b->score)
+        return a->score > b->score ? -1 : 1;
+
+    return trie_word_cmp(a, b);
+}
+
+/*
+   Inserts w into a ranked list of len entries holding at most cap,
+   dropping the last entry if the list is full.
+
+   Returns whether w made it into the list.
+ */
+static bool trie_rank_insert(trie_t **list, int *len, int cap, trie_t *w)
+{
+    int i = *len;
+
+    if (i == cap) {
+        if (trie_rank_cmp(w, list[cap - 1]) > 0)
+            return false;
+        i--;
+    } else {
+        (*len)++;
+    }
+
+    for (; i > 0 && trie_rank_cmp(w, list[i - 1]) < 0; i--)
+        list[i] = list[i - 1];
+    list[i] = w;
+
+    return true;
+}
+
+/*
+   Gives the cached list of t room for exactly size entries, keeping as
+   many of the ones it holds as fit.
+ */
+static int trie_topk_resize(trie_t *t, int size)
+{
+    trie_t **list = NULL;
+
+    if (size == t->topk_size)
+        return EXIT_SUCCESS;
+
+    if (size > 0) {
+        list = trie_mem_alloc(t->arena, size * sizeof(trie_t*));
+        if (list == NULL) {
+            error("Could not allocate memory for top words");
+            return EXIT_FAILURE;
+        }
+        if (t->topk_len > 0)
+            memcpy(list, t->topk, min(size, t->topk_len) * sizeof(trie_t*));
+    }
+
+    trie_mem_free(t->arena, t->topk, t->topk_size * sizeof(trie_t*));
+    t->topk = list;
+    t->topk_size = size;
+    t->topk_len = min(size, t->topk_len);
+
+    return EXIT_SUCCESS;
+}
+
+/* Takes w out of the cached list of t, returning whether it was there */
+static bool trie_topk_remove(trie_t *t, trie_t *w)
+{
+    for (int i = 0; i < t->topk_len; i++) {
+        if (t->topk[i] == w) {
+            memmove(t->topk + i, t->topk + i + 1,
+                (t->topk_len - i - 1) * sizeof(trie_t*));
+            t->topk_len--;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/*
+   Puts w, a word whose rank has just gone up, in the cached list of t.
+
+   Returns whether w is in the list afterwards.
+ */
+static bool trie_topk_offer(trie_t *t, trie_t *w)
+{
+    int len;
+
+    trie_topk_remove(t, w);
+
+    /* Below TRIE_TOPK entries w always gets in, so the list grows by one */
+    if (t->topk_len == t->topk_size && t->topk_len < TRIE_TOPK
+        && trie_topk_resize(t, t->topk_len + 1) != EXIT_SUCCESS)
+        return false;
+
+    len = t->topk_len;
+    bool kept = trie_rank_insert(t->topk, &len, TRIE_TOPK, w);
+    t->topk_len = len;
+
+    return kept;
+}
+
+/*
+   Updates the cached lists above w after its rank went up. A word that
+   misses the list of a node misses the lists of all its ancestors too,
+   so the climb usually stops early.
+ */
+static void trie_topk_raise(trie_t *w)
+{
+    for (trie_t *t = w; t != NULL; t = t->parent) {
+        if (!trie_topk_offer(t, w))
+            return;
+    }
+}
+
+/*
+   Recomputes the cached list of t from its own word and its children's
+   lists, which between them hold every word that can make it.
+ */
+static void trie_topk_rebuild(trie_t *t)
+{
+    trie_t *list[TRIE_TOPK];
+    trie_t *child;
+    int len = 0, pos = 0;
+
+    if (t->is_word == 1)
+        trie_rank_insert(list, &len, TRIE_TOPK, t);
+
+    while ((child = trie_next_child(t, &pos)) != NULL) {
+        for (int i = 0; i < child->topk_len; i++) {
+            if (!trie_rank_insert(list, &len, TRIE_TOPK, child->topk[i]))
+                break;
+        }
+    }
+
+    if (trie_topk_resize(t, len) != EXIT_SUCCESS)
+        return;
+
+    if (len > 0)
+        memcpy(t->topk, list, len * sizeof(trie_t*));
+    t->topk_len = len;
+}
+
+/*
+   Updates the cached lists above w after its rank went down or it
+   stopped being a word. Only lists that held w can change.
+ */
+static void trie_topk_drop(trie_t *w)
+{
+    for (trie_t *t = w; t != NULL; t = t->parent) {
+        bool held = false;
+
+        for (int i = 0; i < t->topk_len && !held; i++)
+            held = t->topk[i] == w;
+
+        if (!held)
+            return;
+
+        trie_topk_rebuild(t);
+    }
+}
+
+/*
+   Points the cached lists of t and its ancestors at to instead of
+   from, once the word ending on from has moved to to.
+ */
+static void trie_topk_rename(trie_t *t, trie_t *from, trie_t *to)
+{
+    for (; t != NULL; t = t->parent) {
+        for (int i = 0; i < t->topk_len; i++) {
+            if (t->topk[i] == from)
+                t->topk[i] = to;
+        }
+    }
+}
+
+/*
+   Splits a TRIE_COMPRESSED node so its label ends after pos characters.
+   The rest of the label moves into a new only child, which takes over
+   the node's children, is_word and score.
+ */
+static int trie_split(trie_t *t, unsigned int pos)
+{
+    assert(pos < t->label_len);
+
+    char *head = NULL;
+    trie_t *tail = trie_new_node(t->arena, t->label[pos], t->flags);
+    if (tail == NULL)
+        return EXIT_FAILURE;
+
+    /* Set early so trie_free() never mistakes tail for a root */
+    tail->parent = t;
+
+    if (trie_set_label(tail, t->label + pos + 1,
+                       t->label_len - pos - 1) != EXIT_SUCCESS) {
+        trie_free(tail);
+        return EXIT_FAILURE;
+    }
+
+    if (pos > 0) {
+        head = trie_mem_alloc(t->arena, pos);
+        if (head == NULL) {
+            error("Could not allocate memory for label");
+            trie_free(tail);
+            return EXIT_FAILURE;
+        }
+        memcpy(head, t->label, pos);
+    }
+
+    if (trie_topk_resize(tail, t->topk_len) != EXIT_SUCCESS) {
+        trie_mem_free(t->arena, head, pos);
+        trie_free(tail);
+        return EXIT_FAILURE;
+    }
+
+    tail->is_word = t->is_word;
+    tail->score = t->score;
+    tail->word_count = t->word_count;
+    memcpy(tail->charlist, t->charlist, sizeof(t->charlist));
+    trie_move_children(tail, t);
+
+    if (trie_attach_child(t, tail) != EXIT_SUCCESS) {
+        trie_move_children(t, tail);
+        trie_mem_free(t->arena, head, pos);
+        trie_free(tail);
+        return EXIT_FAILURE;
+    }
+
+    t->is_word = 0;
+    t->score = 0;
+    trie_mem_free(t->arena, t->label, t->label_len);
+    t->label = head;
+    t->label_len = pos;
+
+    /* Both nodes now cover the same words, t's one having moved to tail */
+    trie_topk_rename(t, t, tail);
+    if (t->topk_len > 0)
+        memcpy(tail->topk, t->topk, t->topk_len * sizeof(trie_t*));
+    tail->topk_len = t->topk_len;
+
+    return EXIT_SUCCESS;
+}
+
+/*
+   Folds the only child of a TRIE_COMPRESSED node back into the node's
+   label, undoing trie_split() once the node no longer branches.
+ */
+static int trie_merge(trie_t *t)
+{
+    assert(t->num_children == 1 && t->is_word == 0);
 
-    t->current = current;
+    int pos = 0;
+    trie_t *child = trie_next_child(t, &pos);
+    unsigned int len = t->label_len + 1 + child->label_len;
 
-    t->children = calloc(256, sizeof(trie_t*));
-    if (t->children == NULL) {
-        error("Could not allocate memory for t->children");
-        return NULL;
+    char *label = trie_mem_alloc(t->arena, len);
+    if (label == NULL) {
+        error("Could not allocate memory for label");
+        return EXIT_FAILURE;
     }
 
-    t->is_word = 0;
-    t->parent = NULL;
-    t->charlist = calloc(256, sizeof(char));
+    /* An empty label may have no buffer behind it at all */
+    if (t->label_len > 0)
+        memcpy(label, t->label, t->label_len);
+    label[t->label_len] = child->current;
+    if (child->label_len > 0)
+        memcpy(label + t->label_len + 1, child->label, child->label_len);
 
-    return t;
+    trie_mem_free(t->arena, t->label, t->label_len);
+    t->label = label;
+    t->label_len = len;
+    t->is_word = child->is_word;
+    t->score = child->score;
+
+    /* t covers exactly the child's words, so it can take the list over */
+    trie_mem_free(t->arena, t->topk, t->topk_size * sizeof(trie_t*));
+    t->topk = child->topk;
+    t->topk_len = child->topk_len;
+    t->topk_size = child->topk_size;
+    trie_topk_rename(t, child, t);
+
+    trie_mem_free(t->arena, t->children, trie_block_size(t->type));
+    t->children = NULL;
+    t->num_children = 0;
+    trie_move_children(t, child);
+
+    trie_mem_free(t->arena, child->label, child->label_len);
+    trie_mem_free(t->arena, child, sizeof(trie_t));
+
+    return EXIT_SUCCESS;
 }
 
-int trie_free(trie_t *t)
+/*
+   Adds delta to the word_count of t and every node above it, called
+   whenever words start or stop ending somewhere at or below t.
+ */
+static void trie_count_words(trie_t *t, int delta)
+{
+    for (; t != NULL; t = t->parent)
+        t->word_count += delta;
+}
+
+/*
+   Marks t as the end of a word, keeping the counts above it in step.
+   Does nothing if t already ends a word.
+ */
+static void trie_set_word(trie_t *t)
+{
+    if (t->is_word == 1)
+        return;
+
+    t->is_word = 1;
+    t->score = 0;
+    trie_count_words(t, 1);
+    trie_topk_raise(t);
+}
+
+int trie_remove_node(trie_t *t, char current)
 {
     assert(t != NULL);
 
-    for (int i = 0; i < 256; i++) {
-        if (t->children[i] != NULL)
-            trie_free(t->children[i]);
+    unsigned char c = (unsigned char)current;
+    trie_t *child = trie_get_child(t, current);
+
+    if (child == NULL)
+        return EXIT_SUCCESS;
+
+    switch (t->type) {
+    case TRIE_NODE4:
+    case TRIE_NODE16: {
+        int i = 0;
+        while (t->keys[i] != c)
+            i++;
+
+        memmove(t->keys + i, t->keys + i + 1, t->num_children - i - 1);
+        memmove(t->children + i, t->children + i + 1,
+            (t->num_children - i - 1) * sizeof(trie_t*));
+        break;
+    }
+    case TRIE_NODE48: {
+        /* Move the last slot into the hole to keep slots packed */
+        int slot = t->keys[c] - 1;
+        int last = t->num_children - 1;
+
+        t->keys[c] = 0;
+        if (slot != last) {
+            trie_t *moved = t->children[last];
+            t->children[slot] = moved;
+            t->keys[(unsigned char)moved->current] = slot + 1;
+        }
+        t->children[last] = NULL;
+        break;
+    }
+    default:
+        t->children[c] = NULL;
+        break;
+    }
+
+    t->num_children--;
+    t->childmap[c / 64] &= ~((uint64_t)1 << (c % 64));
+    trie_count_words(t, -child->word_count);
+
+    /* Words went with the child, so the lists above may have to refill */
+    if (child->word_count > 0) {
+        for (trie_t *up = t; up != NULL; up = up->parent)
+            trie_topk_rebuild(up);
+    }
+
+    trie_free(child);
+
+    if (t->num_children == 0) {
+        trie_mem_free(t->arena, t->children, trie_block_size(t->type));
+        t->children = NULL;
+        t->keys = NULL;
+        t->type = TRIE_NODE4;
+    } else if (t->type != TRIE_NODE4
+               && t->num_children <= trie_shrink_at[t->type]) {
+        /* A failed shrink leaves the node valid, just roomier than needed */
+        if (trie_relayout(t, t->type - 1) != EXIT_SUCCESS)
+            return EXIT_FAILURE;
     }
-    free(t->charlist);
-    free(t);
+
+    /* The root is never merged, callers hold on to it */
+    if ((t->flags & TRIE_COMPRESSED) && t->parent != NULL
+        && t->num_children == 1 && t->is_word == 0)
+        return trie_merge(t);
 
     return EXIT_SUCCESS;
 }
 
-int trie_add_node(trie_t *t, char current)
+/* Sets the charlist bits of t for every character in word */
+static void trie_mark_chars(trie_t *t, char *word)
 {
-    assert(t != NULL);
+    for (; *word != '\0'; word++) {
+        unsigned char index = (unsigned char)*word;
+        t->charlist[index / 64] |= (uint64_t)1 << (index % 64);
+    }
+}
+
+/*
+   trie_insert_string() for TRIE_COMPRESSED tries. Walks down matching
+   labels, splits the node where the word leaves a label and stores
+   whatever is left of the word as the label of one new leaf.
+ */
+static int trie_insert_compressed(trie_t *t, char *word)
+{
+    trie_t *curr = t;
+    unsigned int pos = t->label_len;
+
+    while (*word != '\0') {
+        if (pos < curr->label_len) {
+            if (curr->label[pos] == *word) {
+                pos++;
+                word++;
+                continue;
+            }
+
+            if (trie_split(curr, pos) != EXIT_SUCCESS) {
+                error("Fail to split node");
+                return EXIT_FAILURE;
+            }
+        }
 
-    unsigned int c = (unsigned)current;
+        trie_mark_chars(curr, word);
 
-    if (t->children[c] == NULL)
-        t->children[c] = trie_new(current);
+        trie_t *child = trie_get_child(curr, *word);
+        if (child == NULL) {
+            if (trie_add_node(curr, *word) != EXIT_SUCCESS) {
+                error("Fail to add_node");
+                return EXIT_FAILURE;
+            }
+            child = trie_get_child(curr, *word);
 
-    return EXIT_SUCCESS;  
+            if (trie_set_label(child, word + 1, strlen(word + 1)) != EXIT_SUCCESS) {
+                trie_remove_node(curr, *word);
+                return EXIT_FAILURE;
+            }
+            trie_mark_chars(child, word + 1);
+            trie_set_word(child);
+
+            return EXIT_SUCCESS;
+        }
+
+        curr = child;
+        pos = 0;
+        word++;
+    }
+
+    if (pos < curr->label_len && trie_split(curr, pos) != EXIT_SUCCESS) {
+        error("Fail to split node");
+        return EXIT_FAILURE;
+    }
+
+    trie_set_word(curr);
+
+    return EXIT_SUCCESS;
 }
 
 int trie_insert_string(trie_t *t, char *word)
 {
     assert(t != NULL);
 
+    if (t->flags & TRIE_COMPRESSED)
+        return trie_insert_compressed(t, word);
+
     if (*word == '\0') {
-        t->is_word = 1;
+        trie_set_word(t);
         return EXIT_SUCCESS;
 
     } else {
-        int len = strlen(word);
-        int index;
-
-        /* 
-           For loop that goes through the string
-           and adds all the unique characters to the
-           trie's wordlist field
+        /*
+           Goes through the string and adds all the
+           unique characters to the trie's charlist bitmap
          */
-        for (int i = 0; i < len; i++) {
-            index = (int)word[i];
-            t->charlist[index] = word[i];
-        }
+        trie_mark_chars(t, word);
 
         char curr = word[0];
-        index = (int)curr;
 
         int rc = trie_add_node(t, curr);
         if (rc != 0) {
             error("Fail to add_node");
             return EXIT_FAILURE;
         }
-        
+
         word++;
-        return trie_insert_string(t->children[index],word);
+        return trie_insert_string(trie_get_child(t, curr), word);
     }
 }
 
-bool trie_char_exists(trie_t *t, char c) 
+bool trie_char_exists(trie_t *t, char c)
 {
     assert(t != NULL);
-    assert(t->charlist != NULL);
 
-    int index = (int)c;
+    unsigned char index = (unsigned char)c;
 
-    return (t->charlist[index] != '\0');
+    if (index == '\0')
+        return false;
+
+    return (t->charlist[index / 64] >> (index % 64)) & 1;
 }
 
-trie_t *trie_get_subtrie(trie_t *t, char* word)
+trie_t *trie_step(trie_t *t, unsigned int *pos, char c)
 {
-    int len;
-    trie_t* curr;
-    trie_t** next;
+    assert(t != NULL);
+
+    if (*pos < t->label_len) {
+        if (t->label[*pos] != c)
+            return NULL;
+
+        (*pos)++;
+        return t;
+    }
+
+    trie_t *child = trie_get_child(t, c);
+    if (child != NULL)
+        *pos = 0;
+
+    return child;
+}
+
+/*
+   Follows word down from t. Returns the node it ends at, or NULL, and
+   sets *pos to how much of that node's label the word covers.
+ */
+static trie_t *trie_walk(trie_t *t, char *word, unsigned int *pos)
+{
+    trie_t* curr = t;
 
-    len = strlen(word);
-    curr = t;
-    next = t->children;
+    *pos = t->label_len;
 
-    /* 
+    /*
        Iterates through each character of the word
-       and goes to child of current trie with index
-       of the current character casted as an int
+       and steps to the child of the current trie
+       for that character
      */
-    for (int i = 0; i < len; i++) {
-        int j = (int)word[i];
-        curr = next[j];
+    for (; *word != '\0'; word++) {
+        curr = trie_step(curr, pos, *word);
         if (curr == NULL)
             return NULL;
-        next = next[j]->children;
     }
 
     return curr;
 }
 
+trie_t *trie_get_subtrie(trie_t *t, char* word)
+{
+    unsigned int pos;
+
+    return trie_walk(t, word, &pos);
+}
+
 int trie_search(trie_t *t, char* word)
 {
-    trie_t *end = trie_get_subtrie(t, word);
+    unsigned int pos;
+    trie_t *end = trie_walk(t, word, &pos);
 
     if (end == NULL)
         return NOT_IN_TRIE;
 
-    if (end->is_word == 1) 
+    if (end->is_word == 1 && pos == end->label_len)
         return IN_TRIE;
-  
+
     return PARTIAL_IN_TRIE;
 }
 
-int trie_count_completion_recursive(trie_t *t)
+/*
+   Prefetches what trie_step() on t will read for c, so the loads for a
+   whole batch of lookups are in flight at once.
+ */
+static inline void trie_prefetch_step(trie_t *t, unsigned int pos, char c)
+{
+    unsigned char index = (unsigned char)c;
+
+    if (pos < t->label_len) {
+        __builtin_prefetch(t->label + pos);
+        return;
+    }
+
+    if (t->num_children == 0)
+        return;
+
+    switch (t->type) {
+    case TRIE_NODE4:
+    case TRIE_NODE16:
+        __builtin_prefetch(t->keys);
+        __builtin_prefetch(t->children);
+        break;
+    case TRIE_NODE48:
+        __builtin_prefetch(t->keys + index);
+        break;
+    default:
+        __builtin_prefetch(t->children + index);
+        break;
+    }
+}
+
+int trie_search_many(trie_t *t, char **words, int n, int *results)
+{
+    assert(t != NULL);
+
+    trie_t *node[TRIE_SEARCH_BATCH];
+    unsigned int pos[TRIE_SEARCH_BATCH];
+    char *at[TRIE_SEARCH_BATCH];
+
+    for (int base = 0; base < n; base += TRIE_SEARCH_BATCH) {
+        int m = min(TRIE_SEARCH_BATCH, n - base);
+        int active = 0;
+
+        for (int i = 0; i < m; i++) {
+            node[i] = t;
+            pos[i] = t->label_len;
+            at[i] = words[base + i];
+            if (*at[i] != '\0')
+                active++;
+        }
+
+        /*
+           Every round moves each unfinished lookup down one character.
+           The nodes were prefetched the round before, so reading them
+           here is cheap, and their child storage is prefetched for the
+           whole batch before any of it is used.
+         */
+        while (active > 0) {
+            for (int i = 0; i < m; i++) {
+                if (node[i] != NULL && *at[i] != '\0')
+                    trie_prefetch_step(node[i], pos[i], *at[i]);
+            }
+
+            for (int i = 0; i < m; i++) {
+                if (node[i] == NULL || *at[i] == '\0')
+                    continue;
+
+                node[i] = trie_step(node[i], &pos[i], *at[i]);
+                at[i]++;
+
+                if (node[i] == NULL || *at[i] == '\0')
+                    active--;
+                else
+                    __builtin_prefetch(node[i]);
+            }
+        }
+
+        for (int i = 0; i < m; i++) {
+            if (node[i] == NULL)
+                results[base + i] = NOT_IN_TRIE;
+            else if (node[i]->is_word == 1 && pos[i] == node[i]->label_len)
+                results[base + i] = IN_TRIE;
+            else
+                results[base + i] = PARTIAL_IN_TRIE;
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
+
+int trie_insert_scored(trie_t *t, char *word, double score)
+{
+    assert(t != NULL);
+
+    unsigned int pos;
+
+    if (trie_insert_string(t, word) != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+
+    trie_t *end = trie_walk(t, word, &pos);
+    double old = end->score;
+
+    end->score = score;
+    if (score > old)
+        trie_topk_raise(end);
+    else if (score < old)
+        trie_topk_drop(end);
+
+    return EXIT_SUCCESS;
+}
+
+int trie_remove_string(trie_t *t, char *word)
 {
-	int acc = 0;
+    assert(t != NULL);
+
+    unsigned int pos;
+    trie_t *end = trie_walk(t, word, &pos);
+
+    if (end == NULL)
+        return NOT_IN_TRIE;
+
+    if (end->is_word == 0 || pos != end->label_len)
+        return PARTIAL_IN_TRIE;
+
+    end->is_word = 0;
+    trie_count_words(end, -1);
+    trie_topk_drop(end);
+    end->score = 0;
+
+    /*
+       Climb to the highest node below t that no longer leads to a word
+       and cut the whole dead branch off there
+     */
+    trie_t *dead = end;
+    while (dead != t && dead->parent != t && dead->parent->word_count == 0)
+        dead = dead->parent;
 
-	if (t == NULL)
-		return acc;
+    if (dead != t && dead->word_count == 0) {
+        if (trie_remove_node(dead->parent, dead->current) != EXIT_SUCCESS)
+            error("Fail to remove node");
 
-	if (t->is_word == 1)
-		acc++;
+        return IN_TRIE;
+    }
 
-	for (int i = 0; i < 256; i++)
-		acc += trie_count_completion_recursive(t->children[i]);
+    /* The word ended on a node that still branches on to other words */
+    if ((end->flags & TRIE_COMPRESSED) && end != t
+        && end->num_children == 1 && trie_merge(end) != EXIT_SUCCESS)
+        error("Fail to merge node");
 
-	return acc;
+    return IN_TRIE;
 }
 
 int trie_count_completion(trie_t *t, char *pre)
@@ -169,5 +1161,311 @@ int trie_count_completion(trie_t *t, char *pre)
 	if (end == NULL)
 		return 0;
 
-	return trie_count_completion_recursive(end);
+	return end->word_count;
+}
+
+/*
+   Adds the words below t to out, a ranked list of *n of the best k
+   found so far, skipping every branch whose best word is not good
+   enough to get in.
+ */
+static void trie_topk_collect(trie_t *t, int k, trie_t **out, int *n)
+{
+    trie_t *child;
+    int pos = 0;
+
+    if (t->topk_len == 0)
+        return;
+
+    if (*n == k && trie_rank_cmp(t->topk[0], out[k - 1]) > 0)
+        return;
+
+    /* A list with room to spare already holds every word below t */
+    if (t->topk_len < TRIE_TOPK) {
+        for (int i = 0; i < t->topk_len; i++) {
+            if (!trie_rank_insert(out, n, k, t->topk[i]))
+                break;
+        }
+        return;
+    }
+
+    if (t->is_word == 1)
+        trie_rank_insert(out, n, k, t);
+
+    while ((child = trie_next_child(t, &pos)) != NULL)
+        trie_topk_collect(child, k, out, n);
+}
+
+int trie_topk(trie_t *t, char *pre, int k, trie_t **out)
+{
+    assert(t != NULL);
+    assert(pre != NULL);
+
+    unsigned int pos;
+    int n = 0;
+    trie_t *end = trie_walk(t, pre, &pos);
+
+    if (end == NULL || k <= 0)
+        return 0;
+
+    if (k <= end->topk_len || end->topk_len < TRIE_TOPK) {
+        n = min(k, end->topk_len);
+        if (n > 0)
+            memcpy(out, end->topk, n * sizeof(trie_t*));
+        return n;
+    }
+
+    trie_topk_collect(end, k, out, &n);
+
+    return n;
+}
+
+size_t trie_node_word(trie_t *t, char *buf, size_t size)
+{
+    assert(t != NULL);
+
+    size_t len = 0;
+    trie_t *n;
+
+    for (n = t; n->parent != NULL; n = n->parent)
+        len += 1 + n->label_len;
+    len += n->label_len;
+
+    if (size <= len)
+        return len;
+
+    /* Fill the word in back to front on the way up */
+    char *end = buf + len;
+
+    *end = '\0';
+    for (n = t; n != NULL; n = n->parent) {
+        end -= n->label_len;
+        if (n->label_len > 0)
+            memcpy(end, n->label, n->label_len);
+
+        if (n->parent != NULL)
+            *--end = n->current;
+    }
+
+    return len;
+}
+
+/*
+   Sets *pos so that the next trie_next_child() call returns the first
+   child of t whose character is c or greater.
+ */
+static void trie_seek_child(trie_t *t, unsigned char c, int *pos)
+{
+    if (t->type == TRIE_NODE4 || t->type == TRIE_NODE16) {
+        int i = 0;
+        while (i < t->num_children && t->keys[i] < c)
+            i++;
+        *pos = i;
+    } else {
+        *pos = c;
+    }
+}
+
+/* Copies n bytes of s to position at of the iterator's key, growing it */
+static int trie_iter_put(trie_iter_t *it, size_t at, const char *s, size_t n)
+{
+    if (at + n + 1 > it->key_size) {
+        size_t size = it->key_size * 2;
+        if (size < at + n + 1)
+            size = at + n + 1;
+
+        char *key = realloc(it->key, size);
+        if (key == NULL) {
+            error("Could not allocate memory for iterator key");
+            return EXIT_FAILURE;
+        }
+        it->key = key;
+        it->key_size = size;
+    }
+
+    if (n > 0)
+        memcpy(it->key + at, s, n);
+
+    return EXIT_SUCCESS;
+}
+
+/* Pushes a frame for node, whose word is the first len bytes of the key */
+static int trie_iter_push(trie_iter_t *it, trie_t *node, size_t len)
+{
+    if (it->depth == it->stack_size) {
+        int size = it->stack_size == 0 ? 16 : it->stack_size * 2;
+        trie_iter_frame_t *stack = realloc(it->stack, size * sizeof(trie_iter_frame_t));
+        if (stack == NULL) {
+            error("Could not allocate memory for iterator stack");
+            return EXIT_FAILURE;
+        }
+        it->stack = stack;
+        it->stack_size = size;
+    }
+
+    trie_iter_frame_t *f = &it->stack[it->depth++];
+    f->node = node;
+    f->pos = 0;
+    f->len = len;
+    f->done_self = false;
+
+    return EXIT_SUCCESS;
+}
+
+/* Steps the walk down into child, whose parent's word is at bytes long */
+static int trie_iter_descend(trie_iter_t *it, trie_t *child, size_t at)
+{
+    if (trie_iter_put(it, at, &child->current, 1) != EXIT_SUCCESS
+        || trie_iter_put(it, at + 1, child->label, child->label_len) != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+
+    return trie_iter_push(it, child, at + 1 + child->label_len);
+}
+
+/*
+   Moves a fresh iterator past every word less than or equal to after,
+   by following after down the trie instead of visiting those words.
+ */
+static int trie_iter_seek(trie_iter_t *it, char *after)
+{
+    size_t alen = strlen(after);
+    trie_iter_frame_t *f = &it->stack[0];
+    size_t n = min(f->len, alen);
+    int cmp = n > 0 ? memcmp(it->key, after, n) : 0;
+
+    /* Every word under the prefix sorts before after */
+    if (cmp < 0) {
+        it->depth = 0;
+        return EXIT_SUCCESS;
+    }
+
+    /* Or every word sorts after it */
+    if (cmp > 0 || f->len > alen)
+        return EXIT_SUCCESS;
+
+    /* From here on the key matches after up to the top frame's length */
+    while (true) {
+        f = &it->stack[it->depth - 1];
+
+        /* Anything ending here is a prefix of after, or after itself */
+        f->done_self = true;
+        if (f->len == alen)
+            return EXIT_SUCCESS;
+
+        unsigned char c = (unsigned char)after[f->len];
+        int pos;
+
+        trie_seek_child(f->node, c, &f->pos);
+        pos = f->pos;
+
+        trie_t *child = trie_next_child(f->node, &pos);
+        if (child == NULL || (unsigned char)child->current != c)
+            return EXIT_SUCCESS;
+
+        f->pos = pos;
+        size_t at = f->len + 1;
+
+        if (trie_iter_descend(it, child, f->len) != EXIT_SUCCESS)
+            return EXIT_FAILURE;
+
+        n = min(child->label_len, alen - at);
+        cmp = n > 0 ? memcmp(child->label, after + at, n) : 0;
+
+        /* The whole branch sorts before after, skip it */
+        if (cmp < 0) {
+            it->depth--;
+            return EXIT_SUCCESS;
+        }
+
+        /* The whole branch sorts after it */
+        if (cmp > 0 || child->label_len > alen - at)
+            return EXIT_SUCCESS;
+    }
+}
+
+trie_iter_t *trie_iter_new(trie_t *t, char *pre, char *after)
+{
+    assert(t != NULL);
+    assert(pre != NULL);
+
+    unsigned int pos;
+    trie_iter_t *it = calloc(1, sizeof(trie_iter_t));
+
+    if (it == NULL) {
+        error("Could not allocate memory for trie_iter_t");
+        return NULL;
+    }
+
+    trie_t *end = trie_walk(t, pre, &pos);
+
+    /* Nothing starts with the prefix, leave the iterator empty */
+    if (end == NULL)
+        return it;
+
+    /*
+       The root frame holds the prefix and, in compressed tries, the rest
+       of the label the prefix ended in
+     */
+    size_t len = strlen(pre);
+
+    if (trie_iter_put(it, 0, pre, len) != EXIT_SUCCESS
+        || trie_iter_put(it, len, end->label + pos, end->label_len - pos) != EXIT_SUCCESS
+        || trie_iter_push(it, end, len + end->label_len - pos) != EXIT_SUCCESS) {
+        trie_iter_free(it);
+        return NULL;
+    }
+
+    if (after != NULL && trie_iter_seek(it, after) != EXIT_SUCCESS) {
+        trie_iter_free(it);
+        return NULL;
+    }
+
+    return it;
+}
+
+char *trie_iter_next(trie_iter_t *it, size_t *len)
+{
+    assert(it != NULL);
+
+    while (it->depth > 0) {
+        trie_iter_frame_t *f = &it->stack[it->depth - 1];
+
+        if (!f->done_self) {
+            f->done_self = true;
+
+            if (f->node->is_word == 1) {
+                it->key[f->len] = '\0';
+                if (len != NULL)
+                    *len = f->len;
+                return it->key;
+            }
+        }
+
+        trie_t *child = trie_next_child(f->node, &f->pos);
+
+        if (child == NULL) {
+            it->depth--;
+            continue;
+        }
+
+        /* Nothing to find down a branch with no words left in it */
+        if (child->word_count == 0)
+            continue;
+
+        if (trie_iter_descend(it, child, f->len) != EXIT_SUCCESS)
+            return NULL;
+    }
+
+    return NULL;
+}
+
+int trie_iter_free(trie_iter_t *it)
+{
+    assert(it != NULL);
+
+    free(it->stack);
+    free(it->key);
+    free(it);
+
+    return EXIT_SUCCESS;
 }
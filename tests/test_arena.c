@@ -0,0 +1,100 @@
+#include <criterion/criterion.h>
+#include <stdlib.h>
+#include <string.h>
+#include "arena.h"
+
+/* Checks if arena_new() can properly allocate a new arena */
+Test(arena, arena_new)
+{
+    arena_t *a = arena_new(false);
+
+    cr_assert_not_null(a, "arena_new() failed to allocate memory");
+    cr_assert_eq(a->num_slabs, 0, "arena_new() mapped slabs up front");
+    cr_assert_eq(a->slab_size, ARENA_SLAB_SIZE, "arena_new() set the wrong \
+        slab size");
+
+    cr_assert_eq(arena_free(a), 0, "arena_free() failed");
+}
+
+/* Checks that arena_alloc() hands out zeroed, distinct chunks */
+Test(arena, arena_alloc_zeroed)
+{
+    arena_t *a = arena_new(false);
+    char *p = arena_alloc(a, 40);
+    char *q = arena_alloc(a, 40);
+
+    cr_assert_not_null(p, "arena_alloc() failed");
+    cr_assert_not_null(q, "arena_alloc() failed");
+    cr_assert_geq(q - p, 40, "arena_alloc() returned overlapping chunks");
+
+    for (int i = 0; i < 40; i++)
+        cr_assert_eq(p[i], 0, "arena_alloc() returned dirty memory");
+
+    arena_free(a);
+}
+
+/* Checks that many small allocations share a handful of slabs */
+Test(arena, arena_alloc_slabs)
+{
+    arena_t *a = arena_new(false);
+
+    for (int i = 0; i < 100000; i++)
+        cr_assert_not_null(arena_alloc(a, 64), "arena_alloc() failed");
+
+    /* 6.4 MB of 64 byte chunks in 1 MB slabs */
+    cr_assert_leq(a->num_slabs, 8, "arena_alloc() mapped %zu slabs",
+        a->num_slabs);
+    cr_assert_eq(a->bytes_used, 6400000, "arena_alloc() miscounted bytes");
+
+    arena_free(a);
+}
+
+/* Checks that arena_recycle() memory is reused and zeroed again */
+Test(arena, arena_recycle_reuse)
+{
+    arena_t *a = arena_new(false);
+    char *p = arena_alloc(a, 100);
+
+    memset(p, 'x', 100);
+    arena_recycle(a, p, 100);
+    cr_assert_eq(a->bytes_used, 0, "arena_recycle() miscounted bytes");
+
+    char *q = arena_alloc(a, 100);
+    cr_assert_eq(p, q, "arena_alloc() did not reuse a recycled chunk");
+
+    for (int i = 0; i < 100; i++)
+        cr_assert_eq(q[i], 0, "arena_alloc() returned dirty memory");
+
+    arena_free(a);
+}
+
+/* Checks that allocations too big for a slab get their own mapping */
+Test(arena, arena_alloc_large)
+{
+    arena_t *a = arena_new(false);
+    char *p = arena_alloc(a, 3 * ARENA_SLAB_SIZE);
+
+    cr_assert_not_null(p, "arena_alloc() failed on a large allocation");
+    cr_assert_eq(a->num_slabs, 1, "arena_alloc() did not map the large chunk");
+
+    p[3 * ARENA_SLAB_SIZE - 1] = 'x';
+    arena_recycle(a, p, 3 * ARENA_SLAB_SIZE);
+    cr_assert_eq(a->num_slabs, 0, "arena_recycle() did not unmap the large chunk");
+
+    arena_free(a);
+}
+
+/* Checks that huge page arenas use aligned huge slabs */
+Test(arena, arena_hugepages)
+{
+    arena_t *a = arena_new(true);
+    char *p = arena_alloc(a, 64);
+
+    cr_assert_not_null(p, "arena_alloc() failed with huge pages");
+    cr_assert_eq(a->slab_size, ARENA_HUGE_SLAB_SIZE, "arena_new() set the \
+        wrong slab size");
+    cr_assert_eq((size_t)a->slabs % ARENA_HUGE_SLAB_SIZE, 0, "arena_alloc() \
+        mapped an unaligned huge slab");
+
+    arena_free(a);
+}
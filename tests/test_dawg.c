@@ -0,0 +1,148 @@
+#include <criterion/criterion.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "dawg.h"
+
+/* qsort() comparison for building sorted word lists */
+int dawg_cmp_str(const void *a, const void *b)
+{
+    return strcmp(*(char**)a, *(char**)b);
+}
+
+/* Checks if dawg_new() can properly allocate an empty DAWG */
+Test(dawg, dawg_new)
+{
+    dawg_t *d = dawg_new();
+
+    cr_assert_not_null(d, "dawg_new() failed to allocate memory");
+    cr_assert_eq(d->num_nodes, 1, "dawg_new() should only have a root");
+
+    cr_assert_eq(dawg_finish(d), 0, "dawg_finish() failed");
+    cr_assert_eq(dawg_search(d, ""), PARTIAL_IN_TRIE,
+        "dawg_search() found a word in an empty DAWG");
+    cr_assert_eq(dawg_count_completion(d, ""), 0,
+        "dawg_count_completion() counted words in an empty DAWG");
+
+    cr_assert_eq(dawg_free(d), 0, "dawg_free() failed");
+}
+
+/* Checks that shared endings end up as shared nodes */
+Test(dawg, minimal)
+{
+    char *words[4] = {"tap", "taps", "top", "tops"};
+    dawg_t *d = dawg_build(words, 4);
+
+    cr_assert_not_null(d, "dawg_build() failed");
+
+    /* root, t, ta/to, tap/top, taps/tops */
+    cr_assert_eq(d->num_nodes, 5, "dawg_build() left %d nodes instead of 5",
+        d->num_nodes);
+    cr_assert_eq(dawg_get_subtrie(d, "ta"), dawg_get_subtrie(d, "to"),
+        "ta and to should share a node");
+
+    for (int i = 0; i < 4; i++)
+        cr_assert_eq(dawg_search(d, words[i]), IN_TRIE,
+            "dawg_search() missed %s", words[i]);
+
+    cr_assert_eq(dawg_search(d, "t"), PARTIAL_IN_TRIE,
+        "dawg_search() should find t as a prefix");
+    cr_assert_eq(dawg_search(d, "tip"), NOT_IN_TRIE,
+        "dawg_search() found a missing word");
+    cr_assert_eq(dawg_count_completion(d, "to"), 2,
+        "dawg_count_completion() miscounted to");
+    cr_assert_eq(dawg_count_completion(d, "t"), 4,
+        "dawg_count_completion() miscounted t");
+
+    dawg_free(d);
+}
+
+/* Checks that words out of order are turned down and repeats ignored */
+Test(dawg, add_order)
+{
+    dawg_t *d = dawg_new();
+
+    cr_assert_eq(dawg_add(d, ""), 0, "dawg_add() failed on \"\"");
+    cr_assert_eq(dawg_add(d, "bat"), 0, "dawg_add() failed");
+    cr_assert_eq(dawg_add(d, "bat"), 0, "dawg_add() failed on a repeat");
+    cr_assert_neq(dawg_add(d, "ba"), 0, "dawg_add() took a prefix of the \
+        previous word");
+    cr_assert_neq(dawg_add(d, "ant"), 0, "dawg_add() took a smaller word");
+    cr_assert_eq(dawg_add(d, "bath"), 0, "dawg_add() failed");
+    cr_assert_eq(dawg_add(d, "\xc3\xa9t\xc3\xa9"), 0, "dawg_add() failed on \
+        bytes above 127");
+
+    cr_assert_eq(dawg_finish(d), 0, "dawg_finish() failed");
+    cr_assert_neq(dawg_add(d, "zoo"), 0, "dawg_add() took a word after \
+        dawg_finish()");
+
+    cr_assert_eq(d->num_words, 4, "dawg_add() counted the wrong words");
+    cr_assert_eq(dawg_count_completion(d, ""), 4,
+        "dawg_count_completion() miscounted");
+    cr_assert_eq(dawg_search(d, ""), IN_TRIE, "dawg_search() missed \"\"");
+    cr_assert_eq(dawg_search(d, "\xc3\xa9t\xc3\xa9"), IN_TRIE,
+        "dawg_search() missed a word with bytes above 127");
+
+    dawg_free(d);
+}
+
+/* Checks a DAWG against a trie of the same stems and suffixes */
+Test(dawg, matches_trie)
+{
+    char *stems[8] = {"walk", "talk", "mark", "park", "bark", "work", "wa",
+    "ta"};
+    char *suffixes[6] = {"", "s", "ed", "ing", "er", "ers"};
+    char *words[48];
+    trie_t *t = trie_new('\0');
+    int n = 0;
+
+    for (int i = 0; i < 8; i++) {
+        for (int j = 0; j < 6; j++) {
+            words[n] = malloc(16);
+            sprintf(words[n], "%s%s", stems[i], suffixes[j]);
+            trie_insert_string(t, words[n]);
+            n++;
+        }
+    }
+
+    qsort(words, n, sizeof(char*), dawg_cmp_str);
+    dawg_t *d = dawg_build(words, n);
+
+    cr_assert_not_null(d, "dawg_build() failed");
+    cr_assert_eq(dawg_count_completion(d, ""), t->word_count,
+        "dawg_count_completion() miscounted the whole DAWG");
+
+    for (int i = 0; i < n; i++) {
+        char word[16];
+        strcpy(word, words[i]);
+
+        cr_assert_eq(dawg_search(d, word), IN_TRIE, "dawg_search() missed %s",
+            word);
+
+        /* Prefixes, and words that run one character past */
+        strcat(word, "x");
+        cr_assert_eq(dawg_search(d, word), trie_search(t, word),
+            "dawg_search() disagrees on %s", word);
+
+        for (size_t len = strlen(words[i]); len > 0; len--) {
+            word[len] = '\0';
+            cr_assert_eq(dawg_search(d, word), trie_search(t, word),
+                "dawg_search() disagrees on %s", word);
+            cr_assert_eq(dawg_count_completion(d, word),
+                trie_count_completion(t, word),
+                "dawg_count_completion() disagrees on %s", word);
+        }
+    }
+
+    /* 
+       One node per distinct set of endings, against the trie's 88 nodes.
+       The minimal DAWG is unique, so the count is exact.
+     */
+    cr_assert_eq(d->num_nodes, 13, "dawg_build() left %d nodes instead of 13",
+        d->num_nodes);
+
+    for (int i = 0; i < n; i++)
+        free(words[i]);
+    dawg_free(d);
+    trie_free(t);
+}
@@ -0,0 +1,101 @@
+#include <criterion/criterion.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "distance.h"
+
+/* Fills word with len random characters out of chars */
+void distance_test_word(char *word, int len, char *chars)
+{
+    int n = strlen(chars);
+
+    for (int i = 0; i < len; i++)
+        word[i] = chars[rand() % n];
+    word[len] = '\0';
+}
+
+/* Checks distance_myers() on a few known pairs */
+Test(distance, distance_myers)
+{
+    distance_pattern_t p;
+
+    cr_assert_eq(distance_pattern(&p, "kitten", 6), 0, "distance_pattern() failed");
+    cr_assert_eq(distance_myers(&p, "sitting", 7, 5), 3,
+        "kitten and sitting should be 3 edits apart");
+    cr_assert_eq(distance_myers(&p, "sitting", 7, 2), 3,
+        "distance_myers() should give up after max");
+    cr_assert_eq(distance_myers(&p, "iktten", 6, 5), 1,
+        "A swap should take one edit");
+    cr_assert_eq(distance_myers(&p, "", 0, 9), 6,
+        "Deleting everything should take one edit per character");
+
+    /* A swapped pair is not edited again */
+    cr_assert_eq(distance_pattern(&p, "ca", 2), 0, "distance_pattern() failed");
+    cr_assert_eq(distance_myers(&p, "abc", 3, 5), 3,
+        "ca and abc should be 3 edits apart");
+
+    cr_assert_eq(distance_pattern(&p, "", 0), 0, "distance_pattern() failed on \"\"");
+    cr_assert_eq(distance_myers(&p, "abc", 3, 5), 3,
+        "Inserting everything should take one edit per character");
+
+    char long_word[DISTANCE_MAX_PATTERN + 2];
+    distance_test_word(long_word, DISTANCE_MAX_PATTERN + 1, "ab");
+    cr_assert_neq(distance_pattern(&p, long_word, DISTANCE_MAX_PATTERN + 1), 0,
+        "distance_pattern() took a string that does not fit");
+}
+
+/* Checks distance_myers() against distance_osa() on random pairs */
+Test(distance, matches_osa)
+{
+    char a[DISTANCE_MAX_PATTERN + 1], b[DISTANCE_MAX_PATTERN + 8];
+    int rows[3 * (DISTANCE_MAX_PATTERN + 8)];
+    distance_pattern_t p;
+
+    srand(22019);
+    for (int i = 0; i < 20000; i++) {
+        /* Mostly short words, now and then as long as a pattern goes */
+        int alen = rand() % (i % 10 == 0 ? DISTANCE_MAX_PATTERN + 1 : 9);
+        int blen = rand() % (i % 10 == 0 ? DISTANCE_MAX_PATTERN + 8 : 10);
+        int max = rand() % (i % 10 == 0 ? 70 : 6);
+
+        distance_test_word(a, alen, "abc\xf9");
+        distance_test_word(b, blen, "abc\xf9");
+        distance_pattern(&p, a, alen);
+
+        int expected = distance_osa(a, alen, b, blen, max, rows);
+        cr_assert_eq(distance_myers(&p, b, blen, max), expected,
+            "distance_myers() disagrees on %s and %s", a, b);
+    }
+}
+
+/* Checks that distance_many() gives what distance_myers() gives one by one */
+Test(distance, distance_many)
+{
+    char a[16], words[13][16];
+    char *batch[13];
+    size_t lens[13];
+    int out[13];
+    distance_pattern_t p;
+
+    srand(22019);
+    for (int i = 0; i < 2000; i++) {
+        int alen = rand() % 12;
+        int count = rand() % 14;
+        int max = rand() % 6;
+
+        distance_test_word(a, alen, "abcd");
+        distance_pattern(&p, a, alen);
+
+        for (int k = 0; k < count; k++) {
+            lens[k] = rand() % 14;
+            distance_test_word(words[k], lens[k], "abcd");
+            batch[k] = words[k];
+        }
+
+        distance_many(&p, batch, lens, count, max, out);
+
+        for (int k = 0; k < count; k++)
+            cr_assert_eq(out[k], distance_myers(&p, batch[k], lens[k], max),
+                "distance_many() disagrees on %s and %s", a, batch[k]);
+    }
+}
@@ -0,0 +1,168 @@
+#define _DEFAULT_SOURCE
+
+#include <criterion/criterion.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "louds.h"
+
+/* Builds a trie of n distinct, scrambled hex strings */
+trie_t *louds_test_trie(int flags, int n)
+{
+    trie_t *t = trie_new_flags('\0', flags);
+    char word[16];
+
+    for (int i = 0; i < n; i++) {
+        sprintf(word, "%x", i * 7919 % 100003);
+        trie_insert_string(t, word);
+    }
+
+    return t;
+}
+
+/* Checks that a frozen trie answers like the trie it was built from */
+void check_frozen(trie_t *t, louds_t *l, int n)
+{
+    char word[16];
+
+    cr_assert_eq(louds_count_completion(l, ""), t->word_count,
+        "louds_count_completion() miscounted the whole trie");
+
+    for (int i = 0; i < n + 50; i++) {
+        sprintf(word, "%x", i * 7919 % 100003);
+
+        cr_assert_eq(louds_search(l, word), trie_search(t, word),
+            "louds_search() disagrees on %s", word);
+
+        /* The word and every prefix of it */
+        for (size_t len = strlen(word); len > 0; len--) {
+            word[len] = '\0';
+            cr_assert_eq(louds_search(l, word), trie_search(t, word),
+                "louds_search() disagrees on %s", word);
+            cr_assert_eq(louds_count_completion(l, word),
+                trie_count_completion(t, word),
+                "louds_count_completion() disagrees on %s", word);
+        }
+    }
+
+    cr_assert_eq(louds_search(l, "zz"), NOT_IN_TRIE,
+        "louds_search() found a missing word");
+    cr_assert_eq(louds_count_completion(l, "zz"), 0,
+        "louds_count_completion() counted a missing prefix");
+}
+
+/* Checks that freezing a plain trie keeps its words */
+Test(louds, freeze)
+{
+    trie_t *t = louds_test_trie(0, 3000);
+    louds_t *l = louds_freeze(t);
+
+    cr_assert_not_null(l, "louds_freeze() failed");
+    cr_assert_eq(l->hdr->num_words, 3000, "louds_freeze() lost words");
+
+    check_frozen(t, l, 3000);
+
+    louds_free(l);
+    trie_free(t);
+}
+
+/* Checks that compressed labels are spelled out when freezing */
+Test(louds, freeze_compressed)
+{
+    trie_t *t = louds_test_trie(TRIE_COMPRESSED, 3000);
+    trie_t *plain = louds_test_trie(0, 3000);
+    louds_t *l = louds_freeze(t);
+    louds_t *p = louds_freeze(plain);
+
+    cr_assert_not_null(l, "louds_freeze() failed");
+    cr_assert_eq(l->hdr->size, p->hdr->size, "Compressed and plain tries \
+        froze to different sizes");
+    cr_assert_eq(memcmp(l->hdr, p->hdr, l->hdr->size), 0, "Compressed and \
+        plain tries froze differently");
+
+    check_frozen(t, l, 3000);
+
+    louds_free(l);
+    louds_free(p);
+    trie_free(t);
+    trie_free(plain);
+}
+
+/* Checks the smallest tries, including the empty string as a word */
+Test(louds, freeze_small)
+{
+    trie_t *t = trie_new('\0');
+    louds_t *l = louds_freeze(t);
+
+    cr_assert_eq(louds_search(l, ""), PARTIAL_IN_TRIE,
+        "louds_search() found a word in an empty trie");
+    cr_assert_eq(louds_count_completion(l, ""), 0,
+        "louds_count_completion() counted words in an empty trie");
+    louds_free(l);
+
+    trie_insert_string(t, "");
+    trie_insert_string(t, "a");
+    l = louds_freeze(t);
+
+    cr_assert_eq(louds_search(l, ""), IN_TRIE, "louds_search() missed \"\"");
+    cr_assert_eq(louds_search(l, "a"), IN_TRIE, "louds_search() missed a");
+    cr_assert_eq(louds_get_child(l, LOUDS_ROOT, 'b'), LOUDS_NONE,
+        "louds_get_child() found a missing child");
+    cr_assert_eq(louds_count_completion(l, ""), 2,
+        "louds_count_completion() miscounted");
+
+    louds_free(l);
+    trie_free(t);
+}
+
+/* Checks that a saved trie can be mapped and queried in place */
+Test(louds, save_open)
+{
+    char path[] = "louds_test.XXXXXX";
+    int fd = mkstemp(path);
+    trie_t *t = louds_test_trie(0, 5000);
+    louds_t *l = louds_freeze(t);
+
+    cr_assert_geq(fd, 0, "Could not create a temporary file");
+    close(fd);
+
+    cr_assert_eq(louds_save(l, path), 0, "louds_save() failed");
+    louds_free(l);
+
+    l = louds_open(path);
+    cr_assert_not_null(l, "louds_open() failed");
+    cr_assert(l->mapped, "louds_open() did not map the file");
+
+    check_frozen(t, l, 5000);
+
+    louds_free(l);
+    trie_free(t);
+    unlink(path);
+}
+
+/* Checks that louds_open() turns down files that are not louds files */
+Test(louds, open_bad)
+{
+    char path[] = "louds_test.XXXXXX";
+    int fd = mkstemp(path);
+    trie_t *t = louds_test_trie(0, 100);
+    louds_t *l = louds_freeze(t);
+
+    cr_assert_geq(fd, 0, "Could not create a temporary file");
+    close(fd);
+
+    cr_assert_null(louds_open(path), "louds_open() took an empty file");
+
+    /* A file cut short */
+    FILE *f = fopen(path, "wb");
+    fwrite(l->hdr, 1, l->hdr->size - 8, f);
+    fclose(f);
+    cr_assert_null(louds_open(path), "louds_open() took a truncated file");
+
+    cr_assert_null(louds_open("no/such/file"), "louds_open() took a missing file");
+
+    louds_free(l);
+    trie_free(t);
+    unlink(path);
+}
@@ -0,0 +1,189 @@
+#define _DEFAULT_SOURCE
+
+#include <criterion/criterion.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "qgram.h"
+#include "symspell.h"
+
+/* Collects what qgram_lookup() finds, by word */
+typedef struct {
+    char *words[512];
+    int distances[512];
+    int count;
+} qgram_hits_t;
+
+int qgram_test_found(void *arg, char *word, int distance)
+{
+    qgram_hits_t *hits = arg;
+
+    /* Stops the lookup, which then fails */
+    if (hits->count == 512)
+        return 1;
+
+    hits->words[hits->count] = strdup(word);
+    hits->distances[hits->count] = distance;
+    hits->count++;
+
+    return 0;
+}
+
+void qgram_test_clear(qgram_hits_t *hits)
+{
+    for (int i = 0; i < hits->count; i++)
+        free(hits->words[i]);
+    hits->count = 0;
+}
+
+/* Checks that words can be added, added again and removed */
+Test(qgram, add_remove)
+{
+    qgram_t *qg = qgram_new(QGRAM_Q);
+    qgram_hits_t hits = { .count = 0 };
+
+    cr_assert_not_null(qg, "qgram_new() failed");
+
+    cr_assert_eq(qgram_add(qg, "cat"), 0, "qgram_add() failed");
+    cr_assert_eq(qgram_add(qg, "cart"), 0, "qgram_add() failed");
+    cr_assert_eq(qgram_add(qg, ""), 0, "qgram_add() failed on \"\"");
+    cr_assert_eq(qgram_add(qg, "cat"), 0, "qgram_add() failed on a repeat");
+    cr_assert_eq(qg->num_words, 3, "qgram_add() counted a repeat");
+
+    cr_assert_eq(qgram_remove(qg, "cart"), 0, "qgram_remove() failed");
+    cr_assert_neq(qgram_remove(qg, "cart"), 0,
+        "qgram_remove() removed a missing word");
+    cr_assert_eq(qg->num_words, 2, "qgram_remove() miscounted");
+
+    cr_assert_eq(qgram_lookup(qg, "crt", 2, qgram_test_found, &hits), 0,
+        "qgram_lookup() failed");
+    cr_assert_eq(hits.count, 1, "qgram_lookup() found %d words", hits.count);
+    cr_assert_str_eq(hits.words[0], "cat", "qgram_lookup() found the wrong word");
+    cr_assert_eq(hits.distances[0], 1, "qgram_lookup() got the distance wrong");
+    qgram_test_clear(&hits);
+
+    cr_assert_eq(qgram_lookup(qg, "ct", 3, qgram_test_found, &hits), 0,
+        "qgram_lookup() failed");
+    cr_assert_eq(hits.count, 2, "qgram_lookup() missed \"\" or cat");
+    qgram_test_clear(&hits);
+
+    /* Enough removed words to build the lists again */
+    char word[8];
+    for (int i = 0; i < 200; i++) {
+        sprintf(word, "w%d", i);
+        cr_assert_eq(qgram_add(qg, word), 0, "qgram_add() failed on %s", word);
+    }
+    for (int i = 0; i < 200; i++) {
+        sprintf(word, "w%d", i);
+        cr_assert_eq(qgram_remove(qg, word), 0, "qgram_remove() failed on %s",
+            word);
+    }
+
+    cr_assert_lt(qg->num_stale, 200, "qgram_remove() never built the lists again");
+    cr_assert_eq(qg->num_words, 2, "qgram_remove() miscounted");
+    cr_assert_eq(qgram_lookup(qg, "w1", 1, qgram_test_found, &hits), 0,
+        "qgram_lookup() failed");
+    cr_assert_eq(hits.count, 0, "qgram_lookup() found a removed word");
+
+    cr_assert_eq(qgram_lookup(qg, "cat", 0, qgram_test_found, &hits), 0,
+        "qgram_lookup() failed");
+    cr_assert_eq(hits.count, 1, "qgram_lookup() lost cat");
+
+    qgram_test_clear(&hits);
+    qgram_free(qg);
+}
+
+/* Checks qgram_lookup() against symspell_distance() on every word */
+Test(qgram, lookup_all)
+{
+    trie_t *t = trie_new_flags('\0', TRIE_COMPRESSED);
+    char *words[300];
+    char word[12];
+    int n = 0;
+
+    srand(22018);
+    for (int i = 0; i < 300; i++) {
+        int len = rand() % 11;
+        for (int j = 0; j < len; j++)
+            word[j] = "abcd\xf9"[rand() % 5];
+        word[len] = '\0';
+
+        if (trie_search(t, word) != IN_TRIE) {
+            trie_insert_string(t, word);
+            words[n++] = strdup(word);
+        }
+    }
+
+    for (int q = 1; q <= QGRAM_MAX_Q; q++) {
+        qgram_t *qg = qgram_build(t, q);
+        cr_assert_not_null(qg, "qgram_build() failed");
+        cr_assert_eq(qg->num_words, n, "qgram_build() missed words");
+
+        for (int k = 0; k < 100; k++) {
+            qgram_hits_t hits = { .count = 0 };
+            int len = rand() % 11;
+            int max_edits = rand() % 6;
+
+            for (int j = 0; j < len; j++)
+                word[j] = "abcde"[rand() % 5];
+            word[len] = '\0';
+
+            cr_assert_eq(qgram_lookup(qg, word, max_edits, qgram_test_found,
+                &hits), 0, "qgram_lookup() failed");
+
+            int expected = 0;
+            for (int i = 0; i < n; i++) {
+                int d = symspell_distance(word, words[i], max_edits);
+                if (d > max_edits)
+                    continue;
+
+                int at = 0;
+                while (at < hits.count && strcmp(hits.words[at], words[i]) != 0)
+                    at++;
+
+                cr_assert_lt(at, hits.count, "qgram_lookup() missed %s for %s",
+                    words[i], word);
+                cr_assert_eq(hits.distances[at], d,
+                    "qgram_lookup() got %s wrong for %s", words[i], word);
+                expected++;
+            }
+
+            cr_assert_eq(hits.count, expected,
+                "qgram_lookup() found extra words for %s", word);
+            qgram_test_clear(&hits);
+        }
+
+        qgram_free(qg);
+    }
+
+    for (int i = 0; i < n; i++)
+        free(words[i]);
+    trie_free(t);
+}
+
+/* Checks that a long word only gets the words sharing its q-grams checked */
+Test(qgram, count_filter)
+{
+    qgram_t *qg = qgram_new(QGRAM_Q);
+    qgram_hits_t hits = { .count = 0 };
+    char word[32];
+
+    srand(22018);
+    for (int i = 0; i < 1000; i++) {
+        for (int j = 0; j < 20; j++)
+            word[j] = 'a' + rand() % 26;
+        word[20] = '\0';
+        qgram_add(qg, word);
+    }
+    qgram_add(qg, "internationalization");
+
+    cr_assert_eq(qgram_lookup(qg, "intrenationalizaiton", 4, qgram_test_found,
+        &hits), 0, "qgram_lookup() failed");
+    cr_assert_eq(hits.count, 1, "qgram_lookup() found %d words", hits.count);
+    cr_assert_eq(hits.distances[0], 2, "qgram_lookup() got the distance wrong");
+    cr_assert_lt(qg->checked, 10, "qgram_lookup() checked %d words",
+        qg->checked);
+
+    qgram_test_clear(&hits);
+    qgram_free(qg);
+}
@@ -288,6 +288,54 @@ Test(suggestion, suggestions_s1) {
                 "suggestions() third result incorrect");
 }
 
+// Test a full set, where better matches keep pushing out the worst one
+Test(suggestion, suggestions_full) {
+    trie_t *t = trie_new('\0');
+    match_t **set = calloc(3, sizeof(match_t*));
+
+    // Reached with every number of edits, in no particular order
+    char *words[] = {"zap", "cat", "bat", "cab", "hat", "at", "cast", "c", "act", "mat"};
+    for (int i = 0; i < 10; i++) {
+        trie_insert_string(t, words[i]);
+    }
+
+    int rc = suggestions(set, t, "", "cat", 2, 3);
+    cr_assert_eq(0, rc, "suggestions() failed");
+
+    qsort(set, 3, sizeof(match_t*), cmp_match);
+
+    cr_assert_str_eq(set[0]->str, "cat", "suggestions() first result incorrect");
+    cr_assert_eq(set[0]->edits_left, 2, "suggestions() first score incorrect");
+    cr_assert_str_eq(set[1]->str, "act", "suggestions() second result incorrect");
+    cr_assert_eq(set[1]->edits_left, 1, "suggestions() second score incorrect");
+    cr_assert_str_eq(set[2]->str, "at", "suggestions() third result incorrect");
+    cr_assert_eq(set[2]->edits_left, 1, "suggestions() third score incorrect");
+}
+
+// Test that states reached by different edits are only expanded once
+Test(suggestion, suggestions_stats_saved) {
+    trie_t *t = trie_new('\0');
+    match_t **set = calloc(2, sizeof(match_t*));
+    suggestion_stats_t stats;
+
+    trie_insert_string(t, "abc");
+    trie_insert_string(t, "abd");
+
+    // Replacing b and deleting then inserting it both get to "ab" with "c" left
+    int rc = suggestions_stats(set, t, "", "abc", 3, 2, &stats);
+    cr_assert_eq(0, rc, "suggestions_stats() failed");
+
+    cr_assert_gt(stats.expanded, 0, "suggestions_stats() expanded nothing");
+    cr_assert_gt(stats.saved, 0, "suggestions_stats() saved nothing");
+
+    qsort(set, 2, sizeof(match_t*), cmp_match);
+
+    cr_assert_str_eq(set[0]->str, "abc", "suggestions_stats() first result incorrect");
+    cr_assert_eq(set[0]->edits_left, 3, "suggestions_stats() first score incorrect");
+    cr_assert_str_eq(set[1]->str, "abd", "suggestions_stats() second result incorrect");
+    cr_assert_eq(set[1]->edits_left, 2, "suggestions_stats() second score incorrect");
+}
+
 /*************   These functions test the easy input functions   *************/
 
 // Test for suggestion_set_new function
@@ -400,4 +448,398 @@ Test(suggestion, suggestion_list_s1) {
                 "suggestion_list() second result incorrect");
     cr_assert_eq(0, strncmp(result[2], "antij4-8", MAXLEN), 
                 "suggestion_list() third result incorrect");
-}
\ No newline at end of file
+}
+
+// A word longer than the search buffer must not be written past its end
+Test(suggestion, suggestion_list_long_word) {
+    trie_t *t = trie_new('\0');
+    char word[301];
+
+    memset(word, 'a', 300);
+    word[300] = '\0';
+
+    trie_insert_string(t, word);
+    trie_insert_string(t, "aaa");
+
+    char **result = suggestion_list(t, word, 1, 2);
+
+    if (result != NULL) {
+        for (int i = 0; i < 2; i++) {
+            cr_assert(result[i] == NULL || strcmp(result[i], word) != 0,
+                      "suggestion_list() spelled out a word longer than its buffer");
+        }
+    }
+
+    trie_free(t);
+}
+// Test suggestion_list on a path compressed trie
+Test(suggestion, suggestion_list_compressed) {
+    trie_t *t = trie_new_flags('\0', TRIE_COMPRESSED);
+
+    trie_insert_string(t, "afij4-8");
+    trie_insert_string(t, "ayij48-");
+    trie_insert_string(t, "flij4-8");
+    trie_insert_string(t, "afij4*8");
+    trie_insert_string(t, "antij4-8"); 
+    trie_insert_string(t, "nkj345yf");
+
+    char **result = suggestion_list(t, "afij4-8", 3, 3);
+
+    cr_assert_eq(0, strncmp(result[0], "afij4-8", MAXLEN), 
+                "suggestion_list() first result incorrect");
+    cr_assert_eq(0, strncmp(result[1], "afij4*8", MAXLEN), 
+                "suggestion_list() second result incorrect");
+    cr_assert_eq(0, strncmp(result[2], "antij4-8", MAXLEN), 
+                "suggestion_list() third result incorrect");
+}
+
+// Checks suggestion_list_dp() against suggestion_list() on small random tries
+Test(suggestion, suggestion_list_dp_same) {
+    char word[8];
+    srand(22000);
+
+    for (int run = 0; run < 400; run++) {
+        trie_t *t = trie_new_flags('\0', run % 2 == 0 ? 0 : TRIE_COMPRESSED);
+
+        // Few letters so there are plenty of swaps, and one byte above 127
+        for (int i = 0; i < 10; i++) {
+            int len = rand() % 6;
+            for (int j = 0; j < len; j++) {
+                word[j] = "abc\xf9"[rand() % 4];
+            }
+            word[len] = '\0';
+            trie_insert_string(t, word);
+        }
+
+        int len = rand() % 5;
+        for (int j = 0; j < len; j++) {
+            word[j] = "abcd\xf9"[rand() % 5];
+        }
+        word[len] = '\0';
+
+        int max_edits = rand() % 3;
+        char **expected = suggestion_list(t, word, max_edits, 5);
+        char **result = suggestion_list_dp(t, word, max_edits, 5);
+
+        cr_assert_not_null(result, "suggestion_list_dp() failed");
+
+        for (int i = 0; i < 5; i++) {
+            if (expected[i] == NULL) {
+                cr_assert_null(result[i], "suggestion_list_dp() found extra words for %s", word);
+            } else {
+                cr_assert_not_null(result[i], "suggestion_list_dp() missed %s for %s",
+                                   expected[i], word);
+                cr_assert_str_eq(result[i], expected[i],
+                                 "suggestion_list_dp() disagrees for %s", word);
+            }
+            free(expected[i]);
+            free(result[i]);
+        }
+
+        free(expected);
+        free(result);
+        trie_free(t);
+    }
+}
+
+// A swap only counts as one edit when the path it starts from is in the trie
+Test(suggestion, suggestion_list_dp_swap) {
+    trie_t *t = trie_new('\0');
+
+    trie_insert_string(t, "ab");
+    char **result = suggestion_list_dp(t, "ba", 1, 1);
+    cr_assert_null(result[0], "suggestion_list_dp() swapped from a missing path");
+
+    trie_insert_string(t, "bx");
+    result = suggestion_list_dp(t, "ba", 1, 1);
+    cr_assert_not_null(result[0], "suggestion_list_dp() missed a swap");
+    cr_assert_str_eq(result[0], "ab", "suggestion_list_dp() first result incorrect");
+}
+
+// Bytes above 247 can be inserted and replaced like any other
+Test(suggestion, suggestion_list_high_bytes) {
+    trie_t *t = trie_new('\0');
+
+    trie_insert_string(t, "a\xfc");
+    trie_insert_string(t, "\xff" "b");
+
+    char **result = suggestion_list(t, "a", 1, 2);
+    cr_assert_not_null(result[0], "suggestion_list() missed an inserted byte");
+    cr_assert_str_eq(result[0], "a\xfc", "suggestion_list() first result incorrect");
+    cr_assert_null(result[1], "suggestion_list() found extra words");
+
+    result = suggestion_list(t, "ab", 1, 2);
+    cr_assert_str_eq(result[0], "a\xfc", "suggestion_list() first result incorrect");
+    cr_assert_not_null(result[1], "suggestion_list() missed a replaced byte");
+    cr_assert_str_eq(result[1], "\xff" "b", "suggestion_list() second result incorrect");
+}
+
+// Checks suggestion_list_best_first() against suggestion_list() on small random tries
+Test(suggestion, suggestion_list_best_first_same) {
+    char word[8];
+    srand(22016);
+
+    for (int run = 0; run < 400; run++) {
+        trie_t *t = trie_new_flags('\0', run % 2 == 0 ? 0 : TRIE_COMPRESSED);
+
+        for (int i = 0; i < 10; i++) {
+            int len = rand() % 6;
+            for (int j = 0; j < len; j++) {
+                word[j] = "abc"[rand() % 3];
+            }
+            word[len] = '\0';
+            trie_insert_string(t, word);
+        }
+
+        int len = rand() % 5;
+        for (int j = 0; j < len; j++) {
+            word[j] = "abcd"[rand() % 4];
+        }
+        word[len] = '\0';
+
+        int max_edits = rand() % 4;
+        int n = 1 + rand() % 5;
+        char **expected = suggestion_list(t, word, max_edits, n);
+        char **result = suggestion_list_best_first(t, word, max_edits, n);
+
+        cr_assert_not_null(result, "suggestion_list_best_first() failed");
+
+        for (int i = 0; i < n; i++) {
+            if (expected[i] == NULL) {
+                cr_assert_null(result[i], "suggestion_list_best_first() found extra words for %s",
+                               word);
+            } else {
+                cr_assert_not_null(result[i], "suggestion_list_best_first() missed %s for %s",
+                                   expected[i], word);
+                cr_assert_str_eq(result[i], expected[i],
+                                 "suggestion_list_best_first() disagrees for %s", word);
+            }
+            free(expected[i]);
+            free(result[i]);
+        }
+
+        free(expected);
+        free(result);
+        trie_free(t);
+    }
+}
+
+// Test that the search stops once the set is full of close matches
+Test(suggestion, suggestions_best_first_stops) {
+    trie_t *t = trie_new('\0');
+    match_t **set = calloc(1, sizeof(match_t*));
+    match_t **full = calloc(1, sizeof(match_t*));
+    suggestion_stats_t stats, full_stats;
+    char word[8];
+
+    for (int i = 0; i < 500; i++) {
+        sprintf(word, "%x", i * 7919 % 4096);
+        trie_insert_string(t, word);
+    }
+    trie_insert_string(t, "cat");
+
+    int rc = suggestions_best_first(set, t, "cat", 3, 1, &stats);
+    cr_assert_eq(0, rc, "suggestions_best_first() failed");
+    rc = suggestions_stats(full, t, "", "cat", 3, 1, &full_stats);
+    cr_assert_eq(0, rc, "suggestions_stats() failed");
+
+    cr_assert_str_eq(set[0]->str, "cat", "suggestions_best_first() first result incorrect");
+    cr_assert_eq(set[0]->edits_left, 3, "suggestions_best_first() first score incorrect");
+
+    // Only the states reached without an edit
+    cr_assert_eq(stats.expanded, 4, "suggestions_best_first() expanded %ld states",
+                 stats.expanded);
+    cr_assert_lt(stats.expanded, full_stats.expanded,
+                 "suggestions_best_first() did no less work than suggestions()");
+}
+
+// Test that every engine finds the same words when there are no swaps to tell them apart
+Test(suggestion, suggestion_list_engine) {
+    trie_t *t = trie_new('\0');
+    char *words[5] = {"cart", "care", "cat", "cut", "dog"};
+    int engines[5] = {SUGGEST_DEPTH_FIRST, SUGGEST_DP, SUGGEST_BEST_FIRST, SUGGEST_SYMSPELL,
+                      SUGGEST_QGRAM};
+
+    for (int i = 0; i < 5; i++) {
+        trie_insert_string(t, words[i]);
+    }
+
+    symspell_t *ss = symspell_build(t, 2);
+    cr_assert_not_null(ss, "symspell_build() failed");
+
+    for (int e = 0; e < 5; e++) {
+        char **result = suggestion_list_engine(t, ss, NULL, "cat", 2, 4, engines[e]);
+
+        cr_assert_not_null(result, "suggestion_list_engine() failed for engine %d", e);
+        cr_assert_str_eq(result[0], "cat", "engine %d first result incorrect", e);
+        cr_assert_str_eq(result[1], "cart", "engine %d second result incorrect", e);
+        cr_assert_str_eq(result[2], "cut", "engine %d third result incorrect", e);
+        cr_assert_str_eq(result[3], "care", "engine %d fourth result incorrect", e);
+    }
+
+    // An index that does not go far enough is passed over
+    char **result = suggestion_list_engine(t, ss, NULL, "dgo", 3, 1, SUGGEST_SYMSPELL);
+    cr_assert_not_null(result, "suggestion_list_engine() failed");
+    cr_assert_str_eq(result[0], "dog", "suggestion_list_engine() first result incorrect");
+
+    symspell_free(ss);
+}
+
+// Test that a big budget finds the same words through the q-gram index, with no swaps to
+// tell the engines apart
+Test(suggestion, suggestion_list_qgram) {
+    trie_t *t = trie_new('\0');
+    char *words[6] = {"dictionary", "fiction", "diction", "addiction", "dictator", "zebra"};
+
+    for (int i = 0; i < 6; i++) {
+        trie_insert_string(t, words[i]);
+    }
+
+    char **result = suggestion_list(t, "dixtionery", SUGGEST_QGRAM_EDITS, 5);
+    char **expected = suggestion_list_dp(t, "dixtionery", SUGGEST_QGRAM_EDITS, 5);
+
+    cr_assert_not_null(result, "suggestion_list() failed");
+    cr_assert_str_eq(result[0], "dictionary", "suggestion_list() first result incorrect");
+
+    for (int i = 0; i < 5; i++) {
+        if (expected[i] == NULL) {
+            cr_assert_null(result[i], "suggestion_list() found too many words");
+        } else {
+            cr_assert_not_null(result[i], "suggestion_list() missed %s", expected[i]);
+            cr_assert_str_eq(result[i], expected[i], "suggestion_list() result %d incorrect", i);
+        }
+    }
+
+    qgram_t *qg = qgram_build(t, QGRAM_Q);
+    char **kept = suggestion_list_engine(t, NULL, qg, "dixtionery", SUGGEST_QGRAM_EDITS, 5,
+                                         SUGGEST_QGRAM);
+
+    cr_assert_not_null(kept, "suggestion_list_engine() failed");
+    for (int i = 0; i < 5 && expected[i] != NULL; i++) {
+        cr_assert_str_eq(kept[i], expected[i], "suggestion_list_engine() result %d incorrect", i);
+    }
+
+
+    // Without an index there is nothing to look up, so the trie is walked instead
+    char **walked = suggestion_list_engine(t, NULL, NULL, "dixtionery", SUGGEST_QGRAM_EDITS, 5,
+                                           SUGGEST_QGRAM);
+
+    cr_assert_not_null(walked, "suggestion_list_engine() failed");
+    for (int i = 0; i < 5 && expected[i] != NULL; i++) {
+        cr_assert_str_eq(walked[i], expected[i], "suggestion_list_engine() result %d incorrect", i);
+    }
+
+    qgram_free(qg);
+}
+
+// Test that the depth-first engine and suggestion_list() keep the trie's swaps at any budget,
+// while the q-gram index counts every swap
+Test(suggestion, suggestion_list_qgram_metric) {
+    trie_t *t = trie_new('\0');
+
+    trie_insert_string(t, "receive");
+
+    // "recieve" takes one swap, but the trie has no path for "reci" to make it from
+    char **listed = suggestion_list(t, "recieve", SUGGEST_QGRAM_EDITS, 1);
+    char **depth = suggestion_list_engine(t, NULL, NULL, "recieve", SUGGEST_QGRAM_EDITS, 1,
+                                          SUGGEST_DEPTH_FIRST);
+    match_t **set = calloc(1, sizeof(match_t*));
+
+    cr_assert_not_null(listed, "suggestion_list() failed");
+    cr_assert_not_null(depth, "suggestion_list_engine() failed");
+    cr_assert_eq(suggestions(set, t, "", "recieve", SUGGEST_QGRAM_EDITS, 1), EXIT_SUCCESS,
+                 "suggestions() failed");
+    cr_assert_str_eq(listed[0], "receive", "suggestion_list() result incorrect");
+    cr_assert_str_eq(depth[0], "receive", "suggestion_list_engine() result incorrect");
+    cr_assert_eq(set[0]->edits_left, SUGGEST_QGRAM_EDITS - 2,
+                 "suggestion_list() did not walk the trie");
+
+    qgram_t *qg = qgram_build(t, QGRAM_Q);
+    match_t **grams = calloc(1, sizeof(match_t*));
+
+    cr_assert_eq(suggestions_qgram(grams, qg, "recieve", SUGGEST_QGRAM_EDITS, 1), EXIT_SUCCESS,
+                 "suggestions_qgram() failed");
+    cr_assert_str_eq(grams[0]->str, "receive", "suggestions_qgram() result incorrect");
+    cr_assert_eq(grams[0]->edits_left, SUGGEST_QGRAM_EDITS - 1,
+                 "suggestions_qgram() did not count the swap as one edit");
+
+    qgram_free(qg);
+    trie_free(t);
+}
+
+// Test that a typo in the prefix still completes, best scores first and each word once
+Test(suggestion, suggestion_complete) {
+    trie_t *t = trie_new('\0');
+    char *words[7] = {"receive", "received", "receiver", "recipe", "deceive", "relieve",
+                      "zebra"};
+    double scores[7] = {5, 3, 4, 2, 1, 1, 9};
+    trie_t *out[10];
+    int edits[10];
+    char word[32];
+
+    for (int i = 0; i < 7; i++) {
+        trie_insert_scored(t, words[i], scores[i]);
+    }
+
+    int n = suggestion_complete(t, "recieve", 1, 10, out, edits);
+    cr_assert_eq(n, 4, "suggestion_complete() found %d words", n);
+
+    char *expected[4] = {"receive", "receiver", "received", "relieve"};
+    for (int i = 0; i < 4; i++) {
+        trie_node_word(out[i], word, sizeof(word));
+        cr_assert_str_eq(word, expected[i], "suggestion_complete() result %d incorrect", i);
+        cr_assert_eq(edits[i], 1, "suggestion_complete() edits %d incorrect", i);
+    }
+
+    // Fewer edits go first, whatever the score
+    n = suggestion_complete(t, "rece", 1, 2, out, edits);
+    cr_assert_eq(n, 2, "suggestion_complete() found %d words", n);
+    trie_node_word(out[0], word, sizeof(word));
+    cr_assert_str_eq(word, "receive", "suggestion_complete() first result incorrect");
+    cr_assert_eq(edits[0], 0, "suggestion_complete() first edits incorrect");
+    trie_node_word(out[1], word, sizeof(word));
+    cr_assert_str_eq(word, "receiver", "suggestion_complete() second result incorrect");
+
+    n = suggestion_complete(t, "xyz", 1, 10, out, edits);
+    cr_assert_eq(n, 0, "suggestion_complete() found %d words", n);
+
+    // A prefix that can be deleted outright completes to everything
+    n = suggestion_complete(t, "q", 1, 10, out, edits);
+    cr_assert_eq(n, 7, "suggestion_complete() found %d words", n);
+    trie_node_word(out[0], word, sizeof(word));
+    cr_assert_str_eq(word, "zebra", "suggestion_complete() first result incorrect");
+}
+
+// Test that a swapped pair counts as one edit even where the trie has no path for the typo
+Test(suggestion, suggestion_complete_swap) {
+    int flags[2] = {0, TRIE_COMPRESSED};
+    char *words[3] = {"receive", "received", "receiver"};
+    trie_t *out[10];
+    int edits[10];
+    char word[32];
+
+    for (int f = 0; f < 2; f++) {
+        trie_t *t = trie_new_flags('\0', flags[f]);
+
+        for (int i = 0; i < 3; i++) {
+            trie_insert_string(t, words[i]);
+        }
+
+        int n = suggestion_complete(t, "recieve", 1, 10, out, edits);
+        cr_assert_eq(n, 3, "suggestion_complete() found %d words", n);
+
+        for (int i = 0; i < 3; i++) {
+            trie_node_word(out[i], word, sizeof(word));
+            cr_assert_str_eq(word, words[i], "suggestion_complete() result %d incorrect", i);
+            cr_assert_eq(edits[i], 1, "suggestion_complete() edits %d incorrect", i);
+        }
+
+        // Two swaps are two edits
+        n = suggestion_complete(t, "erceive", 1, 10, out, edits);
+        cr_assert_eq(n, 3, "suggestion_complete() found %d words", n);
+        n = suggestion_complete(t, "erciee", 1, 10, out, edits);
+        cr_assert_eq(n, 0, "suggestion_complete() found %d words", n);
+
+        trie_free(t);
+    }
+}
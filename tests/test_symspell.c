@@ -0,0 +1,156 @@
+#define _DEFAULT_SOURCE
+
+#include <criterion/criterion.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "symspell.h"
+
+/* Collects what symspell_lookup() finds, by word */
+typedef struct {
+    char *words[64];
+    int distances[64];
+    int count;
+} symspell_hits_t;
+
+int symspell_test_found(void *arg, char *word, int distance)
+{
+    symspell_hits_t *hits = arg;
+
+    /* Stops the lookup, which then fails */
+    if (hits->count == 64)
+        return 1;
+
+    hits->words[hits->count] = strdup(word);
+    hits->distances[hits->count] = distance;
+    hits->count++;
+
+    return 0;
+}
+
+/* Checks symspell_distance() on a few known pairs */
+Test(symspell, symspell_distance)
+{
+    cr_assert_eq(symspell_distance("", "", 2), 0, "\"\" and \"\" differ");
+    cr_assert_eq(symspell_distance("abc", "abc", 2), 0, "abc and abc differ");
+    cr_assert_eq(symspell_distance("ab", "ba", 2), 1,
+        "A swap should take one edit");
+    cr_assert_eq(symspell_distance("abc", "", 5), 3,
+        "Deleting everything should take one edit per character");
+    cr_assert_eq(symspell_distance("kitten", "sitting", 5), 3,
+        "kitten and sitting should be 3 edits apart");
+
+    /* A swapped pair is not edited again */
+    cr_assert_eq(symspell_distance("ca", "abc", 5), 3,
+        "ca and abc should be 3 edits apart");
+
+    cr_assert_eq(symspell_distance("kitten", "sitting", 2), 3,
+        "symspell_distance() should give up after max");
+    cr_assert_eq(symspell_distance("a", "abcdef", 1), 2,
+        "symspell_distance() should give up on lengths too far apart");
+}
+
+/* Checks that words can be added, added again and removed */
+Test(symspell, add_remove)
+{
+    symspell_t *ss = symspell_new(2);
+    symspell_hits_t hits = { .count = 0 };
+
+    cr_assert_not_null(ss, "symspell_new() failed");
+
+    cr_assert_eq(symspell_add(ss, "cat"), 0, "symspell_add() failed");
+    cr_assert_eq(symspell_add(ss, "cart"), 0, "symspell_add() failed");
+    cr_assert_eq(symspell_add(ss, "cat"), 0, "symspell_add() failed on a repeat");
+    cr_assert_eq(ss->num_words, 2, "symspell_add() counted a repeat");
+
+    cr_assert_eq(symspell_remove(ss, "cart"), 0, "symspell_remove() failed");
+    cr_assert_neq(symspell_remove(ss, "cart"), 0,
+        "symspell_remove() removed a missing word");
+    cr_assert_neq(symspell_remove(ss, "ca"), 0,
+        "symspell_remove() removed a delete of a word");
+    cr_assert_eq(ss->num_words, 1, "symspell_remove() miscounted");
+
+    cr_assert_eq(symspell_lookup(ss, "crt", 2, symspell_test_found, &hits), 0,
+        "symspell_lookup() failed");
+    cr_assert_eq(hits.count, 1, "symspell_lookup() found %d words", hits.count);
+    cr_assert_str_eq(hits.words[0], "cat", "symspell_lookup() found the wrong word");
+    cr_assert_eq(hits.distances[0], 1, "symspell_lookup() got the distance wrong");
+
+    /* The freed id is handed out again */
+    cr_assert_eq(symspell_add(ss, "cars"), 0, "symspell_add() failed");
+    cr_assert_eq(ss->size, 2, "symspell_add() did not reuse an id");
+
+    cr_assert_neq(symspell_lookup(ss, "cat", 3, symspell_test_found, &hits), 0,
+        "symspell_lookup() went past max_distance");
+
+    for (int i = 0; i < hits.count; i++)
+        free(hits.words[i]);
+    symspell_free(ss);
+}
+
+/* Checks symspell_lookup() against symspell_distance() on every word */
+Test(symspell, lookup_all)
+{
+    trie_t *t = trie_new_flags('\0', TRIE_COMPRESSED);
+    char *words[300];
+    char word[8];
+    int n = 0;
+
+    srand(22017);
+    for (int i = 0; i < 300; i++) {
+        int len = rand() % 7;
+        for (int j = 0; j < len; j++)
+            word[j] = "abcd\xf9"[rand() % 5];
+        word[len] = '\0';
+
+        if (trie_search(t, word) != IN_TRIE) {
+            trie_insert_string(t, word);
+            words[n++] = strdup(word);
+        }
+    }
+
+    symspell_t *ss = symspell_build(t, 2);
+    cr_assert_not_null(ss, "symspell_build() failed");
+    cr_assert_eq(ss->num_words, n, "symspell_build() missed words");
+
+    for (int q = 0; q < 200; q++) {
+        symspell_hits_t hits = { .count = 0 };
+        int len = rand() % 7;
+        int max_edits = rand() % 3;
+
+        for (int j = 0; j < len; j++)
+            word[j] = "abcde"[rand() % 5];
+        word[len] = '\0';
+
+        cr_assert_eq(symspell_lookup(ss, word, max_edits, symspell_test_found,
+            &hits), 0, "symspell_lookup() failed");
+
+        int expected = 0;
+        for (int i = 0; i < n; i++) {
+            int d = symspell_distance(word, words[i], max_edits);
+            if (d > max_edits)
+                continue;
+
+            int at = 0;
+            while (at < hits.count && strcmp(hits.words[at], words[i]) != 0)
+                at++;
+
+            cr_assert_lt(at, hits.count, "symspell_lookup() missed %s for %s",
+                words[i], word);
+            cr_assert_eq(hits.distances[at], d,
+                "symspell_lookup() got %s wrong for %s", words[i], word);
+            expected++;
+        }
+
+        cr_assert_eq(hits.count, expected,
+            "symspell_lookup() found extra words for %s", word);
+
+        for (int i = 0; i < hits.count; i++)
+            free(hits.words[i]);
+    }
+
+    for (int i = 0; i < n; i++)
+        free(words[i]);
+    symspell_free(ss);
+    trie_free(t);
+}
@@ -1,6 +1,7 @@
 #include <criterion/criterion.h>
 #include <stdlib.h>
 #include <stdarg.h>
+#include <stdio.h>
 #include <string.h>
 #include "trie.h"
 #include <stdbool.h>
@@ -25,11 +26,11 @@ Test(trie, trie_add_node_exists)
     int rc = trie_add_node(t, n);
 
     cr_assert_eq(rc, 0, "trie_add_node failed");
-    cr_assert_not_null(t->children[(unsigned)n], "trie_add_node() failed \
+    cr_assert_not_null(trie_get_child(t, n), "trie_add_node() failed \
         to allocate new entry");
-    cr_assert_eq(t->children[(unsigned)n]->current, n, "trie_add_node() \
+    cr_assert_eq(trie_get_child(t, n)->current, n, "trie_add_node() \
         failed to set is_word for new trie");
-    cr_assert_eq(t->children[(unsigned)n]->is_word, 0, "trie_add_node() \
+    cr_assert_eq(trie_get_child(t, n)->is_word, 0, "trie_add_node() \
     failed to set is_word for new trie");
 }
 
@@ -45,14 +46,190 @@ Test(trie, trie_add_node_new)
     int rc = trie_add_node(t, n);
 
     cr_assert_eq(rc, 0, "trie_add_node failed");
-    cr_assert_not_null(t->children[(unsigned)n], "trie_add_node() failed to \
+    cr_assert_not_null(trie_get_child(t, n), "trie_add_node() failed to \
         allocate new entry");
-    cr_assert_eq(t->children[(unsigned)n]->current, n, "trie_add_node() \
+    cr_assert_eq(trie_get_child(t, n)->current, n, "trie_add_node() \
         failed to set is_word for new trie");
-    cr_assert_eq(t->children[(unsigned)n]->is_word, 0, "trie_add_node() \
+    cr_assert_eq(trie_get_child(t, n)->is_word, 0, "trie_add_node() \
         failed to set is_word for new trie");
 }
 
+/* Checks that trie_add_node() moves through every child layout */
+Test(trie, trie_add_node_grow)
+{
+    trie_t *t = trie_new('\0');
+    int expected[4] = {TRIE_NODE4, TRIE_NODE16, TRIE_NODE48, TRIE_NODE256};
+
+    for (int i = 1; i < 256; i++) {
+        int rc = trie_add_node(t, (char)i);
+        cr_assert_eq(rc, 0, "trie_add_node() failed for %d", i);
+
+        int layout = (i <= 4) ? 0 : (i <= 16) ? 1 : (i <= 48) ? 2 : 3;
+        cr_assert_eq(t->type, expected[layout], "trie_add_node() used \
+            layout %d with %d children", t->type, i);
+    }
+
+    cr_assert_eq(t->num_children, 255, "trie_add_node() miscounted children");
+
+    for (int i = 1; i < 256; i++) {
+        trie_t *child = trie_get_child(t, (char)i);
+        cr_assert_not_null(child, "trie_get_child() lost child %d", i);
+        cr_assert_eq((unsigned char)child->current, i, "trie_get_child() \
+            returned the wrong child for %d", i);
+        cr_assert_eq(child->parent, t, "trie_add_node() failed to set parent");
+    }
+
+    trie_free(t);
+}
+
+/* Checks that trie_next_child() returns children in character order */
+Test(trie, trie_next_child_order)
+{
+    char chars[6] = {'z', 'a', 'm', '0', 'b', 'y'};
+    char sorted[6] = {'0', 'a', 'b', 'm', 'y', 'z'};
+    trie_t *t = trie_new('\0');
+    trie_t *child;
+    int pos = 0;
+    int i = 0;
+
+    for (int j = 0; j < 6; j++)
+        trie_add_node(t, chars[j]);
+
+    while ((child = trie_next_child(t, &pos)) != NULL) {
+        cr_assert_lt(i, 6, "trie_next_child() returned too many children");
+        cr_assert_eq(child->current, sorted[i], "trie_next_child() returned \
+            %c instead of %c", child->current, sorted[i]);
+        i++;
+    }
+
+    cr_assert_eq(i, 6, "trie_next_child() returned %d children", i);
+
+    trie_free(t);
+}
+
+/* Checks the child bitmap against trie_get_child() for every character */
+void check_childmap(trie_t *t)
+{
+    int c = trie_next_char(t, 0);
+
+    for (int i = 0; i < 256; i++) {
+        bool has = trie_get_child(t, (char)i) != NULL;
+
+        cr_assert_eq(c == i, has, "trie_next_char() disagrees on %d", i);
+        if (has)
+            c = trie_next_char(t, i + 1);
+    }
+
+    cr_assert_eq(c, -1, "trie_next_char() went past the last child");
+}
+
+/* Checks that the child bitmap follows children through every layout */
+Test(trie, trie_next_char)
+{
+    trie_t *t = trie_new('\0');
+
+    cr_assert_eq(trie_next_char(t, 0), -1, "trie_next_char() found a child \
+        of a leaf");
+
+    /* Every odd character, which takes the node up to TRIE_NODE256 */
+    for (int i = 1; i < 256; i += 2) {
+        trie_add_node(t, (char)i);
+        check_childmap(t);
+    }
+
+    cr_assert_eq(t->type, TRIE_NODE256, "trie_add_node() did not grow");
+    cr_assert_eq(trie_next_char(t, 255), 255, "trie_next_char() missed 255");
+
+    /* And back down, from the middle out */
+    for (int i = 127; i > 0; i -= 2) {
+        trie_remove_node(t, (char)i);
+        trie_remove_node(t, (char)(256 - i));
+        check_childmap(t);
+    }
+
+    cr_assert_eq(trie_next_char(t, 0), -1, "trie_next_char() found a removed \
+        child");
+
+    trie_free(t);
+}
+
+/* Checks that the child bitmap moves with the children on splits and merges */
+Test(trie, trie_next_char_compressed)
+{
+    trie_t *t = trie_new_flags('\0', TRIE_COMPRESSED);
+    unsigned int pos = t->label_len;
+
+    trie_insert_string(t, "banana");
+    trie_insert_string(t, "band");
+    trie_insert_string(t, "bank");
+
+    /* b, with "an" as its label, then the split at a n|d|k */
+    trie_t *b = trie_step(t, &pos, 'b');
+    trie_step(b, &pos, 'a');
+    trie_t *n = trie_step(b, &pos, 'n');
+
+    check_childmap(t);
+    check_childmap(n);
+    cr_assert_eq(trie_next_char(n, 0), 'a', "trie_next_char() missed a");
+    cr_assert_eq(trie_next_char(n, 'a' + 1), 'd', "trie_next_char() missed d");
+
+    trie_remove_string(t, "band");
+    trie_remove_string(t, "bank");
+    check_childmap(t);
+
+    trie_t *merged = trie_get_child(t, 'b');
+    check_childmap(merged);
+    cr_assert_eq(trie_next_char(merged, 0), -1, "trie_next_char() kept the \
+        children of a merged node");
+
+    trie_free(t);
+}
+
+/* Checks that trie_remove_node() shrinks the layout back down */
+Test(trie, trie_remove_node_shrink)
+{
+    trie_t *t = trie_new('\0');
+
+    for (int i = 1; i < 256; i++)
+        trie_add_node(t, (char)i);
+
+    for (int i = 255; i > 2; i--) {
+        int rc = trie_remove_node(t, (char)i);
+        cr_assert_eq(rc, 0, "trie_remove_node() failed for %d", i);
+        cr_assert_null(trie_get_child(t, (char)i), "trie_remove_node() \
+            left child %d behind", i);
+    }
+
+    cr_assert_eq(t->num_children, 2, "trie_remove_node() miscounted children");
+    cr_assert_eq(t->type, TRIE_NODE4, "trie_remove_node() failed to shrink");
+    cr_assert_not_null(trie_get_child(t, (char)1), "trie_remove_node() lost \
+        a remaining child");
+    cr_assert_not_null(trie_get_child(t, (char)2), "trie_remove_node() lost \
+        a remaining child");
+
+    trie_remove_node(t, (char)1);
+    trie_remove_node(t, (char)2);
+    cr_assert_null(t->children, "trie_remove_node() kept storage for a leaf");
+
+    trie_free(t);
+}
+
+/* Checks that trie_remove_node() ignores a child that does not exist */
+Test(trie, trie_remove_node_missing)
+{
+    trie_t *t = trie_new('\0');
+
+    trie_insert_string(t, "ab");
+
+    int rc = trie_remove_node(t, 'b');
+
+    cr_assert_eq(rc, 0, "trie_remove_node() failed on a missing child");
+    cr_assert_eq(trie_search(t, "ab"), IN_TRIE, "trie_remove_node() removed \
+        the wrong child");
+
+    trie_free(t);
+}
+
 /* Checks if trie_insert_string() can properly insert a string */
 Test(trie, trie_insert_string)
 {
@@ -63,26 +240,26 @@ Test(trie, trie_insert_string)
 
     int r1 = trie_insert_string(t,s1);
     cr_assert_eq(r1, 0, "trie_insert_string failed");   
-    cr_assert_not_null(t->children['a'], "trie_add_node() failed to allocate \
+    cr_assert_not_null(trie_get_child(t, 'a'), "trie_add_node() failed to allocate \
         new entry");
-    cr_assert_eq(t->children['a']->is_word,0, "trie_add_node() failed to \
+    cr_assert_eq(trie_get_child(t, 'a')->is_word,0, "trie_add_node() failed to \
         set is_word for new trie");
-    cr_assert_not_null(t->children['a']->children['n'], "trie_add_node() \
+    cr_assert_not_null(trie_get_subtrie(t, "an"), "trie_add_node() \
         failed to allocate new entry");
-    cr_assert_eq(t->children['a']->children['n']->is_word, 1, 
+    cr_assert_eq(trie_get_subtrie(t, "an")->is_word, 1, 
         "trie_insert_string() failed to set is_word for end character");
 
     int r2 = trie_insert_string(t, s2);
     cr_assert_eq(r2, 0, "trie_insert_string() failed");
-    cr_assert_eq(t->children['a']->children['n']->is_word, 1, 
+    cr_assert_eq(trie_get_subtrie(t, "an")->is_word, 1, 
         "trie_insert_string() failed to set is_word for end character");
-    cr_assert_eq(t->children['a']->children['n']->children['t']->children['i']->is_word,
+    cr_assert_eq(trie_get_subtrie(t, "anti")->is_word,
         1, "trie_insert_string() failed to set is_word for end character");
     int r3 = trie_insert_string(t, s3);
     cr_assert_eq(r3, 0, "trie_insert_string() failed");
-    cr_assert_eq(t->children['a']->children['n']->children['t']->is_word, 
+    cr_assert_eq(trie_get_subtrie(t, "ant")->is_word, 
         0, "trie_insert_string() failed to set is_word for middle character");
-    cr_assert_eq(t->children['a']->children['n']->children['t']->children['s']->is_word,
+    cr_assert_eq(trie_get_subtrie(t, "ants")->is_word,
         1, "trie_insert_string() failed to set is_word for end character");
 }
 
@@ -312,6 +489,51 @@ Test(count_completion, prefix_in_trie_5)
     search_completion("antiq", 2);
 }
 
+/* Checks that word_count follows inserts, repeats and removals */
+Test(count_completion, word_count_maintained)
+{
+    trie_t *t = trie_new('\0');
+
+    trie_insert_string(t, "an");
+    trie_insert_string(t, "ant");
+    trie_insert_string(t, "anti");
+    trie_insert_string(t, "ant");
+
+    cr_assert_eq(t->word_count, 3, "word_count at the root is %d", t->word_count);
+    cr_assert_eq(trie_get_subtrie(t, "ant")->word_count, 2, "word_count \
+        below the root is wrong");
+
+    trie_remove_node(trie_get_subtrie(t, "an"), 't');
+
+    cr_assert_eq(t->word_count, 1, "trie_remove_node() did not update word_count");
+    cr_assert_eq(trie_count_completion(t, "a"), 1, "count_completion() \
+        counted removed words");
+
+    trie_free(t);
+}
+
+/* Checks that word_count survives splitting compressed labels */
+Test(count_completion, word_count_compressed)
+{
+    trie_t *t = trie_new_flags('\0', TRIE_COMPRESSED);
+    char* words[8] = {"an","ant","anti", "antique", "antiquity", "antelope", 
+    "antman","anthropology"}; 
+
+    for (int i = 0; i < 8; i++)
+        trie_insert_string(t, words[i]);
+
+    cr_assert_eq(trie_count_completion(t, ""), 8, "count_completion() failed \
+        on the empty prefix");
+    cr_assert_eq(trie_count_completion(t, "antiq"), 2, "count_completion() \
+        failed inside a label");
+    cr_assert_eq(trie_count_completion(t, "anthro"), 1, "count_completion() \
+        failed inside a leaf label");
+    cr_assert_eq(trie_count_completion(t, "antz"), 0, "count_completion() \
+        failed on a missing prefix");
+
+    trie_free(t);
+}
+
 /* Checking if trie_char_exists() can check for a char not in trie */
 Test(trie, trie_char_exists_failure0) {
     trie_t *t;
@@ -445,4 +667,541 @@ Test(trie, integration_extension)
 
     for (int i = 0; i < 9; i++) 
         integration(words[i], NOT_IN_TRIE);
-}
\ No newline at end of file
+}
+/* Checks that a compressed trie keeps unique tails in one label */
+Test(trie, compressed_insert_split)
+{
+    trie_t *t = trie_new_flags('\0', TRIE_COMPRESSED);
+    trie_t *a;
+
+    cr_assert_eq(trie_insert_string(t, "antique"), 0, "trie_insert_string() failed");
+    a = trie_get_child(t, 'a');
+    cr_assert_not_null(a, "trie_insert_string() failed to add a node");
+    cr_assert_eq(a->label_len, 6, "trie_insert_string() did not compress the tail");
+    cr_assert_eq(strncmp(a->label, "ntique", 6), 0, "trie_insert_string() set \
+        the wrong label");
+    cr_assert_eq(a->is_word, 1, "trie_insert_string() failed to set is_word");
+
+    /* Ending inside a label splits it */
+    cr_assert_eq(trie_insert_string(t, "anti"), 0, "trie_insert_string() failed");
+    cr_assert_eq(a->label_len, 3, "trie_insert_string() did not split the label");
+    cr_assert_eq(a->is_word, 1, "trie_insert_string() failed to set is_word");
+    cr_assert_eq(a->num_children, 1, "trie_insert_string() did not add the tail");
+    cr_assert_eq(trie_get_child(a, 'q')->label_len, 2, "trie_insert_string() \
+        set the wrong tail label");
+
+    /* Leaving a label part way splits it too */
+    cr_assert_eq(trie_insert_string(t, "antelope"), 0, "trie_insert_string() failed");
+    cr_assert_eq(a->label_len, 2, "trie_insert_string() did not split the label");
+    cr_assert_eq(a->is_word, 0, "trie_insert_string() kept is_word on a split");
+    cr_assert_eq(a->num_children, 2, "trie_insert_string() did not branch");
+
+    cr_assert_eq(trie_search(t, "antique"), IN_TRIE, "trie_search() lost antique");
+    cr_assert_eq(trie_search(t, "anti"), IN_TRIE, "trie_search() lost anti");
+    cr_assert_eq(trie_search(t, "antelope"), IN_TRIE, "trie_search() lost antelope");
+    cr_assert_eq(trie_search(t, "ant"), PARTIAL_IN_TRIE, "trie_search() \
+        failed on a prefix");
+    cr_assert_eq(trie_search(t, "antel"), PARTIAL_IN_TRIE, "trie_search() \
+        failed on a prefix ending inside a label");
+    cr_assert_eq(trie_search(t, "antelopes"), NOT_IN_TRIE, "trie_search() \
+        failed on an extension");
+    cr_assert_eq(trie_search(t, "antler"), NOT_IN_TRIE, "trie_search() \
+        failed on a word leaving a label");
+
+    trie_free(t);
+}
+
+/* Checks that removing a branch merges a compressed node back together */
+Test(trie, compressed_remove_merge)
+{
+    trie_t *t = trie_new_flags('\0', TRIE_COMPRESSED);
+
+    trie_insert_string(t, "antique");
+    trie_insert_string(t, "antelope");
+
+    trie_t *a = trie_get_child(t, 'a');
+    cr_assert_eq(a->label_len, 2, "trie_insert_string() did not split the label");
+
+    int rc = trie_remove_node(a, 'e');
+    cr_assert_eq(rc, 0, "trie_remove_node() failed");
+
+    cr_assert_eq(a->num_children, 0, "trie_remove_node() did not merge");
+    cr_assert_eq(a->label_len, 6, "trie_remove_node() merged the wrong label");
+    cr_assert_eq(strncmp(a->label, "ntique", 6), 0, "trie_remove_node() \
+        merged the wrong label");
+    cr_assert_eq(trie_search(t, "antique"), IN_TRIE, "trie_search() lost antique");
+    cr_assert_eq(trie_search(t, "antelope"), NOT_IN_TRIE, "trie_search() \
+        found a removed word");
+
+    trie_free(t);
+}
+
+/* Checks that a compressed trie answers like a plain one */
+Test(trie, compressed_matches_plain)
+{
+    char* words[21] = {"Ever", "loved", "someone", "so", "much,", "you",
+    "would", "do", "anything", "for", "them?", "Yeah,", "well,", "make",
+    "that", "yourself", "and", "whatever", "the", "hell", "want."};
+    char* probes[12] = {"Ever", "Eve", "Every", "so", "s", "someones", "th",
+    "the", "them", "them?!", "", "Specter"};
+    trie_t *plain = trie_new('\0');
+    trie_t *compressed = trie_new_flags('\0', TRIE_COMPRESSED);
+
+    for (int i = 0; i < 21; i++) {
+        trie_insert_string(plain, words[i]);
+        trie_insert_string(compressed, words[i]);
+    }
+
+    for (int i = 0; i < 12; i++) {
+        cr_assert_eq(trie_search(compressed, probes[i]),
+            trie_search(plain, probes[i]), "trie_search() differs for %s",
+            probes[i]);
+        cr_assert_eq(trie_count_completion(compressed, probes[i]),
+            trie_count_completion(plain, probes[i]),
+            "trie_count_completion() differs for %s", probes[i]);
+    }
+
+    trie_free(plain);
+    trie_free(compressed);
+}
+
+/* Checks that a trie allocated from an arena behaves like a plain one */
+Test(trie, arena_insert_search)
+{
+    char* words[9] = {"Everybody", "has", "a", "chapter", "they", "don't",
+    "read", "out", "loud."};
+    trie_t *t = trie_new_flags('\0', TRIE_ARENA);
+
+    cr_assert_not_null(t, "trie_new_flags() failed");
+    cr_assert_not_null(t->arena, "trie_new_flags() did not create an arena");
+
+    for (int i = 0; i < 9; i++) {
+        cr_assert_eq(trie_insert_string(t, words[i]), 0, "trie_insert_string() \
+            failed for %s", words[i]);
+    }
+
+    for (int i = 0; i < 9; i++)
+        cr_assert_eq(trie_search(t, words[i]), IN_TRIE, "trie_search() lost %s",
+            words[i]);
+
+    cr_assert_eq(trie_search(t, "chap"), PARTIAL_IN_TRIE, "trie_search() \
+        failed on a prefix");
+    cr_assert_eq(trie_get_child(t, 'h')->arena, t->arena, "trie_add_node() \
+        did not allocate from the arena");
+
+    cr_assert_eq(trie_free(t), 0, "trie_free() failed");
+}
+
+/* Checks that a bulk insert into an arena trie maps only a few slabs */
+Test(trie, arena_bulk_insert)
+{
+    char word[16];
+    trie_t *t = trie_new_flags('\0', TRIE_ARENA | TRIE_COMPRESSED);
+
+    for (int i = 0; i < 20000; i++) {
+        sprintf(word, "w%dx%d", i * 7919 % 20000, i);
+        cr_assert_eq(trie_insert_string(t, word), 0, "trie_insert_string() \
+            failed for %s", word);
+    }
+
+    for (int i = 0; i < 20000; i += 97) {
+        sprintf(word, "w%dx%d", i * 7919 % 20000, i);
+        cr_assert_eq(trie_search(t, word), IN_TRIE, "trie_search() lost %s", word);
+    }
+
+    cr_assert_leq(t->arena->num_slabs, 16, "trie_insert_string() mapped %zu \
+        slabs", t->arena->num_slabs);
+
+    /* Removing a subtree hands its memory back for reuse */
+    size_t used = t->arena->bytes_used;
+    trie_remove_node(trie_get_child(t, 'w'), '1');
+    cr_assert_lt(t->arena->bytes_used, used, "trie_remove_node() did not \
+        recycle memory");
+
+    trie_free(t);
+}
+
+/* Checks that trie_remove_string() removes a word and reclaims its nodes */
+Test(trie, remove_string_basic)
+{
+    trie_t *t = trie_new('\0');
+
+    trie_insert_string(t, "an");
+    trie_insert_string(t, "ant");
+    trie_insert_string(t, "anti");
+
+    cr_assert_eq(trie_remove_string(t, "anti"), IN_TRIE, "trie_remove_string() \
+        failed to remove a word");
+    cr_assert_eq(trie_search(t, "anti"), NOT_IN_TRIE, "trie_remove_string() \
+        left the word behind");
+    cr_assert_eq(trie_search(t, "ant"), IN_TRIE, "trie_remove_string() \
+        removed a prefix word");
+    cr_assert_eq(trie_get_subtrie(t, "ant")->num_children, 0, 
+        "trie_remove_string() did not free the dead node");
+    cr_assert_eq(trie_count_completion(t, "a"), 2, "trie_remove_string() \
+        did not update word counts");
+
+    cr_assert_eq(trie_remove_string(t, "anti"), NOT_IN_TRIE, 
+        "trie_remove_string() removed a word twice");
+    cr_assert_eq(trie_remove_string(t, "a"), PARTIAL_IN_TRIE, 
+        "trie_remove_string() failed on a prefix");
+    cr_assert_eq(trie_search(t, "an"), IN_TRIE, "trie_remove_string() \
+        removed a word for a prefix");
+
+    /* Removing a word with longer words below keeps the nodes */
+    cr_assert_eq(trie_remove_string(t, "an"), IN_TRIE, "trie_remove_string() \
+        failed to remove a word");
+    cr_assert_eq(trie_search(t, "an"), PARTIAL_IN_TRIE, "trie_remove_string() \
+        removed nodes still in use");
+    cr_assert_eq(trie_search(t, "ant"), IN_TRIE, "trie_remove_string() \
+        removed a longer word");
+
+    trie_free(t);
+}
+
+/* Checks that removing the last word leaves an empty root */
+Test(trie, remove_string_last)
+{
+    trie_t *t = trie_new('\0');
+
+    trie_insert_string(t, "hello");
+    trie_remove_string(t, "hello");
+
+    cr_assert_eq(t->num_children, 0, "trie_remove_string() left dead nodes");
+    cr_assert_null(t->children, "trie_remove_string() left child storage");
+    cr_assert_eq(t->word_count, 0, "trie_remove_string() left a word count");
+
+    trie_free(t);
+}
+
+/* Checks that trie_remove_string() merges compressed labels back */
+Test(trie, remove_string_compressed)
+{
+    trie_t *t = trie_new_flags('\0', TRIE_COMPRESSED);
+
+    trie_insert_string(t, "antique");
+    trie_insert_string(t, "antelope");
+    trie_insert_string(t, "anti");
+
+    cr_assert_eq(trie_remove_string(t, "antelope"), IN_TRIE, 
+        "trie_remove_string() failed to remove a word");
+    cr_assert_eq(trie_remove_string(t, "anti"), IN_TRIE, 
+        "trie_remove_string() failed to remove a word");
+
+    trie_t *a = trie_get_child(t, 'a');
+    cr_assert_eq(a->num_children, 0, "trie_remove_string() did not merge");
+    cr_assert_eq(a->label_len, 6, "trie_remove_string() merged the wrong label");
+    cr_assert_eq(trie_search(t, "antique"), IN_TRIE, "trie_remove_string() \
+        lost antique");
+
+    trie_free(t);
+}
+
+/* Checks removal under churn against a plain trie built from scratch */
+Test(trie, remove_string_churn)
+{
+    char word[16];
+    int flags[3] = {0, TRIE_COMPRESSED, TRIE_COMPRESSED | TRIE_ARENA};
+
+    for (int f = 0; f < 3; f++) {
+        trie_t *t = trie_new_flags('\0', flags[f]);
+        trie_t *expected = trie_new('\0');
+
+        for (int i = 0; i < 3000; i++) {
+            sprintf(word, "%x", i * 2654435761u % 4096);
+            trie_insert_string(t, word);
+        }
+
+        /* Remove everything but every third word */
+        for (int i = 0; i < 3000; i++) {
+            sprintf(word, "%x", i * 2654435761u % 4096);
+            if (i % 3 == 0)
+                trie_insert_string(expected, word);
+        }
+        for (int i = 0; i < 3000; i++) {
+            sprintf(word, "%x", i * 2654435761u % 4096);
+            if (trie_search(expected, word) != IN_TRIE)
+                trie_remove_string(t, word);
+        }
+
+        for (int i = 0; i < 4096; i++) {
+            sprintf(word, "%x", i);
+            cr_assert_eq(trie_search(t, word), trie_search(expected, word),
+                "trie_search() differs for %s with flags %d", word, flags[f]);
+            cr_assert_eq(trie_count_completion(t, word),
+                trie_count_completion(expected, word),
+                "trie_count_completion() differs for %s with flags %d", word,
+                flags[f]);
+        }
+
+        trie_free(t);
+        trie_free(expected);
+    }
+}
+
+/* qsort() comparison for the iterator tests */
+int cmp_str(const void *a, const void *b)
+{
+    return strcmp(*(char**)a, *(char**)b);
+}
+
+/* 
+   Checks that an iterator over t returns exactly the words in the sorted
+   list that start with pre and come after after
+ */
+void check_iter(trie_t *t, char **sorted, int n, char *pre, char *after)
+{
+    trie_iter_t *it = trie_iter_new(t, pre, after);
+    char *word;
+    size_t len;
+    int i = 0;
+
+    cr_assert_not_null(it, "trie_iter_new() failed");
+
+    while ((word = trie_iter_next(it, &len)) != NULL) {
+        while (i < n && (strncmp(sorted[i], pre, strlen(pre)) != 0
+               || (after != NULL && strcmp(sorted[i], after) <= 0)))
+            i++;
+
+        cr_assert_lt(i, n, "trie_iter_next() returned extra word %s for %s/%s",
+            word, pre, after);
+        cr_assert_str_eq(word, sorted[i], "trie_iter_next() returned %s \
+            instead of %s for %s/%s", word, sorted[i], pre, after);
+        cr_assert_eq(len, strlen(word), "trie_iter_next() set the wrong length");
+        i++;
+    }
+
+    while (i < n && (strncmp(sorted[i], pre, strlen(pre)) != 0
+           || (after != NULL && strcmp(sorted[i], after) <= 0)))
+        i++;
+    cr_assert_eq(i, n, "trie_iter_next() stopped before %s for %s/%s",
+        sorted[i], pre, after);
+
+    trie_iter_free(it);
+}
+
+/* Checks that iterators return words in order, with prefixes and resuming */
+Test(trie, iter_order)
+{
+    char* words[14] = {"an", "ant", "anti", "antique", "antiquity", "antelope",
+    "antman", "anthropology", "b", "ba", "\xc3\xa9t\xc3\xa9", "Zebra", "zebra",
+    "ant"};
+    char* probes[12] = {"", "a", "an", "ant", "anti", "antiq", "antiqz", "b",
+    "c", "Z", "aaa", "\xc3"};
+    char* sorted[13];
+    int flags[2] = {0, TRIE_COMPRESSED};
+
+    memcpy(sorted, words, sizeof(sorted));
+    qsort(sorted, 13, sizeof(char*), cmp_str);
+
+    for (int f = 0; f < 2; f++) {
+        trie_t *t = trie_new_flags('\0', flags[f]);
+
+        for (int i = 0; i < 14; i++)
+            trie_insert_string(t, words[i]);
+
+        for (int i = 0; i < 12; i++) {
+            check_iter(t, sorted, 13, probes[i], NULL);
+
+            /* Resume after every probe and every word, in and out of the trie */
+            for (int j = 0; j < 12; j++)
+                check_iter(t, sorted, 13, probes[i], probes[j]);
+            for (int j = 0; j < 13; j++)
+                check_iter(t, sorted, 13, probes[i], sorted[j]);
+        }
+
+        trie_free(t);
+    }
+}
+
+/* Checks that an iterator skips words that have been removed */
+Test(trie, iter_removed)
+{
+    trie_t *t = trie_new('\0');
+    char* sorted[2] = {"ant", "anti"};
+
+    trie_insert_string(t, "an");
+    trie_insert_string(t, "ant");
+    trie_insert_string(t, "anti");
+    trie_insert_string(t, "antique");
+    trie_remove_string(t, "an");
+    trie_remove_string(t, "antique");
+
+    check_iter(t, sorted, 2, "", NULL);
+
+    trie_free(t);
+}
+
+/* A word and its score, for checking trie_topk() by brute force */
+typedef struct {
+    char word[8];
+    double score;
+    bool in;
+} scored_t;
+
+/* Ranks scored_t like trie_topk(): highest score first, then by word */
+int cmp_scored(const void *a, const void *b)
+{
+    const scored_t *x = a, *y = b;
+
+    if (x->score != y->score)
+        return x->score > y->score ? -1 : 1;
+
+    return strcmp(x->word, y->word);
+}
+
+/* Checks trie_topk() for pre and k against the sorted list of words */
+void check_topk(trie_t *t, scored_t *sorted, int n, char *pre, int k)
+{
+    trie_t *out[64];
+    char buf[8];
+    int found = trie_topk(t, pre, k, out);
+    int i = 0;
+
+    for (int j = 0; j < found; j++) {
+        while (i < n && (!sorted[i].in
+               || strncmp(sorted[i].word, pre, strlen(pre)) != 0))
+            i++;
+
+        cr_assert_lt(i, n, "trie_topk() returned too many words");
+        cr_assert_eq(trie_node_word(out[j], buf, sizeof(buf)), 
+            strlen(sorted[i].word), "trie_node_word() returned the wrong length");
+        cr_assert_str_eq(buf, sorted[i].word, "trie_topk() returned %s \
+            instead of %s for %s/%d", buf, sorted[i].word, pre, k);
+        cr_assert_eq(out[j]->score, sorted[i].score, "trie_topk() returned \
+            the wrong score");
+        i++;
+    }
+
+    if (found < k) {
+        while (i < n && (!sorted[i].in
+               || strncmp(sorted[i].word, pre, strlen(pre)) != 0))
+            i++;
+        cr_assert_eq(i, n, "trie_topk() missed %s for %s/%d", 
+            sorted[i].word, pre, k);
+    }
+}
+
+/* Checks trie_topk() through score changes, removals, splits and merges */
+Test(trie, topk)
+{
+    char* probes[6] = {"", "a", "ab", "abc", "b", "zz"};
+    int ks[4] = {1, 3, TRIE_TOPK, 40};
+    int flags[3] = {0, TRIE_COMPRESSED, TRIE_ARENA | TRIE_COMPRESSED};
+    scored_t words[200];
+
+    for (int f = 0; f < 3; f++) {
+        trie_t *t = trie_new_flags('\0', flags[f]);
+        unsigned int seed = 7;
+
+        for (int i = 0; i < 200; i++) {
+            int len = 1 + i % 5;
+            for (int j = 0; j < len; j++)
+                words[i].word[j] = 'a' + (seed = seed * 1103515245 + 12345) % 3;
+            words[i].word[len] = '\0';
+            words[i].in = false;
+        }
+
+        for (int round = 0; round < 3; round++) {
+            for (int i = 0; i < 200; i++) {
+                seed = seed * 1103515245 + 12345;
+
+                if (round > 0 && seed % 4 == 0) {
+                    trie_remove_string(t, words[i].word);
+                    for (int j = 0; j < 200; j++) {
+                        if (strcmp(words[j].word, words[i].word) == 0)
+                            words[j].in = false;
+                    }
+                    continue;
+                }
+
+                double score = (seed >> 8) % 10;
+                cr_assert_eq(trie_insert_scored(t, words[i].word, score), 0,
+                    "trie_insert_scored() failed");
+
+                /* Duplicates keep the last score */
+                for (int j = 0; j < 200; j++) {
+                    if (strcmp(words[j].word, words[i].word) == 0) {
+                        words[j].in = j == i;
+                        words[j].score = score;
+                    }
+                }
+            }
+
+            scored_t sorted[200];
+            memcpy(sorted, words, sizeof(sorted));
+            qsort(sorted, 200, sizeof(scored_t), cmp_scored);
+
+            for (int p = 0; p < 6; p++) {
+                for (int k = 0; k < 4; k++)
+                    check_topk(t, sorted, 200, probes[p], ks[k]);
+            }
+        }
+
+        trie_free(t);
+    }
+}
+
+/* Checks that plain inserts rank with score 0 and keep existing scores */
+Test(trie, topk_unscored)
+{
+    trie_t *t = trie_new('\0');
+    trie_t *out[3];
+    char buf[8];
+
+    trie_insert_string(t, "bee");
+    trie_insert_scored(t, "bat", 2);
+    trie_insert_string(t, "bat");
+    trie_insert_string(t, "ant");
+
+    cr_assert_eq(trie_topk(t, "", 3, out), 3, "trie_topk() missed words");
+
+    trie_node_word(out[0], buf, sizeof(buf));
+    cr_assert_str_eq(buf, "bat", "trie_insert_string() reset the score");
+    trie_node_word(out[1], buf, sizeof(buf));
+    cr_assert_str_eq(buf, "ant", "Ties are not in lexicographic order");
+    trie_node_word(out[2], buf, sizeof(buf));
+    cr_assert_str_eq(buf, "bee", "Ties are not in lexicographic order");
+
+    cr_assert_eq(trie_node_word(out[0], buf, 3), 3, 
+        "trie_node_word() should report the length it needs");
+
+    trie_free(t);
+}
+
+/* Checks that trie_search_many() answers like trie_search() */
+Test(trie, search_many)
+{
+    int flags[3] = {0, TRIE_COMPRESSED, TRIE_ARENA};
+    char *words[301];
+    int results[301];
+
+    /* Words, prefixes of words and words that are not in the trie */
+    for (int i = 0; i < 300; i++) {
+        words[i] = malloc(16);
+        sprintf(words[i], "%x", i * 7919 % 4096);
+    }
+    words[300] = "";
+
+    for (int f = 0; f < 3; f++) {
+        trie_t *t = trie_new_flags('\0', flags[f]);
+
+        for (int i = 0; i < 300; i += 3)
+            trie_insert_string(t, words[i]);
+
+        /* Batches of every size, including ones that are not full */
+        for (int n = 0; n <= 301; n += 37) {
+            cr_assert_eq(trie_search_many(t, words + 301 - n, n, results), 0,
+                "trie_search_many() failed");
+
+            for (int i = 0; i < n; i++)
+                cr_assert_eq(results[i], trie_search(t, words[301 - n + i]),
+                    "trie_search_many() disagrees on %s", words[301 - n + i]);
+        }
+
+        trie_free(t);
+    }
+
+    for (int i = 0; i < 300; i++)
+        free(words[i]);
+}